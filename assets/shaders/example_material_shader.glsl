@@ -1,15 +1,21 @@
 __VERTEX__
 #version 430 core
 
+// WRITE_ENTITY_ID: write u_EntityID to the id attachment, only defined on frames with a pending pick
+
 layout(location = 0) in vec3 a_Pos;
 layout(location = 1) in vec3 a_Normal;
 layout(location = 2) in vec2 a_UV;
+layout(location = 3) in vec2 a_LightmapUV;
 
 layout(location = 0) out vec3 o_Color;
 layout(location = 1) out vec2 o_UV;
 layout(location = 2) out vec3 o_WorldNormal;
 layout(location = 3) out vec4 o_WorldPosition;
+#ifdef WRITE_ENTITY_ID
 layout(location = 4) flat out uint o_EntityID;
+#endif
+layout(location = 5) out vec2 o_LightmapUV;
 
 // Environment uniforms
 layout(location = 0) uniform mat4 u_ViewProjection;
@@ -27,9 +33,12 @@ void main(void)
 {
 	o_Color = u_Color;
 	o_UV = a_UV;
+	o_LightmapUV = a_LightmapUV;
 	o_WorldNormal = (u_Model * vec4(a_Normal, 0.0)).xyz;
 	o_WorldPosition = u_Model * vec4(a_Pos, 1.0);
+#ifdef WRITE_ENTITY_ID
 	o_EntityID = u_EntityID;
+#endif
 
 	gl_Position = u_ViewProjection * o_WorldPosition;
 }
@@ -40,10 +49,15 @@ layout(location = 0) in vec3 in_Color;
 layout(location = 1) in vec2 in_UV;
 layout(location = 2) in vec3 in_WorldNormal;
 layout(location = 3) in vec4 in_WorldPosition;
+#ifdef WRITE_ENTITY_ID
 layout(location = 4) flat in uint in_EntityID;
+#endif
+layout(location = 5) in vec2 in_LightmapUV;
 
 layout(location = 0) out vec4 out_Color;
+#ifdef WRITE_ENTITY_ID
 layout(location = 1) out uint out_Id;
+#endif
 
 // Material uniforms (identical to VERTEX)
 layout(location = 3) uniform vec3 u_Color;
@@ -55,6 +69,10 @@ layout(location = 6) uniform vec3 u_DirectionalLight = vec3(-1.0, 1.0, -1.0);
 layout(location = 7) uniform mat4 u_LightViewProjection;
 layout(location = 8) uniform float u_MinVariance = 0.00001f;
 
+// Baked ambient occlusion (r) and sky visibility (g), see Lightmap
+layout(location = 9) uniform bool u_HasLightmap;
+layout(binding = 2) uniform sampler2D u_Lightmap;
+
 float linstep(float min, float max, float v)
 {
 	return clamp((v - min) / (max - min), 0, 1);
@@ -125,7 +143,11 @@ float ShadowContribution(vec2 uv, float distance_to_light)
 
 void main(void)
 {
-	const float ambient = 0.1;
+	// Ambient light from the sky and bounced off nearby surfaces, attenuated by the lightmap
+	const float sky_ambient = 0.07;
+	const float bounce_ambient = 0.03;
+	vec2 lightmap = u_HasLightmap ? texture(u_Lightmap, in_LightmapUV).rg : vec2(1.0);
+	float ambient = sky_ambient * lightmap.g + bounce_ambient * lightmap.r;
 	const vec3 N = normalize(in_WorldNormal);
 	const vec3 L = normalize(u_DirectionalLight);
 	const float lambert = max(dot(N, L), 0.0);
@@ -139,5 +161,7 @@ void main(void)
 
 	vec3 color = in_Color * texture(u_AlbedoMap, in_UV).xyz;
 	out_Color = vec4((ambient + lambert * shadow) * color, 1.0);
+#ifdef WRITE_ENTITY_ID
 	out_Id = in_EntityID;
+#endif
 }
\ No newline at end of file
@@ -9,15 +9,22 @@ uniform vec3 u_CameraPosition;
 uniform ivec3 u_ParticlesPerDim;
 uniform vec3 u_SystemBoundsMin;
 uniform vec3 u_SystemBoundsMax;
-uniform float u_Time;
 uniform int u_VerticesPerBlade;
 
 // Wind
 uniform float u_WindAmp;
-uniform float u_WindFactor;
-uniform vec2 u_WindDirection;
 
-layout(binding = 0) uniform sampler2D u_WindTexture;
+layout(binding = 0) uniform sampler2D u_WindField;
+layout(binding = 3) uniform sampler2D u_GrassDensityMap;
+
+// Trampling
+uniform vec2 u_TrampleOrigin;
+uniform float u_TrampleSize;
+layout(binding = 4) uniform sampler2D u_TrampleMap;
+
+// Tiles behind software occluders, see GrassTileVisibility
+uniform bool u_TileCulling;
+layout(binding = 5) uniform sampler2D u_GrassTileVisibility;
 
 out VS_OUT {
 	vec2 UV;
@@ -48,19 +55,25 @@ void main() {
 	float x = (id % u_ParticlesPerDim.x + (randId - 0.5)) / float(u_ParticlesPerDim.x);
 	float z = (id / u_ParticlesPerDim.x + (randId - 0.5)) / float(u_ParticlesPerDim.z);
 
+	// Blades thinned out by the density map or in occluded tiles collapse to a point outside the clip volume
+	float density = texture(u_GrassDensityMap, vec2(x, z)).r;
+	bool tile_occluded = u_TileCulling && texture(u_GrassTileVisibility, vec2(x, z)).r < 0.5;
+	if (density <= rand(id01 + 0.5) || tile_occluded)
+	{
+		gl_Position = vec4(0.0, 0.0, 2.0, 1.0);
+		return;
+	}
+
 	float width = (0.001 + randId * 0.015) * (1 - row01);
 	float height = 1.0f;
 
-	vec3 windD1 = vec3(u_WindDirection.x, 0, u_WindDirection.y + 0.2);
-	vec3 windD2 = vec3(u_WindDirection.x, 0, u_WindDirection.y - 0.2);
-	float windDFreq = (1.0 + sin(PI * u_Time / 10.0f)) / 2.0f;
-	vec3 wind_direction = normalize(windD1 * windDFreq + (1 - windDFreq) * windD2);
+	// Wind field is evaluated once per frame, grass and wind field share bounds
+	vec4 wind_sample = texture(u_WindField, vec2(x, z));
+	vec3 wind_direction = vec3(wind_sample.x, 0.0, wind_sample.y);
 	vec3 bi_wind = cross(wind_direction, vec3(0.0, 1.0, 0.0));
 	wind_direction = normalize(wind_direction + bi_wind * 0.35 * (randId - 0.5f));
 
-	float global_wind_cascade0 = (sin(PI * 0.5 * u_Time + 5.0f * u_WindFactor * (x * wind_direction.x + z * wind_direction.z) + pow(texture(u_WindTexture, vec2(x + wind_direction.x, z + wind_direction.z)).x, 1.0f)) + 1.0) / 2.0f;
-	float global_wind_cascade1 = (sin(PI * u_Time + 13.0f * u_WindFactor * (x * wind_direction.x + z * wind_direction.z) + pow(texture(u_WindTexture, vec2(x + wind_direction.x, z + wind_direction.z)).x, 1.0f)) + 1.0) / 2.0f;
-	float global_wind_intensity = pow((global_wind_cascade0 * global_wind_cascade1), 1.2f);
+	float global_wind_intensity = wind_sample.z;
 	float wind_intensity =  0.1 + u_WindAmp * (global_wind_intensity + rand(x + z));
 	vec3 wind = bottom * wind_direction * wind_intensity;
 
@@ -68,7 +81,11 @@ void main() {
 	vec3 world_top_pos = world_base_pos + vec3(0.0, 1.0, 0.0) * height + (randId - 0.5) * 0.2;
 	float blade_height = length(world_top_pos - world_base_pos);
 
-	world_top_pos = world_base_pos + normalize(world_top_pos - wind - world_base_pos) * blade_height;
+	// Tips are pushed away from footprints, zero outside the trample map
+	vec2 trample = texture(u_TrampleMap, (world_base_pos.xz - u_TrampleOrigin) / u_TrampleSize).xy;
+	vec3 trample_bend = 3.0 * bottom * vec3(trample.x, 0.0, trample.y);
+
+	world_top_pos = world_base_pos + normalize(world_top_pos - wind + trample_bend - world_base_pos) * blade_height;
 
 	vec3 blade_right = normalize(cross((world_top_pos + world_base_pos) / 2.0f - u_CameraPosition, vec3(0, 1, 0)));
 
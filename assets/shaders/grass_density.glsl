@@ -0,0 +1,24 @@
+__VERTEX__
+#version 430 core
+
+layout(location = 0) in vec3 a_Pos;
+layout(location = 1) in vec3 a_Normal;
+layout(location = 2) in vec2 a_UV;
+
+layout(location = 0) uniform mat4 u_Model;
+layout(location = 1) uniform mat4 u_ViewProjection;
+
+void main(void)
+{
+  gl_Position = u_ViewProjection * u_Model * vec4(a_Pos, 1.0);
+}
+
+__FRAGMENT__
+#version 430 core
+layout(location = 0) out float out_Density;
+
+void main(void)
+{
+  // Everything covered by static geometry is excluded from the grass field
+  out_Density = 0.0;
+}
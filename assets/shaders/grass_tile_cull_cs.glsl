@@ -0,0 +1,32 @@
+__COMPUTE__
+#version 430 core
+
+/*
+* Hi-Z test of the grass tiles, see GrassTileVisibility. One thread per tile, tiles behind the
+* opaque scene are cleared in the visibility texture, visible tiles keep the software occlusion result.
+* AABB, the Hi-Z pyramid uniforms and hiz_occluded() are injected, see get_hiz_shader_defines().
+*/
+
+uniform mat4 u_ViewProjection;
+uniform int u_TilesPerDim;
+uniform vec3 u_BoundsMin;
+uniform vec3 u_BoundsMax;
+uniform float u_TilePadding;
+uniform float u_MaxBladeHeight;
+
+layout(r8, binding = 0) uniform image2D u_TileVisibility;
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main(void) {
+	ivec2 tile = ivec2(gl_GlobalInvocationID.xy);
+	if (any(greaterThanEqual(tile, ivec2(u_TilesPerDim)))) return;
+
+	// Same box as GrassTileVisibility::update
+	vec2 tile_size = (u_BoundsMax.xz - u_BoundsMin.xz) / float(u_TilesPerDim);
+	vec2 tile_min = u_BoundsMin.xz + vec2(tile) * tile_size - u_TilePadding;
+	vec2 tile_max = tile_min + tile_size + 2.0 * u_TilePadding;
+	AABB box = AABB(vec3(tile_min.x, u_BoundsMin.y, tile_min.y), vec3(tile_max.x, u_BoundsMin.y + u_MaxBladeHeight, tile_max.y));
+
+	if (hiz_occluded(box, u_ViewProjection))
+		imageStore(u_TileVisibility, tile, vec4(0.0));
+}
@@ -0,0 +1,52 @@
+__COMPUTE__
+#version 430 core
+#define MAX_FOOTPRINTS 32
+
+uniform float u_TimeDelta;
+uniform float u_RecoveryRate;
+uniform float u_GroundHeight;
+
+// Texel offset between the previous and current map origin
+uniform ivec2 u_Shift;
+// World xz-position of texel (0, 0) and world size of a texel
+uniform vec2 u_Origin;
+uniform float u_TexelSize;
+
+// xyz: world position, w: radius
+uniform int u_NumFootprints;
+uniform vec4 u_Footprints[MAX_FOOTPRINTS];
+
+layout(binding = 0) uniform sampler2D u_PreviousMap;
+layout(rg16f, binding = 0) uniform writeonly image2D u_TrampleMap;
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+void main(void) {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(u_TrampleMap);
+	if (texel.x >= size.x || texel.y >= size.y) return;
+
+	// Scroll and recover, texels scrolled in from outside the previous map start upright
+	vec2 displacement = vec2(0.0);
+	ivec2 previous_texel = texel + u_Shift;
+	if (previous_texel.x >= 0 && previous_texel.y >= 0 && previous_texel.x < size.x && previous_texel.y < size.y)
+		displacement = texelFetch(u_PreviousMap, previous_texel, 0).xy * exp(-u_RecoveryRate * u_TimeDelta);
+
+	vec2 world_xz = u_Origin + (vec2(texel) + 0.5) * u_TexelSize;
+	for (int i = 0; i < u_NumFootprints; i++)
+	{
+		vec4 footprint = u_Footprints[i];
+		vec2 offset = world_xz - footprint.xz;
+		float dist = length(offset);
+		// Only footprints close to the ground bend the grass
+		float ground_falloff = clamp(1.0 - abs(footprint.y - u_GroundHeight), 0.0, 1.0);
+		if (dist < footprint.w && ground_falloff > 0.0)
+		{
+			float strength = (1.0 - dist / footprint.w) * ground_falloff;
+			vec2 push = (dist > 0.0001 ? offset / dist : vec2(0.0)) * strength;
+			if (length(push) > length(displacement))
+				displacement = push;
+		}
+	}
+
+	imageStore(u_TrampleMap, texel, vec4(displacement, 0.0, 0.0));
+}
@@ -0,0 +1,37 @@
+__COMPUTE__
+#version 430 core
+
+/*
+* One level of the Hi-Z pyramid, see HiZPyramid. Every texel keeps the farthest depth of the
+* texels it covers in the level below, the last row and column of a level also cover the
+* remainder of an odd source size. u_SourceLevel -1 copies the depth buffer into level 0.
+*/
+
+uniform int u_SourceLevel;
+layout(binding = 0) uniform sampler2D u_Source;
+layout(r32f, binding = 0) uniform writeonly image2D u_Destination;
+
+layout(local_size_x = 8, local_size_y = 8, local_size_z = 1) in;
+void main(void) {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(u_Destination);
+	if (any(greaterThanEqual(texel, size))) return;
+
+	if (u_SourceLevel < 0)
+	{
+		imageStore(u_Destination, texel, vec4(texelFetch(u_Source, texel, 0).r));
+		return;
+	}
+
+	ivec2 source_size = textureSize(u_Source, u_SourceLevel);
+	ivec2 first = 2 * texel;
+	ivec2 last = min(2 * texel + 1, source_size - 1);
+	if (texel.x == size.x - 1) last.x = source_size.x - 1;
+	if (texel.y == size.y - 1) last.y = source_size.y - 1;
+
+	float depth = 0.0;
+	for (int y = first.y; y <= last.y; y++)
+		for (int x = first.x; x <= last.x; x++)
+			depth = max(depth, texelFetch(u_Source, ivec2(x, y), u_SourceLevel).r);
+	imageStore(u_Destination, texel, vec4(depth));
+}
@@ -0,0 +1,46 @@
+/*
+* Hi-Z occlusion test shared by the culling shaders, injected after their #version line by
+* get_hiz_shader_defines() (see hiz.h). Declares AABB and the pyramid uniforms, set by
+* HiZPyramid::set_uniforms.
+*/
+
+struct AABB {
+	vec3 min;
+	vec3 max;
+};
+
+uniform int u_HiZLevels;
+layout(binding = 0) uniform sampler2D u_HiZ;
+
+// Occluded if the nearest corner is behind the farthest depth under the screen rect
+bool hiz_occluded(AABB box, mat4 view_projection)
+{
+	vec3 ndc_min = vec3(1.0);
+	vec3 ndc_max = vec3(-1.0);
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3((i & 1) != 0 ? box.max.x : box.min.x, (i & 2) != 0 ? box.max.y : box.min.y, (i & 4) != 0 ? box.max.z : box.min.z);
+		vec4 clip = view_projection * vec4(corner, 1.0);
+		if (clip.w <= 0.0 || clip.z < -clip.w)
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		ndc_min = min(ndc_min, ndc);
+		ndc_max = max(ndc_max, ndc);
+	}
+
+	ivec2 size = textureSize(u_HiZ, 0);
+	ivec2 p0 = ivec2(clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(size));
+	ivec2 p1 = ivec2(clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0) * vec2(size));
+	p0 = min(p0, size - 1);
+	p1 = min(p1, size - 1);
+
+	// Lowest level where the rect spans at most two texels per axis
+	int extent = max(p1.x - p0.x, p1.y - p0.y);
+	int level = min(extent > 0 ? findMSB(extent) + 1 : 0, u_HiZLevels - 1);
+	ivec2 level_size = textureSize(u_HiZ, level);
+	p0 = min(p0 >> level, level_size - 1);
+	p1 = min(p1 >> level, level_size - 1);
+
+	float farthest = max(max(texelFetch(u_HiZ, p0, level).r, texelFetch(u_HiZ, ivec2(p1.x, p0.y), level).r),
+		max(texelFetch(u_HiZ, ivec2(p0.x, p1.y), level).r, texelFetch(u_HiZ, p1, level).r));
+	return ndc_min.z * 0.5 + 0.5 > farthest;
+}
@@ -0,0 +1,116 @@
+__COMPUTE__
+#version 430 core
+
+/* Particles are drawn per cluster of 5x5x5, PARTICLES_PER_CLUSTER is injected, see particlesim.h. AABB comes with hiz_occluded.glsl */
+
+uniform int u_NumClusters;
+uniform mat4 u_ViewProjection;
+// Particles are drawn wrapped into the system bounds, see particle.glsl
+uniform vec3 u_SystemBoundsMin;
+uniform vec3 u_SystemBoundsMax;
+// Covered by a denser, inner precipitation layer
+uniform AABB u_InnerVolume;
+// Largest billboard half size, widens the cluster bounds
+uniform float u_ParticleSize;
+
+// Hi-Z pyramid of the opaque scene depth, hiz_occluded() is injected, see HiZPyramid
+uniform bool u_HiZEnabled;
+
+// min, max per cluster, written by the particle update. May extend past the system bounds in a wrapping volume.
+layout(std430, binding = 2) readonly buffer ClusterBoundsSSBO
+{
+	vec4 cluster_bounds[];
+};
+
+layout(std430, binding = 3) writeonly buffer VisibleClustersSSBO
+{
+	uint visible_clusters[];
+};
+
+// DrawArraysIndirectCommand, then a DispatchIndirectCommand of one group per visible cluster
+layout(std430, binding = 4) buffer IndirectCommands
+{
+	uint count;
+	uint instance_count;
+	uint first;
+	uint base_instance;
+	uint dispatch_x;
+	uint dispatch_y;
+	uint dispatch_z;
+};
+
+bool isInside(AABB box, AABB bounds)
+{
+	return all(greaterThanEqual(box.min, bounds.min)) && all(lessThanEqual(box.max, bounds.max));
+}
+
+// Conservative: the box is culled only if all corners are outside the same clip plane
+bool isInFrustum(AABB box)
+{
+	ivec3 below = ivec3(0);
+	ivec3 above = ivec3(0);
+	int behind = 0;
+	for (int i = 0; i < 8; i++) {
+		vec3 corner = vec3((i & 1) != 0 ? box.max.x : box.min.x, (i & 2) != 0 ? box.max.y : box.min.y, (i & 4) != 0 ? box.max.z : box.min.z);
+		vec4 clip = u_ViewProjection * vec4(corner, 1.0);
+		below += ivec3(lessThan(clip.xyz, vec3(-clip.w)));
+		above += ivec3(greaterThan(clip.xyz, vec3(clip.w)));
+		behind += int(clip.w <= 0.0);
+	}
+	return behind < 8 && all(lessThan(below, ivec3(8))) && all(lessThan(above, ivec3(8)));
+}
+
+bool isVisible(AABB box)
+{
+	if (isInside(box, u_InnerVolume))
+		return false;
+	box.min -= vec3(u_ParticleSize);
+	box.max += vec3(u_ParticleSize);
+	return isInFrustum(box) && !(u_HiZEnabled && hiz_occluded(box, u_ViewProjection));
+}
+
+/*
+* Cluster bounds overhanging the system bounds are drawn on the opposite side of the volume.
+* Piece i takes the overhang on the axes of its set bits and the part inside on the others,
+* a cluster away from the seams has only piece 0.
+*/
+bool isAnyPieceVisible(AABB box)
+{
+	vec3 volume_size = u_SystemBoundsMax - u_SystemBoundsMin;
+	for (int i = 0; i < 8; i++) {
+		AABB piece = AABB(max(box.min, u_SystemBoundsMin), min(box.max, u_SystemBoundsMax));
+		bool overhangs = true;
+		for (int axis = 0; axis < 3; axis++) {
+			if ((i & (1 << axis)) == 0)
+				continue;
+			if (box.max[axis] > u_SystemBoundsMax[axis]) {
+				piece.min[axis] = u_SystemBoundsMin[axis];
+				piece.max[axis] = box.max[axis] - volume_size[axis];
+			}
+			else if (box.min[axis] < u_SystemBoundsMin[axis]) {
+				piece.min[axis] = box.min[axis] + volume_size[axis];
+				piece.max[axis] = u_SystemBoundsMax[axis];
+			}
+			else
+				overhangs = false;
+		}
+		if (overhangs && all(lessThanEqual(piece.min, piece.max)) && isVisible(piece))
+			return true;
+	}
+	return false;
+}
+
+// LOCAL_SIZE_X is tuned per device, see ComputeTuner
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint cluster = gl_GlobalInvocationID.x;
+	if (cluster >= u_NumClusters) return;
+
+	AABB box = AABB(cluster_bounds[2 * cluster].xyz, cluster_bounds[2 * cluster + 1].xyz);
+	if (any(greaterThan(box.min, box.max)) || !isAnyPieceVisible(box))
+		return;
+
+	// One instance per particle slot, the vertex stage finds the cluster from the instance
+	visible_clusters[atomicAdd(dispatch_x, 1u)] = cluster;
+	atomicAdd(instance_count, PARTICLES_PER_CLUSTER);
+}
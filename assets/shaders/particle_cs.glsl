@@ -2,56 +2,233 @@ __COMPUTE__
 #version 430 core
 #define PI 3.14159265
 
+/*
+* Constants shared with the CPU reference are injected as defines, see particlesim.h:
+*	POSITION_SCALE, POSITION_MASK, MAX_PARTICLE_SIZE, FLAG_UNUSED, PARTICLES_PER_CLUSTER(_DIM),
+*	GRAVITY, MAX_SPEED, SPAWN_SPEED, SPAWN_OFFSET
+* followed by the packed particle layout, see particle_pack.glsl
+*/
+
 /* Timing */
 uniform float u_time_delta;
-uniform float u_time;
+// Update count, seeds the random kick
+uniform uint u_Frame;
 
 /* Dimensions */
-uniform int u_num_particles;
 uniform vec3 u_BboxMin;
 uniform vec3 u_BboxMax;
 uniform ivec3 u_ParticlesPerDim;
+uniform bool u_WrapVolume;
+
+/* Wind */
+uniform float u_WindAmp;
+uniform vec3 u_WindBoundsMin;
+uniform vec3 u_WindBoundsMax;
+layout(binding = 0) uniform sampler2D u_WindField;
+
+/* Precipitation occlusion, depth is the height of the highest static surface */
+uniform bool u_OcclusionEnabled;
+uniform vec3 u_OcclusionBoundsMin;
+uniform vec3 u_OcclusionBoundsMax;
+layout(binding = 2) uniform sampler2D u_OcclusionMap;
+
+/* Scene collision, xyz: direction out of the surface, w: signed distance */
+uniform bool u_SDFEnabled;
+uniform vec3 u_SDFBoundsMin;
+uniform vec3 u_SDFBoundsMax;
+layout(binding = 3) uniform sampler3D u_SceneSDF;
+
+/*
+* Clusters of 5x5x5 grid particles are stored contiguously, slot = cluster * 125 + local.
+* 128 threads simulate one cluster and reduce its bounds for the cluster cull. LOCAL_SIZE_X is
+* tuned per device (see ComputeTuner), a work group covers LOCAL_SIZE_X / 128 clusters.
+*
+* In a wrapping volume, a cluster that drifted over the seam has particles on both sides of the
+* volume. Its bounds are reduced over the positions closest to its first particle instead, so they
+* stay tight and may extend past the volume, the cull wraps the overhang back in.
+*/
+#define THREADS_PER_CLUSTER 128
+#define CLUSTERS_PER_GROUP (LOCAL_SIZE_X / THREADS_PER_CLUSTER)
+uniform int u_NumClusters;
 
 struct Particle {
-	vec3 position; float width;
-	vec3 velocity; float height;
+	vec3 position;
+	vec3 velocity;
+	float size;
+	uint flags;
 };
 
 layout(std430, binding = 1) buffer ParticleSSBO
 {
-	Particle particles[];
+	uvec4 particles[];
 };
 
-float rand(vec2 co){
-	return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
+// min, max per cluster, min > max for a cluster without particles
+layout(std430, binding = 2) writeonly buffer ClusterBoundsSSBO
+{
+	vec4 cluster_bounds[];
+};
+
+shared uint cluster_min[3 * CLUSTERS_PER_GROUP];
+shared uint cluster_max[3 * CLUSTERS_PER_GROUP];
+// First active particle of the cluster, bounds are reduced relative to its position
+shared uint cluster_first[CLUSTERS_PER_GROUP];
+shared vec3 cluster_reference[CLUSTERS_PER_GROUP];
+
+Particle unpack_particle(uvec4 packed)
+{
+	Particle particle;
+	particle.position = unpack_position(packed, u_BboxMin, u_BboxMax);
+	particle.velocity = unpack_velocity(packed);
+	particle.size = unpack_size(packed);
+	particle.flags = unpack_flags(packed);
+	return particle;
 }
 
-layout(local_size_x = 1024, local_size_y = 1, local_size_z = 1) in;
-void main(void) {
-	uint id = gl_GlobalInvocationID.x;
-	if (id >= u_num_particles) return;
+uvec4 pack_particle(Particle particle)
+{
+	return pack_particle(particle.position, particle.velocity, particle.size, particle.flags, u_BboxMin, u_BboxMax);
+}
 
-	uint x = id % u_ParticlesPerDim.x;
-	uint y = (id / u_ParticlesPerDim.x) % u_ParticlesPerDim.y;
-	uint z = (id / (u_ParticlesPerDim.x * u_ParticlesPerDim.y)) % u_ParticlesPerDim.z;
+bool isSheltered(vec3 pos)
+{
+	if (!u_OcclusionEnabled)
+		return false;
+	vec3 extent = u_OcclusionBoundsMax - u_OcclusionBoundsMin;
+	vec2 uv = (pos.xz - u_OcclusionBoundsMin.xz) / extent.xz;
+	if (any(lessThan(uv, vec2(0.0))) || any(greaterThan(uv, vec2(1.0))))
+		return false;
+	return pos.y < u_OcclusionBoundsMin.y + textureLod(u_OcclusionMap, uv, 0).x * extent.y;
+}
 
-	vec2 rA = vec2(float(id) / float(u_num_particles) + u_time, 2.1923);
-	vec2 rB = vec2(float(id) / float(u_num_particles) + u_time, 14.1923);
-	vec2 rC = vec2(float(id) / float(u_num_particles) + u_time, 8.1923);
+// Floats as uints with the same order, for the shared memory atomicMin/Max reduction
+uint float_to_ordered(float f)
+{
+	uint u = floatBitsToUint(f);
+	return (u & 0x80000000u) != 0u ? ~u : u | 0x80000000u;
+}
 
-	float max_speed = 0.5;
-	Particle particle = particles[id];
-	particle.velocity += u_time_delta * vec3(rand(rA) - 0.5, - rand(rB) * 9.82 * u_time_delta, rand(rC) - 0.5);
-	particle.velocity = clamp(particle.velocity, vec3(-max_speed, -5 * max_speed, -max_speed), vec3(max_speed, 0, max_speed));
+float ordered_to_float(uint u)
+{
+	return uintBitsToFloat((u & 0x80000000u) != 0u ? u & 0x7FFFFFFFu : ~u);
+}
+
+ivec3 get_grid_position(int cluster, int local)
+{
+	ivec3 clusters_per_dim = (u_ParticlesPerDim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
+	ivec3 cluster_pos = ivec3(cluster % clusters_per_dim.x, (cluster / clusters_per_dim.x) % clusters_per_dim.y, cluster / (clusters_per_dim.x * clusters_per_dim.y));
+	ivec3 local_pos = ivec3(local % PARTICLES_PER_CLUSTER_DIM, (local / PARTICLES_PER_CLUSTER_DIM) % PARTICLES_PER_CLUSTER_DIM, local / (PARTICLES_PER_CLUSTER_DIM * PARTICLES_PER_CLUSTER_DIM));
+	return cluster_pos * PARTICLES_PER_CLUSTER_DIM + local_pos;
+}
+
+// "Hash Functions for GPU Rendering", Jarzynski and Olano 2020, same as pcg3d in particlesim.cpp
+uvec3 pcg3d(uvec3 v)
+{
+	v = v * 1664525u + 1013904223u;
+	v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+	v ^= v >> 16u;
+	v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+	return v;
+}
+
+void simulate(uint id, ivec3 grid, inout Particle particle)
+{
+	// Integer hash, the CPU reference draws the same numbers
+	vec3 r = vec3(pcg3d(uvec3(id, u_Frame, 0u)) >> 8u) * (1.0 / 16777216.0);
+	particle.velocity += u_time_delta * vec3(r.x - 0.5, -r.y * GRAVITY * u_time_delta, r.z - 0.5);
+
+	vec2 wind_uv = (particle.position.xz - u_WindBoundsMin.xz) / (u_WindBoundsMax.xz - u_WindBoundsMin.xz);
+	vec4 wind = texture(u_WindField, wind_uv);
+	particle.velocity.xz += u_time_delta * u_WindAmp * (0.1 + wind.z) * wind.xy;
+	particle.velocity = clamp(particle.velocity, vec3(-MAX_SPEED, -5.0 * MAX_SPEED, -MAX_SPEED), vec3(MAX_SPEED, 0.0, MAX_SPEED));
 	particle.position += u_time_delta * particle.velocity;
 
-	if ((particle.position.y < u_BboxMin.y) ||
+	// One distance field sample: push out of the surface and slide along it
+	vec3 sdf_uvw = (particle.position - u_SDFBoundsMin) / (u_SDFBoundsMax - u_SDFBoundsMin);
+	if (u_SDFEnabled && all(greaterThanEqual(sdf_uvw, vec3(0.0))) && all(lessThanEqual(sdf_uvw, vec3(1.0)))) {
+		vec4 sdf = textureLod(u_SceneSDF, sdf_uvw, 0);
+		float radius = particle.size;
+		if (sdf.w < radius && dot(sdf.xyz, sdf.xyz) > 0.0) {
+			vec3 normal = normalize(sdf.xyz);
+			particle.position += (radius - sdf.w) * normal;
+			particle.velocity -= min(dot(particle.velocity, normal), 0.0) * normal;
+		}
+	}
+
+	// Wrapping volumes need no extra work, positions are stored modulo the volume size
+	bool outside = !u_WrapVolume && ((particle.position.y < u_BboxMin.y) ||
 		(particle.position.x < u_BboxMin.x || particle.position.x > u_BboxMax.x) ||
-		(particle.position.z < u_BboxMin.z || particle.position.z > u_BboxMax.z)) {
-		particle.position = u_BboxMin + (u_BboxMax - u_BboxMin) * vec3(x, u_ParticlesPerDim.y, z) / vec3(u_ParticlesPerDim);
-		particle.position.y = u_BboxMax.y;
-		particle.velocity = vec3(0, -0.5, 0);
+		(particle.position.z < u_BboxMin.z || particle.position.z > u_BboxMax.z));
+	bool sheltered = isSheltered(particle.position);
+	if (u_WrapVolume && sheltered) {
+		// Respawn at the top of the volume, it keeps up with the camera so xz stays
+		particle.position.y = u_BboxMax.y - SPAWN_OFFSET * (u_BboxMax.y - u_BboxMin.y);
+		particle.velocity = vec3(0, -SPAWN_SPEED, 0);
+	}
+	else if (outside || sheltered) {
+		particle.position = u_BboxMin + (u_BboxMax - u_BboxMin) * vec3(grid.x, u_ParticlesPerDim.y, grid.z) / vec3(u_ParticlesPerDim);
+		// Just below the top, the top itself wraps to the bottom of the volume
+		particle.position.y = u_BboxMax.y - SPAWN_OFFSET * (u_BboxMax.y - u_BboxMin.y);
+		particle.velocity = vec3(0, -SPAWN_SPEED, 0);
 	}
+}
 
-	particles[id] = particle;
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	int group = int(gl_WorkGroupID.y * gl_NumWorkGroups.x + gl_WorkGroupID.x);
+	int group_cluster = int(gl_LocalInvocationID.x) / THREADS_PER_CLUSTER;
+	int cluster = group * CLUSTERS_PER_GROUP + group_cluster;
+	int local = int(gl_LocalInvocationID.x) % THREADS_PER_CLUSTER;
+	int bounds = 3 * group_cluster;
+
+	if (local < 3) {
+		cluster_min[bounds + local] = 0xFFFFFFFFu;
+		cluster_max[bounds + local] = 0u;
+	}
+	if (local == 0)
+		cluster_first[group_cluster] = 0xFFFFFFFFu;
+	barrier();
+
+	// No early return, every invocation has to reach the barriers
+	bool active = cluster < u_NumClusters && local < PARTICLES_PER_CLUSTER;
+	uint id = uint(cluster * PARTICLES_PER_CLUSTER + local);
+	Particle particle;
+	if (active) {
+		particle = unpack_particle(particles[id]);
+		active = (particle.flags & FLAG_UNUSED) == 0u;
+	}
+	if (active) {
+		simulate(id, get_grid_position(cluster, local), particle);
+		particles[id] = pack_particle(particle);
+		atomicMin(cluster_first[group_cluster], uint(local));
+	}
+	barrier();
+
+	if (active && uint(local) == cluster_first[group_cluster])
+		cluster_reference[group_cluster] = particle.position;
+	barrier();
+
+	if (active) {
+		// Representative within half a volume of the reference, the position itself without wrapping
+		vec3 reference = cluster_reference[group_cluster];
+		vec3 offset = particle.position - reference;
+		if (u_WrapVolume) {
+			vec3 volume_size = u_BboxMax - u_BboxMin;
+			offset -= volume_size * round(offset / volume_size);
+		}
+		vec3 position = reference + offset;
+		for (int i = 0; i < 3; i++) {
+			atomicMin(cluster_min[bounds + i], float_to_ordered(position[i]));
+			atomicMax(cluster_max[bounds + i], float_to_ordered(position[i]));
+		}
+	}
+	barrier();
+
+	if (local == 0 && cluster < u_NumClusters) {
+		bool empty = cluster_max[bounds] < cluster_min[bounds];
+		vec3 bounds_min = vec3(ordered_to_float(cluster_min[bounds]), ordered_to_float(cluster_min[bounds + 1]), ordered_to_float(cluster_min[bounds + 2]));
+		vec3 bounds_max = vec3(ordered_to_float(cluster_max[bounds]), ordered_to_float(cluster_max[bounds + 1]), ordered_to_float(cluster_max[bounds + 2]));
+		cluster_bounds[2 * cluster] = empty ? vec4(1.0) : vec4(bounds_min, 0.0);
+		cluster_bounds[2 * cluster + 1] = empty ? vec4(0.0) : vec4(bounds_max, 0.0);
+	}
 }
\ No newline at end of file
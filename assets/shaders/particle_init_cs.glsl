@@ -0,0 +1,43 @@
+__COMPUTE__
+#version 430 core
+
+/* Dimensions */
+uniform int u_NumParticleSlots;
+uniform vec3 u_BboxMin;
+uniform vec3 u_BboxMax;
+uniform ivec3 u_ParticlesPerDim;
+uniform float u_ParticleSize;
+
+/*
+* Clusters of 5x5x5 particles stored contiguously, see particle_cs.glsl. The constants and
+* the packed particle layout are injected, see particlesim.h and particle_pack.glsl.
+*/
+
+layout(std430, binding = 1) buffer ParticleSSBO
+{
+	uvec4 particles[];
+};
+
+ivec3 get_grid_position(uint slot)
+{
+	ivec3 clusters_per_dim = (u_ParticlesPerDim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
+	int cluster = int(slot) / PARTICLES_PER_CLUSTER;
+	int local = int(slot) % PARTICLES_PER_CLUSTER;
+	ivec3 cluster_pos = ivec3(cluster % clusters_per_dim.x, (cluster / clusters_per_dim.x) % clusters_per_dim.y, cluster / (clusters_per_dim.x * clusters_per_dim.y));
+	ivec3 local_pos = ivec3(local % PARTICLES_PER_CLUSTER_DIM, (local / PARTICLES_PER_CLUSTER_DIM) % PARTICLES_PER_CLUSTER_DIM, local / (PARTICLES_PER_CLUSTER_DIM * PARTICLES_PER_CLUSTER_DIM));
+	return cluster_pos * PARTICLES_PER_CLUSTER_DIM + local_pos;
+}
+
+// LOCAL_SIZE_X is injected, see ComputeTuner
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= u_NumParticleSlots) return;
+
+	// Slots past the grid on the border clusters are never simulated or drawn
+	ivec3 grid = get_grid_position(id);
+	uint flags = any(greaterThanEqual(grid, u_ParticlesPerDim)) ? FLAG_UNUSED : 0u;
+
+	vec3 position = u_BboxMin + (u_BboxMax - u_BboxMin) * (vec3(grid) / vec3(u_ParticlesPerDim));
+	particles[id] = pack_particle(position, vec3(0, -SPAWN_SPEED, 0), u_ParticleSize, flags, u_BboxMin, u_BboxMax);
+}
@@ -0,0 +1,55 @@
+/*
+* Packed particle layout shared by the particle shaders, injected after their #version line
+* together with the particlesim.h constants by get_particle_pack_shader_defines() (see particlesystem.h).
+* Same encoding as pack_particle/unpack_particle in particlesim.cpp.
+*
+* Packed particle, 16 bytes:
+*	x: position.x (21 bits) | position.y low 11 bits
+*	y: position.y high 10 bits | position.z (21 bits), bit 31 unused
+*	z: half velocity.xy
+*	w: half velocity.z | size (8 bits) | flags (8 bits)
+* Positions are fixed point modulo the volume size. Decoding picks the representative
+* inside the current volume, so a moving volume wraps particles without touching them.
+*/
+
+uvec3 unpack_quantized_position(uvec4 packed)
+{
+	return uvec3(packed.x & POSITION_MASK, (packed.x >> 21) | ((packed.y & 0x3FFu) << 11), (packed.y >> 10) & POSITION_MASK);
+}
+
+vec3 unpack_position(uvec4 packed, vec3 bounds_min, vec3 bounds_max)
+{
+	vec3 volume_size = bounds_max - bounds_min;
+	vec3 local = vec3(unpack_quantized_position(packed)) / POSITION_SCALE * volume_size;
+	return bounds_min + mod(local - bounds_min, volume_size);
+}
+
+vec3 unpack_velocity(uvec4 packed)
+{
+	return vec3(unpackHalf2x16(packed.z), unpackHalf2x16(packed.w).x);
+}
+
+float unpack_size(uvec4 packed)
+{
+	return float((packed.w >> 16) & 0xFFu) / 255.0 * MAX_PARTICLE_SIZE;
+}
+
+uint unpack_flags(uvec4 packed)
+{
+	return packed.w >> 24;
+}
+
+uvec4 pack_particle(vec3 position, vec3 velocity, float size, uint flags, vec3 bounds_min, vec3 bounds_max)
+{
+	vec3 volume_size = bounds_max - bounds_min;
+	uvec3 q = min(uvec3(mod(position, volume_size) / volume_size * POSITION_SCALE), uvec3(POSITION_MASK));
+
+	uvec4 packed;
+	packed.x = q.x | (q.y << 21);
+	packed.y = (q.y >> 11) | (q.z << 10);
+	packed.z = packHalf2x16(velocity.xy);
+	packed.w = (packHalf2x16(vec2(velocity.z, 0.0)) & 0xFFFFu)
+		| (uint(clamp(size / MAX_PARTICLE_SIZE, 0.0, 1.0) * 255.0 + 0.5) << 16)
+		| ((flags & 0xFFu) << 24);
+	return packed;
+}
@@ -0,0 +1,68 @@
+__VERTEX__
+#version 430 core
+
+struct PoolParticle {
+  vec3 position; float age;
+  vec3 velocity; uint lifetime_size; // Half floats, x: lifetime, y: size
+};
+
+layout(std430, binding = 1) readonly buffer ParticleSSBO
+{
+  PoolParticle particles[];
+};
+
+// Alive particles, one instance each
+layout(std430, binding = 3) readonly buffer AliveList
+{
+  uint alive_count;
+  uint alive[];
+};
+
+// Visible particles back to front (x: depth key, y: particle index), see particle_sort_cs.glsl
+layout(std430, binding = 4) readonly buffer SortedList
+{
+  uvec2 sorted[];
+};
+
+layout(location = 0) out vec4 out_Color;
+layout(location = 1) out vec2 out_UV;
+
+uniform mat4 u_ViewMatrix;
+uniform mat4 u_ProjectionMatrix;
+uniform bool u_Sorted;
+
+void main() {
+  uint index = u_Sorted ? sorted[gl_InstanceID].y : alive[gl_InstanceID];
+  PoolParticle particle = particles[index];
+  vec2 lifetime_size = unpackHalf2x16(particle.lifetime_size);
+  float half_size = lifetime_size.y;
+
+  // Fade out over the lifetime
+  out_Color = vec4(1.0, 1.0, 1.0, 1.0 - particle.age / lifetime_size.x);
+
+  // Triangle strip corners: (-, -), (+, -), (-, +), (+, +)
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  out_UV = vec2(corner.x, 1.0 - corner.y);
+
+  vec4 view_position = u_ViewMatrix * vec4(particle.position, 1.0);
+  gl_Position = u_ProjectionMatrix * (view_position + vec4(half_size * (2.0 * corner - 1.0), 0.0, 0.0));
+}
+
+__FRAGMENT__
+
+#version 430 core
+layout(location = 0) out vec4 out_Color;
+
+layout(location = 0) in vec4 in_Color;
+layout(location = 1) in vec2 in_UV;
+
+layout(binding = 1) uniform sampler2D u_particle_tex;
+
+// Alpha blended back to front when sorted, otherwise only opaque texels are kept
+uniform bool u_Sorted;
+
+void main() {
+  out_Color = in_Color * texture(u_particle_tex, in_UV);
+  if (!u_Sorted && out_Color.a < 0.5)
+    discard;
+}
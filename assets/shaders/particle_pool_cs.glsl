@@ -0,0 +1,207 @@
+__COMPUTE__
+#version 430 core
+
+/* Passes, one per dispatch (see ParticlePool) */
+#define PASS_INIT 0
+#define PASS_EMIT 1
+#define PASS_PREPARE 2
+#define PASS_SIMULATE 3
+#define PASS_FINALIZE 4
+
+#define SHAPE_POINT 0
+#define SHAPE_BOX 1
+#define SHAPE_MESH 2
+
+uniform int u_Pass;
+uniform uint u_Capacity;
+uniform float u_Time;
+uniform float u_TimeDelta;
+
+/* Emission */
+uniform uint u_EmitCount;
+// Index of this emit dispatch, every dispatch gets its own random pattern
+uniform uint u_EmitDispatch;
+uniform int u_EmitShape;
+uniform mat4 u_EmitTransform;
+uniform vec3 u_EmitDirection;
+uniform float u_EmitSpread;
+uniform float u_EmitSpeed;
+uniform float u_EmitLifetime;
+uniform float u_EmitSize;
+uniform uint u_NumTriangles;
+
+/* Simulation */
+uniform float u_Gravity;
+uniform float u_Drag;
+uniform float u_WindAmp;
+uniform vec3 u_WindBoundsMin;
+uniform vec3 u_WindBoundsMax;
+layout(binding = 0) uniform sampler2D u_WindField;
+
+struct PoolParticle {
+	vec3 position; float age;
+	vec3 velocity; uint lifetime_size; // Half floats, x: lifetime, y: size
+};
+
+layout(std430, binding = 1) buffer ParticleSSBO
+{
+	PoolParticle particles[];
+};
+
+layout(std430, binding = 2) buffer DeadList
+{
+	int dead_count;
+	uint dead[];
+};
+
+// Updated and drawn this frame
+layout(std430, binding = 3) buffer AliveList
+{
+	uint alive_count;
+	uint alive[];
+};
+
+// Survivors of the update, alive list of the next frame
+layout(std430, binding = 4) buffer NextAliveList
+{
+	uint next_alive_count;
+	uint next_alive[];
+};
+
+layout(std430, binding = 5) buffer IndirectArgs
+{
+	uint dispatch_x, dispatch_y, dispatch_z;
+	uint draw_count, draw_instance_count, draw_first, draw_base_instance;
+};
+
+layout(std430, binding = 6) readonly buffer MeshTriangles
+{
+	vec4 triangle_vertices[];
+};
+
+layout(std430, binding = 7) readonly buffer MeshAreaCDF
+{
+	float area_cdf[];
+};
+
+float rand(vec2 co){
+	return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+uint find_triangle(float r)
+{
+	uint lo = 0;
+	uint hi = u_NumTriangles - 1;
+	while (lo < hi) {
+		uint mid = (lo + hi) / 2;
+		if (area_cdf[mid] < r)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+void emit(uint id)
+{
+	if (id >= u_EmitCount) return;
+
+	int slot = atomicAdd(dead_count, -1) - 1;
+	if (slot < 0) {
+		// Pool exhausted, the emission is dropped
+		atomicAdd(dead_count, 1);
+		return;
+	}
+	uint index = dead[slot];
+
+	// Golden ratio steps spread consecutive dispatches evenly over [0, 1)
+	float dispatch_seed = fract(float(u_EmitDispatch & 0xFFFFu) * 0.618034);
+	vec2 seed = vec2(float(id) / float(u_EmitCount), fract(u_Time + dispatch_seed));
+	vec3 r = vec3(rand(seed + 0.13), rand(seed + 0.57), rand(seed + 0.91));
+	vec3 r_dir = vec3(rand(seed + 1.31), rand(seed + 1.73), rand(seed + 2.17)) * 2.0 - 1.0;
+
+	vec3 position = u_EmitTransform[3].xyz;
+	vec3 direction = u_EmitDirection;
+	if (u_EmitShape == SHAPE_BOX) {
+		position = (u_EmitTransform * vec4(r - 0.5, 1.0)).xyz;
+	}
+	else if (u_EmitShape == SHAPE_MESH && u_NumTriangles > 0) {
+		uint triangle = find_triangle(r.x);
+		vec3 a = (u_EmitTransform * vec4(triangle_vertices[3 * triangle + 0].xyz, 1.0)).xyz;
+		vec3 b = (u_EmitTransform * vec4(triangle_vertices[3 * triangle + 1].xyz, 1.0)).xyz;
+		vec3 c = (u_EmitTransform * vec4(triangle_vertices[3 * triangle + 2].xyz, 1.0)).xyz;
+		// Uniform point on the triangle
+		float s = sqrt(r.y);
+		position = (1.0 - s) * a + s * (1.0 - r.z) * b + s * r.z * c;
+		direction = normalize(cross(b - a, c - a));
+	}
+
+	PoolParticle particle;
+	particle.position = position;
+	particle.age = 0.0;
+	particle.velocity = u_EmitSpeed * normalize(direction + u_EmitSpread * r_dir);
+	particle.lifetime_size = packHalf2x16(vec2(u_EmitLifetime, u_EmitSize));
+	particles[index] = particle;
+
+	alive[atomicAdd(alive_count, 1)] = index;
+}
+
+void simulate(uint id)
+{
+	if (id >= alive_count) return;
+
+	uint index = alive[id];
+	PoolParticle particle = particles[index];
+	particle.age += u_TimeDelta;
+	if (particle.age >= unpackHalf2x16(particle.lifetime_size).x) {
+		dead[atomicAdd(dead_count, 1)] = index;
+		return;
+	}
+
+	vec2 wind_uv = (particle.position.xz - u_WindBoundsMin.xz) / (u_WindBoundsMax.xz - u_WindBoundsMin.xz);
+	vec4 wind = texture(u_WindField, wind_uv);
+	particle.velocity.xz += u_TimeDelta * u_WindAmp * (0.1 + wind.z) * wind.xy;
+	particle.velocity.y -= u_TimeDelta * u_Gravity;
+	particle.velocity *= exp(-u_Drag * u_TimeDelta);
+	particle.position += u_TimeDelta * particle.velocity;
+	particles[index] = particle;
+
+	next_alive[atomicAdd(next_alive_count, 1)] = index;
+}
+
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint id = gl_GlobalInvocationID.x;
+
+	if (u_Pass == PASS_INIT) {
+		if (id >= u_Capacity) return;
+		dead[id] = id;
+		if (id == 0) {
+			dead_count = int(u_Capacity);
+			alive_count = 0;
+			next_alive_count = 0;
+		}
+	}
+	else if (u_Pass == PASS_EMIT) {
+		emit(id);
+	}
+	else if (u_Pass == PASS_PREPARE) {
+		if (id != 0) return;
+		dispatch_x = (alive_count + 256 - 1) / 256;
+		dispatch_y = 1;
+		dispatch_z = 1;
+		next_alive_count = 0;
+	}
+	else if (u_Pass == PASS_SIMULATE) {
+		simulate(id);
+	}
+	else if (u_Pass == PASS_FINALIZE) {
+		if (id != 0) return;
+		// Size later passes over the alive particles, such as the depth sort
+		dispatch_x = (next_alive_count + 256 - 1) / 256;
+		draw_count = 4;
+		draw_instance_count = next_alive_count;
+		draw_first = 0;
+		draw_base_instance = 0;
+	}
+}
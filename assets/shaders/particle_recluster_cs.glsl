@@ -0,0 +1,64 @@
+__COMPUTE__
+#version 430 core
+
+/*
+* Regroups the particles of a wrapping ParticleSystem into clusters of nearby particles (see
+* ParticleSystem::recluster). The KEYS pass writes a Morton key per slot, the keys are sorted by
+* ParticleSorter and the GATHER pass copies the particles to their sorted slots.
+* FLAG_UNUSED and the packed particle layout are injected, see particlesim.h and particle_pack.glsl
+*/
+#define PASS_KEYS 0
+#define PASS_GATHER 1
+
+uniform int u_Pass;
+uniform int u_NumParticleSlots;
+
+layout(std430, binding = 1) readonly buffer ParticleSSBO
+{
+	uvec4 particles[];
+};
+
+layout(std430, binding = 2) writeonly buffer SortedParticleSSBO
+{
+	uvec4 sorted_particles[];
+};
+
+// x: key, y: slot
+layout(std430, binding = 4) buffer KeyBuffer
+{
+	uvec2 keys[];
+};
+
+// Spread the low 10 bits of x over every third bit
+uint part_1_by_2(uint x)
+{
+	x &= 0x3FFu;
+	x = (x | (x << 16)) & 0x030000FFu;
+	x = (x | (x << 8)) & 0x0300F00Fu;
+	x = (x | (x << 4)) & 0x030C30C3u;
+	x = (x | (x << 2)) & 0x09249249u;
+	return x;
+}
+
+// Same as get_particle_cluster_key
+uint get_cluster_key(uvec4 packed)
+{
+	if ((unpack_flags(packed) & FLAG_UNUSED) != 0u)
+		return 1u;
+	// Top 10 of the 21 bits per axis
+	uvec3 q = unpack_quantized_position(packed) >> 11;
+	// 0 is left for the padding of the sort, 1 for unused slots
+	return (part_1_by_2(q.x) | (part_1_by_2(q.y) << 1) | (part_1_by_2(q.z) << 2)) + 2u;
+}
+
+// LOCAL_SIZE_X is injected, see ComputeTuner
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= uint(u_NumParticleSlots)) return;
+
+	if (u_Pass == PASS_KEYS)
+		keys[id] = uvec2(get_cluster_key(particles[id]), id);
+	else if (u_Pass == PASS_GATHER)
+		sorted_particles[id] = particles[keys[id].y];
+}
@@ -0,0 +1,152 @@
+__COMPUTE__
+#version 430 core
+
+/* Passes, one per dispatch (see ParticleSorter) */
+#define PASS_CULL 0
+#define PASS_PREPARE 1
+#define PASS_PAD 2
+#define PASS_LOCAL_SORT 3
+#define PASS_GLOBAL_STEP 4
+#define PASS_LOCAL_MERGE 5
+
+// Elements per work group in the shared memory passes, two per thread
+#define TILE_SIZE 512u
+
+uniform int u_Pass;
+uniform mat4 u_ViewMatrix;
+uniform mat4 u_ProjectionMatrix;
+// Bitonic block size and compare distance
+uniform uint u_K;
+uniform uint u_J;
+
+struct PoolParticle {
+	vec3 position; float age;
+	vec3 velocity; uint lifetime_size; // Half floats, x: lifetime, y: size
+};
+
+layout(std430, binding = 1) readonly buffer ParticleSSBO
+{
+	PoolParticle particles[];
+};
+
+layout(std430, binding = 3) readonly buffer AliveList
+{
+	uint alive_count;
+	uint alive[];
+};
+
+// x: depth key, y: particle index
+layout(std430, binding = 4) buffer KeyBuffer
+{
+	uvec2 keys[];
+};
+
+layout(std430, binding = 5) buffer SortArgs
+{
+	uint dispatch_x, dispatch_y, dispatch_z;
+	uint visible_count;
+	uint padded_count;
+	uint draw_count, draw_instance_count, draw_first, draw_base_instance;
+};
+
+shared uvec2 tile[TILE_SIZE];
+
+// Sorts back to front: larger keys first in descending blocks
+void compare_and_swap(inout uvec2 a, inout uvec2 b, bool descending)
+{
+	if (descending ? a.x < b.x : a.x > b.x) {
+		uvec2 tmp = a;
+		a = b;
+		b = tmp;
+	}
+}
+
+// First element of the pair thread t compares at distance j
+uint pair_index(uint t, uint j)
+{
+	return ((t & ~(j - 1)) << 1) | (t & (j - 1));
+}
+
+void cull(uint id)
+{
+	if (id >= alive_count) return;
+
+	uint index = alive[id];
+	PoolParticle particle = particles[index];
+	float half_size = unpackHalf2x16(particle.lifetime_size).y;
+
+	vec4 view_position = u_ViewMatrix * vec4(particle.position, 1.0);
+	vec4 clip_position = u_ProjectionMatrix * view_position;
+	vec2 margin = half_size * vec2(u_ProjectionMatrix[0][0], u_ProjectionMatrix[1][1]);
+	if (clip_position.w <= 0.0 || any(greaterThan(abs(clip_position.xy), vec2(clip_position.w) + margin)))
+		return;
+
+	// Same key as get_particle_sort_key, max(-0.0, 0.0) may keep the sign bit and sort first
+	float depth = -view_position.z;
+	uint key = depth > 0.0 ? floatBitsToUint(depth) : 0u;
+	keys[atomicAdd(visible_count, 1)] = uvec2(key, index);
+}
+
+void sort_tile(uint first_k, uint last_k, uint first_j)
+{
+	uint base = gl_WorkGroupID.x * TILE_SIZE;
+	uint t = gl_LocalInvocationID.x;
+	tile[t] = keys[base + t];
+	tile[t + TILE_SIZE / 2] = keys[base + t + TILE_SIZE / 2];
+	barrier();
+
+	for (uint k = first_k; k <= last_k; k <<= 1) {
+		for (uint j = min(k >> 1, first_j); j > 0; j >>= 1) {
+			uint i = pair_index(t, j);
+			compare_and_swap(tile[i], tile[i + j], ((base + i) & k) == 0);
+			barrier();
+		}
+	}
+
+	keys[base + t] = tile[t];
+	keys[base + t + TILE_SIZE / 2] = tile[t + TILE_SIZE / 2];
+}
+
+layout(local_size_x = 256, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint id = gl_GlobalInvocationID.x;
+
+	if (u_Pass == PASS_CULL) {
+		cull(id);
+	}
+	else if (u_Pass == PASS_PREPARE) {
+		if (id != 0) return;
+		padded_count = visible_count <= TILE_SIZE ? TILE_SIZE : (1u << (findMSB(visible_count - 1) + 1));
+		dispatch_x = padded_count / TILE_SIZE;
+		dispatch_y = 1;
+		dispatch_z = 1;
+		draw_count = 4;
+		draw_instance_count = visible_count;
+		draw_first = 0;
+		draw_base_instance = 0;
+	}
+	else if (u_Pass == PASS_PAD) {
+		// Padding has the smallest key and ends up behind the visible particles
+		uint base = gl_WorkGroupID.x * TILE_SIZE + gl_LocalInvocationID.x;
+		if (base >= visible_count)
+			keys[base] = uvec2(0);
+		if (base + TILE_SIZE / 2 >= visible_count)
+			keys[base + TILE_SIZE / 2] = uvec2(0);
+	}
+	else if (u_Pass == PASS_LOCAL_SORT) {
+		sort_tile(2, TILE_SIZE, TILE_SIZE / 2);
+	}
+	else if (u_Pass == PASS_GLOBAL_STEP) {
+		if (u_K > padded_count) return;
+		uint i = pair_index(id, u_J);
+		uvec2 a = keys[i];
+		uvec2 b = keys[i + u_J];
+		compare_and_swap(a, b, (i & u_K) == 0);
+		keys[i] = a;
+		keys[i + u_J] = b;
+	}
+	else if (u_Pass == PASS_LOCAL_MERGE) {
+		if (u_K > padded_count) return;
+		sort_tile(u_K, u_K, TILE_SIZE / 2);
+	}
+}
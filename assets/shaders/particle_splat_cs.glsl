@@ -0,0 +1,81 @@
+__COMPUTE__
+#version 430 core
+#define PI 3.14159265
+
+/*
+* Point splatting of snowflakes smaller than a few pixels. A billboard of that size is mostly
+* rasterizer overhead for a handful of covered pixels, so each particle adds its coverage
+* to a single pixel of an accumulation image instead, which the resolve pass blends over the scene.
+*
+* One group of 128 threads per visible cluster, dispatched indirectly from the cluster cull.
+* POSITION_SCALE, POSITION_MASK, MAX_PARTICLE_SIZE, FLAG_UNUSED, PARTICLES_PER_CLUSTER, the packed
+* particle layout and SPLAT_SCALE are injected, see particlesim.h, particle_pack.glsl and particlesplat.h
+*/
+
+struct AABB {
+	vec3 min;
+	vec3 max;
+};
+
+uniform mat4 u_ViewProjection;
+uniform vec3 u_SystemBoundsMin;
+uniform vec3 u_SystemBoundsMax;
+// Covered by a denser, inner precipitation layer
+uniform AABB u_InnerVolume;
+// Projected billboard size in pixels is size * u_PixelScale / w
+uniform float u_PixelScale;
+// Particles at least this large in pixels are drawn as billboards
+uniform float u_SplatMaxSize;
+
+layout(binding = 0) uniform sampler2D u_SceneDepth;
+// Coverage in 1 / SPLAT_SCALE units
+layout(r32ui, binding = 0) uniform coherent uimage2D u_Coverage;
+
+layout(std430, binding = 1) readonly buffer ParticleSSBO
+{
+	uvec4 particles[];
+};
+
+layout(std430, binding = 2) readonly buffer VisibleClustersSSBO
+{
+	uint visible_clusters[];
+};
+
+bool is_inside(vec3 pos, AABB bbox)
+{
+	return min(max(pos, bbox.min), bbox.max) == pos;
+}
+
+layout(local_size_x = 128, local_size_y = 1, local_size_z = 1) in;
+void main(void) {
+	uint local = gl_LocalInvocationID.x;
+	if (local >= PARTICLES_PER_CLUSTER) return;
+
+	uint cluster = visible_clusters[gl_WorkGroupID.x];
+	uvec4 particle = particles[cluster * PARTICLES_PER_CLUSTER + local];
+	vec3 position = unpack_position(particle, u_SystemBoundsMin, u_SystemBoundsMax);
+	if ((unpack_flags(particle) & FLAG_UNUSED) != 0u || is_inside(position, u_InnerVolume))
+		return;
+
+	vec4 clip = u_ViewProjection * vec4(position, 1.0);
+	if (clip.w <= 0.0)
+		return;
+
+	// Same billboard as particle.glsl, which skips everything splatted here
+	float size_px = 2.0 * unpack_size(particle) * u_PixelScale / clip.w;
+	if (size_px >= u_SplatMaxSize)
+		return;
+
+	vec3 ndc = clip.xyz / clip.w;
+	if (any(greaterThan(abs(ndc), vec3(1.0))))
+		return;
+
+	ivec2 image_size = imageSize(u_Coverage);
+	ivec2 pixel = min(ivec2((ndc.xy * 0.5 + 0.5) * vec2(image_size)), image_size - 1);
+	if (ndc.z * 0.5 + 0.5 >= texelFetch(u_SceneDepth, pixel, 0).r)
+		return;
+
+	// Fraction of the pixel covered by the round flake
+	float coverage = min(size_px * size_px * PI / 4.0, 1.0);
+	imageAtomicAdd(u_Coverage, pixel, uint(coverage * SPLAT_SCALE + 0.5));
+}
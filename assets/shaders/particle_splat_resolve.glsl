@@ -0,0 +1,27 @@
+__VERTEX__
+#version 430 core
+
+// Fullscreen triangle, drawn without vertex buffers
+void main() {
+  vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
+
+__FRAGMENT__
+#version 430 core
+
+// SPLAT_SCALE is injected, see particlesplat.h
+layout(r32ui, binding = 0) uniform coherent uimage2D u_Coverage;
+
+layout(location = 0) out vec4 out_Color;
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  uint sum = imageLoad(u_Coverage, pixel).r;
+  if (sum == 0u)
+    discard;
+
+  // Cleared for the next frame while it is read
+  imageStore(u_Coverage, pixel, uvec4(0u));
+  out_Color = vec4(1.0, 1.0, 1.0, min(float(sum) / SPLAT_SCALE, 1.0));
+}
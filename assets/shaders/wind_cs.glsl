@@ -0,0 +1,34 @@
+__COMPUTE__
+#version 430 core
+#define PI 3.1415926536f
+
+uniform float u_Time;
+uniform float u_WindFactor;
+uniform vec2 u_WindDirection;
+
+layout(binding = 0) uniform sampler2D u_WindTexture;
+layout(rgba16f, binding = 0) uniform writeonly image2D u_WindField;
+
+layout(local_size_x = 16, local_size_y = 16, local_size_z = 1) in;
+void main(void) {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(u_WindField);
+	if (texel.x >= size.x || texel.y >= size.y) return;
+
+	// Normalized position within the field bounds
+	float x = (texel.x + 0.5) / float(size.x);
+	float z = (texel.y + 0.5) / float(size.y);
+
+	vec3 windD1 = vec3(u_WindDirection.x, 0, u_WindDirection.y + 0.2);
+	vec3 windD2 = vec3(u_WindDirection.x, 0, u_WindDirection.y - 0.2);
+	float windDFreq = (1.0 + sin(PI * u_Time / 10.0f)) / 2.0f;
+	vec3 wind_direction = normalize(windD1 * windDFreq + (1 - windDFreq) * windD2);
+
+	float noise = texture(u_WindTexture, vec2(x + wind_direction.x, z + wind_direction.z)).x;
+	float phase = x * wind_direction.x + z * wind_direction.z;
+	float global_wind_cascade0 = (sin(PI * 0.5 * u_Time + 5.0f * u_WindFactor * phase + noise) + 1.0) / 2.0f;
+	float global_wind_cascade1 = (sin(PI * u_Time + 13.0f * u_WindFactor * phase + noise) + 1.0) / 2.0f;
+	float global_wind_intensity = pow((global_wind_cascade0 * global_wind_cascade1), 1.2f);
+
+	imageStore(u_WindField, texel, vec4(wind_direction.xz, global_wind_intensity, 0.0));
+}
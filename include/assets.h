@@ -5,6 +5,7 @@
 #include <iostream>
 #include <map>
 #include <filesystem>
+#include <vector>
 
 #include "texture.h"
 #include "model.h"
@@ -32,10 +33,25 @@ public:
 
 	static RawModel* GetRawModel(const char* file_name);
 
-	static Shader* GetShader(const char* file_name);
+	/*
+	* Parse the .fbx files of file_names on the job system and create their models, so that later
+	* GetRawModel calls hit the cache. GL objects are still created on the calling thread.
+	*/
+	static void PreloadRawModels(const std::vector<const char*>& file_names);
+
+	/*
+	* Shaders are cached per file name and defines. The defines are inserted after the #version
+	* line of every stage, which lets C++ and GLSL share constants and build shader variants.
+	*/
+	static Shader* GetShader(const char* file_name, const std::string& defines = "");
 
 	static std::string ReadFile(std::filesystem::path file_path);
 
+	/*
+	* Directory for data generated at runtime, such as compute tuning results. Created if missing.
+	*/
+	static std::filesystem::path GetCachePath();
+
 	/*
 	* Reloads all shaders from source avaliable in /../build/assets/shaders
 	*
@@ -56,7 +72,7 @@ private:
 	AssetManager() {};
 
 	static bool ParseFBX(const std::filesystem::path& file_path, ModelData& output);
-	static bool ParseShader(const std::filesystem::path& file_path, std::map<GLuint, std::string>& output_sources);
+	static bool ParseShader(const std::filesystem::path& file_path, std::map<GLuint, std::string>& output_sources, const std::string& defines);
 
 	std::map<std::string, TextureCubeMap*> m_CubeMaps;
 	std::map<std::string, Texture2D*> m_Textures;
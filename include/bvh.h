@@ -0,0 +1,234 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct ModelData;
+
+/*
+* Bounding volume hierarchies for ray queries on the CPU: one MeshBVH per mesh and a SceneBVH
+* over placed instances of them. Nothing here touches GL, queries never wait on the GPU.
+*/
+
+struct Ray
+{
+	glm::vec3 origin;
+	// Not required to be normalized, hit distances are in multiples of direction
+	glm::vec3 direction;
+	float t_max = std::numeric_limits<float>::max();
+};
+
+struct RayHit
+{
+	static constexpr uint32_t INVALID = 0xFFFFFFFF;
+
+	float t = std::numeric_limits<float>::max();
+	// Index of the triangle in the mesh indices / 3, and barycentrics of vertex 1 and 2
+	uint32_t triangle = INVALID;
+	glm::vec2 barycentrics = glm::vec2(0.0f);
+	// Id of the SceneBVH instance that was hit
+	uint32_t instance = INVALID;
+
+	inline bool is_valid() const { return triangle != INVALID; }
+};
+
+struct BVHBounds
+{
+	glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+	glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+	inline void grow(glm::vec3 p) { min = glm::min(min, p); max = glm::max(max, p); }
+	inline void grow(const BVHBounds& b) { min = glm::min(min, b.min); max = glm::max(max, b.max); }
+	inline bool is_empty() const { return min.x > max.x; }
+	float get_surface_area() const;
+};
+
+/**
+* Four children per node, their bounds are stored as SoA so a ray is tested against all
+* four with one set of SIMD slab tests. Children are stored after their parent.
+*/
+struct BVH4Node
+{
+	// min x, y, z, max x, y, z of each child, empty children have inverted bounds
+	float bounds[6][4];
+	// Node index of an inner child, first primitive of a leaf child, -1 if empty
+	int32_t children[4];
+	// Primitives of a leaf child, 0 for inner and empty children
+	uint32_t counts[4];
+};
+
+/**
+* Four-wide BVH over primitive bounds. Built with binned SAH binary splits that are
+* collapsed into four-wide nodes. Leaves reference a range of the primitive index list.
+*/
+struct BVH4
+{
+public:
+	void build(const std::vector<BVHBounds>& primitive_bounds, uint32_t max_leaf_size);
+
+	/**
+	* Recompute the node bounds from new bounds of the same primitives, keeps the topology
+	*/
+	void refit(const std::vector<BVHBounds>& primitive_bounds);
+
+	/**
+	* Visit the leaves hit by ray. The hit children of every node are visited near to far, which
+	* orders the leaves only roughly. intersect_leaf(first, count) tests primitives[first, first + count),
+	* may lower t_max and returns true to end the traversal.
+	*/
+	template<typename LeafFunction>
+	void traverse(const Ray& ray, float& t_max, LeafFunction intersect_leaf) const;
+
+	inline bool is_empty() const { return nodes.empty(); }
+	BVHBounds get_bounds() const;
+
+public:
+	std::vector<BVH4Node> nodes;
+	// Primitive indices in leaf order
+	std::vector<uint32_t> primitives;
+	// Inner nodes on the longest path from the root, bounds the traversal stack
+	uint32_t max_depth = 0;
+
+private:
+	// Mask of the children of node hit within [0, t_max], with their entry distances
+	static uint32_t intersect_node(const BVH4Node& node, glm::vec3 origin, glm::vec3 inv_direction, float t_max, float t_near[4]);
+};
+
+/**
+* BVH over the triangles of a mesh in object space
+*/
+struct MeshBVH
+{
+public:
+	MeshBVH(const ModelData& data);
+
+	/**
+	* Closest hit closer than hit.t and ray.t_max, hit is only written on success
+	*/
+	bool intersect(const Ray& ray, RayHit& hit) const;
+
+	/**
+	* Any hit before ray.t_max, for visibility queries
+	*/
+	bool occluded(const Ray& ray) const;
+
+	inline BVHBounds get_bounds() const { return m_BVH.get_bounds(); }
+
+private:
+	// Triangles in leaf order, precomputed for Moller-Trumbore
+	struct Triangle
+	{
+		glm::vec3 v0;
+		glm::vec3 e1;
+		glm::vec3 e2;
+		uint32_t index;
+	};
+
+	BVH4 m_BVH;
+	std::vector<Triangle> m_Triangles;
+};
+
+struct BVHInstance
+{
+	const MeshBVH* mesh;
+	glm::mat4 transform;
+	// Reported as RayHit::instance
+	uint32_t id;
+};
+
+/**
+* Top-level BVH over mesh instances. Moving instances only refits the node bounds,
+* adding or removing instances requires a rebuild.
+*/
+struct SceneBVH
+{
+public:
+	void build(const std::vector<BVHInstance>& instances);
+
+	/**
+	* Move instance i, the bounds are updated on the next refit()
+	*/
+	void set_transform(uint32_t i, const glm::mat4& transform);
+	void refit();
+
+	bool intersect(const Ray& ray, RayHit& hit) const;
+	bool occluded(const Ray& ray) const;
+
+	inline size_t get_num_instances() const { return m_Instances.size(); }
+	inline const BVHInstance& get_instance(uint32_t i) const { return m_Instances[i]; }
+
+private:
+	BVHBounds get_instance_bounds(uint32_t i) const;
+	Ray to_object_space(const Ray& ray, uint32_t i) const;
+
+private:
+	BVH4 m_BVH;
+	std::vector<BVHInstance> m_Instances;
+	std::vector<glm::mat4> m_InverseTransforms;
+	std::vector<BVHBounds> m_InstanceBounds;
+	bool m_RefitPending = false;
+};
+
+template<typename LeafFunction>
+void BVH4::traverse(const Ray& ray, float& t_max, LeafFunction intersect_leaf) const
+{
+	if (nodes.empty())
+		return;
+
+	// Division by zero yields infinities, which the slab test handles
+	glm::vec3 inv_direction = 1.0f / ray.direction;
+
+	struct StackEntry { int32_t node; float t_near; };
+	// Every level leaves at most three siblings of the popped node behind, degenerate builds get a heap stack
+	static constexpr uint32_t LOCAL_STACK_SIZE = 128;
+	uint32_t stack_capacity = 3 * max_depth + 4;
+	StackEntry local_stack[LOCAL_STACK_SIZE];
+	std::vector<StackEntry> heap_stack;
+	StackEntry* stack = local_stack;
+	if (stack_capacity > LOCAL_STACK_SIZE)
+	{
+		heap_stack.resize(stack_capacity);
+		stack = heap_stack.data();
+	}
+	uint32_t stack_size = 0;
+	stack[stack_size++] = { 0, 0.0f };
+
+	while (stack_size > 0)
+	{
+		StackEntry entry = stack[--stack_size];
+		if (entry.t_near > t_max)
+			continue;
+
+		const BVH4Node& node = nodes[entry.node];
+		float t_near[4];
+		uint32_t hit_mask = intersect_node(node, ray.origin, inv_direction, t_max, t_near);
+
+		// Leaves are tested right away, inner children are pushed far to near so the nearest is popped first
+		int order[4];
+		int num_inner = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			// Inverted bounds of empty children do not fail the slab test
+			if (!(hit_mask & (1u << i)) || node.children[i] < 0)
+				continue;
+			if (node.counts[i] > 0)
+			{
+				if (intersect_leaf((uint32_t)node.children[i], node.counts[i]))
+					return;
+				continue;
+			}
+			int j = num_inner++;
+			while (j > 0 && t_near[order[j - 1]] < t_near[i])
+			{
+				order[j] = order[j - 1];
+				j--;
+			}
+			order[j] = i;
+		}
+		for (int i = 0; i < num_inner; i++)
+			stack[stack_size++] = { node.children[order[i]], t_near[order[i]] };
+	}
+}
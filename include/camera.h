@@ -46,4 +46,11 @@ private:
     float movement_speed; 
 };
 
+/**
+ * Orthographic projection looking straight down (-y) onto the xz-rectangle of [bounds_min, bounds_max].
+ * World x maps to clip x, world z to clip y and world y to depth, so that depth 0 is bounds_min.y 
+ * and depth 1 is bounds_max.y. Texture coordinates of the rendered image equal the normalized xz-position.
+ */
+glm::mat4 get_top_down_projection(glm::vec3 bounds_min, glm::vec3 bounds_max);
+
 #endif //WR_CAMERA_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "model.h"
+#include "shader.h"
+
+enum class RenderCommandType : uint8_t
+{
+	BIND_SHADER,
+	BIND_MODEL,
+	BIND_TEXTURE,
+	SET_INT,
+	SET_UINT,
+	SET_FLOAT3,
+	SET_MATRIX4,
+	DRAW,
+};
+
+/**
+* Draw commands packed back to back into a linear block of memory, so that any thread can record
+* while only the GL thread replays.
+*
+* Recording touches no GL state and allocates only when the buffer outgrows its previous size,
+* clear keeps the memory for the next frame. Every command is a RenderCommandType and a payload
+* of plain data. Uniforms are set by location, taken at record time from the explicit
+* layout(location = N) of the shader, so replay does no lookups.
+*
+* Replay tracks the bound model, a buffer binds a model once for consecutive draws of it.
+*/
+struct CommandBuffer
+{
+public:
+	inline void clear() { m_Data.clear(); m_RecordedModel = nullptr; }
+	inline bool is_empty() const { return m_Data.empty(); }
+	inline size_t get_size() const { return m_Data.size(); }
+
+	void bind_shader(Shader* shader);
+	/**
+	* Skipped if model is already bound by the previous command of this buffer
+	*/
+	void bind_model(RawModel* model);
+	void bind_texture(uint32_t slot, GLuint texture);
+	void set_int(GLint location, int value);
+	void set_uint(GLint location, uint32_t value);
+	void set_float3(GLint location, const glm::vec3& value);
+	void set_matrix4(GLint location, const glm::mat4& value);
+	/**
+	* Draw the bound model
+	*/
+	void draw();
+
+	/**
+	* Issue the recorded commands on the calling thread, which must own the GL context.
+	* Uniforms are set on the bound shader, the one bound before replay until a BIND_SHADER.
+	*/
+	void replay() const;
+
+private:
+	template<typename T>
+	void push(RenderCommandType type, const T& payload)
+	{
+		size_t offset = m_Data.size();
+		m_Data.resize(offset + 1 + sizeof(T));
+		m_Data[offset] = (uint8_t)type;
+		std::memcpy(&m_Data[offset + 1], &payload, sizeof(T));
+	}
+
+private:
+	std::vector<uint8_t> m_Data;
+	RawModel* m_RecordedModel = nullptr;
+};
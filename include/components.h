@@ -1,15 +1,19 @@
 #pragma once
 
 #include <string>
+#include <vector>
 
 #include <imgui.h>
 #include <ImGuizmo.h>
+#include <entt/entity/entity.hpp>
 #include "glm/glm.hpp"
 #include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/quaternion.hpp"
 
 #include "shader.h"
 #include "model.h"
 #include "material.h"
+#include "particlepool.h"
 
 struct NameComponent
 {
@@ -25,25 +29,81 @@ struct NameComponent
 	}
 };
 
+/**
+* Local position, rotation and scale relative to the parent in HierarchyComponent, or to the world for roots.
+* transform caches the world matrix, recomputed by Scene::UpdateTransforms whenever the entity or one of
+* its ancestors is dirty. Static entities follow their parents like any other, a static entity below a
+* moving one re-bakes the static geometry maps whenever it moves.
+*/
 struct TransformComponent
 {
+	glm::vec3 position = glm::vec3(0.0f);
+	glm::quat rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+	glm::vec3 scale = glm::vec3(1.0f);
+
+	// World matrix, read only outside of Scene::UpdateTransforms
 	glm::mat4 transform = glm::mat4(1.0f);
+	bool dirty = true;
+	bool is_static = false;
 
 	TransformComponent() = default;
-	TransformComponent(glm::mat4 t) : transform(t) {};
+	TransformComponent(const glm::mat4& local) { set_local(local); };
+
+	/**
+	* Decompose an affine matrix without shear into position, rotation and scale
+	*/
+	void set_local(const glm::mat4& local)
+	{
+		position = glm::vec3(local[3]);
+		scale = glm::vec3(glm::length(glm::vec3(local[0])), glm::length(glm::vec3(local[1])), glm::length(glm::vec3(local[2])));
+		if (glm::determinant(glm::mat3(local)) < 0.0f)
+			scale.x = -scale.x;
+		rotation = glm::normalize(glm::quat_cast(glm::mat3(glm::vec3(local[0]) / scale.x, glm::vec3(local[1]) / scale.y, glm::vec3(local[2]) / scale.z)));
+		dirty = true;
+	}
+
+	glm::mat4 get_local() const
+	{
+		return glm::translate(glm::mat4(1.0f), position) * glm::mat4_cast(rotation) * glm::scale(glm::mat4(1.0f), scale);
+	}
 
-	static void DrawUI(const TransformComponent& component)
+	static void DrawUI(TransformComponent& component)
 	{
 		if (ImGui::CollapsingHeader("Transform", ImGuiTreeNodeFlags_DefaultOpen))
 		{
-			glm::vec3 translation;
-			glm::vec3 rotation;
-			glm::vec3 scale;
-			ImGuizmo::DecomposeMatrixToComponents((float*) &component.transform[0], &translation.x, &rotation.x, &scale.x);
-			ImGui::InputFloat3("Translation", &translation.x);
-			ImGui::InputFloat3("Rotation", &rotation.x);
-			ImGui::InputFloat3("Scale", &scale.x);
-			ImGuizmo::RecomposeMatrixFromComponents(&translation.x, &rotation.x, &scale.x, (float*)&component.transform[0]);
+			glm::vec3 euler = glm::degrees(glm::eulerAngles(component.rotation));
+			component.dirty |= ImGui::InputFloat3("Position", &component.position.x);
+			if (ImGui::InputFloat3("Rotation", &euler.x))
+			{
+				component.rotation = glm::quat(glm::radians(euler));
+				component.dirty = true;
+			}
+			component.dirty |= ImGui::InputFloat3("Scale", &component.scale.x);
+			ImGui::Checkbox("Static", &component.is_static);
+		}
+	}
+};
+
+/**
+* Parent and children of an entity, every entity created by the scene has one.
+* Only change it through Scene::SetParent, which keeps both sides and the update order in sync.
+*/
+struct HierarchyComponent
+{
+	entt::entity parent = entt::null;
+	std::vector<entt::entity> children;
+
+	HierarchyComponent() = default;
+
+	static void DrawUI(const HierarchyComponent& component)
+	{
+		if (ImGui::CollapsingHeader("Hierarchy", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			if (component.parent != entt::null)
+				ImGui::Text("Parent: %d", (uint32_t)component.parent);
+			else
+				ImGui::Text("Parent: None");
+			ImGui::Text("Children: %d", (int)component.children.size());
 		}
 	}
 };
@@ -83,6 +143,121 @@ struct QuadRendererComponent
 	}
 };
 
+/**
+* Entities with this component bend grass within radius when close to the ground
+*/
+struct GrassTramplerComponent
+{
+	float radius = 1.0f;
+
+	GrassTramplerComponent() = default;
+	GrassTramplerComponent(float r) : radius(r) {};
+
+	static void DrawUI(GrassTramplerComponent& component)
+	{
+		if (ImGui::CollapsingHeader("Grass Trampler", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			ImGui::SliderFloat("Radius", &component.radius, 0.1f, 5.0f);
+		}
+	}
+};
+
+/**
+* Entities with this component are drawn into the software occlusion buffer before the opaque pass.
+* Without a mesh the occluder is the box of the entity's model, scaled around its center so that
+* it stays inside the visible geometry.
+*/
+struct OccluderComponent
+{
+	RawModel* mesh = nullptr;
+	glm::vec3 box_scale = glm::vec3(0.9f);
+
+	OccluderComponent() = default;
+	OccluderComponent(RawModel* m) : mesh(m) {};
+
+	static void DrawUI(OccluderComponent& component)
+	{
+		if (ImGui::CollapsingHeader("Occluder", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			if (component.mesh)
+				ImGui::Text("Custom mesh");
+			else
+				ImGui::SliderFloat3("Box scale", &component.box_scale.x, 0.0f, 1.0f);
+		}
+	}
+};
+
+/**
+* Spawns particles into the scene's particle pool from the entity transform.
+* Mesh emitters use the entity's ModelRendererComponent.
+*/
+struct ParticleEmitterComponent
+{
+	EmitterShape shape = EmitterShape::POINT;
+	float rate = 100.0f; // Particles per second
+	glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f);
+	float spread = 0.5f;
+	float speed = 2.0f;
+	float lifetime = 2.0f;
+	float size = 0.05f;
+
+	int burst_count = 1000;
+	// Emitted on the next frame, on top of the rate
+	uint32_t pending = 0;
+	float accumulator = 0.0f;
+
+	ParticleEmitterComponent() = default;
+	ParticleEmitterComponent(EmitterShape s) : shape(s) {};
+
+	static void DrawUI(ParticleEmitterComponent& component)
+	{
+		if (ImGui::CollapsingHeader("Particle Emitter", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			const char* shapes[] = { "Point", "Box", "Mesh" };
+			int shape = (int)component.shape;
+			if (ImGui::Combo("Shape", &shape, shapes, IM_ARRAYSIZE(shapes)))
+				component.shape = (EmitterShape)shape;
+			ImGui::SliderFloat("Rate", &component.rate, 0.0f, 10000.0f);
+			ImGui::SliderFloat3("Direction", &component.direction.x, -1.0f, 1.0f);
+			ImGui::SliderFloat("Spread", &component.spread, 0.0f, 2.0f);
+			ImGui::SliderFloat("Speed", &component.speed, 0.0f, 20.0f);
+			ImGui::SliderFloat("Lifetime", &component.lifetime, 0.1f, 10.0f);
+			ImGui::SliderFloat("Size", &component.size, 0.01f, 1.0f);
+			ImGui::SliderInt("Burst count", &component.burst_count, 1, 100000);
+			if (ImGui::Button("Burst"))
+				component.pending += component.burst_count;
+		}
+	}
+};
+
+/**
+* Baked ambient occlusion and sky visibility of a static entity, see Lightmap.
+* Loaded from the cache directory on the first draw if it was baked for the same mesh, world
+* matrix and resolution, baked from the Lighting panel. Models get lightmap uvs only once needed.
+*/
+struct LightmapComponent
+{
+	int resolution = 128;
+	GLuint texture = 0;
+	// The cache is only looked up once, later bakes upload directly
+	bool load_attempted = false;
+
+	LightmapComponent() = default;
+	LightmapComponent(int r) : resolution(r) {};
+
+	static void DrawUI(LightmapComponent& component)
+	{
+		if (ImGui::CollapsingHeader("Lightmap", ImGuiTreeNodeFlags_DefaultOpen))
+		{
+			ImGui::SliderInt("Resolution", &component.resolution, 16, 1024);
+			if (component.texture)
+				ImGui::Image((void*)(intptr_t)component.texture, ImVec2(128, 128));
+			else
+				ImGui::Text("Not baked");
+		}
+	}
+};
+
 struct MaterialComponent
 {
 	ExampleMaterial material;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "shader.h"
+
+/**
+* A compute shader variant compiled with LOCAL_SIZE_X threads per work group
+*/
+struct ComputeKernel
+{
+	Shader* shader = nullptr;
+	uint32_t local_size = 0;
+
+	inline uint32_t get_num_groups(uint32_t num_threads) const { return (num_threads + local_size - 1) / local_size; }
+};
+
+/**
+* Picks the fastest work group size of compute kernels on the current device.
+*
+* A kernel is compiled once per candidate size, with LOCAL_SIZE_X defined, and every variant
+* is timed with GL_TIME_ELAPSED queries around a dispatch provided by the caller. The winner is
+* cached per GL_RENDERER and GL_VERSION in the asset cache directory, so a device is tuned once.
+*/
+class ComputeTuner
+{
+public:
+	ComputeTuner(ComputeTuner const&) = delete;
+	void operator=(ComputeTuner const&) = delete;
+
+	/**
+	* Query the device and its limits and load cached results, requires a GL context
+	*/
+	static void Init();
+
+	/**
+	* The fastest variant of file_name among candidate_sizes, sizes above the device limits are skipped.
+	* Without a cached result, dispatch is called several times per candidate and should bind the
+	* variant and issue representative work. The GPU is synchronized while timing.
+	*/
+	static ComputeKernel Tune(const char* file_name, const std::string& defines, const std::vector<uint32_t>& candidate_sizes,
+		const std::function<void(const ComputeKernel&)>& dispatch);
+
+	/**
+	* The variant of file_name with a fixed local size, for kernels not worth tuning
+	*/
+	static ComputeKernel GetKernel(const char* file_name, const std::string& defines, uint32_t local_size);
+
+	inline static uint32_t GetMaxLocalSize() { return Instance().m_MaxLocalSize; }
+
+private:
+	ComputeTuner() {};
+
+	static ComputeTuner& Instance()
+	{
+		static ComputeTuner instance;
+		return instance;
+	}
+
+	static std::string GetCacheKey(const char* file_name, const std::string& defines);
+	static void SaveCache();
+
+private:
+	// GL_RENDERER and GL_VERSION, a driver update re-tunes
+	std::string m_Device;
+	uint32_t m_MaxLocalSize = 0;
+
+	// Device, file name and FNV-1a hash of the defines -> local size, entries of other devices are kept
+	std::map<std::string, uint32_t> m_Results;
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+* Bump allocator for memory that lives no longer than a frame, one per thread.
+*
+* Allocations advance an offset into large blocks and are never freed one by one. The render
+* thread resets its arena at the end of every frame and the simulation thread at the end of every
+* tick. Jobs run between a marker and a release on the arena of the thread that executes them,
+* so nothing a job allocates outlives it. Blocks are kept across resets, a warmed up arena no
+* longer touches the heap.
+*/
+class FrameArena
+{
+public:
+	struct Marker
+	{
+		uint32_t block = 0;
+		size_t offset = 0;
+	};
+
+	FrameArena(FrameArena const&) = delete;
+	void operator=(FrameArena const&) = delete;
+	~FrameArena();
+
+	/**
+	* Arena of the calling thread
+	*/
+	static FrameArena& Get();
+
+	void* allocate(size_t size, size_t alignment);
+
+	inline Marker get_marker() const { return { m_Block, m_Offset }; }
+	/**
+	* Free everything allocated since marker was taken
+	*/
+	inline void release(const Marker& marker) { m_Block = marker.block; m_Offset = marker.offset; }
+	inline void reset() { release(Marker()); }
+
+	// Bytes reserved in blocks
+	size_t get_capacity() const;
+
+private:
+	FrameArena() {};
+
+	struct Block
+	{
+		uint8_t* data;
+		size_t size;
+	};
+
+	static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+	std::vector<Block> m_Blocks;
+	uint32_t m_Block = 0;
+	size_t m_Offset = 0;
+};
+
+/**
+* STL allocator on a FrameArena, deallocate is a no-op.
+* A container must only grow on the thread that created it, and not outlive the frame or job.
+*/
+template<typename T>
+struct FrameAllocator
+{
+	using value_type = T;
+
+	FrameAllocator() : arena(&FrameArena::Get()) {};
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U>& other) : arena(other.arena) {};
+
+	inline T* allocate(size_t n) { return (T*)arena->allocate(n * sizeof(T), alignof(T)); }
+	inline void deallocate(T*, size_t) {}
+
+	FrameArena* arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena == b.arena; }
+template<typename T, typename U>
+inline bool operator!=(const FrameAllocator<T>& a, const FrameAllocator<U>& b) { return a.arena != b.arena; }
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
+using FrameString = std::basic_string<char, std::char_traits<char>, FrameAllocator<char>>;
+
+/**
+* operator new calls since the start of the program on all threads.
+* 0 unless built with TRACK_HEAP_ALLOCATIONS, see the CMake option of the same name.
+*/
+uint64_t get_heap_allocation_count();
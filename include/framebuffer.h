@@ -20,6 +20,7 @@ enum ColorFormat : uint32_t
     RG16    = 3,
     RGBA32F = 4,
     R32UI   = 5,
+    R8      = 6,
     // Add as needed
 };
 
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "framebuffer.h"
+#include "hiz.h"
+#include "occlusion.h"
+#include "shader.h"
+
+/**
+* Density of grass blades in [0, 1] over the xz-bounds of the grass system.
+*
+* The density is the product of two layers:
+*	- Baked: rendered top-down from the static scene, 0 where geometry covers the ground.
+*	- Painted: edited by hand, 1 by default.
+*
+* The grass vertex stage compares the density with a random value per blade and
+* collapses blades that lose, so no blades are shaded underneath buildings.
+*/
+struct GrassDensityMap
+{
+public:
+	GrassDensityMap(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max);
+	~GrassDensityMap();
+
+	/**
+	* Bind the bake target and return the projection the static scene should be drawn with.
+	* Geometry between the ground and max_height above it is written as zero density.
+	*/
+	glm::mat4 begin_bake(float max_height);
+	void end_bake();
+
+	/**
+	* Paint density into the painted layer in a circle around world_xz
+	*/
+	void paint(glm::vec2 world_xz, float radius, float density);
+	void clear_paint();
+
+	inline GLuint get_texture_id() { return m_Handle; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, m_Handle);
+	};
+
+private:
+	void upload();
+
+private:
+	uint32_t m_Resolution;
+	glm::vec3 m_BoundsMin;
+	glm::vec3 m_BoundsMax;
+
+	FrameBuffer* m_BakeBuffer;
+	std::vector<uint8_t> m_Baked;
+	std::vector<uint8_t> m_Painted;
+	std::vector<uint8_t> m_Combined;
+
+	GLuint m_Handle;
+};
+
+/**
+* Camera-centred map of how far grass blades are pushed down by entities walking through them.
+*
+* Each texel stores the horizontal displacement (x, z) of the blade tips. The map covers
+* world_size x world_size meters around the camera and scrolls in whole texels as the camera moves.
+* Footprints are written by a compute pass every frame and the displacement recovers over time,
+* so interaction costs one texture fetch per blade regardless of the number of tramplers.
+*/
+struct GrassTrampleMap
+{
+public:
+	GrassTrampleMap(uint32_t resolution, float world_size);
+	~GrassTrampleMap();
+
+	/**
+	* Scroll the map to center, recover and write num_footprints footprints (xyz: world position, w: radius).
+	* Assumes trample_cs is the trample compute shader.
+	*/
+	void update(float dt, glm::vec3 center, const glm::vec4* footprints, uint32_t num_footprints, Shader& trample_cs);
+
+	inline glm::vec2 get_origin() const { return glm::vec2(m_OriginTexel) * get_texel_size(); }
+	inline float get_world_size() const { return m_WorldSize; }
+	inline float get_texel_size() const { return m_WorldSize / m_Resolution; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, m_Handles[m_Current]);
+	};
+
+public:
+	static constexpr int MAX_FOOTPRINTS = 32;
+	float recovery_rate = 0.5f;
+	float ground_height = 0.0f;
+
+private:
+	uint32_t m_Resolution;
+	float m_WorldSize;
+	glm::ivec2 m_OriginTexel = glm::ivec2(0);
+
+	// Ping-ponged, m_Handles[m_Current] holds the latest displacement
+	GLuint m_Handles[2];
+	int m_Current = 0;
+};
+
+/**
+* Per-tile visibility of the grass field, tested against the software occlusion buffer and
+* the Hi-Z pyramid of the opaque scene.
+*
+* The xz-bounds are split into tiles_per_dim^2 tiles, every tile is tested as a box from the
+* ground to the tallest blade. The grass vertex stage collapses blades of occluded tiles
+* before any wind or shading work, so grass behind buildings costs one fetch per vertex.
+*/
+struct GrassTileVisibility
+{
+public:
+	GrassTileVisibility(uint32_t tiles_per_dim, glm::vec3 bounds_min, glm::vec3 bounds_max);
+	~GrassTileVisibility();
+
+	/**
+	* Test every tile against occlusion (after finish()) and upload the result
+	*/
+	void update(const OcclusionBuffer& occlusion, const glm::mat4& view_projection);
+
+	/**
+	* Additionally hide the tiles behind the depth of hiz, on the GPU. Not reflected in get_num_visible().
+	* Assumes tile_cull_cs is grass_tile_cull_cs.glsl.
+	*/
+	void cull(const HiZPyramid& hiz, const glm::mat4& view_projection, Shader& tile_cull_cs);
+
+	/**
+	* Mark every tile visible, for frames without occlusion culling
+	*/
+	void clear();
+
+	inline uint32_t get_num_visible() const { return m_NumVisible; }
+	inline uint32_t get_num_tiles() const { return m_TilesPerDim * m_TilesPerDim; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, m_Handle);
+	};
+
+public:
+	// Blades lean out of their tile with wind and trampling
+	static constexpr float TILE_PADDING = 0.5f;
+
+	// Tallest blade including wind and tips, in meters above the ground
+	float max_blade_height = 1.5f;
+
+private:
+	void upload();
+
+private:
+	uint32_t m_TilesPerDim;
+	glm::vec3 m_BoundsMin;
+	glm::vec3 m_BoundsMax;
+	uint32_t m_NumVisible = 0;
+
+	std::vector<uint8_t> m_Visibility;
+	GLuint m_Handle;
+};
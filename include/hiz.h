@@ -0,0 +1,54 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+
+/**
+* Hierarchical-Z pyramid of a depth buffer for occlusion culling on the GPU.
+*
+* Every texel of level n keeps the farthest depth of the texels it covers in level n - 1,
+* level 0 is a copy of the depth buffer. Levels follow the GL mip chain, so odd sizes fold their
+* last row and column into the last texel of the next level, and pixel p of level 0 is covered
+* by texel min(p >> n, size(n) - 1) of level n.
+*
+* A screen rect is tested with four texel fetches from the level where it spans at most two
+* texels per axis, see hiz_occluded.glsl.
+*/
+struct HiZPyramid
+{
+public:
+	HiZPyramid(uint32_t width, uint32_t height);
+	~HiZPyramid();
+
+	/**
+	* Rebuild all levels from depth_texture, which has the size of level 0.
+	* Assumes downsample_cs is hiz_downsample_cs.glsl.
+	*/
+	void build(GLuint depth_texture, Shader& downsample_cs);
+
+	/**
+	* Bind the pyramid to slot and set u_HiZ and u_HiZLevels of shader, which must be bound
+	*/
+	void set_uniforms(Shader& shader, uint32_t slot) const;
+
+	inline uint32_t get_num_levels() const { return m_NumLevels; }
+	inline uint32_t get_width() const { return m_Width; }
+	inline uint32_t get_height() const { return m_Height; }
+
+private:
+	uint32_t m_Width;
+	uint32_t m_Height;
+	uint32_t m_NumLevels;
+
+	GLuint m_Texture;
+};
+
+/**
+* hiz_occluded.glsl, the AABB struct, u_HiZ, u_HiZLevels and hiz_occluded(box, view_projection),
+* for injection into culling shaders as defines
+*/
+const std::string& get_hiz_shader_defines();
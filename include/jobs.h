@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+* Number of unfinished jobs of a batch. Jobs started with a counter increment it before they are
+* queued and decrement it when they return, JobSystem::Wait returns once it reaches zero.
+* A job that depends on another batch waits on that batch's counter.
+*/
+struct JobCounter
+{
+	std::atomic<uint32_t> pending = 0;
+
+	inline bool is_done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+/**
+* Work-stealing job scheduler, one worker per hardware thread besides the calling thread.
+*
+* Every worker owns a deque: it pushes and pops its own jobs at the back, idle workers steal from
+* the front of the others, so large batches spread out while recently queued, cache-warm work stays
+* local. Threads that are not workers, such as the main thread, share deque 0. Waiting threads run
+* queued jobs instead of blocking, so jobs may wait on other jobs without starving the pool.
+*
+* Without Init, or with a single hardware thread, jobs run inline on the calling thread.
+*/
+class JobSystem
+{
+public:
+	using Job = std::function<void()>;
+	// Half-open index range [begin, end)
+	using RangeJob = std::function<void(uint32_t begin, uint32_t end)>;
+
+	JobSystem(JobSystem const&) = delete;
+	void operator=(JobSystem const&) = delete;
+
+	/**
+	* Start num_workers worker threads, 0 uses one less than the hardware threads
+	*/
+	static void Init(uint32_t num_workers = 0);
+	static void Destroy();
+
+	/**
+	* Queue job, counter is incremented now and decremented once the job has run
+	*/
+	static void Run(Job job, JobCounter* counter = nullptr);
+
+	/**
+	* Call job over [0, count) in ranges of at most grain_size indices and wait for all of them.
+	* 0 picks a grain size of a few ranges per thread. Ranges run inline if there is only one.
+	*/
+	static void ParallelFor(uint32_t count, uint32_t grain_size, const RangeJob& job);
+
+	/**
+	* Run queued jobs on the calling thread until counter reaches zero
+	*/
+	static void Wait(JobCounter& counter);
+
+	/**
+	* Worker threads plus the calling thread
+	*/
+	static uint32_t GetNumThreads();
+
+private:
+	JobSystem() {};
+
+	static JobSystem& Instance()
+	{
+		static JobSystem instance;
+		return instance;
+	}
+
+	struct QueuedJob
+	{
+		Job job;
+		JobCounter* counter;
+	};
+
+	struct WorkerQueue
+	{
+		std::mutex mutex;
+		std::deque<QueuedJob> jobs;
+	};
+
+	static void WorkerLoop(uint32_t worker_index);
+	/**
+	* Pop from the back of the own queue, otherwise steal from the front of another one
+	*/
+	static bool TryRunJob(uint32_t worker_index);
+	static void Execute(QueuedJob& queued);
+
+private:
+	std::vector<std::thread> m_Workers;
+	// Index 0 is shared by all threads that are not workers
+	std::vector<std::unique_ptr<WorkerQueue>> m_Queues;
+
+	// Jobs queued but not yet taken, workers sleep while it is zero
+	std::atomic<uint32_t> m_NumQueued = 0;
+	std::mutex m_WakeMutex;
+	std::condition_variable m_WakeCondition;
+	std::atomic<bool> m_Stop = false;
+};
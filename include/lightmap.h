@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "model.h"
+
+/*
+* Baked ambient lighting of static meshes. Lightmaps are traced on the CPU against a SceneBVH
+* and stored per entity, sampled with the lightmap_uv of the mesh vertices. Nothing here touches GL.
+*/
+
+/**
+* Fill Vertex::lightmap_uv of data. Mesh UVs are kept if they lie in [0, 1] and do not overlap,
+* otherwise every triangle becomes a chart of its own, which splits shared vertices. Charts keep
+* their shape and are shelf packed into a square atlas, so texel density follows surface area.
+* Deterministic, so a lightmap baked against the result matches the mesh on the next load.
+*/
+void generate_lightmap_uvs(ModelData& data);
+
+/**
+* Identifies what a lightmap was baked for: vertices, indices, transform and resolution
+*/
+uint64_t get_lightmap_hash(const ModelData& mesh, const glm::mat4& transform, uint32_t resolution);
+
+struct LightmapBakeSettings
+{
+	uint32_t num_rays = 32;
+	// Occluders further away than this do not contribute to ambient occlusion, in meters
+	float ao_radius = 2.0f;
+	// Ray origins are pushed off the surface along the normal, in meters
+	float bias = 0.005f;
+};
+
+/**
+* Two 8-bit channels per texel, both cosine weighted over the hemisphere of the surface:
+*	R: ambient occlusion, 1 if nothing is hit within ao_radius
+*	G: sky visibility, 1 if nothing is hit at all
+*
+* Stored in the cache directory as a .lightmap file: LightmapFileHeader followed by the texels.
+*/
+struct Lightmap
+{
+public:
+	/**
+	* Trace the texels covered by mesh placed at transform against scene, on all job system threads.
+	* Texels outside the triangles are dilated from their covered neighbours, so bilinear filtering
+	* does not bleed unlit texels over chart borders. Warns about triangles smaller than 2 texels.
+	*/
+	void bake(const ModelData& mesh, const glm::mat4& transform, const SceneBVH& scene, uint32_t resolution,
+		const LightmapBakeSettings& settings);
+
+	bool save(const std::filesystem::path& file_path) const;
+	/**
+	* Fails if the file was baked for anything but expected_hash, see get_lightmap_hash
+	*/
+	bool load(const std::filesystem::path& file_path, uint64_t expected_hash);
+
+	inline bool is_empty() const { return texels.empty(); }
+
+public:
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint64_t source_hash = 0;
+	std::vector<uint8_t> texels;
+};
+
+struct LightmapFileHeader
+{
+	char magic[4] = { 'L', 'M', 'A', 'P' };
+	uint32_t version = 2;
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint64_t source_hash = 0;
+};
@@ -4,6 +4,7 @@
 #include <imgui.h>
 
 #include "assets.h"
+#include "commandbuffer.h"
 #include "gl_helpers.h"
 
 struct EnvironmentSettings
@@ -32,27 +33,27 @@ struct ExampleMaterial
 	// Samplers
 	GLuint _Albedo = -1;
 
-	void Bind(int sampler_index) 
+	// Uniform locations and texture slots of GetShader(), its layout(location = N) and layout(binding = N)
+	static constexpr GLint ENTITY_ID_LOCATION = 1;
+	static constexpr GLint MODEL_LOCATION = 2;
+	static constexpr GLint COLOR_LOCATION = 3;
+	static constexpr GLint HAS_LIGHTMAP_LOCATION = 9;
+	static constexpr uint32_t SHADOW_MAP_SLOT = 0;
+	static constexpr uint32_t ALBEDO_SLOT = 1;
+	static constexpr uint32_t LIGHTMAP_SLOT = 2;
+
+	/**
+	* Record the material uniforms and textures, replayed with GetShader() bound
+	*/
+	void Record(CommandBuffer& buffer) const
 	{
-		Shader* shader = ExampleMaterial::GetShader();
-		shader->bind();
-		shader->set_float3("u_Color", _Color.x, _Color.y, _Color.z);
+		buffer.set_float3(COLOR_LOCATION, _Color);
 		if (_Albedo != -1)
-		{
-			shader->set_int("u_AlbedoMap", sampler_index);
-			GL_CHECK(glActiveTexture(GL_TEXTURE0 + sampler_index));
-			GL_CHECK(glBindTexture(GL_TEXTURE_2D, _Albedo));
-			sampler_index++;
-		}
+			buffer.bind_texture(ALBEDO_SLOT, _Albedo);
 
 		/* TODO: Enable normal mapping
 		if (_NormalMap != -1)
-		{
-			shader->set_int("u_NormalMap", sampler_index);
-			GL_CHECK(glActiveTexture(GL_TEXTURE0 + sampler_index));
-			GL_CHECK(glBindTexture(GL_TEXTURE_2D, _Albedo));
-			sampler_index++;
-		}
+			buffer.bind_texture(NORMAL_MAP_SLOT, _NormalMap);
 		*/
 	}
 
@@ -93,7 +94,13 @@ struct ExampleMaterial
 		}
 	}
 
-	static Shader* GetShader() { return AssetManager::GetShader("example_material_shader.glsl"); }
+	/**
+	* The variant that writes entity ids is only needed on frames with a pending pick
+	*/
+	static Shader* GetShader(bool write_entity_id = false) 
+	{ 
+		return AssetManager::GetShader("example_material_shader.glsl", write_entity_id ? "#define WRITE_ENTITY_ID\n" : "");
+	}
 };
 
 
@@ -115,6 +122,9 @@ struct RawModelMaterial : Material
 
 struct RawModelFlatColorMaterial : Material
 {
+	// layout(location = N) of u_Model in raw_model_flat_color.glsl
+	static constexpr GLint MODEL_LOCATION = 0;
+
 	RawModelFlatColorMaterial(Shader* shader, glm::vec4 model_color) : u_ModelColor(model_color) 
 	{
 		this->shader = shader;
@@ -7,6 +7,7 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "bvh.h"
 #include "texture.h"
 
 struct Vertex 
@@ -14,6 +15,8 @@ struct Vertex
     glm::vec3 position;
     glm::vec3 normal;
     glm::vec2 uv;
+    // Unique parameterization for baked lighting, see generate_lightmap_uvs
+    glm::vec2 lightmap_uv = glm::vec2(0.0f);
 };
 
 struct ModelData
@@ -35,9 +38,26 @@ public:
     inline void unbind() { glBindVertexArray(0); }
     inline void draw() { glDrawElements(GL_TRIANGLES, m_IndexCount, GL_UNSIGNED_INT, 0); }
 
+    // CPU copy of the buffers, used by offline bakers
+    inline const ModelData& get_model_data() const { return m_Data; }
+
+    /**
+     * Generate lightmap uvs and upload them, once, for models that get a lightmap.
+     * May split vertices shared between triangles, call on the GL thread.
+     */
+    void ensure_lightmap_uvs();
+
+    /**
+     * BVH of the CPU copy for ray queries, built on first use and rebuilt in place when the data changes
+     */
+    const MeshBVH& get_bvh() const;
+
 private:
 
 private:
+    ModelData m_Data;
+    mutable MeshBVH* m_BVH = nullptr;
+    bool m_HasLightmapUVs = false;
     GLuint m_VAO, m_VBO, m_EBO;
     GLenum m_Usage;
     uint32_t m_IndexCount;
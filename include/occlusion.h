@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct ModelData;
+
+/**
+* Low resolution depth buffer that a few large occluders are rasterized into on the CPU,
+* so that bounds hidden behind them can be rejected before anything is submitted to the GPU.
+*
+* Depth is NDC depth in [0, 1], occluders keep the nearest depth per pixel. Rows are rasterized
+* eight pixels at a time with AVX2 if the CPU supports it, checked at runtime, otherwise with a
+* scalar loop. finish() reduces the farthest depth of every 8x8 tile, so most bounds are decided
+* by a few tile tests before any pixel is read. Nothing here touches GL.
+*/
+struct OcclusionBuffer
+{
+public:
+	static constexpr uint32_t TILE_SIZE = 8;
+
+	/**
+	* width and height are rounded up to multiples of TILE_SIZE
+	*/
+	OcclusionBuffer(uint32_t width, uint32_t height);
+
+	void clear();
+
+	/**
+	* Rasterize the triangles of data, both faces. Triangles crossing the near plane are clipped.
+	*/
+	void draw_occluder(const ModelData& data, const glm::mat4& model_view_projection);
+
+	/**
+	* Rasterize the twelve triangles of a box
+	*/
+	void draw_box(glm::vec3 bounds_min, glm::vec3 bounds_max, const glm::mat4& model_view_projection);
+
+	/**
+	* Reduce the tile depths, call after the last occluder and before testing
+	*/
+	void finish();
+
+	/**
+	* True if the box is entirely behind rasterized occluders. Boxes crossing the near plane or
+	* outside the screen are never occluded, frustum culling is left to the caller.
+	*/
+	bool is_occluded(glm::vec3 bounds_min, glm::vec3 bounds_max, const glm::mat4& model_view_projection) const;
+
+	inline uint32_t get_width() const { return m_Width; }
+	inline uint32_t get_height() const { return m_Height; }
+	inline const std::vector<float>& get_depth() const { return m_Depth; }
+
+public:
+	// Rasterize with AVX2, defaults to cpu_supports_avx2(). Clear it to force the scalar path, e.g. to compare both.
+	bool use_avx2;
+
+private:
+	void draw_triangle(glm::vec4 a, glm::vec4 b, glm::vec4 c);
+	void rasterize(glm::vec3 a, glm::vec3 b, glm::vec3 c);
+
+private:
+	uint32_t m_Width;
+	uint32_t m_Height;
+	uint32_t m_TilesX;
+	uint32_t m_TilesY;
+
+	std::vector<float> m_Depth;
+	// Farthest depth per tile, written by finish()
+	std::vector<float> m_TileMaxDepth;
+};
+
+/**
+* True if the CPU and OS support AVX2 and FMA, false on other architectures
+*/
+bool cpu_supports_avx2();
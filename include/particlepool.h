@@ -0,0 +1,117 @@
+#pragma once
+
+#include <map>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "model.h"
+#include "shader.h"
+#include "wind.h"
+
+enum class EmitterShape : int
+{
+	POINT = 0,
+	BOX   = 1, // Unit cube around the origin of the emitter transform
+	MESH  = 2, // Surface of a mesh, uniformly by area
+};
+
+/**
+* One emission into a ParticlePool
+*/
+struct ParticleEmitter
+{
+	EmitterShape shape = EmitterShape::POINT;
+	glm::mat4 transform = glm::mat4(1.0f);
+	const RawModel* mesh = nullptr;
+
+	glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f);
+	float spread = 0.5f;
+	float speed = 1.0f;
+	float lifetime = 2.0f;
+	float size = 0.05f;
+};
+
+/**
+* Fixed capacity GPU pool shared by all emitters.
+*
+* Free particles are kept on an atomic dead list and live ones on an alive list that is
+* rebuilt by every update. The update is dispatched and the billboards are drawn indirectly
+* from the alive count, so work scales with the live particles and not with the capacity.
+* Nothing is read back to the CPU, emissions beyond the free capacity are dropped.
+*/
+struct ParticlePool
+{
+public:
+	ParticlePool(uint32_t capacity, Shader& pool_cs);
+	~ParticlePool();
+
+	/**
+	* Spawn count particles from emitter, assumes pool_cs is the particle pool compute shader
+	*/
+	void emit(const ParticleEmitter& emitter, uint32_t count, Shader& pool_cs);
+
+	/**
+	* Age, kill and simulate all alive particles
+	*/
+	void update(float dt, Shader& pool_cs, const WindField& wind_field);
+
+	/**
+	* Indirect draw of one 4 vertex triangle strip per alive particle. The vertex stage pulls
+	* particles (binding 1) through the alive list (binding 3).
+	*/
+	void draw();
+
+	inline uint32_t get_capacity() const { return m_Capacity; }
+	/**
+	* Upper bound of the alive particles, from the emissions whose lifetime has not run out.
+	* Known on the CPU without a readback.
+	*/
+	inline uint32_t get_max_alive() const { return glm::min(m_MaxAlive, m_Capacity); }
+	// After update(): DispatchIndirectCommand over the alive particles, 256 per group
+	inline GLuint get_indirect_buffer() const { return m_IndirectBuffer; }
+	inline void bind_particles(uint32_t binding) const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_ParticleBuffer); }
+	inline void bind_alive_list(uint32_t binding) const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_AliveLists[m_Current]); }
+
+public:
+	float gravity = 2.0f;
+	float drag = 0.5f;
+
+private:
+	struct MeshEmitterBuffers
+	{
+		// 3 vec4 positions per triangle and the normalized cumulative triangle area
+		GLuint triangles, area_cdf;
+		uint32_t num_triangles;
+	};
+
+	void dispatch_pass(Shader& pool_cs, int pass, uint32_t num_groups);
+	void bind_buffers();
+	void unbind_buffers();
+	const MeshEmitterBuffers& get_mesh_buffers(const RawModel* mesh);
+
+private:
+	uint32_t m_Capacity;
+	float m_Time = 0.0f;
+	// Emit dispatches so far, decorrelates emitters dispatched in the same frame
+	uint32_t m_EmitDispatch = 0;
+
+	struct Emission
+	{
+		// Pool time after which all particles of the emission are dead
+		float expiry;
+		uint32_t count;
+	};
+	std::vector<Emission> m_Emissions;
+	// Sum of the counts in m_Emissions
+	uint32_t m_MaxAlive = 0;
+
+	// m_AliveLists[m_Current] holds the particles to update and draw
+	GLuint m_VAO, m_ParticleBuffer, m_DeadList, m_AliveLists[2];
+	int m_Current = 0;
+	// DispatchIndirectCommand followed by DrawArraysIndirectCommand
+	GLuint m_IndirectBuffer;
+
+	std::map<const RawModel*, MeshEmitterBuffers> m_MeshBuffers;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+/*
+* Particle layout, constants and the CPU reference of the snow update. Nothing here touches GL,
+* so the reference runs on machines without a GPU.
+*
+* The constants are injected into the particle shaders as defines (see get_particle_shader_defines),
+* the shaders must not redefine them.
+*/
+
+// Positions are 21-bit fixed point per axis
+constexpr float PARTICLE_POSITION_SCALE = 2097152.0f;
+constexpr uint32_t PARTICLE_POSITION_MASK = 0x1FFFFF;
+constexpr float MAX_PARTICLE_SIZE = 1.0f;
+constexpr uint32_t PARTICLE_FLAG_UNUSED = 1;
+
+// 5 * 5 * 5 = 125 ~ 128 particles per cluster
+constexpr int PARTICLES_PER_CLUSTER_DIM = 5;
+constexpr int PARTICLES_PER_CLUSTER = PARTICLES_PER_CLUSTER_DIM * PARTICLES_PER_CLUSTER_DIM * PARTICLES_PER_CLUSTER_DIM;
+
+// Simulation
+constexpr float PARTICLE_GRAVITY = 9.82f;
+constexpr float PARTICLE_MAX_SPEED = 0.5f;
+constexpr float PARTICLE_SPAWN_SPEED = 0.5f;
+// Respawned particles are placed this fraction of the volume height below the top
+constexpr float PARTICLE_SPAWN_OFFSET = 0.001f;
+
+/**
+* Packed particle, 16 bytes. Written and read on the GPU (see particle_pack.glsl) and by the CPU reference:
+*	- position: 21-bit fixed point per axis, stored modulo the volume size, bit 31 of position[1] is unused
+*	- velocity_xy: two half floats
+*	- velocity_z_size_flags: half float velocity z, 8-bit size, 8-bit flags
+*/
+struct Particle
+{
+	uint32_t position[2];
+	uint32_t velocity_xy;
+	uint32_t velocity_z_size_flags;
+};
+static_assert(sizeof(Particle) == 16, "Particle must match the packed layout in the particle shaders");
+
+struct UnpackedParticle
+{
+	glm::vec3 position;
+	glm::vec3 velocity;
+	float size;
+	uint32_t flags;
+};
+
+/**
+* Same encoding as pack_particle and the unpack functions of particle_pack.glsl. Unpacking picks
+* the position representative inside the volume.
+*/
+Particle pack_particle(const UnpackedParticle& particle, glm::vec3 bbox_min, glm::vec3 bbox_max);
+UnpackedParticle unpack_particle(const Particle& particle, glm::vec3 bbox_min, glm::vec3 bbox_max);
+
+/**
+* Grid position of a cluster-major particle slot, slot = cluster * 125 + index in cluster
+*/
+glm::ivec3 get_particle_grid_position(int slot, glm::ivec3 particles_per_dim);
+
+/**
+* Key along a Morton curve through the volume, 10 bits per axis of the stored position, so that
+* particles close to each other get close keys. Unused slots get 1 and used particles more.
+* Same as particle_recluster_cs.glsl, ParticleSystem regroups its clusters by it.
+*/
+uint32_t get_particle_cluster_key(const Particle& particle);
+
+/**
+* Three uniform random numbers per (particle slot, step), identical on the CPU and GPU.
+* pcg3d from "Hash Functions for GPU Rendering", Jarzynski and Olano 2020.
+*/
+glm::uvec3 pcg3d(glm::uvec3 v);
+
+/**
+* The constants above as GLSL defines, pass to AssetManager::GetShader for the particle shaders.
+* Shaders that read or write packed particles use get_particle_pack_shader_defines (see particlesystem.h).
+*/
+const std::string& get_particle_shader_defines();
+
+/**
+* CPU implementation of the particle_cs.glsl update without scene interaction (wind, shelter,
+* collision): random kick, gravity, velocity clamp and respawn at the top of the bbox, or
+* toroidal wrapping once the volume follows a center like ParticleSystem::set_volume_center.
+*
+* Particles use the packed GPU layout and are quantized every step like on the GPU, so after
+* N steps the state can be compared against a GPU readback. The update is vectorized with SSE2
+* when available and split over jobs by particle slot.
+*/
+struct ParticleReferenceSimulation
+{
+public:
+	/**
+	* Same initial state as a ParticleSystem with the same arguments
+	*/
+	ParticleReferenceSimulation(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max, float particle_size = 0.05f);
+
+	/**
+	* Same as ParticleSystem::set_volume_center, particles wrap instead of respawning from then on
+	*/
+	void set_volume_center(glm::vec3 center, float ground_height);
+
+	void step(float dt);
+	void run(uint32_t steps, float dt);
+	/**
+	* Reorder the slots by descending get_particle_cluster_key, like ParticleSystem does in a
+	* wrapping volume. Equal keys keep their order, the GPU sort is not stable.
+	*/
+	void recluster();
+
+	inline const std::vector<Particle>& get_particles() const { return m_Particles; }
+	inline int get_num_particles() const { return m_NumParticles; }
+	inline glm::vec3 get_bbox_min() const { return m_BboxMin; }
+	inline glm::vec3 get_bbox_max() const { return m_BboxMax; }
+
+public:
+	// Number of jobs a step is split into, 0 uses one per job system thread
+	uint32_t num_threads = 0;
+
+private:
+	void step_slots(float dt, int slot_begin, int slot_end);
+
+private:
+	glm::ivec3 m_ParticlesPerDim;
+	glm::vec3 m_BboxMin;
+	glm::vec3 m_BboxMax;
+	int m_NumParticles;
+	bool m_WrapVolume = false;
+	uint32_t m_Frame = 0;
+
+	std::vector<Particle> m_Particles;
+	// Grid x and z of every slot, particles respawn above them
+	std::vector<float> m_GridX;
+	std::vector<float> m_GridZ;
+};
+
+struct ParticleComparison
+{
+	float max_position_error = 0.0f;
+	float max_velocity_error = 0.0f;
+	// Particles with a position or velocity error above the tolerance
+	uint32_t num_mismatches = 0;
+	uint32_t num_compared = 0;
+};
+
+/**
+* Compare two packed states of the same system, unused slots are skipped
+*/
+ParticleComparison compare_particles(const std::vector<Particle>& a, const std::vector<Particle>& b,
+	glm::vec3 bbox_min, glm::vec3 bbox_max, float tolerance);
+
+struct ClusterBoundsCheck
+{
+	// Particles outside the bounds of their cluster, the cull would drop them
+	uint32_t num_outside = 0;
+	// Clusters with bounds past the volume, drifted over a seam of a wrapping volume
+	uint32_t num_overhanging = 0;
+	// Largest cluster extent on any axis, as a fraction of the volume size
+	float max_extent = 0.0f;
+};
+
+/**
+* Check cluster bounds as written by particle_cs.glsl (min, max per cluster) against the packed
+* particles of the same step. Bounds may overhang a wrapping volume, a particle is inside if one of
+* its copies one volume size apart is. Unused slots and empty clusters are skipped.
+*/
+ClusterBoundsCheck check_cluster_bounds(const std::vector<Particle>& particles, const std::vector<glm::vec4>& cluster_bounds,
+	glm::vec3 bbox_min, glm::vec3 bbox_max);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "particlepool.h"
+#include "shader.h"
+
+/**
+* Back to front ordering of the visible particles in a ParticlePool for alpha blending.
+*
+* Every frame the alive particles are frustum culled and the visible ones are written as
+* (depth key, particle index) pairs, which are bitonic sorted on the GPU. Only the visible
+* count, padded to a power of two, is sorted: passes over larger blocks exit immediately, and
+* passes beyond the pool's upper bound of alive particles are not dispatched at all.
+* draw() then issues the billboards of the visible particles in sorted order.
+*/
+struct ParticleSorter
+{
+public:
+	ParticleSorter(uint32_t capacity);
+	~ParticleSorter();
+
+	/**
+	* Cull and sort the particles alive after pool.update(), assumes sort_cs is the particle sort compute shader
+	*/
+	void sort(const ParticlePool& pool, const glm::mat4& view, const glm::mat4& projection, Shader& sort_cs);
+
+	/**
+	* Sort count (key, index) pairs written to the key buffer by descending key, without culling.
+	* Keys of 0 are reserved for the padding. ParticleSystem regroups its clusters with this.
+	*/
+	void sort_keys(uint32_t count, Shader& sort_cs);
+
+	inline void bind_keys(uint32_t binding) const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, m_KeyBuffer); }
+
+	/**
+	* Indirect draw of the sorted particles. The vertex stage pulls particles (binding 1)
+	* through the sorted keys (binding 4).
+	*/
+	void draw(const ParticlePool& pool);
+
+	/**
+	* Read back the keys of the last sort() and check them against the CPU reference: back to front,
+	* and the same keys as radix_sort_particles of them. Stalls the GPU, a debugging aid.
+	*/
+	bool validate() const;
+
+private:
+	void dispatch_pass(Shader& sort_cs, int pass);
+	/**
+	* Bitonic sort of the keys after PREPARE, max_count bounds the count on the GPU
+	*/
+	void dispatch_sort(Shader& sort_cs, uint32_t max_count);
+
+private:
+	// Power of two, at least one sort tile
+	uint32_t m_PaddedCapacity;
+
+	GLuint m_VAO, m_KeyBuffer;
+	// DispatchIndirectCommand, visible count, padded count, DrawArraysIndirectCommand
+	GLuint m_ArgsBuffer;
+};
+
+/* CPU reference, same keys and order as the GPU sort and usable without a GL context */
+
+/**
+* Sort key of a particle, the bits of its non-negative view depth. Larger is further away.
+*/
+uint32_t get_particle_sort_key(glm::vec3 position, const glm::mat4& view);
+
+/**
+* Stable LSD radix sort of (key, particle index) pairs, back to front
+*/
+void radix_sort_particles(std::vector<glm::uvec2>& keys);
+
+/**
+* True if keys are ordered back to front, ties between equal keys may be in any order
+*/
+bool is_sorted_back_to_front(const std::vector<glm::uvec2>& keys);
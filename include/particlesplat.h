@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "particlesystem.h"
+#include "shader.h"
+
+// Fixed point scale of the splat coverage, one fully covered pixel adds SPLAT_SCALE
+constexpr float PARTICLE_SPLAT_SCALE = 256.0f;
+
+/**
+* Compute rasterizer for snowflakes that project to less than a few pixels.
+*
+* Sub-pixel billboards pay for a full quad and mostly produce helper invocations, so particles
+* below the size threshold are skipped by the particle vertex stage and splatted here instead:
+* one thread per particle projects it, depth tests against the scene and atomically adds its
+* coverage to one pixel of an R32UI image. resolve() blends the accumulated coverage of all
+* systems over the color target and clears the image.
+*
+* Snow is white, so coverage is the only accumulated quantity and a 32-bit add suffices.
+*/
+struct ParticleSplatTarget
+{
+public:
+	ParticleSplatTarget(uint32_t width, uint32_t height);
+	~ParticleSplatTarget();
+
+	/**
+	* Splat the small particles of the clusters that passed system.update(). depth_texture is the
+	* depth of the opaque scene, max_size is the billboard size in pixels below which particles are splatted.
+	* Assumes splat_cs is particle_splat_cs.glsl with get_splat_shader_defines().
+	*/
+	void splat(const ParticleSystem& system, const glm::mat4& view, const glm::mat4& projection,
+		const AABB& inner_volume, GLuint depth_texture, float max_size, Shader& splat_cs);
+
+	/**
+	* Blend the coverage over color attachment 0 of the bound framebuffer and clear it, other
+	* attachments are expected to be masked.
+	* Assumes resolve_shader is particle_splat_resolve.glsl with get_splat_shader_defines().
+	*/
+	void resolve(Shader& resolve_shader);
+
+	/**
+	* Scale from the world size of a particle at view depth w to its size in pixels
+	*/
+	inline float get_pixel_scale(const glm::mat4& projection) const { return 0.5f * projection[1][1] * m_Height; }
+
+private:
+	uint32_t m_Width;
+	uint32_t m_Height;
+
+	GLuint m_VAO, m_CoverageTexture;
+};
+
+/**
+* get_particle_pack_shader_defines() and SPLAT_SCALE
+*/
+const std::string& get_splat_shader_defines();
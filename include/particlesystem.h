@@ -7,45 +7,185 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "computetuner.h"
+#include "framebuffer.h"
+#include "hiz.h"
+#include "particlesim.h"
+#include "sdf.h"
 #include "shader.h"
+#include "wind.h"
 
-struct Particle
+struct ParticleSorter;
+
+struct AABB
+{
+	glm::vec3 min;
+	glm::vec3 max;
+};
+
+/**
+* Top-down height of the highest static geometry over the xz-bounds, rendered as depth.
+*
+* Precipitation below the height is sheltered (under a roof, inside a building) and is
+* respawned by the particle update, at constant cost per particle for any number of occluders.
+* Outside the xz-bounds nothing is sheltered.
+*/
+struct PrecipitationOcclusionMap
+{
+public:
+	PrecipitationOcclusionMap(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max);
+	~PrecipitationOcclusionMap();
+
+	/**
+	* Bind the bake target and return the projection the static scene should be drawn with.
+	* The depth test keeps the highest surface.
+	*/
+	glm::mat4 begin_bake();
+	void end_bake();
+
+	inline glm::vec3 get_bounds_min() const { return m_BoundsMin; }
+	inline glm::vec3 get_bounds_max() const { return m_BoundsMax; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, m_BakeBuffer->get_depth_attachment());
+	};
+
+private:
+	glm::vec3 m_BoundsMin;
+	glm::vec3 m_BoundsMax;
+	FrameBuffer* m_BakeBuffer;
+};
+
+/**
+* View state the compute update culls particle clusters against.
+* Clusters inside the inner volume are not drawn, an empty box (min > max) culls nothing.
+* Clusters behind the depth of hiz are not drawn, nullptr disables the occlusion test.
+*/
+struct ParticleCullInfo
 {
-	glm::vec3 position; float width;
-	glm::vec3 velocity; float height;
+	glm::mat4 view;
+	glm::mat4 projection;
+	AABB inner_volume = { glm::vec3(1.0f), glm::vec3(0.0f) };
+	const HiZPyramid* hiz = nullptr;
 };
 
 struct ParticleSystem 
 {
 public:
-	ParticleSystem(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max);
+	/**
+	* Particles are placed on a grid over the bbox by a compute dispatch, nothing is kept on the CPU.
+	* particle_size is quantized to 8 bits in [0, 1] meters.
+	*
+	* The grid is split into clusters of 5x5x5 particles that are stored contiguously, clusters on
+	* the border of a grid that is not a multiple of 5 have unused slots.
+	*/
+	ParticleSystem(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max, float particle_size = 0.05f);
+	~ParticleSystem();
+	// Owns GL buffers
+	ParticleSystem(ParticleSystem const&) = delete;
+	void operator=(ParticleSystem const&) = delete;
 
-	void update(float dt, Shader& particle_cs);
+	/**
+	* Switch to a volume of the bbox extent that follows center. Particle positions wrap 
+	* toroidally within the volume, so no particle has to be respawned when the center moves.
+	* The volume never extends below ground_height.
+	*
+	* Particles of a cluster drift apart over time, in a wrapping volume they are regrouped by
+	* position every RECLUSTER_INTERVAL updates to keep the cluster bounds tight.
+	*/
+	void set_volume_center(glm::vec3 center, float ground_height);
+
+	/**
+	* Simulate all particles and gather the clusters visible under cull_info for draw().
+	* Cluster bounds are reduced during the simulation, so culling costs one test per cluster.
+	* Particles sheltered by the occlusion map are respawned at the top of the volume,
+	* particles touching the scene distance field slide along it.
+	*
+	* The work group sizes of the update kernels are tuned on the first call.
+	*/
+	void update(float dt, const WindField& wind_field, const PrecipitationOcclusionMap& occlusion_map, 
+		const SignedDistanceField& scene_sdf, const ParticleCullInfo& cull_info);
+
+	/**
+	* Indirect draw of one 4 vertex triangle strip per particle slot of the visible clusters.
+	* The vertex stage pulls the cluster from the visible list (binding 2) and its particles
+	* from the particle buffer (binding 1).
+	*/
 	void draw();
-	void draw_instanced(uint32_t vertex_count);
-	inline int get_num_clusters() { return num_clusters; }
-	inline glm::vec3 get_bbox_min() { return bbox_min; }
-	inline glm::vec3 get_bbox_max() { return bbox_min; }
-	inline glm::ivec3 get_particles_per_dim() { return particles_per_dim; }
+
+	/**
+	* Read back the packed particles of all slots, for comparison with ParticleReferenceSimulation
+	*/
+	void read_particles(std::vector<Particle>& output);
+	/**
+	* Read back the cluster bounds of the last update, min and max per cluster, see check_cluster_bounds
+	*/
+	void read_cluster_bounds(std::vector<glm::vec4>& output);
+
+	inline void bind_particles(uint32_t binding) const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, ssbo); }
+	inline void bind_visible_clusters(uint32_t binding) const { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, visible_clusters_ssbo); }
+	// DrawArraysIndirectCommand, then a DispatchIndirectCommand of one group per visible cluster at byte 16
+	inline GLuint get_indirect_buffer() const { return indirect_buffer; }
+
+	inline int get_num_clusters() const { return num_clusters; }
+	/**
+	* Clusters culled by the update of a recent frame, read back a few frames late without waiting for the GPU.
+	* Empty clusters and clusters inside the inner volume count as culled.
+	*/
+	inline int get_num_culled_clusters() const { return num_clusters - (int)num_visible_clusters; }
+	inline int get_num_particles() const { return num_particles; }
+	inline glm::vec3 get_bbox_min() const { return bbox_min; }
+	inline glm::vec3 get_bbox_max() const { return bbox_max; }
+	inline glm::ivec3 get_particles_per_dim() const { return particles_per_dim; }
+
+public:
+	// Wind, shelter and collision. Without them the update matches the CPU reference.
+	bool scene_interaction = true;
+	// Regroup clusters in a wrapping volume. The GPU sort orders equal keys differently than the CPU reference.
+	bool recluster_particles = true;
+	static constexpr uint32_t RECLUSTER_INTERVAL = 64;
 
 private:
 	int get_cluster(glm::vec3 position);
+	void simulate(const ComputeKernel& kernel, float dt, const WindField& wind_field, 
+		const PrecipitationOcclusionMap& occlusion_map, const SignedDistanceField& scene_sdf);
+	void cull_clusters(const ComputeKernel& kernel, const ParticleCullInfo& cull_info);
+	void read_back_visible_clusters();
+	void recluster();
 
 private:
-	// System data
-	std::vector<Particle> particles;
-
 	// System dimensions
+	int num_particles;
+	int num_particle_slots;
+	float particle_size;
 	glm::vec3 bbox_min;
 	glm::vec3 bbox_max;
 	glm::ivec3 particles_per_dim;
 	int num_clusters;
+	bool wrap_volume = false;
+	uint32_t frame = 0;
 
-	// 5 * 5 * 5 = 125 ~ 128 particles per cluster
-	const int particles_per_cluster_dim = 5;
-	const int particles_per_cluster = 125;
-
-	GLuint vao, ssbo, 
+	// cluster_bounds_ssbo: min, max per cluster, written by the compute update
+	// visible_clusters_ssbo: indices of the clusters that passed culling
+	// indirect_buffer: DrawArraysIndirectCommand and DispatchIndirectCommand, written by the cluster cull
+	// sorted_ssbo: particles in the order of the cluster sort, swapped with ssbo after a recluster.
+	//   Also the scratch copy the candidates of particle_cs.glsl are tuned on
+	GLuint vao, ssbo, sorted_ssbo, cluster_bounds_ssbo, visible_clusters_ssbo, indirect_buffer,
 		u_time, u_time_delta, u_num_particles, 
 		u_bboxmin, u_bboxmax, u_particles_per_dim;
-};
\ No newline at end of file
+	ComputeKernel simulate_kernel, cluster_cull_kernel;
+	// Created on the first recluster, only wrapping volumes need it
+	ParticleSorter* cluster_sorter = nullptr;
+
+	// Ring of copies of the visible cluster count, read once their fence has signaled
+	static constexpr int VISIBLE_COUNT_LATENCY = 3;
+	GLuint visible_count_buffers[VISIBLE_COUNT_LATENCY];
+	GLsync visible_count_fences[VISIBLE_COUNT_LATENCY] = {};
+	uint32_t visible_count_frame = 0;
+	uint32_t num_visible_clusters = 0;
+};
+/**
+* get_particle_shader_defines() followed by particle_pack.glsl, the packed particle layout with
+* pack_particle and the unpack functions, for the shaders that read or write particles
+*/
+const std::string& get_particle_pack_shader_defines();
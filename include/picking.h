@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glad/glad.h>
+
+/**
+* Asynchronous readback of single entity ids from the R32UI id attachment.
+*
+* request() copies one texel into a pixel buffer object and fences it, so the CPU does not
+* wait for the GPU to finish the frame. poll() returns the id a frame or two later, once the
+* fence has signaled. Up to MAX_PENDING picks are in flight, older ones are dropped beyond that.
+*/
+struct EntityPicker
+{
+public:
+	// Cleared into the id attachment, no entity covers the pixel
+	static constexpr uint32_t INVALID_ID = 0xFFFFFFFF;
+	static constexpr int MAX_PENDING = 3;
+
+	EntityPicker();
+	~EntityPicker();
+
+	/**
+	* Queue a readback of pixel (x, y) of color attachment id_attachment of the bound framebuffer
+	*/
+	void request(int x, int y, GLenum id_attachment);
+
+	/**
+	* True if the oldest pick has completed, its id is written to entity_id. Never blocks.
+	*/
+	bool poll(uint32_t& entity_id);
+
+	inline bool is_pending() const { return m_NumPending > 0; }
+
+private:
+	GLuint m_PixelBuffers[MAX_PENDING];
+	GLsync m_Fences[MAX_PENDING];
+	// Ring of pending picks, m_Oldest is completed first
+	int m_Oldest = 0;
+	int m_NumPending = 0;
+};
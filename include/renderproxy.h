@@ -0,0 +1,83 @@
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include <entt/entity/registry.hpp>
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "components.h"
+
+/**
+* Draw data of all entities with one renderer component, one array per field so that a pass
+* only streams through what it reads. Entries follow the registry view order at the last rebuild.
+*
+* The scene rebuilds proxies when renderer, material, lightmap or occluder components are added
+* or removed, see Scene::UpdateRenderProxies, and writes moved world matrices through set_transform.
+* Proxies of the scene refer to the material and lightmap components, which stay valid until the
+* next rebuild. Copies made by copy_draw_data hold values instead, so a snapshot stays valid while
+* the simulation adds or removes components.
+*/
+struct RenderProxies
+{
+public:
+	/**
+	* Gather every entity with a TransformComponent and a Renderer component that has a model
+	*/
+	template<typename Renderer>
+	void rebuild(entt::registry& registry)
+	{
+		clear();
+		registry.view<TransformComponent, Renderer>().each([&](auto entity, TransformComponent& tc, Renderer& renderer) {
+			if (!renderer.model)
+				return;
+			MaterialComponent* matc = registry.try_get<MaterialComponent>(entity);
+			add(entity, tc.transform, renderer.model, matc ? &matc->material : nullptr,
+				registry.try_get<LightmapComponent>(entity), registry.all_of<OccluderComponent>(entity));
+		});
+	}
+
+	void clear();
+
+	/**
+	* Copy the per-entity arrays of source, without the entity lookup used by set_transform.
+	* Materials and lightmap textures are read from the components of source, call with the scene
+	* mutex held. Reuses the capacity of this, so copying into a recycled snapshot does not allocate.
+	*/
+	void copy_draw_data(const RenderProxies& source);
+
+	/**
+	* Update the world matrix of entity, entities without a proxy are ignored
+	*/
+	void set_transform(entt::entity entity, const glm::mat4& transform);
+
+	inline uint32_t size() const { return (uint32_t)entities.size(); }
+
+public:
+	std::vector<entt::entity> entities;
+	std::vector<glm::mat4> transforms;
+	std::vector<RawModel*> models;
+	// Model space bounds of models
+	std::vector<BVHBounds> bounds;
+	// Occluders are never tested against the occlusion buffer they are drawn into
+	std::vector<uint8_t> occluders;
+
+	/* Written by copy_draw_data, empty in the proxies of the scene */
+	// 0 if the entity has no MaterialComponent, such entities are only drawn into the shadow map
+	std::vector<uint8_t> has_material;
+	std::vector<ExampleMaterial> materials;
+	// 0 without a baked or loaded lightmap
+	std::vector<GLuint> lightmap_textures;
+
+private:
+	void add(entt::entity entity, const glm::mat4& transform, RawModel* model, const ExampleMaterial* material,
+		const LightmapComponent* lightmap, bool occluder);
+
+private:
+	std::unordered_map<entt::entity, uint32_t> m_Index;
+	// Component storage, valid until the next rebuild
+	std::vector<const ExampleMaterial*> m_MaterialComponents;
+	std::vector<const LightmapComponent*> m_LightmapComponents;
+};
@@ -18,15 +18,33 @@
 #include "backends/imgui_impl_opengl3.h"
 #endif
 
+#include <functional>
+#include <mutex>
+
 #include <entt/entity/registry.hpp>
 
 #include <entity.h>
 #include <input.h>
 #include <camera.h>
+#include "bvh.h"
+#include "commandbuffer.h"
+#include "framearena.h"
 #include "gl_helpers.h"
 #include "framebuffer.h"
 #include "window.h"
+#include "particlepool.h"
+#include "particlesort.h"
+#include "particlesplat.h"
+#include "picking.h"
 #include "particlesystem.h"
+#include "sdf.h"
+#include "grass.h"
+#include "hiz.h"
+#include "jobs.h"
+#include "lightmap.h"
+#include "occlusion.h"
+#include "renderproxy.h"
+#include "snapshot.h"
 
 class Scene
 {
@@ -37,35 +55,198 @@ public:
 	~Scene() = default;
 
 	/**
-	* Update all systems
+	* Update all systems, called with the scene mutex held, see SimulationLoop
 	*/
-	void Update();
+	void Update(float dt);
 
 	/**
-	* Dispatch compute and draw
+	* Copy what Draw needs from the simulation into snapshot, called with the scene mutex held after Update
 	*/
-	void Draw(const Camera& camera, const Window& window);
+	void WriteSnapshot(FrameSnapshot& snapshot) const;
 
 	/**
-	* Draw ImGui
+	* Dispatch compute and draw snapshot from camera. Transforms are only read from the snapshot,
+	* the scene mutex is taken for the few steps that touch the registry. GPU effects (wind, grass
+	* trample, snow, emitters) advance by dt, the frame time of the render thread.
+	*/
+	void Draw(const FrameSnapshot& snapshot, const Camera& camera, const Window& window, float dt);
+
+	/**
+	* Draw ImGui, takes the scene mutex since the inspector edits components
 	*/
 	void DrawGUI(const Camera& camera);
 
+	/**
+	* Held by the simulation during a tick, and by the render thread whenever it touches the registry
+	*/
+	inline std::mutex& GetMutex() { return m_Mutex; }
+
 	Entity CreateEntity(const std::string& name);
+	/**
+	* Destroys the entity and all of its children
+	*/
 	void DestroyEntity(Entity entity);
 
+	/**
+	* Attach child to parent, or make it a root if parent is Entity::Invalid().
+	* The local transform is kept, so the child moves with its new parent.
+	*/
+	void SetParent(Entity child, Entity parent);
+
+	/**
+	* Closest hit of ray against the meshes of all model and quad entities, on the CPU.
+	* hit.instance is the entity id. Reflects the transforms as of the last Update.
+	*/
+	bool Raycast(const Ray& ray, RayHit& hit) const;
+
 	FrameBuffer* m_VarianceMapBuffer;
 
 private:
 	template <typename Component>
 	void DrawComponentUIIfExists(Entity entity);
 
+	/**
+	* Re-render all maps derived from the static scene geometry
+	*/
+	void BakeStaticGeometryMaps();
+
+	/**
+	* Trace the lightmaps of all LightmapComponents against the scene BVH, save them to the cache and upload them
+	*/
+	void BakeLightmaps();
+
+	/**
+	* Upload cached lightmaps of LightmapComponents that have not looked for one yet
+	*/
+	void LoadLightmaps();
+
+	/**
+	* Update, cull and draw a snow particle system, particles inside inner_volume are skipped
+	*/
+	void DrawParticleSystem(ParticleSystem& system, const Camera& camera, const AABB& inner_volume);
+
+	/**
+	* Run the snow update on the GPU and on the CPU reference from the same initial state
+	* and compare the results, also measures the CPU reference throughput
+	*/
+	void ValidateParticleSimulation();
+
+	/**
+	* Recompute the world matrices of dirty transforms and their subtrees, parents before children
+	*/
+	void UpdateTransforms();
+
+	/**
+	* Breadth-first order of the hierarchy, also sorts the transform storage to match it
+	*/
+	void RebuildTransformOrder();
+
+	/**
+	* Draw a hierarchy button for entity, followed by its children indented
+	*/
+	void DrawHierarchyNode(entt::entity entity);
+
+	/**
+	* Rebuild the scene BVH when entities with meshes are added or removed, otherwise refit moved ones
+	*/
+	void UpdateSceneBVH();
+
+	/**
+	* World space ray through the cursor, from the near plane towards the far plane
+	*/
+	Ray GetCursorRay(const Camera& camera, const Window& window) const;
+
+	/**
+	* Rasterize all OccluderComponents into the software occlusion buffer and update the grass tile visibility
+	*/
+	void DrawOccluders(const glm::mat4& view_projection);
+
+	/**
+	* Bounds of proxy index are hidden behind the occluders of this frame
+	*/
+	bool IsOccluded(const RenderProxies& proxies, uint32_t index, const glm::mat4& view_projection) const;
+
+	/**
+	* Occlusion test of every proxy on the job system, visible is 0 for culled proxies. Returns the number culled.
+	*/
+	uint32_t CullRenderProxies(const RenderProxies& proxies, const glm::mat4& view_projection, FrameVector<uint8_t>& visible);
+
+	/**
+	* Record count draws on the job system, one command buffer per RECORD_GRAIN_SIZE draws in order.
+	* Buffers are reused from the previous call, record may be called concurrently for different buffers.
+	*/
+	static void RecordCommands(uint32_t count, std::vector<CommandBuffer>& buffers, const std::function<void(CommandBuffer&, uint32_t)>& record);
+
+	/**
+	* Replay buffers in order on the GL thread, the shader their uniform locations belong to is bound by the caller
+	*/
+	static void ReplayCommands(const std::vector<CommandBuffer>& buffers);
+
+	/**
+	* Record the opaque draws of the visible proxies with a material, sorted by model and material.
+	* Uniforms and textures go to the locations and slots of ExampleMaterial::GetShader().
+	*/
+	static void RecordOpaqueCommands(const RenderProxies& proxies, const FrameVector<uint8_t>& visible, std::vector<CommandBuffer>& buffers);
+
+	/**
+	* Rebuild the render proxies if a component they gather was added or removed since the last call
+	*/
+	void UpdateRenderProxies();
+
+	/**
+	* Registry signal of the components gathered into render proxies
+	*/
+	void OnRenderComponentChanged(entt::registry& registry, entt::entity entity);
+
 private:
 	std::string m_Name;
 	entt::registry m_EntityRegistry;
 
 	Entity m_ActiveEntity;
 
+	std::mutex m_Mutex;
+
+	// Simulated time, advanced by Update
+	float m_Time = 0.0f;
+	float m_TimeDelta = 0.0f;
+	// Time of the GPU effects, advanced by Draw every frame
+	float m_DrawTime = 0.0f;
+	float m_DrawTimeDelta = 0.0f;
+
+	// Transforms in breadth-first order, parent is an index into the same array or -1 for roots
+	struct TransformNode
+	{
+		entt::entity entity;
+		int32_t parent;
+	};
+	std::vector<TransformNode> m_TransformOrder;
+	// End of every level of the hierarchy in m_TransformOrder
+	std::vector<uint32_t> m_TransformLevels;
+	// Nodes per job when a level is updated in parallel
+	static constexpr uint32_t TRANSFORM_GRAIN_SIZE = 256;
+	// World matrix changed during the current UpdateTransforms, per TransformNode
+	std::vector<uint8_t> m_TransformChanged;
+	bool m_HierarchyDirty = true;
+
+	// Draw data of quad and model entities, packed for the passes that walk all of them
+	RenderProxies m_QuadProxies;
+	RenderProxies m_ModelProxies;
+	bool m_RenderProxiesDirty = true;
+
+	// Draws recorded by the job system for the GL thread, kept across frames to reuse their memory
+	std::vector<CommandBuffer> m_ShadowQuadCommands;
+	std::vector<CommandBuffer> m_ShadowModelCommands;
+	std::vector<CommandBuffer> m_QuadCommands;
+	std::vector<CommandBuffer> m_ModelCommands;
+	// Draws per command buffer
+	static constexpr uint32_t RECORD_GRAIN_SIZE = 64;
+
+	// Set whenever static geometry is created, destroyed or moved
+	bool m_StaticGeometryDirty = true;
+
+	// Instances of all model and quad entities, for ray queries
+	SceneBVH m_SceneBVH;
+
 	// Textures received from: https://www.humus.name/index.php?page=Textures
 	const char* skyboxes_names[3] = { "skansen", "ocean", "church" };
 	int current_skybox_idx = 1;
@@ -76,29 +257,62 @@ private:
 
 	FrameBuffer* m_DefaultFrameBuffer;
 	FrameBuffer* m_ShadowMapBuffer;
+	// Clicks are read back from the entity id attachment of m_DefaultFrameBuffer
+	EntityPicker* m_EntityPicker;
+	// Pick by raycasting the scene BVH instead of the GPU readback
+	bool cpu_picking = true;
+	float pick_time_us = 0.0f;
+	// Occluders rasterized on the CPU, entities and grass tiles behind them are not submitted
+	OcclusionBuffer* m_OcclusionBuffer;
+	bool occlusion_culling = true;
+	uint32_t occlusion_culled_entities = 0;
+	float occlusion_time_us = 0.0f;
+	// Farthest depth pyramid of the opaque pass, culls snow clusters and grass tiles on the GPU
+	HiZPyramid* m_HiZPyramid;
+	bool hiz_culling = true;
 
 	Shader* m_GrassShader;
 	Shader* m_SkyboxShader;
 	Shader* m_ParticleShader;
-	Shader* m_ParticleCSShader;
 	Shader* m_FramebufferShader;
 	Shader* m_VarianceShadowMapShader;
+	Shader* m_GrassDensityShader;
+	Shader* m_WindCSShader;
+	Shader* m_GrassTrampleCSShader;
+	Shader* m_ParticlePoolShader;
+	Shader* m_ParticlePoolCSShader;
+	Shader* m_ParticleSortCSShader;
+	Shader* m_ParticleSplatCSShader;
+	Shader* m_ParticleSplatResolveShader;
+	Shader* m_HiZDownsampleCSShader;
+	Shader* m_GrassTileCullCSShader;
 
 	Texture2D* m_WindTexture;
+	Texture2D* m_SnowflakeTexture;
 
 	/** SETTINGS VARIABLES **/
 	bool draw_shadow_map = false;
 	bool draw_colliders = true;
 	bool colored_particles = false;
 	bool depth_cull = false;
+	int particle_validation_steps = 600;
+	float particle_validation_tolerance = 0.01f;
+	bool particle_validation_wrap = true;
+	bool particle_validation_done = false;
+	ParticleComparison particle_validation;
+	ClusterBoundsCheck particle_bounds_validation;
+	// Particle updates per second on the CPU reference
+	double particle_reference_rate = 0.0;
 	bool draw_quads = true;
 	bool draw_skybox_b = true;
 	bool draw_depthbuffer = false;
 
+	// Lightmaps
+	LightmapBakeSettings lightmap_settings;
+	float lightmap_bake_time = 0.0f;
+
 	// Wind
-	float u_WindAmp = 0.3f;
-	float u_WindFactor = 20.0f;
-	glm::vec2 u_WindDirection = glm::vec2(1.0, 1.0);
+	WindField* m_WindField;
 
 	// Grass
 	bool g_DrawGrass = true;
@@ -108,13 +322,46 @@ private:
 	glm::vec3 bbox_min = bbox_center + glm::vec3(-0.5, -0.5, -0.5) * bbox_scale;
 	glm::vec3 bbox_max = bbox_center + glm::vec3(0.5, 0.5, 0.5) * bbox_scale;
 	glm::ivec2 grass_per_dim = glm::ivec2(3000, 3000);
-	ParticleSystem grass_system;
+	GLuint m_GrassVAO;
+	GrassDensityMap* m_GrassDensityMap;
+	float grass_exclusion_height = 12.0f;
+	bool paint_grass_density = false;
+	float grass_brush_radius = 2.0f;
+	float grass_brush_density = 0.0f;
+	GrassTrampleMap* m_GrassTrampleMap;
+	bool camera_tramples_grass = true;
+	GrassTileVisibility* m_GrassTileVisibility;
+	float camera_trample_radius = 1.0f;
 
 	float quad_alpha = 1.0;
 	float ortho_size = 25.0f;
 	float ortho_far = 100.0f;
 
+	// Snow
+	bool g_DrawSnow = true;
 	glm::ivec3 particles_per_dim = glm::ivec3(160, 160 * 2, 160);
+	// World box of particles_per_dim, only created if camera-relative snow is disabled
+	ParticleSystem* m_SnowSystem = nullptr;
+	// Precipitation volumes that wrap around the camera, ordered near to far
+	bool camera_relative_snow = true;
+	std::vector<ParticleSystem*> m_SnowLayers;
+	// Flakes smaller than splat_max_size pixels are splatted by a compute pass instead of drawn as quads
+	bool splat_small_particles = true;
+	float splat_max_size = 1.5f;
+	ParticleSplatTarget* m_ParticleSplatTarget;
+	// Static geometry shelters snow below it, re-baked with the grass density
+	PrecipitationOcclusionMap* m_PrecipitationOcclusionMap;
+	// Static geometry snow collides with, re-baked with the grass density
+	SignedDistanceField* m_SceneSDF;
+	float sdf_band_width = 3.0f;
+
+	// Shared by all ParticleEmitterComponents
+	bool g_DrawEmitters = true;
+	ParticlePool* m_ParticlePool;
+	// Transparent pass: emitter particles alpha blended back to front
+	bool sort_emitter_particles = true;
+	ParticleSorter* m_ParticleSorter;
+
 	glm::vec3 directional_light = glm::normalize(glm::vec3(-1.0, 1.0, -1.0));
 	glm::mat4 light_view = glm::lookAt(directional_light * ortho_size, glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
 	glm::mat4 light_view_projection = glm::ortho<float>(-ortho_size, ortho_size, -ortho_size, ortho_size, 0.1, ortho_far) * light_view;
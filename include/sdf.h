@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "jobs.h"
+#include "model.h"
+
+/**
+* A mesh placed in the world, input to the signed distance field baker
+*/
+struct SDFMeshInstance
+{
+	const ModelData* data;
+	glm::mat4 transform;
+};
+
+/**
+* Narrow band signed distance field of static triangle meshes on a regular grid over the bounds.
+*
+* Each voxel stores:
+*	xyz: unit direction away from the nearest surface
+*	w:   signed distance to the nearest surface, negative inside
+*
+* Only voxels within band_width of a triangle are computed exactly, every other voxel is
+* treated as outside at band_width. The sign is taken from the normal of the nearest triangle,
+* so meshes do not have to be closed. Baking runs on the CPU without a GL context,
+* upload() moves the result into an RGBA16F 3D texture for the particle update.
+*
+* bake_async() bakes in background jobs instead, the previous voxels stay in use until
+* finish_bake() takes over the result.
+*/
+struct SignedDistanceField
+{
+public:
+	SignedDistanceField(glm::ivec3 resolution, glm::vec3 bounds_min, glm::vec3 bounds_max);
+	// Waits for a running bake
+	~SignedDistanceField();
+	SignedDistanceField(SignedDistanceField const&) = delete;
+	void operator=(SignedDistanceField const&) = delete;
+
+	/**
+	* Bake the meshes on all job system threads, replaces the previous bake
+	*/
+	void bake(const std::vector<SDFMeshInstance>& meshes, float band_width);
+	void upload();
+
+	/**
+	* Start baking the meshes in a job and return. The world space triangles are gathered before
+	* returning, the meshes may change afterwards. A bake requested while another one runs is
+	* started once that one is picked up, a newer request replaces it.
+	*/
+	void bake_async(const std::vector<SDFMeshInstance>& meshes, float band_width);
+	/**
+	* Replace the voxels with a finished background bake, true if it did. upload() afterwards.
+	* Call from the thread that started the bake.
+	*/
+	bool finish_bake();
+	inline bool is_baking() const { return m_BakeRunning; }
+
+	/**
+	* Nearest voxel lookup, band_width outside the bounds
+	*/
+	float get_distance(glm::vec3 position) const;
+	glm::vec3 get_voxel_center(glm::ivec3 voxel) const;
+	// x-major, then y and z
+	inline const std::vector<glm::vec4>& get_voxels() const { return m_Voxels; }
+
+	inline bool is_uploaded() const { return m_Handle != 0; }
+	inline glm::ivec3 get_resolution() const { return m_Resolution; }
+	inline glm::vec3 get_bounds_min() const { return m_BoundsMin; }
+	inline glm::vec3 get_bounds_max() const { return m_BoundsMax; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_3D, m_Handle);
+	};
+
+private:
+	struct Triangle
+	{
+		glm::vec3 a, b, c;
+		glm::vec3 normal;
+		glm::vec3 bounds_min, bounds_max;
+	};
+
+	static std::vector<Triangle> get_triangles(const std::vector<SDFMeshInstance>& meshes, float band_width);
+	// Voxels of the slices [z_begin, z_end), alignment resolves ties between equally near triangles
+	void bake_slices(const std::vector<Triangle>& triangles, float band_width,
+		glm::vec4* voxels, float* alignment, int z_begin, int z_end) const;
+	void start_bake();
+
+private:
+	glm::ivec3 m_Resolution;
+	glm::vec3 m_BoundsMin;
+	glm::vec3 m_BoundsMax;
+	float m_BandWidth = 0.0f;
+
+	std::vector<glm::vec4> m_Voxels;
+	GLuint m_Handle = 0;
+
+	// Background bake, the slice jobs read m_BakeTriangles and write m_BakeVoxels only
+	JobCounter m_BakeCounter;
+	bool m_BakeRunning = false;
+	std::vector<Triangle> m_BakeTriangles;
+	std::vector<glm::vec4> m_BakeVoxels;
+	std::vector<float> m_BakeAlignment;
+	float m_BakeBandWidth = 0.0f;
+	bool m_BakePending = false;
+	std::vector<Triangle> m_PendingTriangles;
+	float m_PendingBandWidth = 0.0f;
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include<functional>
 #include<map>
 #include<iostream>
 #include<fstream>
@@ -16,15 +17,18 @@ public:
 	inline void bind() { glUseProgram(m_Handle); }
 	inline void unbind() { glUseProgram(0); }
 
-	void set_uint(const std::string& name, const uint32_t value);
-	void set_int(const std::string&, const int);
-	void set_int3(const std::string&, const int, const int, const int);
-	void set_float(const std::string&, const float);
-	void set_float2(const std::string&, const float, const float);
-	void set_float3(const std::string&, const float, const float, const float);
-	void set_float4(const std::string&, const float, const float, const float, const float);
-	void set_float3v(const std::string&, size_t, const float*);
-	void set_matrix4fv(const std::string&, const float*);
+	// Uniform names are looked up without building a std::string, only the first use of a name allocates
+	void set_uint(const char* name, const uint32_t value);
+	void set_int(const char*, const int);
+	void set_int2(const char*, const int, const int);
+	void set_int3(const char*, const int, const int, const int);
+	void set_float(const char*, const float);
+	void set_float2(const char*, const float, const float);
+	void set_float3(const char*, const float, const float, const float);
+	void set_float4(const char*, const float, const float, const float, const float);
+	void set_float3v(const char*, size_t, const float*);
+	void set_float4v(const char*, size_t, const float*);
+	void set_matrix4fv(const char*, const float*);
 
 	static GLuint GetGLShaderTypeFromString(const std::string& shader_type_str);
 	static std::string GetStringFromGLShaderType(GLuint shader_type);
@@ -35,13 +39,15 @@ private:
 	void Init(const std::map<GLuint, std::string>& shader_sources);
 	void Reload(const std::map<GLuint, std::string>& shader_sources);
 
-	void FindUniformLocationIfNotExists(const char* name);
+	GLuint GetUniformLocation(const char* name);
 
 private:
 	Shader() = delete;
 
 	GLuint m_Handle = 0;
 	std::string m_FileName;
-	std::map<std::string, GLuint> m_UniformLocations;
+	std::string m_Defines;
+	// Transparent comparator, finds by const char*
+	std::map<std::string, GLuint, std::less<>> m_UniformLocations;
 };
 
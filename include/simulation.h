@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "scene.h"
+#include "snapshot.h"
+
+/**
+* Runs Scene::Update on a thread of its own at a fixed tick rate, independent of the render frame
+* rate. The camera stays on the render thread, so it moves every frame and not in ticks.
+*
+* Every tick takes the latest InputSnapshot, advances the scene with the scene mutex held and
+* publishes a FrameSnapshot. The render thread draws the latest snapshot and never
+* waits for a tick, a tick only waits while the render thread holds the scene mutex.
+*/
+class SimulationLoop
+{
+public:
+	SimulationLoop(Scene& scene, float tick_rate = 60.0f);
+	~SimulationLoop();
+
+	/**
+	* Run the first tick on the calling thread, so a snapshot exists before the first frame, then start the thread
+	*/
+	void start();
+	void stop();
+
+	/* RENDER THREAD */
+	inline void submit_input(const InputSnapshot& input) { m_Input.get_write_buffer() = input; m_Input.publish(); }
+
+	/**
+	* The newest snapshot, the previous one if no tick has completed since
+	*/
+	inline const FrameSnapshot& acquire_snapshot() { m_Snapshots.acquire(); return m_Snapshots.get_read_buffer(); }
+
+	inline float get_tick_rate() const { return m_TickRate; }
+	// Time spent in the last tick, in seconds
+	inline float get_tick_time() const { return m_TickTime.load(std::memory_order_relaxed); }
+
+private:
+	void tick(float dt);
+	void run();
+
+private:
+	Scene& m_Scene;
+	float m_TickRate;
+	uint64_t m_Tick = 0;
+
+	std::thread m_Thread;
+	std::atomic<bool> m_Running = false;
+	std::atomic<float> m_TickTime = 0.0f;
+
+	TripleBuffer<InputSnapshot> m_Input;
+	TripleBuffer<FrameSnapshot> m_Snapshots;
+};
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "particlepool.h"
+#include "renderproxy.h"
+
+/**
+* Single producer, single consumer handoff of the latest value without locks or waiting.
+*
+* The writer fills get_write_buffer() and publishes it, the reader acquires the newest published
+* buffer. Three buffers let both sides keep working on their own while a third one holds the
+* latest published value. A reader that is slower than the writer skips values, a faster
+* one keeps reading the value it already has.
+*/
+template<typename T>
+class TripleBuffer
+{
+public:
+	TripleBuffer(const T& initial) : m_Buffers{ initial, initial, initial } {};
+
+	/* WRITER */
+	inline T& get_write_buffer() { return m_Buffers[m_Write]; }
+
+	/**
+	* Make the write buffer the newest value, the writer continues on the previously published one
+	*/
+	void publish()
+	{
+		m_Write = m_Published.exchange(m_Write | NEW_BIT, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	/* READER */
+	/**
+	* Swap in the newest published value, false if nothing was published since the last acquire
+	*/
+	bool acquire()
+	{
+		if ((m_Published.load(std::memory_order_relaxed) & NEW_BIT) == 0)
+			return false;
+		m_Read = m_Published.exchange(m_Read, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	inline const T& get_read_buffer() const { return m_Buffers[m_Read]; }
+
+private:
+	static constexpr uint8_t INDEX_MASK = 0x3;
+	// Set by publish until the reader takes the buffer
+	static constexpr uint8_t NEW_BIT = 0x4;
+
+	T m_Buffers[3];
+	uint8_t m_Write = 0;
+	std::atomic<uint8_t> m_Published = 1;
+	uint8_t m_Read = 2;
+};
+
+/**
+* Input state sampled on the render thread, which owns the window, and applied by the simulation.
+* Camera input is applied on the render thread itself.
+*/
+struct InputSnapshot
+{
+	bool paused = false;
+};
+
+/**
+* A ParticleEmitterComponent with the world matrix of its entity at the end of a tick
+*/
+struct EmitterSnapshot
+{
+	entt::entity entity;
+	// Particles per second
+	float rate;
+	ParticleEmitter emitter;
+};
+
+/**
+* Everything the render thread draws that the simulation changes, written once per simulation
+* tick and never modified after it is published.
+*
+* Nothing in a snapshot points into component storage, materials and lightmap textures are
+* copied, so the simulation may add or remove components while an older snapshot is drawn.
+*/
+struct FrameSnapshot
+{
+	uint64_t tick = 0;
+	// Simulated time at the end of the tick, in seconds
+	float time = 0.0f;
+
+	RenderProxies quads;
+	RenderProxies models;
+	// xyz position and radius of every GrassTramplerComponent
+	std::vector<glm::vec4> footprints;
+	std::vector<EmitterSnapshot> emitters;
+};
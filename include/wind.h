@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "texture.h"
+
+/**
+* Wind evaluated once per frame into a texture covering the xz-bounds of the outdoor scene.
+*
+* Each texel stores:
+*	rg: normalized horizontal wind direction (x, z)
+*	b:  gust intensity in [0, 1]
+*
+* Grass blades and snow particles both sample the field, so wind is coherent between systems.
+*/
+struct WindField
+{
+public:
+	WindField(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max);
+	~WindField();
+
+	/**
+	* Dispatch the wind compute pass, assumes wind_cs is the wind field compute shader
+	*/
+	void update(float time, Shader& wind_cs, Texture2D* noise_texture);
+
+	inline glm::vec3 get_bounds_min() const { return m_BoundsMin; }
+	inline glm::vec3 get_bounds_max() const { return m_BoundsMax; }
+	inline GLuint get_texture_id() const { return m_Handle; }
+	inline void bind(uint32_t slot) const {
+		glActiveTexture(GL_TEXTURE0 + slot);
+		glBindTexture(GL_TEXTURE_2D, m_Handle);
+	};
+
+public:
+	float amplitude = 0.3f;
+	float factor = 20.0f;
+	glm::vec2 direction = glm::vec2(1.0, 1.0);
+
+private:
+	uint32_t m_Resolution;
+	glm::vec3 m_BoundsMin;
+	glm::vec3 m_BoundsMax;
+
+	GLuint m_Handle;
+};
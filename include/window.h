@@ -6,8 +6,6 @@
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 
-#include "camera.h"
-
 struct Window {
 public:
   Window(uint32_t width, uint32_t height);
@@ -23,9 +21,8 @@ public:
   inline int get_width() const { return width; };
   inline int get_height() const { return height; };
 
-  void resize(Camera& camera) {
+  void resize() {
     glfwGetFramebufferSize(window, &width, &height);
-    camera.set_aspect(width / (float)height);
     glViewport(0, 0, width, height);
   }
 
@@ -9,67 +9,67 @@ Shader::Shader(const std::string& filename, const std::map<GLuint, std::string>&
     Init(shader_sources);
 }
 
-void Shader::FindUniformLocationIfNotExists(const char* name)
+GLuint Shader::GetUniformLocation(const char* name)
 {
-    if (m_UniformLocations.find(name) == m_UniformLocations.end())
-    {
-        GLuint location = glGetUniformLocation(m_Handle, name);
-        m_UniformLocations[name] = location;
-    }
+    auto it = m_UniformLocations.find(name);
+    if (it == m_UniformLocations.end())
+        it = m_UniformLocations.emplace(name, glGetUniformLocation(m_Handle, name)).first;
+    return it->second;
+}
+
+void Shader::set_uint(const char* name, const uint32_t value)
+{
+    GL_CHECK(glUniform1ui(GetUniformLocation(name), value));
+}
+
+void Shader::set_int(const char* name, const int value)
+{
+    GL_CHECK(glUniform1i(GetUniformLocation(name), value));
 }
 
-void Shader::set_uint(const std::string& name, const uint32_t value)
+void Shader::set_int2(const char* name, const int v1, const int v2)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform1ui(m_UniformLocations[name], value));
+    GL_CHECK(glUniform2i(GetUniformLocation(name), v1, v2));
 }
 
-void Shader::set_int(const std::string& name, const int value)
+void Shader::set_int3(const char* name, const int v1, const int v2, const int v3)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform1i(m_UniformLocations[name], value));
+    GL_CHECK(glUniform3i(GetUniformLocation(name), v1, v2, v3));
 }
 
-void Shader::set_int3(const std::string& name, const int v1, const int v2, const int v3)
+void Shader::set_float(const char* name, const float value)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform3i(m_UniformLocations[name], v1, v2, v3));
+    GL_CHECK(glUniform1f(GetUniformLocation(name), value));
 }
 
-void Shader::set_float(const std::string& name, const float value)
+void Shader::set_float2(const char* name, const float v1, const float v2)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform1f(m_UniformLocations[name], value));
+    GL_CHECK(glUniform2f(GetUniformLocation(name), v1, v2));
 }
 
-void Shader::set_float2(const std::string& name, const float v1, const float v2)
+void Shader::set_float3(const char* name, const float v1, const float v2, const float v3)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform2f(m_UniformLocations[name], v1, v2));
+    GL_CHECK(glUniform3f(GetUniformLocation(name), v1, v2, v3));
 }
 
-void Shader::set_float3(const std::string& name, const float v1, const float v2, const float v3)
+void Shader::set_float4(const char* name, const float v1, const float v2, const float v3, const float v4)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform3f(m_UniformLocations[name], v1, v2, v3));
+    GL_CHECK(glUniform4f(GetUniformLocation(name), v1, v2, v3, v4));
 }
 
-void Shader::set_float4(const std::string& name, const float v1, const float v2, const float v3, const float v4)
+void Shader::set_float3v(const char* name, size_t count, const float* values) 
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform4f(m_UniformLocations[name], v1, v2, v3, v4));
+    GL_CHECK(glUniform3fv(GetUniformLocation(name), count, values));
 }
 
-void Shader::set_float3v(const std::string& name, size_t count, const float* values) 
+void Shader::set_float4v(const char* name, size_t count, const float* values) 
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniform3fv(m_UniformLocations[name], count, values));
+    GL_CHECK(glUniform4fv(GetUniformLocation(name), count, values));
 }
 
-void Shader::set_matrix4fv(const std::string& name, const float* value_ptr)
+void Shader::set_matrix4fv(const char* name, const float* value_ptr)
 {
-    FindUniformLocationIfNotExists(name.c_str());
-    GL_CHECK(glUniformMatrix4fv(m_UniformLocations[name], 1, false, value_ptr));
+    GL_CHECK(glUniformMatrix4fv(GetUniformLocation(name), 1, false, value_ptr));
 }
 
 void Shader::Init(const std::map<GLuint, std::string>& shader_sources)
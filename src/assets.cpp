@@ -5,6 +5,8 @@
 
 #include <OpenFBX/src/ofbx.h>
 
+#include "jobs.h"
+
 void AssetManager::Init()
 {
 	// Show the Open dialog box.
@@ -137,18 +139,49 @@ RawModel* AssetManager::GetRawModel(const char* file_name)
 	return model->second;
 }
 
-Shader* AssetManager::GetShader(const char* file_name)
+void AssetManager::PreloadRawModels(const std::vector<const char*>& file_names)
 {
-	auto s = Instance().m_Shaders.find(file_name);
+	std::map<std::string, RawModel*>& models = Instance().m_Models;
+	std::vector<const char*> missing;
+	for (const char* file_name : file_names)
+	{
+		if (models.find(file_name) == models.end())
+			missing.push_back(file_name);
+	}
+
+	std::vector<ModelData> fbx_data(missing.size());
+	std::vector<uint8_t> parsed(missing.size(), 0);
+	JobSystem::ParallelFor((uint32_t)missing.size(), 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; i++)
+		{
+			std::filesystem::path file_path(GetModelPath());
+			file_path.append(missing[i]);
+			parsed[i] = ParseFBX(file_path, fbx_data[i]);
+		}
+	});
+
+	for (uint32_t i = 0; i < missing.size(); i++)
+	{
+		// Failures are reported again, and exit, by GetRawModel
+		if (parsed[i])
+			models.insert(std::make_pair(missing[i], new RawModel(fbx_data[i])));
+	}
+}
+
+Shader* AssetManager::GetShader(const char* file_name, const std::string& defines)
+{
+	std::string key = std::string(file_name) + defines;
+	auto s = Instance().m_Shaders.find(key);
 	if (s == Instance().m_Shaders.end())
 	{
 		std::filesystem::path file_path(GetShaderPath());
 		file_path.append(file_name);
 		std::map<GLuint, std::string> shader_sources;
-		if (ParseShader(file_path, shader_sources))
+		if (ParseShader(file_path, shader_sources, defines))
 		{
 			Shader* new_shader = new Shader(file_name, shader_sources);
-			Instance().m_Shaders.insert(std::make_pair(file_name, new_shader));
+			new_shader->m_Defines = defines;
+			Instance().m_Shaders.insert(std::make_pair(key, new_shader));
 			return new_shader;
 		}
 		exit(0);
@@ -158,6 +191,16 @@ Shader* AssetManager::GetShader(const char* file_name)
 
 
 
+std::filesystem::path AssetManager::GetCachePath()
+{
+	std::filesystem::path cache_path = std::filesystem::path(GetBasePath()).append("cache\\");
+	std::error_code error;
+	std::filesystem::create_directories(cache_path, error);
+	if (error)
+		std::cout << "Error: Could not create cache directory " << cache_path << ": " << error.message() << std::endl;
+	return cache_path;
+}
+
 std::string AssetManager::ReadFile(std::filesystem::path file_path)
 {
 	std::string result;
@@ -266,20 +309,20 @@ void AssetManager::ReloadShaders()
 	for (auto& [name, shader] : Instance().m_Shaders)
 	{
 		std::filesystem::path file_path(GetShaderPath());
-		file_path.append(name);
+		file_path.append(shader->m_FileName);
 		std::map<GLuint, std::string> shader_sources;
-		if (ParseShader(file_path, shader_sources))
+		if (ParseShader(file_path, shader_sources, shader->m_Defines))
 		{
 			shader->Reload(shader_sources);
 		}
 		else
 		{
-			std::cout << "Error: Could not reload shader " << name << std::endl;
+			std::cout << "Error: Could not reload shader " << shader->m_FileName << std::endl;
 		}
 	}
 }
 
-bool AssetManager::ParseShader(const std::filesystem::path& file_path, std::map<GLuint, std::string>& output_sources)
+bool AssetManager::ParseShader(const std::filesystem::path& file_path, std::map<GLuint, std::string>& output_sources, const std::string& defines)
 {
 	output_sources.clear();
 
@@ -320,6 +363,18 @@ bool AssetManager::ParseShader(const std::filesystem::path& file_path, std::map<
 		else
 			shader_code = shader_source.substr(pos, next_pos - pos);
 
+		if (!defines.empty())
+		{
+			size_t version_pos = shader_code.find("#version");
+			size_t line_end = version_pos == std::string::npos ? std::string::npos : shader_code.find('\n', version_pos);
+			if (line_end == std::string::npos)
+			{
+				std::cout << "Error: Could not insert defines, no #version line in '" << file_path << "'" << std::endl;
+				return false;
+			}
+			shader_code.insert(line_end + 1, defines);
+		}
+
 		output_sources.emplace(std::make_pair(gl_shader_type, shader_code));
 
 		pos = next_pos;
@@ -0,0 +1,505 @@
+#include "bvh.h"
+
+#include <algorithm>
+
+#include "model.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BVH_SSE2
+#include <emmintrin.h>
+#endif
+
+// SAH costs relative to one primitive test
+static constexpr float SAH_TRAVERSAL_COST = 1.0f;
+static constexpr int SAH_BINS = 16;
+
+float BVHBounds::get_surface_area() const
+{
+	if (is_empty())
+		return 0.0f;
+	glm::vec3 d = max - min;
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+/* BUILD */
+
+struct BinaryNode
+{
+	BVHBounds bounds;
+	// Inner: child nodes, leaf: left = -1 and a range of the primitive list
+	int32_t left = -1;
+	int32_t right = -1;
+	uint32_t first = 0;
+	uint32_t count = 0;
+
+	inline bool is_leaf() const { return left < 0; }
+};
+
+struct BinaryBuilder
+{
+	const std::vector<BVHBounds>& primitive_bounds;
+	std::vector<glm::vec3> centroids;
+	std::vector<uint32_t>& primitives;
+	std::vector<BinaryNode> nodes;
+	uint32_t max_leaf_size;
+
+	int32_t build(uint32_t first, uint32_t count)
+	{
+		int32_t index = (int32_t)nodes.size();
+		nodes.emplace_back();
+		BVHBounds bounds, centroid_bounds;
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			bounds.grow(primitive_bounds[primitives[i]]);
+			centroid_bounds.grow(centroids[primitives[i]]);
+		}
+		nodes[index].bounds = bounds;
+		nodes[index].first = first;
+		nodes[index].count = count;
+		if (count <= 1)
+			return index;
+
+		// Bin centroids along the widest axis
+		glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		uint32_t split = first + count / 2;
+		if (extent[axis] > 0.0f)
+		{
+			BVHBounds bin_bounds[SAH_BINS];
+			uint32_t bin_counts[SAH_BINS] = {};
+			float bin_scale = SAH_BINS / extent[axis];
+			auto get_bin = [&](uint32_t primitive) {
+				return std::min((int)((centroids[primitive][axis] - centroid_bounds.min[axis]) * bin_scale), SAH_BINS - 1);
+			};
+			for (uint32_t i = first; i < first + count; i++)
+			{
+				int bin = get_bin(primitives[i]);
+				bin_bounds[bin].grow(primitive_bounds[primitives[i]]);
+				bin_counts[bin]++;
+			}
+
+			// Sweep from the right, then from the left, evaluating every bin boundary
+			float right_cost[SAH_BINS];
+			BVHBounds right_bounds;
+			uint32_t right_count = 0;
+			for (int b = SAH_BINS - 1; b > 0; b--)
+			{
+				right_bounds.grow(bin_bounds[b]);
+				right_count += bin_counts[b];
+				right_cost[b] = right_bounds.get_surface_area() * right_count;
+			}
+			float best_cost = std::numeric_limits<float>::max();
+			int best_bin = -1;
+			BVHBounds left_bounds;
+			uint32_t left_count = 0;
+			for (int b = 1; b < SAH_BINS; b++)
+			{
+				left_bounds.grow(bin_bounds[b - 1]);
+				left_count += bin_counts[b - 1];
+				if (left_count == 0 || left_count == count)
+					continue;
+				float cost = left_bounds.get_surface_area() * left_count + right_cost[b];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_bin = b;
+				}
+			}
+
+			float leaf_cost = bounds.get_surface_area() * count;
+			float split_cost = SAH_TRAVERSAL_COST * bounds.get_surface_area() + best_cost;
+			if (best_bin < 0 || (count <= max_leaf_size && leaf_cost <= split_cost))
+			{
+				if (count <= max_leaf_size)
+					return index;
+			}
+			else
+			{
+				auto middle = std::partition(primitives.begin() + first, primitives.begin() + first + count,
+					[&](uint32_t primitive) { return get_bin(primitive) < best_bin; });
+				split = (uint32_t)(middle - primitives.begin());
+			}
+		}
+		else if (count <= max_leaf_size)
+		{
+			return index;
+		}
+
+		// Coincident centroids fall back to splitting the range in half
+		int32_t left = build(first, split - first);
+		int32_t right = build(split, first + count - split);
+		nodes[index].left = left;
+		nodes[index].right = right;
+		return index;
+	}
+};
+
+static void set_child(BVH4Node& node, int i, const BVHBounds& bounds, int32_t child, uint32_t count)
+{
+	node.bounds[0][i] = bounds.min.x;
+	node.bounds[1][i] = bounds.min.y;
+	node.bounds[2][i] = bounds.min.z;
+	node.bounds[3][i] = bounds.max.x;
+	node.bounds[4][i] = bounds.max.y;
+	node.bounds[5][i] = bounds.max.z;
+	node.children[i] = child;
+	node.counts[i] = count;
+}
+
+/**
+* Emit the four-wide node of binary node index, its children are the up to four
+* descendants left after repeatedly opening the child with the largest surface area. The root is at depth 1.
+*/
+static int32_t collapse(const std::vector<BinaryNode>& binary, int32_t index, uint32_t depth, std::vector<BVH4Node>& nodes, uint32_t& max_depth)
+{
+	max_depth = std::max(max_depth, depth);
+	int32_t children[4];
+	int num_children = 0;
+	if (binary[index].is_leaf())
+	{
+		children[num_children++] = index;
+	}
+	else
+	{
+		children[num_children++] = binary[index].left;
+		children[num_children++] = binary[index].right;
+	}
+	while (num_children < 4)
+	{
+		int largest = -1;
+		float largest_area = -1.0f;
+		for (int i = 0; i < num_children; i++)
+		{
+			float area = binary[children[i]].bounds.get_surface_area();
+			if (!binary[children[i]].is_leaf() && area > largest_area)
+			{
+				largest = i;
+				largest_area = area;
+			}
+		}
+		if (largest < 0)
+			break;
+		int32_t opened = children[largest];
+		children[largest] = binary[opened].left;
+		children[num_children++] = binary[opened].right;
+	}
+
+	int32_t node_index = (int32_t)nodes.size();
+	nodes.emplace_back();
+	for (int i = 0; i < 4; i++)
+		set_child(nodes[node_index], i, BVHBounds(), -1, 0);
+	for (int i = 0; i < num_children; i++)
+	{
+		const BinaryNode& child = binary[children[i]];
+		if (child.is_leaf())
+		{
+			set_child(nodes[node_index], i, child.bounds, (int32_t)child.first, child.count);
+		}
+		else
+		{
+			int32_t child_index = collapse(binary, children[i], depth + 1, nodes, max_depth);
+			set_child(nodes[node_index], i, child.bounds, child_index, 0);
+		}
+	}
+	return node_index;
+}
+
+void BVH4::build(const std::vector<BVHBounds>& primitive_bounds, uint32_t max_leaf_size)
+{
+	nodes.clear();
+	max_depth = 0;
+	primitives.resize(primitive_bounds.size());
+	for (uint32_t i = 0; i < primitives.size(); i++)
+		primitives[i] = i;
+	if (primitives.empty())
+		return;
+
+	BinaryBuilder builder = { primitive_bounds, {}, primitives, {}, max_leaf_size };
+	builder.centroids.resize(primitive_bounds.size());
+	for (size_t i = 0; i < primitive_bounds.size(); i++)
+		builder.centroids[i] = 0.5f * (primitive_bounds[i].min + primitive_bounds[i].max);
+	builder.nodes.reserve(2 * primitive_bounds.size());
+	builder.build(0, (uint32_t)primitives.size());
+
+	collapse(builder.nodes, 0, 1, nodes, max_depth);
+}
+
+void BVH4::refit(const std::vector<BVHBounds>& primitive_bounds)
+{
+	// Children are stored after their parent, so a reverse sweep visits them first
+	for (size_t n = nodes.size(); n-- > 0;)
+	{
+		BVH4Node& node = nodes[n];
+		for (int i = 0; i < 4; i++)
+		{
+			if (node.children[i] < 0)
+				continue;
+
+			BVHBounds bounds;
+			if (node.counts[i] > 0)
+			{
+				for (uint32_t p = node.children[i]; p < node.children[i] + node.counts[i]; p++)
+					bounds.grow(primitive_bounds[primitives[p]]);
+			}
+			else
+			{
+				const BVH4Node& child = nodes[node.children[i]];
+				for (int j = 0; j < 4; j++)
+				{
+					if (child.children[j] < 0)
+						continue;
+					bounds.grow({ glm::vec3(child.bounds[0][j], child.bounds[1][j], child.bounds[2][j]),
+						glm::vec3(child.bounds[3][j], child.bounds[4][j], child.bounds[5][j]) });
+				}
+			}
+			set_child(node, i, bounds, node.children[i], node.counts[i]);
+		}
+	}
+}
+
+BVHBounds BVH4::get_bounds() const
+{
+	BVHBounds bounds;
+	if (nodes.empty())
+		return bounds;
+	for (int i = 0; i < 4; i++)
+	{
+		if (nodes[0].children[i] < 0)
+			continue;
+		bounds.grow({ glm::vec3(nodes[0].bounds[0][i], nodes[0].bounds[1][i], nodes[0].bounds[2][i]),
+			glm::vec3(nodes[0].bounds[3][i], nodes[0].bounds[4][i], nodes[0].bounds[5][i]) });
+	}
+	return bounds;
+}
+
+/* TRAVERSAL */
+
+// Rounding of (bound - origin) * inv_direction can put the entry an ulp past the exit for a ray
+// through a box corner or edge, which is exactly where a triangle vertex on the leaf bounds is hit.
+// Widening the exit by 1 + 2 * gamma(3) keeps the test conservative.
+static const float GAMMA_3 = 3.0f * 0.5f * std::numeric_limits<float>::epsilon() / (1.0f - 3.0f * 0.5f * std::numeric_limits<float>::epsilon());
+static const float SLAB_EXIT_SCALE = 1.0f + 2.0f * GAMMA_3;
+
+uint32_t BVH4::intersect_node(const BVH4Node& node, glm::vec3 origin, glm::vec3 inv_direction, float t_max, float t_near[4])
+{
+#ifdef BVH_SSE2
+	// Slab test of all four children. SSE min/max return the second operand if either is NaN,
+	// so the NaN of 0 * inf for a ray in a slab plane keeps the running interval.
+	__m128 t_enter = _mm_setzero_ps();
+	__m128 t_exit = _mm_set1_ps(t_max);
+	for (int axis = 0; axis < 3; axis++)
+	{
+		__m128 o = _mm_set1_ps(origin[axis]);
+		__m128 inv_d = _mm_set1_ps(inv_direction[axis]);
+		__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[axis]), o), inv_d);
+		__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.bounds[axis + 3]), o), inv_d);
+		t_enter = _mm_max_ps(_mm_min_ps(t0, t1), t_enter);
+		t_exit = _mm_min_ps(_mm_max_ps(t0, t1), t_exit);
+	}
+	_mm_storeu_ps(t_near, t_enter);
+	t_exit = _mm_mul_ps(t_exit, _mm_set1_ps(SLAB_EXIT_SCALE));
+	return (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit));
+#else
+	uint32_t mask = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		float t_enter = 0.0f;
+		float t_exit = t_max;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float t0 = (node.bounds[axis][i] - origin[axis]) * inv_direction[axis];
+			float t1 = (node.bounds[axis + 3][i] - origin[axis]) * inv_direction[axis];
+			// Running interval first, so a NaN of 0 * inf is ignored like in the SSE path
+			t_enter = std::max(t_enter, std::min(t0, t1));
+			t_exit = std::min(t_exit, std::max(t0, t1));
+		}
+		t_near[i] = t_enter;
+		if (t_enter <= t_exit * SLAB_EXIT_SCALE)
+			mask |= 1u << i;
+	}
+	return mask;
+#endif
+}
+
+/* MESH */
+
+MeshBVH::MeshBVH(const ModelData& data)
+{
+	uint32_t num_triangles = (uint32_t)(data.indices.size() / 3);
+	std::vector<BVHBounds> triangle_bounds(num_triangles);
+	for (uint32_t t = 0; t < num_triangles; t++)
+		for (int v = 0; v < 3; v++)
+			triangle_bounds[t].grow(data.vertices[data.indices[3 * t + v]].position);
+
+	m_BVH.build(triangle_bounds, 4);
+
+	// Reorder the triangles so every leaf is a contiguous range
+	m_Triangles.resize(num_triangles);
+	for (uint32_t i = 0; i < num_triangles; i++)
+	{
+		uint32_t t = m_BVH.primitives[i];
+		glm::vec3 v0 = data.vertices[data.indices[3 * t + 0]].position;
+		glm::vec3 v1 = data.vertices[data.indices[3 * t + 1]].position;
+		glm::vec3 v2 = data.vertices[data.indices[3 * t + 2]].position;
+		m_Triangles[i] = { v0, v1 - v0, v2 - v0, t };
+	}
+}
+
+/**
+* Moller-Trumbore, double sided. Returns the distance or a negative value on a miss.
+*/
+static inline float intersect_triangle(const Ray& ray, glm::vec3 v0, glm::vec3 e1, glm::vec3 e2, glm::vec2& barycentrics)
+{
+	glm::vec3 p = glm::cross(ray.direction, e2);
+	float det = glm::dot(e1, p);
+	if (std::abs(det) < 1e-12f)
+		return -1.0f;
+	float inv_det = 1.0f / det;
+	glm::vec3 s = ray.origin - v0;
+	float u = glm::dot(s, p) * inv_det;
+	if (u < 0.0f || u > 1.0f)
+		return -1.0f;
+	glm::vec3 q = glm::cross(s, e1);
+	float v = glm::dot(ray.direction, q) * inv_det;
+	if (v < 0.0f || u + v > 1.0f)
+		return -1.0f;
+	barycentrics = glm::vec2(u, v);
+	return glm::dot(e2, q) * inv_det;
+}
+
+bool MeshBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	float t_max = std::min(ray.t_max, hit.t);
+	bool found = false;
+	m_BVH.traverse(ray, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			const Triangle& triangle = m_Triangles[i];
+			glm::vec2 barycentrics;
+			float t = intersect_triangle(ray, triangle.v0, triangle.e1, triangle.e2, barycentrics);
+			if (t >= 0.0f && t < t_max)
+			{
+				t_max = t;
+				hit.t = t;
+				hit.triangle = triangle.index;
+				hit.barycentrics = barycentrics;
+				found = true;
+			}
+		}
+		return false;
+	});
+	return found;
+}
+
+bool MeshBVH::occluded(const Ray& ray) const
+{
+	float t_max = ray.t_max;
+	bool found = false;
+	m_BVH.traverse(ray, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t i = first; i < first + count; i++)
+		{
+			const Triangle& triangle = m_Triangles[i];
+			glm::vec2 barycentrics;
+			float t = intersect_triangle(ray, triangle.v0, triangle.e1, triangle.e2, barycentrics);
+			if (t >= 0.0f && t < t_max)
+				return found = true;
+		}
+		return false;
+	});
+	return found;
+}
+
+/* SCENE */
+
+void SceneBVH::build(const std::vector<BVHInstance>& instances)
+{
+	m_Instances = instances;
+	m_InverseTransforms.resize(instances.size());
+	m_InstanceBounds.resize(instances.size());
+	for (uint32_t i = 0; i < instances.size(); i++)
+	{
+		m_InverseTransforms[i] = glm::inverse(instances[i].transform);
+		m_InstanceBounds[i] = get_instance_bounds(i);
+	}
+	m_BVH.build(m_InstanceBounds, 1);
+	m_RefitPending = false;
+}
+
+void SceneBVH::set_transform(uint32_t i, const glm::mat4& transform)
+{
+	m_Instances[i].transform = transform;
+	m_InverseTransforms[i] = glm::inverse(transform);
+	m_InstanceBounds[i] = get_instance_bounds(i);
+	m_RefitPending = true;
+}
+
+void SceneBVH::refit()
+{
+	if (!m_RefitPending)
+		return;
+	m_BVH.refit(m_InstanceBounds);
+	m_RefitPending = false;
+}
+
+BVHBounds SceneBVH::get_instance_bounds(uint32_t i) const
+{
+	// World bounds of the eight transformed corners of the object bounds
+	BVHBounds local = m_Instances[i].mesh->get_bounds();
+	BVHBounds bounds;
+	if (local.is_empty())
+		return bounds;
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner((c & 1) ? local.max.x : local.min.x, (c & 2) ? local.max.y : local.min.y, (c & 4) ? local.max.z : local.min.z);
+		bounds.grow(glm::vec3(m_Instances[i].transform * glm::vec4(corner, 1.0f)));
+	}
+	return bounds;
+}
+
+Ray SceneBVH::to_object_space(const Ray& ray, uint32_t i) const
+{
+	// The direction is not renormalized, so distances stay comparable between instances
+	Ray object_ray;
+	object_ray.origin = glm::vec3(m_InverseTransforms[i] * glm::vec4(ray.origin, 1.0f));
+	object_ray.direction = glm::vec3(m_InverseTransforms[i] * glm::vec4(ray.direction, 0.0f));
+	object_ray.t_max = ray.t_max;
+	return object_ray;
+}
+
+bool SceneBVH::intersect(const Ray& ray, RayHit& hit) const
+{
+	float t_max = std::min(ray.t_max, hit.t);
+	bool found = false;
+	m_BVH.traverse(ray, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t p = first; p < first + count; p++)
+		{
+			uint32_t i = m_BVH.primitives[p];
+			Ray object_ray = to_object_space(ray, i);
+			object_ray.t_max = t_max;
+			if (m_Instances[i].mesh->intersect(object_ray, hit))
+			{
+				t_max = hit.t;
+				hit.instance = m_Instances[i].id;
+				found = true;
+			}
+		}
+		return false;
+	});
+	return found;
+}
+
+bool SceneBVH::occluded(const Ray& ray) const
+{
+	float t_max = ray.t_max;
+	bool found = false;
+	m_BVH.traverse(ray, t_max, [&](uint32_t first, uint32_t count) {
+		for (uint32_t p = first; p < first + count; p++)
+		{
+			uint32_t i = m_BVH.primitives[p];
+			if (m_Instances[i].mesh->occluded(to_object_space(ray, i)))
+				return found = true;
+		}
+		return false;
+	});
+	return found;
+}
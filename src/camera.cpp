@@ -42,4 +42,18 @@ void Camera::move(float dt, int dir) {
         this->position += right * (float) (dt * this->movement_speed);
     if (dir & Direction::LEFT)
         this->position -= right * (float) (dt * this->movement_speed);
+}
+
+glm::mat4 get_top_down_projection(glm::vec3 bounds_min, glm::vec3 bounds_max) {
+    glm::vec3 extent = bounds_max - bounds_min;
+    glm::mat4 projection(0.0f);
+    projection[0][0] = 2.0f / extent.x; // x -> clip x
+    projection[2][1] = 2.0f / extent.z; // z -> clip y
+    projection[1][2] = 2.0f / extent.y; // y -> clip z
+    projection[3] = glm::vec4(
+        -2.0f * bounds_min.x / extent.x - 1.0f,
+        -2.0f * bounds_min.z / extent.z - 1.0f,
+        -2.0f * bounds_min.y / extent.y - 1.0f,
+        1.0f);
+    return projection;
 }
\ No newline at end of file
@@ -0,0 +1,122 @@
+#include "commandbuffer.h"
+
+#include "gl_helpers.h"
+
+/* COMMAND PAYLOADS */
+struct BindShaderCommand { Shader* shader; };
+struct BindModelCommand { RawModel* model; };
+struct BindTextureCommand { uint32_t slot; GLuint texture; };
+struct SetIntCommand { GLint location; int value; };
+struct SetUIntCommand { GLint location; uint32_t value; };
+struct SetFloat3Command { GLint location; glm::vec3 value; };
+struct SetMatrix4Command { GLint location; glm::mat4 value; };
+
+void CommandBuffer::bind_shader(Shader* shader)
+{
+	push(RenderCommandType::BIND_SHADER, BindShaderCommand{ shader });
+}
+
+void CommandBuffer::bind_model(RawModel* model)
+{
+	if (model == m_RecordedModel)
+		return;
+	m_RecordedModel = model;
+	push(RenderCommandType::BIND_MODEL, BindModelCommand{ model });
+}
+
+void CommandBuffer::bind_texture(uint32_t slot, GLuint texture)
+{
+	push(RenderCommandType::BIND_TEXTURE, BindTextureCommand{ slot, texture });
+}
+
+void CommandBuffer::set_int(GLint location, int value)
+{
+	push(RenderCommandType::SET_INT, SetIntCommand{ location, value });
+}
+
+void CommandBuffer::set_uint(GLint location, uint32_t value)
+{
+	push(RenderCommandType::SET_UINT, SetUIntCommand{ location, value });
+}
+
+void CommandBuffer::set_float3(GLint location, const glm::vec3& value)
+{
+	push(RenderCommandType::SET_FLOAT3, SetFloat3Command{ location, value });
+}
+
+void CommandBuffer::set_matrix4(GLint location, const glm::mat4& value)
+{
+	push(RenderCommandType::SET_MATRIX4, SetMatrix4Command{ location, value });
+}
+
+void CommandBuffer::draw()
+{
+	m_Data.push_back((uint8_t)RenderCommandType::DRAW);
+}
+
+// Payloads are unaligned in the buffer, copy them out before use
+template<typename T>
+static T read_payload(const uint8_t*& cursor)
+{
+	T payload;
+	std::memcpy(&payload, cursor, sizeof(T));
+	cursor += sizeof(T);
+	return payload;
+}
+
+void CommandBuffer::replay() const
+{
+	RawModel* model = nullptr;
+	const uint8_t* cursor = m_Data.data();
+	const uint8_t* end = cursor + m_Data.size();
+	while (cursor < end)
+	{
+		RenderCommandType type = (RenderCommandType)*cursor++;
+		switch (type)
+		{
+		case RenderCommandType::BIND_SHADER:
+			read_payload<BindShaderCommand>(cursor).shader->bind();
+			break;
+		case RenderCommandType::BIND_MODEL:
+			model = read_payload<BindModelCommand>(cursor).model;
+			model->bind();
+			break;
+		case RenderCommandType::BIND_TEXTURE:
+		{
+			BindTextureCommand command = read_payload<BindTextureCommand>(cursor);
+			GL_CHECK(glActiveTexture(GL_TEXTURE0 + command.slot));
+			GL_CHECK(glBindTexture(GL_TEXTURE_2D, command.texture));
+			break;
+		}
+		case RenderCommandType::SET_INT:
+		{
+			SetIntCommand command = read_payload<SetIntCommand>(cursor);
+			GL_CHECK(glUniform1i(command.location, command.value));
+			break;
+		}
+		case RenderCommandType::SET_UINT:
+		{
+			SetUIntCommand command = read_payload<SetUIntCommand>(cursor);
+			GL_CHECK(glUniform1ui(command.location, command.value));
+			break;
+		}
+		case RenderCommandType::SET_FLOAT3:
+		{
+			SetFloat3Command command = read_payload<SetFloat3Command>(cursor);
+			GL_CHECK(glUniform3fv(command.location, 1, &command.value[0]));
+			break;
+		}
+		case RenderCommandType::SET_MATRIX4:
+		{
+			SetMatrix4Command command = read_payload<SetMatrix4Command>(cursor);
+			GL_CHECK(glUniformMatrix4fv(command.location, 1, GL_FALSE, &command.value[0][0]));
+			break;
+		}
+		case RenderCommandType::DRAW:
+			model->draw();
+			break;
+		}
+	}
+	if (model)
+		model->unbind();
+}
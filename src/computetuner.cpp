@@ -0,0 +1,136 @@
+#include "computetuner.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "assets.h"
+#include "gl_helpers.h"
+
+// One warm-up dispatch, then the fastest of the timed dispatches counts
+static constexpr int TUNING_RUNS = 5;
+static const char* TUNING_CACHE_FILE = "compute_tuning.cache";
+
+void ComputeTuner::Init()
+{
+	ComputeTuner& tuner = Instance();
+	tuner.m_Device = std::string((const char*)glGetString(GL_RENDERER)) + " / " + (const char*)glGetString(GL_VERSION);
+
+	int work_group_sizes[3];
+	int work_group_invocations;
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &work_group_sizes[0]);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &work_group_sizes[1]);
+	glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 2, &work_group_sizes[2]);
+	glGetIntegerv(GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS, &work_group_invocations);
+	std::cout << "GL_MAX_COMPUTE_WORK_GROUP_SIZE: " << work_group_sizes[0] << ", " << work_group_sizes[1] << ", " << work_group_sizes[2] << std::endl;
+	std::cout << "GL_MAX_COMPUTE_WORK_GROUP_INVOCATIONS: " << work_group_invocations << std::endl;
+	tuner.m_MaxLocalSize = (uint32_t)std::min(work_group_sizes[0], work_group_invocations);
+
+	// Lines of: device \t kernel \t local size. Lines that do not parse are skipped, their kernels are re-tuned.
+	std::ifstream in(AssetManager::GetCachePath().append(TUNING_CACHE_FILE));
+	std::string line;
+	while (std::getline(in, line))
+	{
+		size_t size_pos = line.find_last_of('\t');
+		if (size_pos == std::string::npos)
+			continue;
+		const char* size_begin = line.c_str() + size_pos + 1;
+		char* size_end = nullptr;
+		unsigned long local_size = std::strtoul(size_begin, &size_end, 10);
+		if (size_end == size_begin || *size_end != '\0' || local_size == 0 || local_size > tuner.m_MaxLocalSize)
+		{
+			std::cout << "Error: Skipping malformed line in " << TUNING_CACHE_FILE << ": " << line << std::endl;
+			continue;
+		}
+		tuner.m_Results[line.substr(0, size_pos)] = (uint32_t)local_size;
+	}
+}
+
+ComputeKernel ComputeTuner::Tune(const char* file_name, const std::string& defines, const std::vector<uint32_t>& candidate_sizes,
+	const std::function<void(const ComputeKernel&)>& dispatch)
+{
+	ComputeTuner& tuner = Instance();
+	std::string key = GetCacheKey(file_name, defines);
+	// A cached size that is no longer a candidate, e.g. from an edited cache file, is re-tuned
+	auto result = tuner.m_Results.find(key);
+	if (result != tuner.m_Results.end() && std::find(candidate_sizes.begin(), candidate_sizes.end(), result->second) != candidate_sizes.end())
+		return GetKernel(file_name, defines, result->second);
+
+	GLuint query;
+	GL_CHECK(glGenQueries(1, &query));
+
+	ComputeKernel best_kernel;
+	GLuint64 best_time = std::numeric_limits<GLuint64>::max();
+	for (uint32_t local_size : candidate_sizes)
+	{
+		if (local_size > tuner.m_MaxLocalSize)
+			continue;
+
+		ComputeKernel kernel = GetKernel(file_name, defines, local_size);
+		dispatch(kernel);
+
+		GLuint64 kernel_time = std::numeric_limits<GLuint64>::max();
+		for (int run = 0; run < TUNING_RUNS; run++)
+		{
+			GL_CHECK(glBeginQuery(GL_TIME_ELAPSED, query));
+			dispatch(kernel);
+			GL_CHECK(glEndQuery(GL_TIME_ELAPSED));
+			GLuint64 elapsed = 0;
+			GL_CHECK(glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed));
+			kernel_time = std::min(kernel_time, elapsed);
+		}
+
+		std::cout << "Compute tuning: " << file_name << " local size " << local_size << ": " << kernel_time / 1000.0 << "us" << std::endl;
+		if (kernel_time < best_time)
+		{
+			best_time = kernel_time;
+			best_kernel = kernel;
+		}
+	}
+	GL_CHECK(glDeleteQueries(1, &query));
+
+	if (!best_kernel.shader)
+	{
+		std::cout << "Error: No candidate local size of " << file_name << " fits the device limit " << tuner.m_MaxLocalSize << std::endl;
+		exit(1);
+	}
+
+	tuner.m_Results[key] = best_kernel.local_size;
+	SaveCache();
+	return best_kernel;
+}
+
+ComputeKernel ComputeTuner::GetKernel(const char* file_name, const std::string& defines, uint32_t local_size)
+{
+	ComputeKernel kernel;
+	kernel.shader = AssetManager::GetShader(file_name, defines + "#define LOCAL_SIZE_X " + std::to_string(local_size) + "\n");
+	kernel.local_size = local_size;
+	return kernel;
+}
+
+std::string ComputeTuner::GetCacheKey(const char* file_name, const std::string& defines)
+{
+	// FNV-1a, unlike std::hash the same on every standard library and build
+	uint64_t hash = 14695981039346656037ull;
+	for (char c : defines)
+		hash = (hash ^ (uint8_t)c) * 1099511628211ull;
+
+	std::ostringstream key;
+	key << Instance().m_Device << '\t' << file_name << ' ' << std::hex << hash;
+	return key.str();
+}
+
+void ComputeTuner::SaveCache()
+{
+	std::ofstream out(AssetManager::GetCachePath().append(TUNING_CACHE_FILE));
+	if (!out)
+	{
+		std::cout << "Error: Could not write " << TUNING_CACHE_FILE << std::endl;
+		return;
+	}
+	for (auto& [key, local_size] : Instance().m_Results)
+		out << key << '\t' << local_size << '\n';
+}
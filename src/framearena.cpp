@@ -0,0 +1,94 @@
+#include "framearena.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+FrameArena::~FrameArena()
+{
+	for (Block& block : m_Blocks)
+		std::free(block.data);
+}
+
+FrameArena& FrameArena::Get()
+{
+	static thread_local FrameArena arena;
+	return arena;
+}
+
+// Offset from data of the first address at or after data + offset that is a multiple of alignment
+static size_t align_offset(const uint8_t* data, size_t offset, size_t alignment)
+{
+	uintptr_t address = (uintptr_t)(data + offset);
+	return offset + (((address + alignment - 1) & ~(uintptr_t)(alignment - 1)) - address);
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+	while (m_Block < m_Blocks.size())
+	{
+		Block& block = m_Blocks[m_Block];
+		size_t offset = align_offset(block.data, m_Offset, alignment);
+		if (offset + size <= block.size)
+		{
+			m_Offset = offset + size;
+			return block.data + offset;
+		}
+		m_Block++;
+		m_Offset = 0;
+	}
+
+	// Out of blocks, oversized allocations get a block of their own
+	size_t block_size = std::max(BLOCK_SIZE, size + alignment);
+	uint8_t* data = (uint8_t*)std::malloc(block_size);
+	if (!data)
+		throw std::bad_alloc();
+	m_Blocks.push_back({ data, block_size });
+	m_Block = (uint32_t)m_Blocks.size() - 1;
+
+	size_t offset = align_offset(data, 0, alignment);
+	m_Offset = offset + size;
+	return data + offset;
+}
+
+size_t FrameArena::get_capacity() const
+{
+	size_t capacity = 0;
+	for (const Block& block : m_Blocks)
+		capacity += block.size;
+	return capacity;
+}
+
+#ifdef TRACK_HEAP_ALLOCATIONS
+static std::atomic<uint64_t> s_HeapAllocations = 0;
+
+uint64_t get_heap_allocation_count()
+{
+	return s_HeapAllocations.load(std::memory_order_relaxed);
+}
+
+// The nothrow and array forms forward to these by default
+void* operator new(size_t size)
+{
+	s_HeapAllocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+#else
+uint64_t get_heap_allocation_count()
+{
+	return 0;
+}
+#endif
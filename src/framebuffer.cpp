@@ -74,6 +74,8 @@ uint32_t GetGLInternalFormat(ColorFormat fmt)
         return GL_RGBA32F;
     case R32UI:
         return GL_R32UI;
+    case R8:
+        return GL_R8;
     default:
         std::cout << "Error: Color format '" << fmt << "' is invalid" << std::endl;
         return 0;
@@ -94,6 +96,8 @@ uint32_t GetGLDataFormat(ColorFormat fmt)
         return GL_RGBA;
     case R32UI:
         return GL_RED_INTEGER;
+    case R8:
+        return GL_RED;
     default:
         std::cout << "Error: Color format '" << fmt << "' is invalid" << std::endl;
         return 0;
@@ -113,6 +117,8 @@ uint32_t GetGLDataType(ColorFormat fmt)
         return GL_FLOAT;
     case R32UI:
         return GL_UNSIGNED_INT;
+    case R8:
+        return GL_UNSIGNED_BYTE;
     default:
         std::cout << "Error: Color format '" << fmt << "' is invalid" << std::endl;
         return 0;
@@ -0,0 +1,242 @@
+#include "grass.h"
+
+#include <algorithm>
+
+#include "camera.h"
+#include "gl_helpers.h"
+
+GrassDensityMap::GrassDensityMap(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max)
+	: m_Resolution(resolution), m_BoundsMin(bounds_min), m_BoundsMax(bounds_max)
+{
+	m_Baked.resize(resolution * resolution, 255);
+	m_Painted.resize(resolution * resolution, 255);
+	m_Combined.resize(resolution * resolution, 255);
+
+	FrameBufferCreateInfo bake_cinfo;
+	bake_cinfo.width = bake_cinfo.height = resolution;
+	bake_cinfo.attachment_bits = AttachmentType::COLOR;
+	bake_cinfo.num_color_attachments = 1;
+	FrameBufferTextureCreateInfo bake_tex_cinfo = { ColorFormat::R8, GL_NEAREST, GL_NEAREST };
+	bake_cinfo.color_attachment_infos = &bake_tex_cinfo;
+	m_BakeBuffer = new FrameBuffer(bake_cinfo);
+
+	GL_CHECK(glGenTextures(1, &m_Handle));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handle));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+	GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, resolution, resolution, 0, GL_RED, GL_UNSIGNED_BYTE, NULL));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+
+	upload();
+}
+
+GrassDensityMap::~GrassDensityMap()
+{
+	delete m_BakeBuffer;
+	glDeleteTextures(1, &m_Handle);
+}
+
+glm::mat4 GrassDensityMap::begin_bake(float max_height)
+{
+	m_BakeBuffer->bind();
+	GL_CHECK(glClearColor(1.0, 1.0, 1.0, 1.0));
+	GL_CHECK(glClear(GL_COLOR_BUFFER_BIT));
+	GL_CHECK(glDisable(GL_DEPTH_TEST));
+	GL_CHECK(glDisable(GL_CULL_FACE));
+
+	glm::vec3 bake_min(m_BoundsMin.x, m_BoundsMin.y, m_BoundsMin.z);
+	glm::vec3 bake_max(m_BoundsMax.x, m_BoundsMin.y + max_height, m_BoundsMax.z);
+	return get_top_down_projection(bake_min, bake_max);
+}
+
+void GrassDensityMap::end_bake()
+{
+	GL_CHECK(glReadBuffer(GL_COLOR_ATTACHMENT0));
+	GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+	GL_CHECK(glReadPixels(0, 0, m_Resolution, m_Resolution, GL_RED, GL_UNSIGNED_BYTE, m_Baked.data()));
+	GL_CHECK(glPixelStorei(GL_PACK_ALIGNMENT, 4));
+	m_BakeBuffer->unbind();
+
+	GL_CHECK(glEnable(GL_DEPTH_TEST));
+	GL_CHECK(glEnable(GL_CULL_FACE));
+
+	upload();
+}
+
+void GrassDensityMap::paint(glm::vec2 world_xz, float radius, float density)
+{
+	glm::vec2 bounds_min(m_BoundsMin.x, m_BoundsMin.z);
+	glm::vec2 bounds_max(m_BoundsMax.x, m_BoundsMax.z);
+	glm::vec2 texel_size = (bounds_max - bounds_min) / (float)m_Resolution;
+
+	glm::ivec2 min_texel = glm::max(glm::ivec2((world_xz - radius - bounds_min) / texel_size), glm::ivec2(0));
+	glm::ivec2 max_texel = glm::min(glm::ivec2((world_xz + radius - bounds_min) / texel_size), glm::ivec2(m_Resolution - 1));
+
+	uint8_t value = (uint8_t)(glm::clamp(density, 0.0f, 1.0f) * 255.0f);
+	for (int y = min_texel.y; y <= max_texel.y; y++)
+	{
+		for (int x = min_texel.x; x <= max_texel.x; x++)
+		{
+			glm::vec2 texel_center = bounds_min + (glm::vec2(x, y) + 0.5f) * texel_size;
+			if (glm::distance(texel_center, world_xz) <= radius)
+				m_Painted[y * m_Resolution + x] = value;
+		}
+	}
+	upload();
+}
+
+void GrassDensityMap::clear_paint()
+{
+	std::fill(m_Painted.begin(), m_Painted.end(), 255);
+	upload();
+}
+
+void GrassDensityMap::upload()
+{
+	for (size_t i = 0; i < m_Combined.size(); i++)
+		m_Combined[i] = (uint8_t)((m_Baked[i] * m_Painted[i]) / 255);
+
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handle));
+	GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+	GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_Resolution, m_Resolution, GL_RED, GL_UNSIGNED_BYTE, m_Combined.data()));
+	GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+GrassTrampleMap::GrassTrampleMap(uint32_t resolution, float world_size)
+	: m_Resolution(resolution), m_WorldSize(world_size)
+{
+	GL_CHECK(glGenTextures(2, m_Handles));
+	for (int i = 0; i < 2; i++)
+	{
+		GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handles[i]));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER));
+		float border_color[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		GL_CHECK(glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border_color));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, resolution, resolution));
+		float zero[] = { 0.0f, 0.0f };
+		GL_CHECK(glClearTexImage(m_Handles[i], 0, GL_RG, GL_FLOAT, zero));
+	}
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+GrassTrampleMap::~GrassTrampleMap()
+{
+	glDeleteTextures(2, m_Handles);
+}
+
+void GrassTrampleMap::update(float dt, glm::vec3 center, const glm::vec4* footprints, uint32_t num_footprints, Shader& trample_cs)
+{
+	glm::ivec2 origin_texel = glm::ivec2(glm::floor(glm::vec2(center.x, center.z) / get_texel_size())) - glm::ivec2(m_Resolution / 2);
+	glm::ivec2 shift = origin_texel - m_OriginTexel;
+	m_OriginTexel = origin_texel;
+
+	num_footprints = glm::min(num_footprints, (uint32_t)MAX_FOOTPRINTS);
+	glm::vec2 origin = get_origin();
+
+	trample_cs.bind();
+	trample_cs.set_float("u_TimeDelta", dt);
+	trample_cs.set_float("u_RecoveryRate", recovery_rate);
+	trample_cs.set_float("u_GroundHeight", ground_height);
+	trample_cs.set_int2("u_Shift", shift.x, shift.y);
+	trample_cs.set_float2("u_Origin", origin.x, origin.y);
+	trample_cs.set_float("u_TexelSize", get_texel_size());
+	trample_cs.set_int("u_NumFootprints", num_footprints);
+	if (num_footprints > 0)
+		trample_cs.set_float4v("u_Footprints", num_footprints, &footprints[0][0]);
+
+	int previous = m_Current;
+	m_Current = 1 - m_Current;
+	trample_cs.set_int("u_PreviousMap", 0);
+	GL_CHECK(glActiveTexture(GL_TEXTURE0));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handles[previous]));
+	GL_CHECK(glBindImageTexture(0, m_Handles[m_Current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F));
+
+	GL_CHECK(glDispatchCompute((m_Resolution + 16 - 1) / 16, (m_Resolution + 16 - 1) / 16, 1));
+	GL_CHECK(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+	trample_cs.unbind();
+}
+
+GrassTileVisibility::GrassTileVisibility(uint32_t tiles_per_dim, glm::vec3 bounds_min, glm::vec3 bounds_max)
+	: m_TilesPerDim(tiles_per_dim), m_BoundsMin(bounds_min), m_BoundsMax(bounds_max)
+{
+	m_Visibility.resize(tiles_per_dim * tiles_per_dim, 255);
+
+	GL_CHECK(glGenTextures(1, &m_Handle));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handle));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, tiles_per_dim, tiles_per_dim, 0, GL_RED, GL_UNSIGNED_BYTE, NULL));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+
+	upload();
+}
+
+GrassTileVisibility::~GrassTileVisibility()
+{
+	glDeleteTextures(1, &m_Handle);
+}
+
+void GrassTileVisibility::update(const OcclusionBuffer& occlusion, const glm::mat4& view_projection)
+{
+	const float padding = TILE_PADDING;
+	glm::vec2 tile_size = glm::vec2(m_BoundsMax.x - m_BoundsMin.x, m_BoundsMax.z - m_BoundsMin.z) / (float)m_TilesPerDim;
+	for (uint32_t z = 0; z < m_TilesPerDim; z++)
+	{
+		for (uint32_t x = 0; x < m_TilesPerDim; x++)
+		{
+			glm::vec3 tile_min(m_BoundsMin.x + x * tile_size.x - padding, m_BoundsMin.y, m_BoundsMin.z + z * tile_size.y - padding);
+			glm::vec3 tile_max(tile_min.x + tile_size.x + 2.0f * padding, m_BoundsMin.y + max_blade_height, tile_min.z + tile_size.y + 2.0f * padding);
+			m_Visibility[z * m_TilesPerDim + x] = occlusion.is_occluded(tile_min, tile_max, view_projection) ? 0 : 255;
+		}
+	}
+	upload();
+}
+
+void GrassTileVisibility::cull(const HiZPyramid& hiz, const glm::mat4& view_projection, Shader& tile_cull_cs)
+{
+	tile_cull_cs.bind();
+	tile_cull_cs.set_matrix4fv("u_ViewProjection", &view_projection[0][0]);
+	tile_cull_cs.set_int("u_TilesPerDim", m_TilesPerDim);
+	tile_cull_cs.set_float3("u_BoundsMin", m_BoundsMin.x, m_BoundsMin.y, m_BoundsMin.z);
+	tile_cull_cs.set_float3("u_BoundsMax", m_BoundsMax.x, m_BoundsMax.y, m_BoundsMax.z);
+	tile_cull_cs.set_float("u_TilePadding", TILE_PADDING);
+	tile_cull_cs.set_float("u_MaxBladeHeight", max_blade_height);
+	hiz.set_uniforms(tile_cull_cs, 0);
+	GL_CHECK(glBindImageTexture(0, m_Handle, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8));
+
+	GL_CHECK(glDispatchCompute((m_TilesPerDim + 7) / 8, (m_TilesPerDim + 7) / 8, 1));
+	// Sampled by the grass vertex stage
+	GL_CHECK(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT));
+	tile_cull_cs.unbind();
+
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+void GrassTileVisibility::clear()
+{
+	std::fill(m_Visibility.begin(), m_Visibility.end(), 255);
+	upload();
+}
+
+void GrassTileVisibility::upload()
+{
+	m_NumVisible = (uint32_t)std::count(m_Visibility.begin(), m_Visibility.end(), 255);
+
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handle));
+	GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+	GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_TilesPerDim, m_TilesPerDim, GL_RED, GL_UNSIGNED_BYTE, m_Visibility.data()));
+	GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
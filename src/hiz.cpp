@@ -0,0 +1,68 @@
+#include "hiz.h"
+
+#include "assets.h"
+#include "gl_helpers.h"
+
+HiZPyramid::HiZPyramid(uint32_t width, uint32_t height)
+	: m_Width(width), m_Height(height)
+{
+	m_NumLevels = 1;
+	while ((glm::max(width, height) >> m_NumLevels) > 0)
+		m_NumLevels++;
+
+	GL_CHECK(glGenTextures(1, &m_Texture));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Texture));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, m_NumLevels, GL_R32F, width, height));
+	// Far plane everywhere until the first build, nothing is culled
+	float far_depth = 1.0f;
+	for (uint32_t level = 0; level < m_NumLevels; level++)
+		GL_CHECK(glClearTexImage(m_Texture, level, GL_RED, GL_FLOAT, &far_depth));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+HiZPyramid::~HiZPyramid()
+{
+	glDeleteTextures(1, &m_Texture);
+}
+
+void HiZPyramid::build(GLuint depth_texture, Shader& downsample_cs)
+{
+	downsample_cs.bind();
+	downsample_cs.set_int("u_Source", 0);
+	GL_CHECK(glActiveTexture(GL_TEXTURE0));
+
+	/* LEVEL 0: copy of the depth buffer, then one 8x8 group per 8x8 texels of every level */
+	for (uint32_t level = 0; level < m_NumLevels; level++)
+	{
+		uint32_t width = glm::max(m_Width >> level, 1u);
+		uint32_t height = glm::max(m_Height >> level, 1u);
+		downsample_cs.set_int("u_SourceLevel", (int)level - 1);
+		GL_CHECK(glBindTexture(GL_TEXTURE_2D, level == 0 ? depth_texture : m_Texture));
+		GL_CHECK(glBindImageTexture(0, m_Texture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+		GL_CHECK(glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1));
+		// The next level fetches this one
+		GL_CHECK(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+	}
+	downsample_cs.unbind();
+
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+void HiZPyramid::set_uniforms(Shader& shader, uint32_t slot) const
+{
+	shader.set_int("u_HiZ", slot);
+	shader.set_int("u_HiZLevels", m_NumLevels);
+	GL_CHECK(glActiveTexture(GL_TEXTURE0 + slot));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Texture));
+}
+
+const std::string& get_hiz_shader_defines()
+{
+	static const std::string defines = AssetManager::ReadFile(std::filesystem::path(AssetManager::GetShaderPath()).append("hiz_occluded.glsl"));
+	return defines;
+}
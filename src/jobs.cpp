@@ -0,0 +1,167 @@
+#include "jobs.h"
+
+#include <algorithm>
+
+#include "framearena.h"
+
+// Queue of the current thread, 0 for threads that are not workers
+static thread_local uint32_t s_WorkerIndex = 0;
+
+void JobSystem::Init(uint32_t num_workers)
+{
+	JobSystem& system = Instance();
+	if (!system.m_Queues.empty())
+		return;
+
+	if (num_workers == 0)
+		num_workers = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+
+	system.m_Stop = false;
+	for (uint32_t i = 0; i < num_workers + 1; i++)
+		system.m_Queues.push_back(std::make_unique<WorkerQueue>());
+	for (uint32_t i = 1; i < num_workers + 1; i++)
+		system.m_Workers.emplace_back(&JobSystem::WorkerLoop, i);
+}
+
+void JobSystem::Destroy()
+{
+	JobSystem& system = Instance();
+	{
+		std::lock_guard<std::mutex> lock(system.m_WakeMutex);
+		system.m_Stop = true;
+	}
+	system.m_WakeCondition.notify_all();
+	for (std::thread& worker : system.m_Workers)
+		worker.join();
+	system.m_Workers.clear();
+
+	// Leftovers run on the calling thread, nobody waits on a counter that never finishes
+	while (TryRunJob(0));
+	system.m_Queues.clear();
+}
+
+void JobSystem::Run(Job job, JobCounter* counter)
+{
+	JobSystem& system = Instance();
+	if (counter)
+		counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+	QueuedJob queued = { std::move(job), counter };
+	if (system.m_Workers.empty())
+	{
+		Execute(queued);
+		return;
+	}
+
+	WorkerQueue& queue = *system.m_Queues[s_WorkerIndex];
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(std::move(queued));
+	}
+	system.m_NumQueued.fetch_add(1);
+	// Taking the lock orders the increment before a worker's check of it, no wakeup is lost
+	{
+		std::lock_guard<std::mutex> lock(system.m_WakeMutex);
+	}
+	system.m_WakeCondition.notify_one();
+}
+
+void JobSystem::ParallelFor(uint32_t count, uint32_t grain_size, const RangeJob& job)
+{
+	if (count == 0)
+		return;
+	if (grain_size == 0)
+		grain_size = std::max(count / (4 * GetNumThreads()), 1u);
+	if (count <= grain_size || Instance().m_Workers.empty())
+	{
+		job(0, count);
+		return;
+	}
+
+	JobCounter counter;
+	for (uint32_t begin = grain_size; begin < count; begin += grain_size)
+	{
+		uint32_t end = std::min(begin + grain_size, count);
+		Run([&job, begin, end]() { job(begin, end); }, &counter);
+	}
+	// The first range runs here, the thread would only wait otherwise
+	job(0, grain_size);
+	Wait(counter);
+}
+
+void JobSystem::Wait(JobCounter& counter)
+{
+	while (!counter.is_done())
+	{
+		if (!TryRunJob(s_WorkerIndex))
+			std::this_thread::yield();
+	}
+}
+
+uint32_t JobSystem::GetNumThreads()
+{
+	return (uint32_t)Instance().m_Workers.size() + 1;
+}
+
+void JobSystem::WorkerLoop(uint32_t worker_index)
+{
+	JobSystem& system = Instance();
+	s_WorkerIndex = worker_index;
+	while (true)
+	{
+		if (TryRunJob(worker_index))
+			continue;
+
+		std::unique_lock<std::mutex> lock(system.m_WakeMutex);
+		system.m_WakeCondition.wait(lock, [&]() { return system.m_NumQueued.load() > 0 || system.m_Stop; });
+		if (system.m_Stop)
+			return;
+	}
+}
+
+bool JobSystem::TryRunJob(uint32_t worker_index)
+{
+	JobSystem& system = Instance();
+	uint32_t num_queues = (uint32_t)system.m_Queues.size();
+	if (num_queues == 0)
+		return false;
+
+	QueuedJob queued;
+	bool found = false;
+	// Own queue first, then the others starting with the next one so thieves spread out
+	for (uint32_t i = 0; i < num_queues && !found; i++)
+	{
+		WorkerQueue& queue = *system.m_Queues[(worker_index + i) % num_queues];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+		if (i == 0)
+		{
+			queued = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			queued = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+		}
+		found = true;
+	}
+	if (!found)
+		return false;
+
+	system.m_NumQueued.fetch_sub(1);
+	Execute(queued);
+	return true;
+}
+
+void JobSystem::Execute(QueuedJob& queued)
+{
+	// Jobs nest on the stack of a waiting thread, each one frees exactly what it allocated
+	FrameArena& arena = FrameArena::Get();
+	FrameArena::Marker marker = arena.get_marker();
+	queued.job();
+	arena.release(marker);
+	if (queued.counter)
+		queued.counter->pending.fetch_sub(1, std::memory_order_release);
+}
@@ -0,0 +1,426 @@
+#include "lightmap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+
+#include "jobs.h"
+
+static constexpr float PI = 3.14159265f;
+
+// More than this fraction of overlapping texels or degenerate triangles rejects the mesh UVs
+static constexpr float MAX_UV_OVERLAP = 0.01f;
+
+static bool has_unique_uvs(const ModelData& data)
+{
+	const int resolution = 128;
+	std::vector<uint8_t> coverage(resolution * resolution, 0);
+	size_t num_triangles = data.indices.size() / 3;
+	size_t num_covered = 0, num_overlapping = 0, num_degenerate = 0;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		glm::vec2 uv[3];
+		for (int i = 0; i < 3; i++)
+		{
+			uv[i] = data.vertices[data.indices[3 * t + i]].uv;
+			if (glm::any(glm::lessThan(uv[i], glm::vec2(-1e-4f))) || glm::any(glm::greaterThan(uv[i], glm::vec2(1.0f + 1e-4f))))
+				return false;
+			uv[i] *= (float)resolution;
+		}
+
+		float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[1].y - uv[0].y) * (uv[2].x - uv[0].x);
+		if (std::abs(area) < 1e-8f)
+		{
+			num_degenerate++;
+			continue;
+		}
+		if (area < 0.0f)
+			std::swap(uv[1], uv[2]);
+
+		glm::ivec2 lo = glm::max(glm::ivec2(glm::floor(glm::min(uv[0], glm::min(uv[1], uv[2])))), glm::ivec2(0));
+		glm::ivec2 hi = glm::min(glm::ivec2(glm::ceil(glm::max(uv[0], glm::max(uv[1], uv[2])))), glm::ivec2(resolution - 1));
+		for (int y = lo.y; y <= hi.y; y++)
+		for (int x = lo.x; x <= hi.x; x++)
+		{
+			glm::vec2 p(x + 0.5f, y + 0.5f);
+			bool inside = true;
+			for (int i = 0; i < 3 && inside; i++)
+			{
+				glm::vec2 a = uv[i];
+				glm::vec2 b = uv[(i + 1) % 3];
+				inside = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x) >= 0.0f;
+			}
+			if (!inside)
+				continue;
+			uint8_t& texel = coverage[y * resolution + x];
+			if (texel)
+				num_overlapping++;
+			else
+				num_covered++;
+			texel = 1;
+		}
+	}
+	return num_overlapping <= MAX_UV_OVERLAP * num_covered && num_degenerate <= MAX_UV_OVERLAP * num_triangles;
+}
+
+void generate_lightmap_uvs(ModelData& data)
+{
+	if (has_unique_uvs(data))
+	{
+		for (Vertex& vertex : data.vertices)
+			vertex.lightmap_uv = vertex.uv;
+		return;
+	}
+
+	// Every triangle needs vertices of its own
+	bool split = data.vertices.size() != data.indices.size();
+	for (size_t i = 0; !split && i < data.indices.size(); i++)
+		split = data.indices[i] != i;
+	if (split)
+	{
+		std::vector<Vertex> vertices;
+		vertices.reserve(data.indices.size());
+		for (size_t i = 0; i < data.indices.size(); i++)
+		{
+			vertices.push_back(data.vertices[data.indices[i]]);
+			data.indices[i] = (uint32_t)i;
+		}
+		data.vertices = std::move(vertices);
+	}
+
+	/* CHARTS: every triangle keeps its shape, longest edge along x, in object space units */
+	struct Chart
+	{
+		glm::vec2 uv[3];
+		glm::vec2 size;
+	};
+	size_t num_triangles = data.indices.size() / 3;
+	std::vector<Chart> charts(num_triangles);
+	double total_area = 0.0;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		glm::vec3 p[3] = { data.vertices[3 * t].position, data.vertices[3 * t + 1].position, data.vertices[3 * t + 2].position };
+		int longest = 0;
+		for (int i = 1; i < 3; i++)
+			if (glm::length(p[(i + 1) % 3] - p[i]) > glm::length(p[(longest + 1) % 3] - p[longest]))
+				longest = i;
+		int i0 = longest, i1 = (longest + 1) % 3, i2 = (longest + 2) % 3;
+		glm::vec3 edge = p[i1] - p[i0];
+		float length = glm::length(edge);
+		// The opposite vertex projects inside the longest edge
+		glm::vec2 apex(0.0f);
+		if (length > 0.0f)
+			apex = glm::vec2(glm::dot(p[i2] - p[i0], edge) / length, glm::length(glm::cross(edge, p[i2] - p[i0])) / length);
+
+		Chart& chart = charts[t];
+		chart.uv[i0] = glm::vec2(0.0f);
+		chart.uv[i1] = glm::vec2(length, 0.0f);
+		chart.uv[i2] = apex;
+		chart.size = glm::vec2(length, apex.y);
+		total_area += (double)chart.size.x * chart.size.y;
+	}
+
+	/* PACK: shelves of charts sorted by height, texel density follows surface area */
+	std::vector<uint32_t> order(num_triangles);
+	for (uint32_t t = 0; t < num_triangles; t++)
+		order[t] = t;
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return charts[a].size.y > charts[b].size.y; });
+
+	// Gap around every chart for dilation and bilinear filtering, relative to the average chart
+	float margin = (float)std::sqrt(total_area / std::max(num_triangles, (size_t)1)) / 8.0f;
+	if (margin <= 0.0f)
+		margin = 1.0f;
+	auto pack = [&](float shelf_width, std::vector<glm::vec2>& origins) {
+		glm::vec2 cursor(0.0f);
+		float shelf_height = 0.0f;
+		float used_width = 0.0f;
+		for (uint32_t t : order)
+		{
+			glm::vec2 size = charts[t].size + 2.0f * margin;
+			if (cursor.x > 0.0f && cursor.x + size.x > shelf_width)
+			{
+				cursor = glm::vec2(0.0f, cursor.y + shelf_height);
+				shelf_height = 0.0f;
+			}
+			origins[t] = cursor + margin;
+			cursor.x += size.x;
+			shelf_height = std::max(shelf_height, size.y);
+			used_width = std::max(used_width, cursor.x);
+		}
+		return std::max(used_width, cursor.y + shelf_height);
+	};
+
+	// The atlas is square, try a few shelf widths around the square root of the padded area
+	double padded_area = 0.0;
+	for (const Chart& chart : charts)
+		padded_area += (double)(chart.size.x + 2.0f * margin) * (chart.size.y + 2.0f * margin);
+	std::vector<glm::vec2> origins(num_triangles), best_origins;
+	float best_side = std::numeric_limits<float>::max();
+	for (int i = 0; i < 8; i++)
+	{
+		float side = pack((float)std::sqrt(padded_area) * (1.0f + 0.1f * i), origins);
+		if (side < best_side)
+		{
+			best_side = side;
+			best_origins = origins;
+		}
+	}
+
+	for (size_t t = 0; t < num_triangles; t++)
+		for (int i = 0; i < 3; i++)
+			data.vertices[3 * t + i].lightmap_uv = (best_origins[t] + charts[t].uv[i]) / best_side;
+}
+
+uint64_t get_lightmap_hash(const ModelData& mesh, const glm::mat4& transform, uint32_t resolution)
+{
+	// FNV-1a
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++)
+			hash = (hash ^ ((const uint8_t*)data)[i]) * 1099511628211ull;
+	};
+	for (const Vertex& vertex : mesh.vertices)
+	{
+		add(&vertex.position, sizeof(vertex.position));
+		add(&vertex.normal, sizeof(vertex.normal));
+		add(&vertex.lightmap_uv, sizeof(vertex.lightmap_uv));
+	}
+	add(mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+	add(&transform, sizeof(transform));
+	add(&resolution, sizeof(resolution));
+	return hash;
+}
+
+static float radical_inverse(uint32_t bits)
+{
+	bits = (bits << 16u) | (bits >> 16u);
+	bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+	bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+	bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+	bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+	return (float)bits * 2.3283064365386963e-10f;
+}
+
+static uint32_t hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	x ^= x >> 16;
+	return x;
+}
+
+void Lightmap::bake(const ModelData& mesh, const glm::mat4& transform, const SceneBVH& scene, uint32_t resolution,
+	const LightmapBakeSettings& settings)
+{
+	width = height = resolution;
+	source_hash = get_lightmap_hash(mesh, transform, resolution);
+	texels.assign((size_t)width * height * 2, 255);
+	std::vector<uint8_t> covered((size_t)width * height, 0);
+
+	glm::mat3 normal_matrix = glm::transpose(glm::inverse(glm::mat3(transform)));
+	size_t num_triangles = mesh.indices.size() / 3;
+
+	// Triangles covering less than two texels are lit by dilation from their neighbours at best
+	size_t num_small = 0;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		glm::vec2 a = mesh.vertices[mesh.indices[3 * t + 0]].lightmap_uv * (float)resolution;
+		glm::vec2 b = mesh.vertices[mesh.indices[3 * t + 1]].lightmap_uv * (float)resolution;
+		glm::vec2 c = mesh.vertices[mesh.indices[3 * t + 2]].lightmap_uv * (float)resolution;
+		if (std::abs((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x)) < 2.0f * 2.0f)
+			num_small++;
+	}
+	if (num_small > 0)
+		std::cout << "Warning: " << num_small << " of " << num_triangles << " lightmap triangles cover less than 2 texels at resolution "
+			<< resolution << ", raise the resolution" << std::endl;
+
+	auto trace_texel = [&](glm::ivec2 texel, glm::vec3 position, glm::vec3 normal) {
+		// Branchless orthonormal basis, Duff et al. 2017
+		float sign = std::copysign(1.0f, normal.z);
+		float a = -1.0f / (sign + normal.z);
+		float b = normal.x * normal.y * a;
+		glm::vec3 tangent(1.0f + sign * normal.x * normal.x * a, sign * b, -sign * normal.x);
+		glm::vec3 bitangent(b, sign + normal.y * normal.y * a, -normal.y);
+
+		// Hammersley points, rotated per texel so neighbouring texels do not share a pattern
+		uint32_t seed = hash(texel.y * width + texel.x);
+		glm::vec2 rotation(hash(seed) * 2.3283064365386963e-10f, hash(seed + 1) * 2.3283064365386963e-10f);
+		uint32_t ao_hits = 0, sky_hits = 0;
+		for (uint32_t i = 0; i < settings.num_rays; i++)
+		{
+			glm::vec2 u = glm::fract(glm::vec2((i + 0.5f) / settings.num_rays, radical_inverse(i)) + rotation);
+			// Cosine weighted hemisphere
+			float r = std::sqrt(u.x);
+			float phi = 2.0f * PI * u.y;
+			glm::vec3 direction = tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + normal * std::sqrt(1.0f - u.x);
+
+			Ray ray;
+			ray.origin = position + normal * settings.bias;
+			ray.direction = direction;
+			ray.t_max = settings.ao_radius;
+			if (scene.occluded(ray))
+			{
+				ao_hits++;
+				sky_hits++;
+				continue;
+			}
+			ray.t_max = std::numeric_limits<float>::max();
+			if (scene.occluded(ray))
+				sky_hits++;
+		}
+
+		size_t i = (size_t)texel.y * width + texel.x;
+		texels[2 * i + 0] = (uint8_t)std::lround(255.0f * (1.0f - (float)ao_hits / settings.num_rays));
+		texels[2 * i + 1] = (uint8_t)std::lround(255.0f * (1.0f - (float)sky_hits / settings.num_rays));
+		covered[i] = 1;
+	};
+
+	/* TRACE: texel centers inside the triangles in lightmap space */
+	auto bake_rows = [&](uint32_t row_offset, uint32_t row_stride) {
+		glm::vec2 size((float)width, (float)height);
+		for (size_t t = 0; t < num_triangles; t++)
+		{
+			const Vertex* v[3];
+			glm::vec2 uv[3];
+			for (int i = 0; i < 3; i++)
+			{
+				v[i] = &mesh.vertices[mesh.indices[3 * t + i]];
+				uv[i] = v[i]->lightmap_uv * size;
+			}
+			float area = (uv[1].x - uv[0].x) * (uv[2].y - uv[0].y) - (uv[1].y - uv[0].y) * (uv[2].x - uv[0].x);
+			if (std::abs(area) < 1e-12f)
+				continue;
+
+			glm::vec3 world[3];
+			glm::vec3 normals[3];
+			for (int i = 0; i < 3; i++)
+			{
+				world[i] = glm::vec3(transform * glm::vec4(v[i]->position, 1.0f));
+				normals[i] = normal_matrix * v[i]->normal;
+			}
+			glm::vec3 face_normal = glm::cross(world[1] - world[0], world[2] - world[0]);
+			if (glm::dot(face_normal, face_normal) == 0.0f)
+				continue;
+			face_normal = glm::normalize(face_normal);
+
+			glm::ivec2 lo = glm::max(glm::ivec2(glm::floor(glm::min(uv[0], glm::min(uv[1], uv[2])))), glm::ivec2(0));
+			glm::ivec2 hi = glm::min(glm::ivec2(glm::ceil(glm::max(uv[0], glm::max(uv[1], uv[2])))), glm::ivec2(width - 1, height - 1));
+			// First row of this job at or after lo.y
+			int first_row = lo.y + (int)((row_stride + row_offset - lo.y % row_stride) % row_stride);
+			for (int y = first_row; y <= hi.y; y += row_stride)
+			for (int x = lo.x; x <= hi.x; x++)
+			{
+				glm::vec2 p(x + 0.5f, y + 0.5f);
+				float w1 = ((p.x - uv[0].x) * (uv[2].y - uv[0].y) - (p.y - uv[0].y) * (uv[2].x - uv[0].x)) / area;
+				float w2 = ((uv[1].x - uv[0].x) * (p.y - uv[0].y) - (uv[1].y - uv[0].y) * (p.x - uv[0].x)) / area;
+				float w0 = 1.0f - w1 - w2;
+				if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f)
+					continue;
+
+				glm::vec3 position = w0 * world[0] + w1 * world[1] + w2 * world[2];
+				glm::vec3 normal = w0 * normals[0] + w1 * normals[1] + w2 * normals[2];
+				normal = glm::dot(normal, normal) > 0.0f ? glm::normalize(normal) : face_normal;
+				trace_texel(glm::ivec2(x, y), position, normal);
+			}
+		}
+	};
+
+	// Interleaved rows balance the load, triangles rarely cover the lightmap evenly
+	uint32_t num_jobs = glm::clamp(JobSystem::GetNumThreads(), 1u, height);
+	JobSystem::ParallelFor(num_jobs, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t job = begin; job < end; job++)
+			bake_rows(job, num_jobs);
+	});
+
+	/* DILATE: uncovered texels take the average of their covered neighbours */
+	for (int pass = 0; pass < 2; pass++)
+	{
+		std::vector<uint8_t> dilated = covered;
+		for (int y = 0; y < (int)height; y++)
+		for (int x = 0; x < (int)width; x++)
+		{
+			size_t i = (size_t)y * width + x;
+			if (covered[i])
+				continue;
+			uint32_t sum[2] = { 0, 0 };
+			uint32_t count = 0;
+			for (int dy = -1; dy <= 1; dy++)
+			for (int dx = -1; dx <= 1; dx++)
+			{
+				int nx = x + dx, ny = y + dy;
+				if (nx < 0 || ny < 0 || nx >= (int)width || ny >= (int)height)
+					continue;
+				size_t n = (size_t)ny * width + nx;
+				if (!covered[n])
+					continue;
+				sum[0] += texels[2 * n + 0];
+				sum[1] += texels[2 * n + 1];
+				count++;
+			}
+			if (count == 0)
+				continue;
+			texels[2 * i + 0] = (uint8_t)(sum[0] / count);
+			texels[2 * i + 1] = (uint8_t)(sum[1] / count);
+			dilated[i] = 1;
+		}
+		covered = std::move(dilated);
+	}
+}
+
+bool Lightmap::save(const std::filesystem::path& file_path) const
+{
+	std::error_code error;
+	std::filesystem::create_directories(file_path.parent_path(), error);
+	std::ofstream out(file_path, std::ios::out | std::ios::binary);
+	if (!out)
+	{
+		std::cout << "Error: Could not write lightmap " << file_path << std::endl;
+		return false;
+	}
+
+	LightmapFileHeader header;
+	header.width = width;
+	header.height = height;
+	header.source_hash = source_hash;
+	out.write((const char*)&header, sizeof(header));
+	out.write((const char*)texels.data(), texels.size());
+	return (bool)out;
+}
+
+bool Lightmap::load(const std::filesystem::path& file_path, uint64_t expected_hash)
+{
+	std::ifstream in(file_path, std::ios::in | std::ios::binary);
+	if (!in)
+		return false;
+
+	LightmapFileHeader expected;
+	LightmapFileHeader header;
+	in.read((char*)&header, sizeof(header));
+	if (!in || !std::equal(header.magic, header.magic + 4, expected.magic) || header.version != expected.version)
+	{
+		std::cout << "Error: " << file_path << " is not a version " << expected.version << " lightmap" << std::endl;
+		return false;
+	}
+	if (header.source_hash != expected_hash)
+	{
+		std::cout << "Lightmap " << file_path << " was baked for another mesh, transform or resolution, bake again" << std::endl;
+		return false;
+	}
+
+	std::vector<uint8_t> data((size_t)header.width * header.height * 2);
+	in.read((char*)data.data(), data.size());
+	if (!in)
+	{
+		std::cout << "Error: Lightmap " << file_path << " is truncated" << std::endl;
+		return false;
+	}
+	width = header.width;
+	height = header.height;
+	source_hash = header.source_hash;
+	texels = std::move(data);
+	return true;
+}
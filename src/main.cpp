@@ -25,6 +25,10 @@
 #include "components.h"
 #include "scene.h"
 #include "assets.h"
+#include "computetuner.h"
+#include "framearena.h"
+#include "jobs.h"
+#include "simulation.h"
 
 Entity g_selected_entity = Entity::Invalid();
 
@@ -33,23 +37,21 @@ bool simulation_pause = false;
 double update_sum = 0.0;
 double draw_sum = 0.0;
 double fps_sum = 0.0;
+// operator new calls during the last frame, on all threads
+uint64_t heap_allocations = 0;
 
 float movement_speed = 15.0;
 float rotation_speed = 100.0;
 
-struct AABB
-{
-  glm::vec3 min;
-  glm::vec3 max;
-};
-
 /** FUNCTIONS */
-void update(const Window& window, double dt, Camera& camera);
+InputSnapshot sample_input();
+void update_camera(const Window& window, double dt, Camera& camera);
 void draw_gui();
 
 int main(void)
 {
     AssetManager::Init();
+    JobSystem::Init();
 
     // FHD: 1920, 1080, 2k: 2560, 1440
     Window window(1920, 1080);
@@ -78,17 +80,13 @@ int main(void)
 
     GL_CHECK(glEnable(GL_CULL_FACE));
     GL_CHECK(glEnable(GL_DEPTH_TEST));
+    // Blending is only enabled by the transparent pass in Scene::Draw
     GL_CHECK(glDisable(GL_BLEND));
-    //GL_CHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
-    // TODO: Draw transparent objects later in the pipeline, such as particles
     GL_CHECK(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
     GL_CHECK(glEnable(GL_LINE_SMOOTH));
 
-    int work_group_sizes[3];
-    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 0, &work_group_sizes[0]);
-    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 1, &work_group_sizes[1]);
-    glGetIntegeri_v(GL_MAX_COMPUTE_WORK_GROUP_SIZE, 2, &work_group_sizes[2]);
-    std::cout << "GL_MAX_COMPUTE_WORK_GROUP_SIZE: " << work_group_sizes[0] << ", " << work_group_sizes[1] << ", " << work_group_sizes[2] << std::endl;
+    // Compute work group sizes are tuned per device on first use
+    ComputeTuner::Init();
 
     glm::vec4 vertex_color(1.0, 1.0, 1.0, 1.0);
     std::vector<Vertex> quad_vertices{
@@ -149,14 +147,19 @@ int main(void)
 
     Scene testScene(window, "TestScene");
 
+    // The .fbx files are parsed in parallel, the entities below only look them up
+    AssetManager::PreloadRawModels({ "wood_workbench.fbx", "stanford-bunny.fbx", "container.fbx", "garage.fbx" });
+
     Texture2D white_tex;
     RawModel quad_raw(quad_vertices, quad_indices, GL_STATIC_DRAW);
     RawModel cube_raw(cube_vertices, cube_indices, GL_STATIC_DRAW);
 
     Entity ground_plane = testScene.CreateEntity("Ground plane");
     {
-        ground_plane.GetComponent<TransformComponent>().transform = glm::rotate(-glm::half_pi<float>(), glm::vec3(1.0, 0.0, 0.0)) * glm::scale(glm::vec3(500, 500, 1)) * glm::mat4(1.0);
+        ground_plane.GetComponent<TransformComponent>().is_static = true;
+        ground_plane.GetComponent<TransformComponent>().set_local(glm::rotate(-glm::half_pi<float>(), glm::vec3(1.0, 0.0, 0.0)) * glm::scale(glm::vec3(500, 500, 1)) * glm::mat4(1.0));
         ground_plane.AddComponent<QuadRendererComponent>().model = &quad_raw;
+        ground_plane.AddComponent<LightmapComponent>(512);
         auto& material = ground_plane.AddComponent<MaterialComponent>().material;
         material._Albedo = white_tex.get_texture_id();
         material._Color = glm::vec4(236, 193, 111, 255) / (255.0f);
@@ -164,8 +167,11 @@ int main(void)
 
     Entity wall = testScene.CreateEntity("Wall");
     {
-        wall.GetComponent<TransformComponent>().transform = glm::translate(glm::vec3(0.0, 2.0, -8.0)) * glm::scale(glm::vec3(25, 3, 1)) * glm::mat4(1.0);
+        wall.GetComponent<TransformComponent>().is_static = true;
+        wall.GetComponent<TransformComponent>().set_local(glm::translate(glm::vec3(0.0, 2.0, -8.0)) * glm::scale(glm::vec3(25, 3, 1)) * glm::mat4(1.0));
         wall.AddComponent<QuadRendererComponent>(&quad_raw);
+        wall.AddComponent<OccluderComponent>(&quad_raw);
+        wall.AddComponent<LightmapComponent>(64);
         auto& material = wall.AddComponent<MaterialComponent>().material;
         material._Albedo = white_tex.get_texture_id();
         material._Color = glm::vec4(236, 193, 111, 255) / (255.0f);
@@ -173,8 +179,10 @@ int main(void)
 
     Entity workbench = testScene.CreateEntity("Workbench");
     {
-        workbench.GetComponent<TransformComponent>().transform = glm::translate(glm::vec3(-8.0, 1.1, 0.0)) * glm::rotate(glm::quarter_pi<float>(), glm::vec3(0, 1, 0)) * glm::mat4(1.0);
+        workbench.GetComponent<TransformComponent>().is_static = true;
+        workbench.GetComponent<TransformComponent>().set_local(glm::translate(glm::vec3(-8.0, 1.1, 0.0)) * glm::rotate(glm::quarter_pi<float>(), glm::vec3(0, 1, 0)) * glm::mat4(1.0));
         workbench.AddComponent<ModelRendererComponent>(AssetManager::GetRawModel("wood_workbench.fbx"));
+        workbench.AddComponent<LightmapComponent>();
         auto& material = workbench.AddComponent<MaterialComponent>().material;
         material._Albedo = AssetManager::GetTexture2D("carpenterbench_albedo.png")->get_texture_id();
         material._Color = glm::vec3(1.0f);
@@ -182,8 +190,13 @@ int main(void)
 
     Entity bunny = testScene.CreateEntity("Bunny");
     {
-        bunny.GetComponent<TransformComponent>().transform = glm::translate(glm::vec3(-8.0, 20.0, 0.0)) * glm::rotate(glm::quarter_pi<float>() / 2.0f, glm::vec3(1, 0, 0)) * glm::mat4(1.0);
+        // Child of the workbench, the world placement is converted into the workbench's space
+        testScene.SetParent(bunny, workbench);
+        glm::mat4 workbench_world = workbench.GetComponent<TransformComponent>().get_local();
+        bunny.GetComponent<TransformComponent>().set_local(glm::inverse(workbench_world) * glm::translate(glm::vec3(-8.0, 20.0, 0.0)) * glm::rotate(glm::quarter_pi<float>() / 2.0f, glm::vec3(1, 0, 0)) * glm::mat4(1.0));
         bunny.AddComponent<ModelRendererComponent>(AssetManager::GetRawModel("stanford-bunny.fbx"));
+        bunny.AddComponent<GrassTramplerComponent>(2.0f);
+        bunny.AddComponent<ParticleEmitterComponent>(EmitterShape::MESH).rate = 200.0f;
         auto& material = bunny.AddComponent<MaterialComponent>().material;
         material._Albedo = white_tex.get_texture_id();
         material._Color = glm::vec3(1.0f);
@@ -191,8 +204,10 @@ int main(void)
 
     Entity container = testScene.CreateEntity("Container");
     {
-        container.GetComponent<TransformComponent>().transform = glm::rotate(glm::half_pi<float>(), glm::vec3(0, 1, 0)) * glm::scale(glm::vec3(1, 1, 1)) * glm::mat4(1.0);
+        container.GetComponent<TransformComponent>().is_static = true;
+        container.GetComponent<TransformComponent>().set_local(glm::rotate(glm::half_pi<float>(), glm::vec3(0, 1, 0)) * glm::scale(glm::vec3(1, 1, 1)) * glm::mat4(1.0));
         container.AddComponent<ModelRendererComponent>(AssetManager::GetRawModel("container.fbx"));
+        container.AddComponent<LightmapComponent>();
         auto& material = container.AddComponent<MaterialComponent>().material;
         material._Albedo = AssetManager::GetTexture2D("container_albedo.png")->get_texture_id();
         material._Color = glm::vec3(1.0f);
@@ -210,16 +225,15 @@ int main(void)
         glm::vec3(1.0),
         glm::vec3(1.0)
     };
-    std::vector<AABB> colliders;
-    for (int i = 0; i < garage_positions.size(); i++)
-    colliders.push_back({ garage_positions[i] - glm::vec3(6.0f, 0.0f, 5.0f) * garage_sizes[i], garage_positions[i] + glm::vec3(5.0f, 5.5f, 5.0f) * garage_sizes[i] });
-
     for (int i = 0; i < garage_positions.size(); i++)
     {
         Entity garage = testScene.CreateEntity("Garage");
         {
-            garage.GetComponent<TransformComponent>().transform = glm::translate(garage_positions[i]) * glm::rotate(-glm::half_pi<float>(), glm::vec3(0, 1, 0)) * glm::scale(garage_sizes[i]) * glm::mat4(1.0);
+            garage.GetComponent<TransformComponent>().is_static = true;
+            garage.GetComponent<TransformComponent>().set_local(glm::translate(garage_positions[i]) * glm::rotate(-glm::half_pi<float>(), glm::vec3(0, 1, 0)) * glm::scale(garage_sizes[i]) * glm::mat4(1.0));
             garage.AddComponent<ModelRendererComponent>(AssetManager::GetRawModel("garage.fbx"));
+            garage.AddComponent<OccluderComponent>();
+            garage.AddComponent<LightmapComponent>(256);
             auto& material = garage.AddComponent<MaterialComponent>().material;
             material._Albedo = AssetManager::GetTexture2D("color_palette.png")->get_texture_id();
             material._Color = glm::vec3(1.0f);
@@ -232,21 +246,32 @@ int main(void)
     std::vector<double> draw_times(fps_wrap);
     std::vector<double> fps(fps_wrap);
     Clock clock;
+    // CPU time of Scene::Draw, measured on the render thread
+    Clock draw_clock;
     GLenum err;
     double start = clock.since_start();
 
-    static float time = 0.0f;
+    // The scene is only touched with its mutex held from here on
+    SimulationLoop simulation(testScene, 60.0f);
+    simulation.start();
+
+    uint64_t last_heap_allocation_count = get_heap_allocation_count();
 
   while (!window.should_close ()) {
-    /** UPDATE BEGIN **/
-    double dt = simulation_pause ? 0 : clock.tick();
-    time += dt;
+    /** INPUT BEGIN **/
+    double dt = clock.tick();
     fps[n++ % fps_wrap] = dt;
-    update(window, dt, camera);
-    testScene.Update();
-    /** UPDATE END **/
-
-    testScene.Draw(camera, window);
+    simulation.submit_input(sample_input());
+    // The camera and GPU effects advance every frame by the frame time, not in simulation ticks
+    double draw_dt = simulation_pause ? 0.0 : dt;
+    update_camera(window, draw_dt, camera);
+    /** INPUT END **/
+
+    const FrameSnapshot& snapshot = simulation.acquire_snapshot();
+    draw_clock.tick();
+    testScene.Draw(snapshot, camera, window, (float)draw_dt);
+    draw_times[n % fps_wrap] = draw_clock.tick();
+    update_times[n % fps_wrap] = simulation.get_tick_time();
 
     update_sum = 0.0;
     draw_sum = 0.0;
@@ -264,12 +289,15 @@ int main(void)
     testScene.DrawGUI(camera);
     /** GUI RENDERING END **/
 
-    camera.set_movement_speed(movement_speed);
-    camera.set_rotation_speed(rotation_speed);
-
-    window.resize(camera);
+    window.resize();
     window.swap_buffers ();
     window.poll_events ();
+
+    // Everything allocated from the frame arena of this thread is dead now
+    FrameArena::Get().reset();
+    uint64_t heap_allocation_count = get_heap_allocation_count();
+    heap_allocations = heap_allocation_count - last_heap_allocation_count;
+    last_heap_allocation_count = heap_allocation_count;
   }
 
 #ifdef __APPLE__
@@ -282,12 +310,26 @@ int main(void)
 
   //pDevice->release();
 
+  simulation.stop();
   AssetManager::Destroy();
+  JobSystem::Destroy();
 
   return 0;
 }
 
-void update(const Window& window, double dt, Camera& camera) {
+InputSnapshot sample_input() {
+  if (Input::IsKeyClicked(Key::P)) { simulation_pause = !simulation_pause; }
+
+  InputSnapshot input;
+  input.paused = simulation_pause;
+  return input;
+}
+
+void update_camera(const Window& window, double dt, Camera& camera) {
+  camera.set_aspect(window.get_width() / (float)window.get_height());
+  camera.set_movement_speed(movement_speed);
+  camera.set_rotation_speed(rotation_speed);
+
   if (Input::IsKeyPressed(Key::LEFT)) camera.rotate_yaw(dt);
   if (Input::IsKeyPressed(Key::RIGHT)) camera.rotate_yaw(-dt);
   if (Input::IsKeyPressed(Key::UP)) camera.rotate_pitch(dt);
@@ -299,16 +341,18 @@ void update(const Window& window, double dt, Camera& camera) {
   if (Input::IsKeyPressed(Key::A)) direction |= Camera::LEFT;
   if (Input::IsKeyPressed(Key::D)) direction |= Camera::RIGHT;
   camera.move(dt, direction);
-
-  if (Input::IsKeyClicked(Key::P)) { simulation_pause = !simulation_pause; }
 }
 
 void draw_gui()
 {
     ImGui::Begin("Settings");
     ImGui::Text("FPS: %f, time: %f (ms)", (1 / fps_sum), fps_sum * 1000);
-    ImGui::Text("Update-time: %f (ms)", update_sum * 1000);
+    ImGui::Text("Simulation tick: %f (ms)", update_sum * 1000);
+    ImGui::Text("Job threads: %u", JobSystem::GetNumThreads());
     ImGui::Text("Draw-time: %f (ms)", draw_sum * 1000);
+#ifdef TRACK_HEAP_ALLOCATIONS
+    ImGui::Text("Heap allocations: %llu per frame", (unsigned long long)heap_allocations);
+#endif
 
     ImGui::Dummy(ImVec2(0.0, 5.0));
     if (ImGui::CollapsingHeader("Camera"))
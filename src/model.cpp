@@ -2,7 +2,9 @@
 
 #include <cassert>
 
-RawModel::RawModel(const std::vector<Vertex>& data, const std::vector<uint32_t>& indices, GLenum usage) : m_Usage(usage) {
+#include "lightmap.h"
+
+RawModel::RawModel(const std::vector<Vertex>& data, const std::vector<uint32_t>& indices, GLenum usage) : m_Data{ data, indices }, m_Usage(usage) {
     assert((indices.size() % 3) == 0);
     int vertex_size = sizeof(Vertex);
 
@@ -11,11 +13,11 @@ RawModel::RawModel(const std::vector<Vertex>& data, const std::vector<uint32_t>&
     glBindVertexArray(m_VAO);
     glGenBuffers(1, &m_VBO);
     glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-    glBufferData(GL_ARRAY_BUFFER, data.size() * vertex_size, &data[0], usage);
+    glBufferData(GL_ARRAY_BUFFER, m_Data.vertices.size() * vertex_size, &m_Data.vertices[0], usage);
     glGenBuffers(1, &m_EBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), &indices[0], usage);
-    m_IndexCount = indices.size();
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_Data.indices.size() * sizeof(uint32_t), &m_Data.indices[0], usage);
+    m_IndexCount = m_Data.indices.size();
 
     // Bind buffers to VAO
     bind();
@@ -26,21 +28,23 @@ RawModel::RawModel(const std::vector<Vertex>& data, const std::vector<uint32_t>&
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, vertex_size, (const void*) offsetof(Vertex, normal));
     glEnableVertexAttribArray(2); // UV
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, vertex_size, (const void*) offsetof(Vertex, uv));
+    glEnableVertexAttribArray(3); // Lightmap UV
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, vertex_size, (const void*) offsetof(Vertex, lightmap_uv));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
     unbind();
 };
 
-RawModel::RawModel(const ModelData& model_data) : m_Usage(GL_STATIC_DRAW)
+RawModel::RawModel(const ModelData& model_data) : m_Data(model_data), m_Usage(GL_STATIC_DRAW)
 {
     glGenVertexArrays(1, &m_VAO);
     glBindVertexArray(m_VAO);
     glGenBuffers(1, &m_VBO);
     glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
-    glBufferData(GL_ARRAY_BUFFER, model_data.vertices.size() * sizeof(Vertex), &model_data.vertices[0], m_Usage);
+    glBufferData(GL_ARRAY_BUFFER, m_Data.vertices.size() * sizeof(Vertex), &m_Data.vertices[0], m_Usage);
     glGenBuffers(1, &m_EBO);
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, model_data.indices.size() * sizeof(uint32_t), &model_data.indices[0], m_Usage);
-    this->m_IndexCount = model_data.indices.size();
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_Data.indices.size() * sizeof(uint32_t), &m_Data.indices[0], m_Usage);
+    this->m_IndexCount = m_Data.indices.size();
 
     // Bind buffers to VAO
     bind();
@@ -51,12 +55,15 @@ RawModel::RawModel(const ModelData& model_data) : m_Usage(GL_STATIC_DRAW)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, normal));
     glEnableVertexAttribArray(2); // UV
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, uv));
+    glEnableVertexAttribArray(3); // Lightmap UV
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const void*)offsetof(Vertex, lightmap_uv));
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_EBO);
     unbind();
 }
 
 RawModel::~RawModel()
 {
+    delete m_BVH;
     glDeleteBuffers(1, &m_VBO);
     glDeleteBuffers(1, &m_EBO);
     glDeleteVertexArrays(1, &m_VAO);
@@ -64,6 +71,10 @@ RawModel::~RawModel()
 
 void RawModel::update_vertex_data(const std::vector<Vertex>& vertices) {
     if (this->m_Usage == GL_DYNAMIC_DRAW || this->m_Usage == GL_STREAM_DRAW) {
+        m_Data.vertices = vertices;
+        // Rebuilt in place, BVH instances keep pointing at it
+        if (m_BVH)
+            *m_BVH = MeshBVH(m_Data);
         this->bind();
         glBufferSubData(GL_ARRAY_BUFFER, 0, vertices.size() * sizeof(Vertex), &vertices[0]);
         this->unbind();
@@ -74,6 +85,10 @@ void RawModel::update_vertex_data(const std::vector<Vertex>& vertices) {
 
 void RawModel::update_index_data(const std::vector<uint32_t>& indices) {
     if (this->m_Usage == GL_DYNAMIC_DRAW || this->m_Usage == GL_STREAM_DRAW) {
+        m_Data.indices = indices;
+        // Rebuilt in place, BVH instances keep pointing at it
+        if (m_BVH)
+            *m_BVH = MeshBVH(m_Data);
         this->bind();
         m_IndexCount = indices.size();
         glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, indices.size() * sizeof(uint32_t), &indices[0]);
@@ -83,6 +98,37 @@ void RawModel::update_index_data(const std::vector<uint32_t>& indices) {
     }
 }
 
+void RawModel::ensure_lightmap_uvs()
+{
+    if (m_HasLightmapUVs)
+        return;
+    m_HasLightmapUVs = true;
+
+    size_t num_vertices = m_Data.vertices.size();
+    generate_lightmap_uvs(m_Data);
+    // Split vertices change the size of both buffers, the triangles stay the same
+    bind();
+    glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+    if (m_Data.vertices.size() != num_vertices)
+    {
+        glBufferData(GL_ARRAY_BUFFER, m_Data.vertices.size() * sizeof(Vertex), &m_Data.vertices[0], m_Usage);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_Data.indices.size() * sizeof(uint32_t), &m_Data.indices[0], m_Usage);
+        if (m_BVH)
+            *m_BVH = MeshBVH(m_Data);
+    }
+    else
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, 0, m_Data.vertices.size() * sizeof(Vertex), &m_Data.vertices[0]);
+    }
+    unbind();
+}
+
+const MeshBVH& RawModel::get_bvh() const
+{
+    if (!m_BVH)
+        m_BVH = new MeshBVH(m_Data);
+    return *m_BVH;
+}
 
 Skybox::Skybox(TextureCubeMap* cube_map) : m_CubeMapTexture(cube_map){
     init();
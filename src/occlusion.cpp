@@ -0,0 +1,306 @@
+#include "occlusion.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "model.h"
+
+/*
+* The AVX2 paths are compiled for AVX2 per function, the rest of this file and everything it
+* inlines stays baseline x86-64. They only run after cpu_supports_avx2().
+*/
+#if defined(__x86_64__) || defined(_M_X64)
+#define OCCLUSION_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define OCCLUSION_AVX2_TARGET __attribute__((target("avx2,fma")))
+#else
+#define OCCLUSION_AVX2_TARGET
+#endif
+#endif
+
+// Vertices closer than this in clip w are clipped away
+static constexpr float NEAR_W = 1e-4f;
+
+bool cpu_supports_avx2()
+{
+#if defined(OCCLUSION_X86) && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	// The OS saves the YMM registers
+	bool ymm = osxsave && (_xgetbv(0) & 0x6) == 0x6;
+	__cpuidex(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	return fma && ymm && avx2;
+#elif defined(OCCLUSION_X86)
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+	return false;
+#endif
+}
+
+// Nearest depth into the pixels of row in [x_min, x_max] whose centres are inside all three edges
+static void rasterize_row(float* row, int x_min, int x_max, float py, const glm::vec3 edges[3], const glm::vec3& depth_plane)
+{
+	for (int x = x_min; x <= x_max; x++)
+	{
+		float px = x + 0.5f;
+		if (edges[0].x * px + edges[0].y * py + edges[0].z < 0.0f ||
+			edges[1].x * px + edges[1].y * py + edges[1].z < 0.0f ||
+			edges[2].x * px + edges[2].y * py + edges[2].z < 0.0f)
+			continue;
+		float z = depth_plane.x * px + depth_plane.y * py + depth_plane.z;
+		row[x] = std::min(row[x], z);
+	}
+}
+
+static float get_tile_max(const float* tile, uint32_t stride)
+{
+	float tile_max = 0.0f;
+	for (uint32_t y = 0; y < OcclusionBuffer::TILE_SIZE; y++)
+		for (uint32_t x = 0; x < OcclusionBuffer::TILE_SIZE; x++)
+			tile_max = std::max(tile_max, tile[y * stride + x]);
+	return tile_max;
+}
+
+#ifdef OCCLUSION_X86
+// Eight pixels per step from x_min, a multiple of 8, the row width is a multiple of 8 as well
+OCCLUSION_AVX2_TARGET static void rasterize_row_avx2(float* row, int x_min, int x_max, float py, const glm::vec3 edges[3], const glm::vec3& depth_plane)
+{
+	const __m256 lane = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+	__m256 edge_x[3];
+	__m256 edge_row[3];
+	for (int i = 0; i < 3; i++)
+	{
+		edge_x[i] = _mm256_set1_ps(edges[i].x);
+		edge_row[i] = _mm256_set1_ps(edges[i].y * py + edges[i].z);
+	}
+	__m256 depth_x = _mm256_set1_ps(depth_plane.x);
+	__m256 depth_row = _mm256_set1_ps(depth_plane.y * py + depth_plane.z);
+
+	for (int x = x_min; x <= x_max; x += 8)
+	{
+		__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), lane);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+		for (int i = 0; i < 3; i++)
+		{
+			__m256 e = _mm256_fmadd_ps(edge_x[i], px, edge_row[i]);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(e, _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+		if (_mm256_testz_ps(inside, inside))
+			continue;
+
+		__m256 z = _mm256_fmadd_ps(depth_x, px, depth_row);
+		__m256 depth = _mm256_loadu_ps(row + x);
+		_mm256_storeu_ps(row + x, _mm256_blendv_ps(depth, _mm256_min_ps(depth, z), inside));
+	}
+}
+
+OCCLUSION_AVX2_TARGET static float get_tile_max_avx2(const float* tile, uint32_t stride)
+{
+	__m256 tile_max = _mm256_loadu_ps(tile);
+	for (uint32_t y = 1; y < OcclusionBuffer::TILE_SIZE; y++)
+		tile_max = _mm256_max_ps(tile_max, _mm256_loadu_ps(tile + y * stride));
+	__m128 m = _mm_max_ps(_mm256_castps256_ps128(tile_max), _mm256_extractf128_ps(tile_max, 1));
+	m = _mm_max_ps(m, _mm_movehl_ps(m, m));
+	m = _mm_max_ss(m, _mm_shuffle_ps(m, m, 1));
+	return _mm_cvtss_f32(m);
+}
+#endif
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+	: use_avx2(cpu_supports_avx2())
+{
+	m_TilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	m_TilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	m_Width = m_TilesX * TILE_SIZE;
+	m_Height = m_TilesY * TILE_SIZE;
+	m_Depth.resize(m_Width * m_Height);
+	m_TileMaxDepth.resize(m_TilesX * m_TilesY);
+	clear();
+}
+
+void OcclusionBuffer::clear()
+{
+	std::fill(m_Depth.begin(), m_Depth.end(), 1.0f);
+	std::fill(m_TileMaxDepth.begin(), m_TileMaxDepth.end(), 1.0f);
+}
+
+void OcclusionBuffer::draw_occluder(const ModelData& data, const glm::mat4& model_view_projection)
+{
+	std::vector<glm::vec4> clip(data.vertices.size());
+	for (size_t i = 0; i < data.vertices.size(); i++)
+		clip[i] = model_view_projection * glm::vec4(data.vertices[i].position, 1.0f);
+	for (size_t i = 0; i + 2 < data.indices.size(); i += 3)
+		draw_triangle(clip[data.indices[i]], clip[data.indices[i + 1]], clip[data.indices[i + 2]]);
+}
+
+void OcclusionBuffer::draw_box(glm::vec3 bounds_min, glm::vec3 bounds_max, const glm::mat4& model_view_projection)
+{
+	glm::vec4 corners[8];
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner((c & 1) ? bounds_max.x : bounds_min.x, (c & 2) ? bounds_max.y : bounds_min.y, (c & 4) ? bounds_max.z : bounds_min.z);
+		corners[c] = model_view_projection * glm::vec4(corner, 1.0f);
+	}
+	// Two triangles per face: -x, +x, -y, +y, -z, +z
+	static const int faces[6][4] = { { 0, 2, 6, 4 }, { 1, 5, 7, 3 }, { 0, 4, 5, 1 }, { 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 6, 7, 5 } };
+	for (const int* face : faces)
+	{
+		draw_triangle(corners[face[0]], corners[face[1]], corners[face[2]]);
+		draw_triangle(corners[face[0]], corners[face[2]], corners[face[3]]);
+	}
+}
+
+void OcclusionBuffer::draw_triangle(glm::vec4 a, glm::vec4 b, glm::vec4 c)
+{
+	// Clip against the near plane (z = -w), a triangle becomes up to a quad
+	glm::vec4 in[3] = { a, b, c };
+	glm::vec4 out[4];
+	int num_out = 0;
+	for (int i = 0; i < 3; i++)
+	{
+		const glm::vec4& p = in[i];
+		const glm::vec4& q = in[(i + 1) % 3];
+		float dp = p.z + p.w;
+		float dq = q.z + q.w;
+		if (dp >= 0.0f)
+			out[num_out++] = p;
+		if ((dp >= 0.0f) != (dq >= 0.0f))
+			out[num_out++] = p + (q - p) * (dp / (dp - dq));
+	}
+	if (num_out < 3)
+		return;
+
+	glm::vec3 screen[4];
+	glm::vec2 size((float)m_Width, (float)m_Height);
+	for (int i = 0; i < num_out; i++)
+	{
+		if (out[i].w < NEAR_W)
+			return;
+		glm::vec3 ndc = glm::vec3(out[i]) / out[i].w;
+		screen[i] = glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * size, ndc.z * 0.5f + 0.5f);
+	}
+	rasterize(screen[0], screen[1], screen[2]);
+	if (num_out == 4)
+		rasterize(screen[0], screen[2], screen[3]);
+}
+
+void OcclusionBuffer::rasterize(glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (area == 0.0f)
+		return;
+	// Both faces are drawn, counter-clockwise winding from here on
+	if (area < 0.0f)
+	{
+		std::swap(b, c);
+		area = -area;
+	}
+
+	int x_min = std::max((int)std::floor(std::min({ a.x, b.x, c.x })), 0);
+	int x_max = std::min((int)std::ceil(std::max({ a.x, b.x, c.x })), (int)m_Width - 1);
+	int y_min = std::max((int)std::floor(std::min({ a.y, b.y, c.y })), 0);
+	int y_max = std::min((int)std::ceil(std::max({ a.y, b.y, c.y })), (int)m_Height - 1);
+	if (x_min > x_max || y_min > y_max)
+		return;
+
+	// Edge functions and depth as planes over the screen: v = v_x * x + v_y * y + v_0
+	glm::vec3 edges[3];
+	const glm::vec3 vertices[3] = { a, b, c };
+	for (int i = 0; i < 3; i++)
+	{
+		glm::vec3 p = vertices[(i + 1) % 3];
+		glm::vec3 q = vertices[(i + 2) % 3];
+		edges[i] = glm::vec3(p.y - q.y, q.x - p.x, p.x * q.y - p.y * q.x);
+	}
+	// Barycentric weights are edge values / area
+	glm::vec3 depth_plane = (edges[0] * a.z + edges[1] * b.z + edges[2] * c.z) / area;
+
+	x_min &= ~7;
+	for (int y = y_min; y <= y_max; y++)
+	{
+		float py = y + 0.5f;
+		float* row = &m_Depth[y * m_Width];
+#ifdef OCCLUSION_X86
+		if (use_avx2)
+		{
+			rasterize_row_avx2(row, x_min, x_max, py, edges, depth_plane);
+			continue;
+		}
+#endif
+		rasterize_row(row, x_min, x_max, py, edges, depth_plane);
+	}
+}
+
+void OcclusionBuffer::finish()
+{
+	for (uint32_t ty = 0; ty < m_TilesY; ty++)
+	{
+		for (uint32_t tx = 0; tx < m_TilesX; tx++)
+		{
+			const float* tile = &m_Depth[ty * TILE_SIZE * m_Width + tx * TILE_SIZE];
+#ifdef OCCLUSION_X86
+			if (use_avx2)
+			{
+				m_TileMaxDepth[ty * m_TilesX + tx] = get_tile_max_avx2(tile, m_Width);
+				continue;
+			}
+#endif
+			m_TileMaxDepth[ty * m_TilesX + tx] = get_tile_max(tile, m_Width);
+		}
+	}
+}
+
+bool OcclusionBuffer::is_occluded(glm::vec3 bounds_min, glm::vec3 bounds_max, const glm::mat4& model_view_projection) const
+{
+	glm::vec2 screen_min(std::numeric_limits<float>::max());
+	glm::vec2 screen_max(-std::numeric_limits<float>::max());
+	float nearest = 1.0f;
+	glm::vec2 size((float)m_Width, (float)m_Height);
+	for (int c = 0; c < 8; c++)
+	{
+		glm::vec3 corner((c & 1) ? bounds_max.x : bounds_min.x, (c & 2) ? bounds_max.y : bounds_min.y, (c & 4) ? bounds_max.z : bounds_min.z);
+		glm::vec4 clip = model_view_projection * glm::vec4(corner, 1.0f);
+		if (clip.w < NEAR_W || clip.z < -clip.w)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 screen = (glm::vec2(ndc) * 0.5f + 0.5f) * size;
+		screen_min = glm::min(screen_min, screen);
+		screen_max = glm::max(screen_max, screen);
+		nearest = std::min(nearest, ndc.z * 0.5f + 0.5f);
+	}
+
+	// Pixels whose centers the rect covers
+	int x_min = std::max((int)std::floor(screen_min.x - 0.5f), 0);
+	int x_max = std::min((int)std::ceil(screen_max.x - 0.5f), (int)m_Width - 1);
+	int y_min = std::max((int)std::floor(screen_min.y - 0.5f), 0);
+	int y_max = std::min((int)std::ceil(screen_max.y - 0.5f), (int)m_Height - 1);
+	if (x_min > x_max || y_min > y_max)
+		return false;
+
+	for (int ty = y_min / TILE_SIZE; ty <= y_max / (int)TILE_SIZE; ty++)
+	{
+		for (int tx = x_min / TILE_SIZE; tx <= x_max / (int)TILE_SIZE; tx++)
+		{
+			// Everything in the tile is nearer than the box
+			if (m_TileMaxDepth[ty * m_TilesX + tx] < nearest)
+				continue;
+
+			int px_min = std::max(x_min, tx * (int)TILE_SIZE);
+			int px_max = std::min(x_max, (tx + 1) * (int)TILE_SIZE - 1);
+			int py_min = std::max(y_min, ty * (int)TILE_SIZE);
+			int py_max = std::min(y_max, (ty + 1) * (int)TILE_SIZE - 1);
+			for (int y = py_min; y <= py_max; y++)
+				for (int x = px_min; x <= px_max; x++)
+					if (m_Depth[y * m_Width + x] >= nearest)
+						return false;
+		}
+	}
+	return true;
+}
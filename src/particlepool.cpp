@@ -0,0 +1,226 @@
+#include "particlepool.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "gl_helpers.h"
+
+enum PoolPass : int
+{
+	INIT     = 0,
+	EMIT     = 1,
+	PREPARE  = 2,
+	SIMULATE = 3,
+	FINALIZE = 4,
+};
+
+// Matches PoolParticle in particle_pool_cs.glsl
+struct PoolParticle
+{
+	glm::vec3 position; float age;
+	glm::vec3 velocity; uint32_t lifetime_size;
+};
+
+static constexpr uint32_t POOL_GROUP_SIZE = 256;
+
+ParticlePool::ParticlePool(uint32_t capacity, Shader& pool_cs)
+	: m_Capacity(capacity)
+{
+	GL_CHECK(glGenVertexArrays(1, &m_VAO));
+
+	GL_CHECK(glGenBuffers(1, &m_ParticleBuffer));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ParticleBuffer));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(PoolParticle) * capacity, NULL, GL_DYNAMIC_DRAW));
+
+	// Lists are a count followed by capacity particle indices
+	GL_CHECK(glGenBuffers(1, &m_DeadList));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_DeadList));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * (capacity + 1), NULL, GL_DYNAMIC_DRAW));
+	GL_CHECK(glGenBuffers(2, m_AliveLists));
+	for (int i = 0; i < 2; i++)
+	{
+		GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_AliveLists[i]));
+		GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * (capacity + 1), NULL, GL_DYNAMIC_DRAW));
+	}
+
+	// dispatch x, y, z, draw count, instance_count, first, base_instance
+	GLuint indirect_args[7] = { 0, 1, 1, 4, 0, 0, 0 };
+	GL_CHECK(glGenBuffers(1, &m_IndirectBuffer));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_IndirectBuffer));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(indirect_args), indirect_args, GL_DYNAMIC_DRAW));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+	/* COMPUTE INITIALIZATION: every particle starts on the dead list */
+	pool_cs.bind();
+	pool_cs.set_uint("u_Capacity", capacity);
+	bind_buffers();
+	dispatch_pass(pool_cs, PoolPass::INIT, (capacity + POOL_GROUP_SIZE - 1) / POOL_GROUP_SIZE);
+	unbind_buffers();
+	pool_cs.unbind();
+}
+
+ParticlePool::~ParticlePool()
+{
+	for (auto& [mesh, buffers] : m_MeshBuffers)
+	{
+		glDeleteBuffers(1, &buffers.triangles);
+		glDeleteBuffers(1, &buffers.area_cdf);
+	}
+	glDeleteBuffers(1, &m_IndirectBuffer);
+	glDeleteBuffers(2, m_AliveLists);
+	glDeleteBuffers(1, &m_DeadList);
+	glDeleteBuffers(1, &m_ParticleBuffer);
+	glDeleteVertexArrays(1, &m_VAO);
+}
+
+void ParticlePool::emit(const ParticleEmitter& emitter, uint32_t count, Shader& pool_cs)
+{
+	if (count == 0)
+		return;
+
+	pool_cs.bind();
+	pool_cs.set_float("u_Time", m_Time);
+	pool_cs.set_uint("u_EmitCount", count);
+	pool_cs.set_uint("u_EmitDispatch", m_EmitDispatch++);
+	pool_cs.set_int("u_EmitShape", (int)emitter.shape);
+	pool_cs.set_matrix4fv("u_EmitTransform", &emitter.transform[0][0]);
+	pool_cs.set_float3("u_EmitDirection", emitter.direction.x, emitter.direction.y, emitter.direction.z);
+	pool_cs.set_float("u_EmitSpread", emitter.spread);
+	pool_cs.set_float("u_EmitSpeed", emitter.speed);
+	pool_cs.set_float("u_EmitLifetime", emitter.lifetime);
+	pool_cs.set_float("u_EmitSize", emitter.size);
+
+	uint32_t num_triangles = 0;
+	if (emitter.shape == EmitterShape::MESH && emitter.mesh)
+	{
+		const MeshEmitterBuffers& mesh_buffers = get_mesh_buffers(emitter.mesh);
+		num_triangles = mesh_buffers.num_triangles;
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, mesh_buffers.triangles));
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, mesh_buffers.area_cdf));
+	}
+	pool_cs.set_uint("u_NumTriangles", num_triangles);
+
+	bind_buffers();
+	dispatch_pass(pool_cs, PoolPass::EMIT, (count + POOL_GROUP_SIZE - 1) / POOL_GROUP_SIZE);
+
+	// Lifetimes are stored as half floats on the GPU, the slack covers their rounding
+	m_Emissions.push_back({ m_Time + emitter.lifetime * 1.01f + 0.1f, count });
+	m_MaxAlive += count;
+	unbind_buffers();
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, 0));
+	pool_cs.unbind();
+}
+
+void ParticlePool::update(float dt, Shader& pool_cs, const WindField& wind_field)
+{
+	m_Time += dt;
+	auto expired = std::remove_if(m_Emissions.begin(), m_Emissions.end(), [&](const Emission& emission) {
+		if (emission.expiry > m_Time)
+			return false;
+		m_MaxAlive -= emission.count;
+		return true;
+	});
+	m_Emissions.erase(expired, m_Emissions.end());
+
+	pool_cs.bind();
+	pool_cs.set_float("u_Time", m_Time);
+	pool_cs.set_float("u_TimeDelta", dt);
+	pool_cs.set_float("u_Gravity", gravity);
+	pool_cs.set_float("u_Drag", drag);
+
+	glm::vec3 wind_min = wind_field.get_bounds_min();
+	glm::vec3 wind_max = wind_field.get_bounds_max();
+	pool_cs.set_float("u_WindAmp", wind_field.amplitude);
+	pool_cs.set_float3("u_WindBoundsMin", wind_min.x, wind_min.y, wind_min.z);
+	pool_cs.set_float3("u_WindBoundsMax", wind_max.x, wind_max.y, wind_max.z);
+	pool_cs.set_int("u_WindField", 0);
+	wind_field.bind(0);
+
+	bind_buffers();
+	// Size the update to the alive count, then hand the survivors to the draw
+	dispatch_pass(pool_cs, PoolPass::PREPARE, 1);
+	pool_cs.set_int("u_Pass", PoolPass::SIMULATE);
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_IndirectBuffer));
+	GL_CHECK(glDispatchComputeIndirect(0));
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+	dispatch_pass(pool_cs, PoolPass::FINALIZE, 1);
+	unbind_buffers();
+	pool_cs.unbind();
+
+	m_Current = 1 - m_Current;
+}
+
+void ParticlePool::draw()
+{
+	GL_CHECK(glBindVertexArray(m_VAO));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_ParticleBuffer));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_AliveLists[m_Current]));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_IndirectBuffer));
+	GL_CHECK(glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)(3 * sizeof(GLuint))));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
+	GL_CHECK(glBindVertexArray(0));
+}
+
+void ParticlePool::dispatch_pass(Shader& pool_cs, int pass, uint32_t num_groups)
+{
+	pool_cs.set_int("u_Pass", pass);
+	GL_CHECK(glDispatchCompute(num_groups, 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+}
+
+void ParticlePool::bind_buffers()
+{
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_ParticleBuffer));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_DeadList));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_AliveLists[m_Current]));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_AliveLists[1 - m_Current]));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_IndirectBuffer));
+}
+
+void ParticlePool::unbind_buffers()
+{
+	for (int i = 1; i <= 5; i++)
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
+}
+
+const ParticlePool::MeshEmitterBuffers& ParticlePool::get_mesh_buffers(const RawModel* mesh)
+{
+	auto it = m_MeshBuffers.find(mesh);
+	if (it != m_MeshBuffers.end())
+		return it->second;
+
+	const ModelData& data = mesh->get_model_data();
+	uint32_t num_triangles = data.indices.size() / 3;
+	std::vector<glm::vec4> triangles(3 * num_triangles);
+	std::vector<float> area_cdf(num_triangles);
+	float total_area = 0.0f;
+	for (uint32_t i = 0; i < num_triangles; i++)
+	{
+		glm::vec3 a = data.vertices[data.indices[3 * i + 0]].position;
+		glm::vec3 b = data.vertices[data.indices[3 * i + 1]].position;
+		glm::vec3 c = data.vertices[data.indices[3 * i + 2]].position;
+		triangles[3 * i + 0] = glm::vec4(a, 1.0f);
+		triangles[3 * i + 1] = glm::vec4(b, 1.0f);
+		triangles[3 * i + 2] = glm::vec4(c, 1.0f);
+		total_area += 0.5f * glm::length(glm::cross(b - a, c - a));
+		area_cdf[i] = total_area;
+	}
+	for (float& area : area_cdf)
+		area /= total_area > 0.0f ? total_area : 1.0f;
+
+	MeshEmitterBuffers buffers;
+	buffers.num_triangles = num_triangles;
+	GL_CHECK(glGenBuffers(1, &buffers.triangles));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.triangles));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::vec4) * triangles.size(), triangles.data(), GL_STATIC_DRAW));
+	GL_CHECK(glGenBuffers(1, &buffers.area_cdf));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.area_cdf));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(float) * area_cdf.size(), area_cdf.data(), GL_STATIC_DRAW));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+	return m_MeshBuffers[mesh] = buffers;
+}
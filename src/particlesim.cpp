@@ -0,0 +1,399 @@
+#include "particlesim.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <glm/gtc/packing.hpp>
+
+#include "jobs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARTICLE_SIM_SSE2
+#include <emmintrin.h>
+#endif
+
+// GLSL mod, x - y * floor(x / y)
+static glm::vec3 glsl_mod(glm::vec3 x, glm::vec3 y)
+{
+	return x - y * glm::floor(x / y);
+}
+
+Particle pack_particle(const UnpackedParticle& particle, glm::vec3 bbox_min, glm::vec3 bbox_max)
+{
+	glm::vec3 volume_size = bbox_max - bbox_min;
+	glm::uvec3 q = glm::min(glm::uvec3(glsl_mod(particle.position, volume_size) / volume_size * PARTICLE_POSITION_SCALE), glm::uvec3(PARTICLE_POSITION_MASK));
+
+	Particle packed;
+	packed.position[0] = q.x | (q.y << 21);
+	packed.position[1] = (q.y >> 11) | (q.z << 10);
+	packed.velocity_xy = glm::packHalf2x16(glm::vec2(particle.velocity.x, particle.velocity.y));
+	packed.velocity_z_size_flags = (glm::packHalf2x16(glm::vec2(particle.velocity.z, 0.0f)) & 0xFFFF)
+		| ((uint32_t)(glm::clamp(particle.size / MAX_PARTICLE_SIZE, 0.0f, 1.0f) * 255.0f + 0.5f) << 16)
+		| ((particle.flags & 0xFF) << 24);
+	return packed;
+}
+
+UnpackedParticle unpack_particle(const Particle& packed, glm::vec3 bbox_min, glm::vec3 bbox_max)
+{
+	glm::vec3 volume_size = bbox_max - bbox_min;
+	glm::uvec3 q(packed.position[0] & PARTICLE_POSITION_MASK,
+		(packed.position[0] >> 21) | ((packed.position[1] & 0x3FF) << 11),
+		(packed.position[1] >> 10) & PARTICLE_POSITION_MASK);
+	glm::vec3 local = glm::vec3(q) / PARTICLE_POSITION_SCALE * volume_size;
+
+	UnpackedParticle particle;
+	particle.position = bbox_min + glsl_mod(local - bbox_min, volume_size);
+	glm::vec2 velocity_xy = glm::unpackHalf2x16(packed.velocity_xy);
+	particle.velocity = glm::vec3(velocity_xy, glm::unpackHalf2x16(packed.velocity_z_size_flags).x);
+	particle.size = (float)((packed.velocity_z_size_flags >> 16) & 0xFF) / 255.0f * MAX_PARTICLE_SIZE;
+	particle.flags = packed.velocity_z_size_flags >> 24;
+	return particle;
+}
+
+// Spread the low 10 bits of x over every third bit
+static uint32_t part_1_by_2(uint32_t x)
+{
+	x &= 0x3FF;
+	x = (x | (x << 16)) & 0x030000FF;
+	x = (x | (x << 8)) & 0x0300F00F;
+	x = (x | (x << 4)) & 0x030C30C3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+uint32_t get_particle_cluster_key(const Particle& particle)
+{
+	if ((particle.velocity_z_size_flags >> 24) & PARTICLE_FLAG_UNUSED)
+		return 1;
+	// Top 10 of the 21 bits per axis
+	uint32_t x = (particle.position[0] & PARTICLE_POSITION_MASK) >> 11;
+	uint32_t y = ((particle.position[0] >> 21) | ((particle.position[1] & 0x3FF) << 11)) >> 11;
+	uint32_t z = ((particle.position[1] >> 10) & PARTICLE_POSITION_MASK) >> 11;
+	// 0 is left for the padding of the GPU sort, 1 for unused slots
+	return (part_1_by_2(x) | (part_1_by_2(y) << 1) | (part_1_by_2(z) << 2)) + 2;
+}
+
+glm::ivec3 get_particle_grid_position(int slot, glm::ivec3 particles_per_dim)
+{
+	glm::ivec3 clusters_per_dim = (particles_per_dim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
+	int cluster = slot / PARTICLES_PER_CLUSTER;
+	int local = slot % PARTICLES_PER_CLUSTER;
+	glm::ivec3 cluster_pos(cluster % clusters_per_dim.x, (cluster / clusters_per_dim.x) % clusters_per_dim.y, cluster / (clusters_per_dim.x * clusters_per_dim.y));
+	glm::ivec3 local_pos(local % PARTICLES_PER_CLUSTER_DIM, (local / PARTICLES_PER_CLUSTER_DIM) % PARTICLES_PER_CLUSTER_DIM, local / (PARTICLES_PER_CLUSTER_DIM * PARTICLES_PER_CLUSTER_DIM));
+	return cluster_pos * PARTICLES_PER_CLUSTER_DIM + local_pos;
+}
+
+glm::uvec3 pcg3d(glm::uvec3 v)
+{
+	v = v * 1664525u + 1013904223u;
+	v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+	v ^= v >> 16u;
+	v.x += v.y * v.z; v.y += v.z * v.x; v.z += v.x * v.y;
+	return v;
+}
+
+const std::string& get_particle_shader_defines()
+{
+	static const std::string defines = []() {
+		// Enough digits to round trip every float, GLSL parses the same values as the CPU
+		std::ostringstream out;
+		out << std::setprecision(9) << std::showpoint;
+		out << "#define POSITION_SCALE " << PARTICLE_POSITION_SCALE << "\n";
+		out << "#define POSITION_MASK " << PARTICLE_POSITION_MASK << "u\n";
+		out << "#define MAX_PARTICLE_SIZE " << MAX_PARTICLE_SIZE << "\n";
+		out << "#define FLAG_UNUSED " << PARTICLE_FLAG_UNUSED << "u\n";
+		out << "#define PARTICLES_PER_CLUSTER_DIM " << PARTICLES_PER_CLUSTER_DIM << "\n";
+		out << "#define PARTICLES_PER_CLUSTER " << PARTICLES_PER_CLUSTER << "\n";
+		out << "#define GRAVITY " << PARTICLE_GRAVITY << "\n";
+		out << "#define MAX_SPEED " << PARTICLE_MAX_SPEED << "\n";
+		out << "#define SPAWN_SPEED " << PARTICLE_SPAWN_SPEED << "\n";
+		out << "#define SPAWN_OFFSET " << PARTICLE_SPAWN_OFFSET << "\n";
+		return out.str();
+	}();
+	return defines;
+}
+
+ParticleReferenceSimulation::ParticleReferenceSimulation(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max, float particle_size)
+	: m_ParticlesPerDim(particles_per_dim), m_BboxMin(bbox_min), m_BboxMax(bbox_max)
+{
+	m_NumParticles = particles_per_dim.x * particles_per_dim.y * particles_per_dim.z;
+	glm::ivec3 clusters_per_dim = (particles_per_dim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
+	int num_slots = clusters_per_dim.x * clusters_per_dim.y * clusters_per_dim.z * PARTICLES_PER_CLUSTER;
+
+	// Same as particle_init_cs.glsl
+	m_Particles.resize(num_slots);
+	m_GridX.resize(num_slots);
+	m_GridZ.resize(num_slots);
+	for (int slot = 0; slot < num_slots; slot++)
+	{
+		glm::ivec3 grid = get_particle_grid_position(slot, particles_per_dim);
+		UnpackedParticle particle;
+		particle.position = bbox_min + (bbox_max - bbox_min) * (glm::vec3(grid) / glm::vec3(particles_per_dim));
+		particle.velocity = glm::vec3(0.0f, -PARTICLE_SPAWN_SPEED, 0.0f);
+		particle.size = particle_size;
+		particle.flags = glm::any(glm::greaterThanEqual(grid, particles_per_dim)) ? PARTICLE_FLAG_UNUSED : 0;
+		m_Particles[slot] = pack_particle(particle, bbox_min, bbox_max);
+		m_GridX[slot] = (float)grid.x;
+		m_GridZ[slot] = (float)grid.z;
+	}
+}
+
+void ParticleReferenceSimulation::set_volume_center(glm::vec3 center, float ground_height)
+{
+	glm::vec3 extent = m_BboxMax - m_BboxMin;
+	m_BboxMin = center - extent / 2.0f;
+	m_BboxMin.y = glm::max(m_BboxMin.y, ground_height);
+	m_BboxMax = m_BboxMin + extent;
+	m_WrapVolume = true;
+}
+
+void ParticleReferenceSimulation::run(uint32_t steps, float dt)
+{
+	for (uint32_t i = 0; i < steps; i++)
+		step(dt);
+}
+
+void ParticleReferenceSimulation::recluster()
+{
+	std::vector<uint32_t> keys(m_Particles.size());
+	std::vector<uint32_t> order(m_Particles.size());
+	for (size_t i = 0; i < m_Particles.size(); i++)
+	{
+		keys[i] = get_particle_cluster_key(m_Particles[i]);
+		order[i] = (uint32_t)i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+	std::vector<Particle> particles(m_Particles.size());
+	for (size_t i = 0; i < order.size(); i++)
+		particles[i] = m_Particles[order[i]];
+	m_Particles.swap(particles);
+}
+
+void ParticleReferenceSimulation::step(float dt)
+{
+	// Jobs own disjoint slot ranges of whole SIMD blocks
+	int num_slots = (int)m_Particles.size();
+	int num_blocks = (num_slots + 3) / 4;
+	int num_jobs = num_threads > 0 ? (int)num_threads : (int)JobSystem::GetNumThreads();
+	num_jobs = glm::clamp(num_jobs, 1, glm::max(num_blocks, 1));
+	JobSystem::ParallelFor(num_jobs, 1, [&](uint32_t begin, uint32_t end) {
+		for (uint32_t job = begin; job < end; job++)
+		{
+			int slot_begin = 4 * (num_blocks * (int)job / num_jobs);
+			int slot_end = glm::min(4 * (num_blocks * ((int)job + 1) / num_jobs), num_slots);
+			step_slots(dt, slot_begin, slot_end);
+		}
+	});
+
+	m_Frame++;
+}
+
+#ifdef PARTICLE_SIM_SSE2
+// SSE2 has no 32-bit low multiply, multiply the even and odd lanes as 64-bit and interleave
+static inline __m128i mullo_epi32(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+	return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline void pcg3d_sse2(__m128i& x, __m128i& y, __m128i& z)
+{
+	const __m128i mul = _mm_set1_epi32(1664525);
+	const __m128i inc = _mm_set1_epi32(1013904223);
+	x = _mm_add_epi32(mullo_epi32(x, mul), inc);
+	y = _mm_add_epi32(mullo_epi32(y, mul), inc);
+	z = _mm_add_epi32(mullo_epi32(z, mul), inc);
+	x = _mm_add_epi32(x, mullo_epi32(y, z)); y = _mm_add_epi32(y, mullo_epi32(z, x)); z = _mm_add_epi32(z, mullo_epi32(x, y));
+	x = _mm_xor_si128(x, _mm_srli_epi32(x, 16));
+	y = _mm_xor_si128(y, _mm_srli_epi32(y, 16));
+	z = _mm_xor_si128(z, _mm_srli_epi32(z, 16));
+	x = _mm_add_epi32(x, mullo_epi32(y, z)); y = _mm_add_epi32(y, mullo_epi32(z, x)); z = _mm_add_epi32(z, mullo_epi32(x, y));
+}
+
+static inline __m128 random_float_sse2(__m128i h)
+{
+	return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(h, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+}
+
+static inline __m128 clamp_sse2(__m128 x, float lo, float hi)
+{
+	return _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(lo)), _mm_set1_ps(hi));
+}
+
+static inline __m128 select_sse2(__m128 mask, __m128 a, __m128 b)
+{
+	return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+#endif
+
+void ParticleReferenceSimulation::step_slots(float dt, int slot_begin, int slot_end)
+{
+	// Same operations in the same order as simulate() in particle_cs.glsl
+	const glm::vec3 extent = m_BboxMax - m_BboxMin;
+	const glm::vec3 particles_per_dim = glm::vec3(m_ParticlesPerDim);
+	const float spawn_y = m_BboxMax.y - PARTICLE_SPAWN_OFFSET * extent.y;
+
+	for (int base = slot_begin; base < slot_end; base += 4)
+	{
+		int lanes = glm::min(4, slot_end - base);
+
+		// Lanes past slot_end are simulated on zeros and never written back
+		alignas(16) float px[4] = {}, py[4] = {}, pz[4] = {};
+		alignas(16) float vx[4] = {}, vy[4] = {}, vz[4] = {};
+		alignas(16) float gx[4] = {}, gz[4] = {};
+		UnpackedParticle particles[4];
+		for (int l = 0; l < lanes; l++)
+		{
+			particles[l] = unpack_particle(m_Particles[base + l], m_BboxMin, m_BboxMax);
+			px[l] = particles[l].position.x; py[l] = particles[l].position.y; pz[l] = particles[l].position.z;
+			vx[l] = particles[l].velocity.x; vy[l] = particles[l].velocity.y; vz[l] = particles[l].velocity.z;
+			gx[l] = m_GridX[base + l];
+			gz[l] = m_GridZ[base + l];
+		}
+
+#ifdef PARTICLE_SIM_SSE2
+		__m128i hx = _mm_add_epi32(_mm_set1_epi32(base), _mm_set_epi32(3, 2, 1, 0));
+		__m128i hy = _mm_set1_epi32((int)m_Frame);
+		__m128i hz = _mm_setzero_si128();
+		pcg3d_sse2(hx, hy, hz);
+		__m128 rx = random_float_sse2(hx);
+		__m128 ry = random_float_sse2(hy);
+		__m128 rz = random_float_sse2(hz);
+
+		const __m128 dt4 = _mm_set1_ps(dt);
+		const __m128 half = _mm_set1_ps(0.5f);
+		__m128 kick_y = _mm_mul_ps(_mm_mul_ps(_mm_sub_ps(_mm_setzero_ps(), ry), _mm_set1_ps(PARTICLE_GRAVITY)), dt4);
+		__m128 vel_x = _mm_add_ps(_mm_load_ps(vx), _mm_mul_ps(dt4, _mm_sub_ps(rx, half)));
+		__m128 vel_y = _mm_add_ps(_mm_load_ps(vy), _mm_mul_ps(dt4, kick_y));
+		__m128 vel_z = _mm_add_ps(_mm_load_ps(vz), _mm_mul_ps(dt4, _mm_sub_ps(rz, half)));
+		vel_x = clamp_sse2(vel_x, -PARTICLE_MAX_SPEED, PARTICLE_MAX_SPEED);
+		vel_y = clamp_sse2(vel_y, -5.0f * PARTICLE_MAX_SPEED, 0.0f);
+		vel_z = clamp_sse2(vel_z, -PARTICLE_MAX_SPEED, PARTICLE_MAX_SPEED);
+		__m128 pos_x = _mm_add_ps(_mm_load_ps(px), _mm_mul_ps(dt4, vel_x));
+		__m128 pos_y = _mm_add_ps(_mm_load_ps(py), _mm_mul_ps(dt4, vel_y));
+		__m128 pos_z = _mm_add_ps(_mm_load_ps(pz), _mm_mul_ps(dt4, vel_z));
+
+		__m128 outside = _mm_cmplt_ps(pos_y, _mm_set1_ps(m_BboxMin.y));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(pos_x, _mm_set1_ps(m_BboxMin.x)));
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(pos_x, _mm_set1_ps(m_BboxMax.x)));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(pos_z, _mm_set1_ps(m_BboxMin.z)));
+		outside = _mm_or_ps(outside, _mm_cmpgt_ps(pos_z, _mm_set1_ps(m_BboxMax.z)));
+		// Wrapping volumes need no extra work, positions are stored modulo the volume size
+		if (m_WrapVolume)
+			outside = _mm_setzero_ps();
+
+		__m128 spawn_x = _mm_add_ps(_mm_set1_ps(m_BboxMin.x), _mm_div_ps(_mm_mul_ps(_mm_set1_ps(extent.x), _mm_load_ps(gx)), _mm_set1_ps(particles_per_dim.x)));
+		__m128 spawn_z = _mm_add_ps(_mm_set1_ps(m_BboxMin.z), _mm_div_ps(_mm_mul_ps(_mm_set1_ps(extent.z), _mm_load_ps(gz)), _mm_set1_ps(particles_per_dim.z)));
+		_mm_store_ps(px, select_sse2(outside, spawn_x, pos_x));
+		_mm_store_ps(py, select_sse2(outside, _mm_set1_ps(spawn_y), pos_y));
+		_mm_store_ps(pz, select_sse2(outside, spawn_z, pos_z));
+		_mm_store_ps(vx, select_sse2(outside, _mm_setzero_ps(), vel_x));
+		_mm_store_ps(vy, select_sse2(outside, _mm_set1_ps(-PARTICLE_SPAWN_SPEED), vel_y));
+		_mm_store_ps(vz, select_sse2(outside, _mm_setzero_ps(), vel_z));
+#else
+		for (int l = 0; l < lanes; l++)
+		{
+			glm::uvec3 h = pcg3d(glm::uvec3((uint32_t)(base + l), m_Frame, 0u));
+			glm::vec3 r = glm::vec3(h >> 8u) * (1.0f / 16777216.0f);
+
+			glm::vec3 velocity(vx[l], vy[l], vz[l]);
+			velocity += dt * glm::vec3(r.x - 0.5f, -r.y * PARTICLE_GRAVITY * dt, r.z - 0.5f);
+			velocity = glm::clamp(velocity, glm::vec3(-PARTICLE_MAX_SPEED, -5.0f * PARTICLE_MAX_SPEED, -PARTICLE_MAX_SPEED), glm::vec3(PARTICLE_MAX_SPEED, 0.0f, PARTICLE_MAX_SPEED));
+			glm::vec3 position = glm::vec3(px[l], py[l], pz[l]) + dt * velocity;
+
+			bool outside = !m_WrapVolume && ((position.y < m_BboxMin.y) ||
+				(position.x < m_BboxMin.x || position.x > m_BboxMax.x) ||
+				(position.z < m_BboxMin.z || position.z > m_BboxMax.z));
+			if (outside)
+			{
+				position = m_BboxMin + extent * glm::vec3(gx[l], particles_per_dim.y, gz[l]) / particles_per_dim;
+				position.y = spawn_y;
+				velocity = glm::vec3(0.0f, -PARTICLE_SPAWN_SPEED, 0.0f);
+			}
+			px[l] = position.x; py[l] = position.y; pz[l] = position.z;
+			vx[l] = velocity.x; vy[l] = velocity.y; vz[l] = velocity.z;
+		}
+#endif
+
+		for (int l = 0; l < lanes; l++)
+		{
+			if (particles[l].flags & PARTICLE_FLAG_UNUSED)
+				continue;
+			particles[l].position = glm::vec3(px[l], py[l], pz[l]);
+			particles[l].velocity = glm::vec3(vx[l], vy[l], vz[l]);
+			m_Particles[base + l] = pack_particle(particles[l], m_BboxMin, m_BboxMax);
+		}
+	}
+}
+
+ParticleComparison compare_particles(const std::vector<Particle>& a, const std::vector<Particle>& b,
+	glm::vec3 bbox_min, glm::vec3 bbox_max, float tolerance)
+{
+	ParticleComparison result;
+	glm::vec3 volume_size = bbox_max - bbox_min;
+	size_t count = std::min(a.size(), b.size());
+	for (size_t i = 0; i < count; i++)
+	{
+		UnpackedParticle pa = unpack_particle(a[i], bbox_min, bbox_max);
+		UnpackedParticle pb = unpack_particle(b[i], bbox_min, bbox_max);
+		if ((pa.flags | pb.flags) & PARTICLE_FLAG_UNUSED)
+			continue;
+
+		// Positions are stored modulo the volume, opposite faces are the same point
+		glm::vec3 delta = glm::abs(pa.position - pb.position);
+		delta = glm::min(delta, volume_size - delta);
+		float position_error = glm::length(delta);
+		float velocity_error = glm::length(pa.velocity - pb.velocity);
+
+		result.max_position_error = glm::max(result.max_position_error, position_error);
+		result.max_velocity_error = glm::max(result.max_velocity_error, velocity_error);
+		if (position_error > tolerance || velocity_error > tolerance)
+			result.num_mismatches++;
+		result.num_compared++;
+	}
+	return result;
+}
+
+ClusterBoundsCheck check_cluster_bounds(const std::vector<Particle>& particles, const std::vector<glm::vec4>& cluster_bounds,
+	glm::vec3 bbox_min, glm::vec3 bbox_max)
+{
+	ClusterBoundsCheck result;
+	glm::vec3 volume_size = bbox_max - bbox_min;
+	// Bounds are reduced before positions are quantized
+	glm::vec3 margin = 2.0f * volume_size / PARTICLE_POSITION_SCALE;
+	size_t num_clusters = std::min(cluster_bounds.size() / 2, particles.size() / PARTICLES_PER_CLUSTER);
+	for (size_t cluster = 0; cluster < num_clusters; cluster++)
+	{
+		glm::vec3 bounds_min = glm::vec3(cluster_bounds[2 * cluster]) - margin;
+		glm::vec3 bounds_max = glm::vec3(cluster_bounds[2 * cluster + 1]) + margin;
+		if (glm::any(glm::greaterThan(bounds_min, bounds_max)))
+			continue;
+		if (glm::any(glm::lessThan(bounds_min, bbox_min - margin)) || glm::any(glm::greaterThan(bounds_max, bbox_max + margin)))
+			result.num_overhanging++;
+		glm::vec3 extent = (bounds_max - bounds_min - 2.0f * margin) / volume_size;
+		result.max_extent = glm::max(result.max_extent, glm::max(extent.x, glm::max(extent.y, extent.z)));
+
+		for (size_t slot = cluster * PARTICLES_PER_CLUSTER; slot < (cluster + 1) * PARTICLES_PER_CLUSTER; slot++)
+		{
+			UnpackedParticle particle = unpack_particle(particles[slot], bbox_min, bbox_max);
+			if (particle.flags & PARTICLE_FLAG_UNUSED)
+				continue;
+			bool inside = true;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				bool axis_inside = false;
+				for (int shift = -1; shift <= 1; shift++)
+				{
+					float position = particle.position[axis] + shift * volume_size[axis];
+					axis_inside |= position >= bounds_min[axis] && position <= bounds_max[axis];
+				}
+				inside &= axis_inside;
+			}
+			result.num_outside += !inside;
+		}
+	}
+	return result;
+}
@@ -0,0 +1,211 @@
+#include "particlesort.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "gl_helpers.h"
+
+enum SortPass : int
+{
+	CULL        = 0,
+	PREPARE     = 1,
+	PAD         = 2,
+	LOCAL_SORT  = 3,
+	GLOBAL_STEP = 4,
+	LOCAL_MERGE = 5,
+};
+
+// Elements sorted in shared memory by one work group, matches particle_sort_cs.glsl
+static constexpr uint32_t SORT_TILE_SIZE = 512;
+
+ParticleSorter::ParticleSorter(uint32_t capacity)
+{
+	m_PaddedCapacity = SORT_TILE_SIZE;
+	while (m_PaddedCapacity < capacity)
+		m_PaddedCapacity *= 2;
+
+	GL_CHECK(glGenVertexArrays(1, &m_VAO));
+
+	GL_CHECK(glGenBuffers(1, &m_KeyBuffer));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_KeyBuffer));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(glm::uvec2) * m_PaddedCapacity, NULL, GL_DYNAMIC_DRAW));
+
+	// dispatch x, y, z, visible count, padded count, draw count, instance_count, first, base_instance
+	GLuint args[9] = { 1, 1, 1, 0, SORT_TILE_SIZE, 4, 0, 0, 0 };
+	GL_CHECK(glGenBuffers(1, &m_ArgsBuffer));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ArgsBuffer));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(args), args, GL_DYNAMIC_DRAW));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+ParticleSorter::~ParticleSorter()
+{
+	glDeleteBuffers(1, &m_ArgsBuffer);
+	glDeleteBuffers(1, &m_KeyBuffer);
+	glDeleteVertexArrays(1, &m_VAO);
+}
+
+void ParticleSorter::sort(const ParticlePool& pool, const glm::mat4& view, const glm::mat4& projection, Shader& sort_cs)
+{
+	GLuint visible_count = 0;
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ArgsBuffer));
+	GL_CHECK(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &visible_count));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+	sort_cs.bind();
+	sort_cs.set_matrix4fv("u_ViewMatrix", &view[0][0]);
+	sort_cs.set_matrix4fv("u_ProjectionMatrix", &projection[0][0]);
+	pool.bind_particles(1);
+	pool.bind_alive_list(3);
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_KeyBuffer));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_ArgsBuffer));
+
+	/* CULL: one thread per alive particle, visible keys are appended */
+	sort_cs.set_int("u_Pass", SortPass::CULL);
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, pool.get_indirect_buffer()));
+	GL_CHECK(glDispatchComputeIndirect(0));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+
+	sort_cs.set_int("u_Pass", SortPass::PREPARE);
+	GL_CHECK(glDispatchCompute(1, 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+
+	// The visible count never exceeds the alive particles
+	dispatch_sort(sort_cs, pool.get_max_alive());
+
+	for (int i = 1; i <= 5; i++)
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
+	sort_cs.unbind();
+}
+
+void ParticleSorter::sort_keys(uint32_t count, Shader& sort_cs)
+{
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ArgsBuffer));
+	GL_CHECK(glBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &count));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+	sort_cs.bind();
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_KeyBuffer));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, m_ArgsBuffer));
+
+	sort_cs.set_int("u_Pass", SortPass::PREPARE);
+	GL_CHECK(glDispatchCompute(1, 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT));
+	dispatch_sort(sort_cs, count);
+
+	for (int i = 4; i <= 5; i++)
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
+	sort_cs.unbind();
+}
+
+void ParticleSorter::draw(const ParticlePool& pool)
+{
+	GL_CHECK(glBindVertexArray(m_VAO));
+	pool.bind_particles(1);
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_KeyBuffer));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_ArgsBuffer));
+	GL_CHECK(glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)(5 * sizeof(GLuint))));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
+	GL_CHECK(glBindVertexArray(0));
+}
+
+bool ParticleSorter::validate() const
+{
+	GL_CHECK(glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT));
+	GLuint visible_count = 0;
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_ArgsBuffer));
+	GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 3 * sizeof(GLuint), sizeof(GLuint), &visible_count));
+	std::vector<glm::uvec2> keys(visible_count);
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_KeyBuffer));
+	if (visible_count > 0)
+		GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(glm::uvec2) * visible_count, keys.data()));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+
+	// Ties may be ordered differently, only the key sequence has to match
+	std::vector<glm::uvec2> reference = keys;
+	radix_sort_particles(reference);
+	bool same_keys = std::equal(keys.begin(), keys.end(), reference.begin(), [](glm::uvec2 a, glm::uvec2 b) { return a.x == b.x; });
+	bool sorted = is_sorted_back_to_front(keys);
+	if (!sorted || !same_keys)
+		std::cout << "Error: GPU particle sort of " << visible_count << " keys differs from the CPU reference" << std::endl;
+	else
+		std::cout << "GPU particle sort of " << visible_count << " keys matches the CPU reference" << std::endl;
+	return sorted && same_keys;
+}
+
+void ParticleSorter::dispatch_sort(Shader& sort_cs, uint32_t max_count)
+{
+	/* BITONIC SORT: one thread per compared pair, sized to the padded count */
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, m_ArgsBuffer));
+	dispatch_pass(sort_cs, SortPass::PAD);
+	dispatch_pass(sort_cs, SortPass::LOCAL_SORT);
+	// Passes beyond the padded upper bound would exit immediately, they are not dispatched
+	uint32_t padded_max_count = SORT_TILE_SIZE;
+	while (padded_max_count < max_count)
+		padded_max_count *= 2;
+	for (uint32_t k = 2 * SORT_TILE_SIZE; k <= glm::min(padded_max_count, m_PaddedCapacity); k *= 2)
+	{
+		sort_cs.set_uint("u_K", k);
+		for (uint32_t j = k / 2; j >= SORT_TILE_SIZE; j /= 2)
+		{
+			sort_cs.set_uint("u_J", j);
+			dispatch_pass(sort_cs, SortPass::GLOBAL_STEP);
+		}
+		dispatch_pass(sort_cs, SortPass::LOCAL_MERGE);
+	}
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0));
+}
+
+void ParticleSorter::dispatch_pass(Shader& sort_cs, int pass)
+{
+	sort_cs.set_int("u_Pass", pass);
+	GL_CHECK(glDispatchComputeIndirect(0));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+}
+
+uint32_t get_particle_sort_key(glm::vec3 position, const glm::mat4& view)
+{
+	// Not glm::max, which keeps -0.0 at the camera plane and its sign bit would make it the furthest key
+	float depth = -(view * glm::vec4(position, 1.0f)).z;
+	uint32_t key = 0;
+	if (depth > 0.0f)
+		std::memcpy(&key, &depth, sizeof(key));
+	return key;
+}
+
+void radix_sort_particles(std::vector<glm::uvec2>& keys)
+{
+	std::vector<glm::uvec2> scratch(keys.size());
+	for (int shift = 0; shift < 32; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for (const glm::uvec2& key : keys)
+			offsets[(key.x >> shift) & 0xFF]++;
+
+		// Largest digit first for back to front
+		size_t offset = 0;
+		for (int digit = 255; digit >= 0; digit--)
+		{
+			size_t count = offsets[digit];
+			offsets[digit] = offset;
+			offset += count;
+		}
+
+		for (const glm::uvec2& key : keys)
+			scratch[offsets[(key.x >> shift) & 0xFF]++] = key;
+		keys.swap(scratch);
+	}
+}
+
+bool is_sorted_back_to_front(const std::vector<glm::uvec2>& keys)
+{
+	for (size_t i = 1; i < keys.size(); i++)
+	{
+		if (keys[i - 1].x < keys[i].x)
+			return false;
+	}
+	return true;
+}
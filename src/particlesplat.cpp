@@ -0,0 +1,90 @@
+#include "particlesplat.h"
+
+#include "gl_helpers.h"
+
+ParticleSplatTarget::ParticleSplatTarget(uint32_t width, uint32_t height)
+	: m_Width(width), m_Height(height)
+{
+	// Fullscreen resolve without vertex buffers
+	GL_CHECK(glGenVertexArrays(1, &m_VAO));
+
+	GL_CHECK(glGenTextures(1, &m_CoverageTexture));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_CoverageTexture));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+	GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_R32UI, width, height));
+	GLuint zero = 0;
+	GL_CHECK(glClearTexImage(m_CoverageTexture, 0, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+ParticleSplatTarget::~ParticleSplatTarget()
+{
+	glDeleteTextures(1, &m_CoverageTexture);
+	glDeleteVertexArrays(1, &m_VAO);
+}
+
+void ParticleSplatTarget::splat(const ParticleSystem& system, const glm::mat4& view, const glm::mat4& projection,
+	const AABB& inner_volume, GLuint depth_texture, float max_size, Shader& splat_cs)
+{
+	glm::mat4 view_projection = projection * view;
+	glm::vec3 system_min = system.get_bbox_min();
+	glm::vec3 system_max = system.get_bbox_max();
+
+	splat_cs.bind();
+	splat_cs.set_matrix4fv("u_ViewProjection", &view_projection[0][0]);
+	splat_cs.set_float3("u_SystemBoundsMin", system_min.x, system_min.y, system_min.z);
+	splat_cs.set_float3("u_SystemBoundsMax", system_max.x, system_max.y, system_max.z);
+	splat_cs.set_float3("u_InnerVolume.min", inner_volume.min.x, inner_volume.min.y, inner_volume.min.z);
+	splat_cs.set_float3("u_InnerVolume.max", inner_volume.max.x, inner_volume.max.y, inner_volume.max.z);
+	splat_cs.set_float("u_PixelScale", get_pixel_scale(projection));
+	splat_cs.set_float("u_SplatMaxSize", max_size);
+
+	splat_cs.set_int("u_SceneDepth", 0);
+	GL_CHECK(glActiveTexture(GL_TEXTURE0));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, depth_texture));
+	GL_CHECK(glBindImageTexture(0, m_CoverageTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+	system.bind_particles(1);
+	system.bind_visible_clusters(2);
+
+	// One group per visible cluster, the count is written by the cluster cull
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, system.get_indirect_buffer()));
+	GL_CHECK(glDispatchComputeIndirect(4 * sizeof(GLuint)));
+	GL_CHECK(glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+	splat_cs.unbind();
+
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+void ParticleSplatTarget::resolve(Shader& resolve_shader)
+{
+	GL_CHECK(glEnable(GL_BLEND));
+	GL_CHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+	GL_CHECK(glDisable(GL_DEPTH_TEST));
+	GL_CHECK(glDepthMask(GL_FALSE));
+
+	resolve_shader.bind();
+	GL_CHECK(glBindImageTexture(0, m_CoverageTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+	GL_CHECK(glBindVertexArray(m_VAO));
+	GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 3));
+	GL_CHECK(glBindVertexArray(0));
+	// The cleared image is splatted into by the next frame
+	GL_CHECK(glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT));
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32UI));
+	resolve_shader.unbind();
+
+	GL_CHECK(glDepthMask(GL_TRUE));
+	GL_CHECK(glEnable(GL_DEPTH_TEST));
+	GL_CHECK(glDisable(GL_BLEND));
+}
+
+const std::string& get_splat_shader_defines()
+{
+	static const std::string defines = get_particle_pack_shader_defines()
+		+ "#define SPLAT_SCALE " + std::to_string(PARTICLE_SPLAT_SCALE) + "\n";
+	return defines;
+}
@@ -5,60 +5,144 @@
 
 #include <glm/gtx/norm.hpp>
 
+#include "assets.h"
+#include "camera.h"
 #include "clock.h"
+#include "computetuner.h"
 #include "gl_helpers.h"
+#include "particlesort.h"
 
-ParticleSystem::ParticleSystem(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max)
-	: particles_per_dim(particles_per_dim), bbox_min(bbox_min), bbox_max(bbox_max)
+ParticleSystem::ParticleSystem(glm::ivec3 particles_per_dim, glm::vec3 bbox_min, glm::vec3 bbox_max, float particle_size)
+	: particles_per_dim(particles_per_dim), bbox_min(bbox_min), bbox_max(bbox_max), particle_size(particle_size)
 {
-	particles.resize(particles_per_dim.x * particles_per_dim.y * particles_per_dim.z);
-	glm::ivec3 clusters_per_dim = (particles_per_dim + particles_per_cluster_dim - 1) / particles_per_cluster_dim;
+	num_particles = particles_per_dim.x * particles_per_dim.y * particles_per_dim.z;
+	glm::ivec3 clusters_per_dim = (particles_per_dim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
 	num_clusters = clusters_per_dim.x * clusters_per_dim.y * clusters_per_dim.z;
-
-	for (int z = 0; z < particles_per_dim.z; z++)
-	{
-		for (int y = 0; y < particles_per_dim.y; y++)
-		{
-			for (int x = 0; x < particles_per_dim.x; x++)
-			{
-				int i = particles_per_dim.x * (z * particles_per_dim.y + y) + x;
-				particles[i].position = bbox_min + (bbox_max - bbox_min) * (glm::vec3(x, y, z) / (glm::vec3)particles_per_dim);
-				particles[i].velocity = { 0, -0.5f, 0 };
-				particles[i].width = 0.05f;
-				particles[i].height = 0.05f;
-			}
-		}
-	}
+	num_particle_slots = num_clusters * PARTICLES_PER_CLUSTER;
 
 	/* SHADER STORAGE BUFFER BINDINGS */
 	GL_CHECK(glGenVertexArrays(1, &vao));
 
 	GL_CHECK(glGenBuffers(1, &ssbo));
 	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo));
-	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * particles.size(), &particles[0], GL_DYNAMIC_DRAW));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * num_particle_slots, NULL, GL_DYNAMIC_DRAW));
+
+	GL_CHECK(glGenBuffers(1, &sorted_ssbo));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, sorted_ssbo));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Particle) * num_particle_slots, NULL, GL_DYNAMIC_DRAW));
+
+	GL_CHECK(glGenBuffers(1, &cluster_bounds_ssbo));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_bounds_ssbo));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(glm::vec4) * num_clusters, NULL, GL_DYNAMIC_DRAW));
+
+	GL_CHECK(glGenBuffers(1, &visible_clusters_ssbo));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, visible_clusters_ssbo));
+	GL_CHECK(glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(uint32_t) * num_clusters, NULL, GL_DYNAMIC_DRAW));
+
+	// count, instance_count, first, base_instance, dispatch x, y, z
+	GLuint indirect_commands[7] = { 4, 0, 0, 0, 0, 1, 1 };
+	GL_CHECK(glGenBuffers(1, &indirect_buffer));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer));
+	GL_CHECK(glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(indirect_commands), indirect_commands, GL_DYNAMIC_DRAW));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+
+	GL_CHECK(glGenBuffers(VISIBLE_COUNT_LATENCY, visible_count_buffers));
+	for (GLuint buffer : visible_count_buffers)
+	{
+		GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, buffer));
+		GL_CHECK(glBufferData(GL_COPY_WRITE_BUFFER, sizeof(GLuint), NULL, GL_STREAM_READ));
+	}
+	GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+	/* COMPUTE INITIALIZATION: runs once, not worth tuning */
+	ComputeKernel init_kernel = ComputeTuner::GetKernel("particle_init_cs.glsl", get_particle_pack_shader_defines(), 256);
+	Shader* particle_init_cs = init_kernel.shader;
+	particle_init_cs->bind();
+	particle_init_cs->set_int("u_NumParticleSlots", num_particle_slots);
+	particle_init_cs->set_float3("u_BboxMin", bbox_min.x, bbox_min.y, bbox_min.z);
+	particle_init_cs->set_float3("u_BboxMax", bbox_max.x, bbox_max.y, bbox_max.z);
+	particle_init_cs->set_int3("u_ParticlesPerDim", particles_per_dim.x, particles_per_dim.y, particles_per_dim.z);
+	particle_init_cs->set_float("u_ParticleSize", particle_size);
+	GL_CHECK(glDispatchCompute(init_kernel.get_num_groups(num_particle_slots), 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+	particle_init_cs->unbind();
 
-	GL_CHECK(glBindVertexArray(vao));
-	GL_CHECK(glBindBuffer(GL_ARRAY_BUFFER, ssbo));
-	GL_CHECK(glEnableVertexAttribArray(0)); // Position
-	GL_CHECK(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const void*)offsetof(Particle, position)));
-	GL_CHECK(glEnableVertexAttribArray(1)); // Velocity
-	GL_CHECK(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Particle), (const void*)offsetof(Particle, velocity)));
-	GL_CHECK(glEnableVertexAttribArray(2)); // Size
-	GL_CHECK(glVertexAttribPointer(2, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const void*)offsetof(Particle, width)));
-	GL_CHECK(glEnableVertexAttribArray(3)); // Size
-	GL_CHECK(glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(Particle), (const void*)offsetof(Particle, height)));
-	GL_CHECK(glBindVertexArray(0));
-	
 	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
 }
 
+ParticleSystem::~ParticleSystem()
+{
+	for (GLsync fence : visible_count_fences)
+		if (fence)
+			glDeleteSync(fence);
+	glDeleteBuffers(VISIBLE_COUNT_LATENCY, visible_count_buffers);
+	glDeleteBuffers(1, &indirect_buffer);
+	glDeleteBuffers(1, &visible_clusters_ssbo);
+	glDeleteBuffers(1, &cluster_bounds_ssbo);
+	glDeleteBuffers(1, &sorted_ssbo);
+	glDeleteBuffers(1, &ssbo);
+	delete cluster_sorter;
+	glDeleteVertexArrays(1, &vao);
+}
+
+PrecipitationOcclusionMap::PrecipitationOcclusionMap(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max)
+	: m_BoundsMin(bounds_min), m_BoundsMax(bounds_max)
+{
+	FrameBufferCreateInfo bake_cinfo;
+	bake_cinfo.width = bake_cinfo.height = resolution;
+	bake_cinfo.attachment_bits = AttachmentType::DEPTH;
+	bake_cinfo.num_color_attachments = 0;
+	m_BakeBuffer = new FrameBuffer(bake_cinfo);
+
+	// Nothing baked yet, every texel at the bottom of the bounds
+	m_BakeBuffer->bind();
+	GL_CHECK(glClearDepth(0.0));
+	GL_CHECK(glClear(GL_DEPTH_BUFFER_BIT));
+	GL_CHECK(glClearDepth(1.0));
+	m_BakeBuffer->unbind();
+}
+
+PrecipitationOcclusionMap::~PrecipitationOcclusionMap()
+{
+	delete m_BakeBuffer;
+}
+
+glm::mat4 PrecipitationOcclusionMap::begin_bake()
+{
+	m_BakeBuffer->bind();
+	GL_CHECK(glEnable(GL_DEPTH_TEST));
+	GL_CHECK(glDepthMask(GL_TRUE));
+	GL_CHECK(glClearDepth(0.0));
+	GL_CHECK(glClear(GL_DEPTH_BUFFER_BIT));
+	GL_CHECK(glDepthFunc(GL_GREATER));
+	GL_CHECK(glDisable(GL_CULL_FACE));
+	return get_top_down_projection(m_BoundsMin, m_BoundsMax);
+}
+
+void PrecipitationOcclusionMap::end_bake()
+{
+	m_BakeBuffer->unbind();
+	GL_CHECK(glClearDepth(1.0));
+	GL_CHECK(glDepthFunc(GL_LESS));
+	GL_CHECK(glEnable(GL_CULL_FACE));
+}
+
+void ParticleSystem::set_volume_center(glm::vec3 center, float ground_height)
+{
+	glm::vec3 extent = bbox_max - bbox_min;
+	bbox_min = center - extent / 2.0f;
+	bbox_min.y = glm::max(bbox_min.y, ground_height);
+	bbox_max = bbox_min + extent;
+	wrap_volume = true;
+}
+
 int ParticleSystem::get_cluster(glm::vec3 position)
 {
 	glm::ivec3 relative_pos = ((glm::vec3)particles_per_dim) * (position - bbox_min) / (bbox_max - bbox_min);
 	relative_pos = glm::min(relative_pos, particles_per_dim - 1);
-	relative_pos = relative_pos / particles_per_cluster_dim;
+	relative_pos = relative_pos / PARTICLES_PER_CLUSTER_DIM;
 
-	glm::ivec3 clusters_per_dim = (particles_per_dim + particles_per_cluster_dim - 1) / particles_per_cluster_dim;
+	glm::ivec3 clusters_per_dim = (particles_per_dim + PARTICLES_PER_CLUSTER_DIM - 1) / PARTICLES_PER_CLUSTER_DIM;
 
 	int cluster = clusters_per_dim.x * (relative_pos.z * clusters_per_dim.y + relative_pos.y) + relative_pos.x;
 
@@ -69,35 +153,222 @@ int ParticleSystem::get_cluster(glm::vec3 position)
 void ParticleSystem::draw()
 {
 	GL_CHECK(glBindVertexArray(vao));
-	GL_CHECK(glDrawArrays(GL_POINTS, 0, particles.size()));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, visible_clusters_ssbo));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer));
+	GL_CHECK(glDrawArraysIndirect(GL_TRIANGLE_STRIP, (const void*)0));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, 0));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
 	GL_CHECK(glBindVertexArray(0));
 }
 
-void ParticleSystem::draw_instanced(uint32_t vertex_count)
+void ParticleSystem::read_particles(std::vector<Particle>& output)
 {
-	GL_CHECK(glBindVertexArray(vao));
-	GL_CHECK(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, vertex_count, particles.size()));
-	GL_CHECK(glBindVertexArray(0));
+	output.resize(num_particle_slots);
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, ssbo));
+	GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(Particle) * num_particle_slots, output.data()));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
+}
+
+void ParticleSystem::read_cluster_bounds(std::vector<glm::vec4>& output)
+{
+	output.resize(2 * num_clusters);
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, cluster_bounds_ssbo));
+	GL_CHECK(glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 2 * sizeof(glm::vec4) * num_clusters, output.data()));
+	GL_CHECK(glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0));
 }
 
-void ParticleSystem::update(float dt, Shader& particle_cs)
+void ParticleSystem::update(float dt, const WindField& wind_field, const PrecipitationOcclusionMap& occlusion_map, 
+	const SignedDistanceField& scene_sdf, const ParticleCullInfo& cull_info)
 {
-	static float time = 0.0f;
-	time += dt;
+	// Tuned on the first update of any system. Even without a time step the update respawns sheltered
+	// particles and pushes them out of the SDF, so the candidates run on a copy in the scratch buffer.
+	if (!simulate_kernel.shader)
+	{
+		GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, ssbo));
+		GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, sorted_ssbo));
+		GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(Particle) * num_particle_slots));
+		GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+		GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+		std::swap(ssbo, sorted_ssbo);
+		simulate_kernel = ComputeTuner::Tune("particle_cs.glsl", get_particle_pack_shader_defines(), { 128, 256, 512, 1024 },
+			[&](const ComputeKernel& kernel) { simulate(kernel, 0.0f, wind_field, occlusion_map, scene_sdf); });
+		std::swap(ssbo, sorted_ssbo);
+	}
+	if (!cluster_cull_kernel.shader)
+	{
+		static const std::string cull_defines = get_particle_shader_defines() + get_hiz_shader_defines();
+		cluster_cull_kernel = ComputeTuner::Tune("particle_cluster_cull_cs.glsl", cull_defines, { 64, 128, 256, 512, 1024 },
+			[&](const ComputeKernel& kernel) { cull_clusters(kernel, cull_info); });
+	}
+
+	// Before the simulation, which reduces the bounds of the regrouped clusters
+	if (wrap_volume && recluster_particles && frame > 0 && frame % RECLUSTER_INTERVAL == 0)
+		recluster();
+	simulate(simulate_kernel, dt, wind_field, occlusion_map, scene_sdf);
+	frame++;
+	cull_clusters(cluster_cull_kernel, cull_info);
+}
 
-	/* COMPUTE UPDATE */
+void ParticleSystem::simulate(const ComputeKernel& kernel, float dt, const WindField& wind_field, 
+	const PrecipitationOcclusionMap& occlusion_map, const SignedDistanceField& scene_sdf)
+{
+	Shader& particle_cs = *kernel.shader;
 	particle_cs.bind();
 	particle_cs.set_float("u_time_delta", dt);
-	particle_cs.set_float("u_time", time);
-	particle_cs.set_int("u_num_particles", particles.size());
+	particle_cs.set_uint("u_Frame", frame);
 	particle_cs.set_float3("u_BboxMin", bbox_min.x, bbox_min.y, bbox_min.z);
 	particle_cs.set_float3("u_BboxMax", bbox_max.x, bbox_max.y, bbox_max.z);
 	particle_cs.set_int3("u_ParticlesPerDim", particles_per_dim.x, particles_per_dim.y, particles_per_dim.z);
+	particle_cs.set_int("u_WrapVolume", wrap_volume);
+
+	glm::vec3 wind_min = wind_field.get_bounds_min();
+	glm::vec3 wind_max = wind_field.get_bounds_max();
+	particle_cs.set_float("u_WindAmp", scene_interaction ? wind_field.amplitude : 0.0f);
+	particle_cs.set_float3("u_WindBoundsMin", wind_min.x, wind_min.y, wind_min.z);
+	particle_cs.set_float3("u_WindBoundsMax", wind_max.x, wind_max.y, wind_max.z);
+	particle_cs.set_int("u_WindField", 0);
+	wind_field.bind(0);
+
+	glm::vec3 occlusion_min = occlusion_map.get_bounds_min();
+	glm::vec3 occlusion_max = occlusion_map.get_bounds_max();
+	particle_cs.set_int("u_OcclusionEnabled", scene_interaction);
+	particle_cs.set_float3("u_OcclusionBoundsMin", occlusion_min.x, occlusion_min.y, occlusion_min.z);
+	particle_cs.set_float3("u_OcclusionBoundsMax", occlusion_max.x, occlusion_max.y, occlusion_max.z);
+	particle_cs.set_int("u_OcclusionMap", 2);
+	occlusion_map.bind(2);
+
+	glm::vec3 sdf_min = scene_sdf.get_bounds_min();
+	glm::vec3 sdf_max = scene_sdf.get_bounds_max();
+	particle_cs.set_int("u_SDFEnabled", scene_interaction && scene_sdf.is_uploaded());
+	particle_cs.set_float3("u_SDFBoundsMin", sdf_min.x, sdf_min.y, sdf_min.z);
+	particle_cs.set_float3("u_SDFBoundsMax", sdf_max.x, sdf_max.y, sdf_max.z);
+	particle_cs.set_int("u_SceneSDF", 3);
+	scene_sdf.bind(3);
 
+	/* SIMULATION: 128 threads per cluster, each group reduces the bounds of its clusters */
 	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo));
-	GL_CHECK(glDispatchCompute((particles.size() + 1024 - 1) / 1024, 1, 1));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cluster_bounds_ssbo));
+	particle_cs.set_int("u_NumClusters", num_clusters);
+	// Split over two dimensions, the group count per dimension is limited to 65535
+	int num_groups = kernel.get_num_groups(num_clusters * 128);
+	int groups_x = glm::min(num_groups, 1024);
+	GL_CHECK(glDispatchCompute(groups_x, (num_groups + groups_x - 1) / groups_x, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+	particle_cs.unbind();
 
-	GL_CHECK(glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT));
 	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0));
-	particle_cs.unbind();
-}
\ No newline at end of file
+}
+
+void ParticleSystem::cull_clusters(const ComputeKernel& kernel, const ParticleCullInfo& cull_info)
+{
+	/* CLUSTER CULLING: one thread per cluster, visible clusters are appended */
+	GLuint zero = 0;
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer));
+	GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 1 * sizeof(GLuint), sizeof(GLuint), &zero));
+	GL_CHECK(glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 4 * sizeof(GLuint), sizeof(GLuint), &zero));
+	GL_CHECK(glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0));
+
+	glm::mat4 view_projection = cull_info.projection * cull_info.view;
+	const AABB& inner = cull_info.inner_volume;
+	Shader& cluster_cull_cs = *kernel.shader;
+	cluster_cull_cs.bind();
+	cluster_cull_cs.set_int("u_NumClusters", num_clusters);
+	cluster_cull_cs.set_matrix4fv("u_ViewProjection", &view_projection[0][0]);
+	cluster_cull_cs.set_float3("u_SystemBoundsMin", bbox_min.x, bbox_min.y, bbox_min.z);
+	cluster_cull_cs.set_float3("u_SystemBoundsMax", bbox_max.x, bbox_max.y, bbox_max.z);
+	cluster_cull_cs.set_float3("u_InnerVolume.min", inner.min.x, inner.min.y, inner.min.z);
+	cluster_cull_cs.set_float3("u_InnerVolume.max", inner.max.x, inner.max.y, inner.max.z);
+	cluster_cull_cs.set_float("u_ParticleSize", particle_size);
+	cluster_cull_cs.set_int("u_HiZEnabled", cull_info.hiz != nullptr);
+	if (cull_info.hiz)
+		cull_info.hiz->set_uniforms(cluster_cull_cs, 0);
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, cluster_bounds_ssbo));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, visible_clusters_ssbo));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, indirect_buffer));
+	GL_CHECK(glDispatchCompute(kernel.get_num_groups(num_clusters), 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT));
+	cluster_cull_cs.unbind();
+
+	if (cull_info.hiz)
+		GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+	for (int i = 2; i <= 4; i++)
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
+
+	read_back_visible_clusters();
+}
+
+// Passes of particle_recluster_cs.glsl
+enum ReclusterPass : int
+{
+	RECLUSTER_KEYS   = 0,
+	RECLUSTER_GATHER = 1,
+};
+
+void ParticleSystem::recluster()
+{
+	if (!cluster_sorter)
+		cluster_sorter = new ParticleSorter(num_particle_slots);
+	ComputeKernel recluster_kernel = ComputeTuner::GetKernel("particle_recluster_cs.glsl", get_particle_pack_shader_defines(), 256);
+	Shader& recluster_cs = *recluster_kernel.shader;
+	int num_groups = recluster_kernel.get_num_groups(num_particle_slots);
+
+	/* KEYS: nearby particles get nearby keys */
+	recluster_cs.bind();
+	recluster_cs.set_int("u_NumParticleSlots", num_particle_slots);
+	recluster_cs.set_int("u_Pass", ReclusterPass::RECLUSTER_KEYS);
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo));
+	cluster_sorter->bind_keys(4);
+	GL_CHECK(glDispatchCompute(num_groups, 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+	recluster_cs.unbind();
+
+	cluster_sorter->sort_keys(num_particle_slots, *AssetManager::GetShader("particle_sort_cs.glsl"));
+
+	/* GATHER: consecutive sorted particles form the new clusters, unused slots end up last */
+	recluster_cs.bind();
+	recluster_cs.set_int("u_Pass", ReclusterPass::RECLUSTER_GATHER);
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, ssbo));
+	GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, sorted_ssbo));
+	cluster_sorter->bind_keys(4);
+	GL_CHECK(glDispatchCompute(num_groups, 1, 1));
+	GL_CHECK(glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT));
+	recluster_cs.unbind();
+	for (int i : { 1, 2, 4 })
+		GL_CHECK(glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0));
+
+	std::swap(ssbo, sorted_ssbo);
+}
+
+void ParticleSystem::read_back_visible_clusters()
+{
+	// The oldest copy is reused, unless the GPU has not finished it, then this frame is not counted
+	int slot = visible_count_frame % VISIBLE_COUNT_LATENCY;
+	if (visible_count_fences[slot])
+	{
+		GLenum status = glClientWaitSync(visible_count_fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+			return;
+		GL_CHECK(glDeleteSync(visible_count_fences[slot]));
+		visible_count_fences[slot] = 0;
+		GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, visible_count_buffers[slot]));
+		GL_CHECK(glGetBufferSubData(GL_COPY_WRITE_BUFFER, 0, sizeof(uint32_t), &num_visible_clusters));
+	}
+
+	// dispatch_x of the indirect commands, one per visible cluster
+	GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, indirect_buffer));
+	GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, visible_count_buffers[slot]));
+	GL_CHECK(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 4 * sizeof(GLuint), 0, sizeof(GLuint)));
+	GL_CHECK(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+	GL_CHECK(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+	visible_count_fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	visible_count_frame++;
+}
+
+const std::string& get_particle_pack_shader_defines()
+{
+	static const std::string defines = get_particle_shader_defines()
+		+ AssetManager::ReadFile(std::filesystem::path(AssetManager::GetShaderPath()).append("particle_pack.glsl"));
+	return defines;
+}
@@ -0,0 +1,63 @@
+#include "picking.h"
+
+#include "gl_helpers.h"
+
+EntityPicker::EntityPicker()
+{
+	GL_CHECK(glGenBuffers(MAX_PENDING, m_PixelBuffers));
+	for (int i = 0; i < MAX_PENDING; i++)
+	{
+		GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PixelBuffers[i]));
+		GL_CHECK(glBufferData(GL_PIXEL_PACK_BUFFER, sizeof(uint32_t), NULL, GL_STREAM_READ));
+		m_Fences[i] = 0;
+	}
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+}
+
+EntityPicker::~EntityPicker()
+{
+	for (int i = 0; i < MAX_PENDING; i++)
+		if (m_Fences[i])
+			glDeleteSync(m_Fences[i]);
+	glDeleteBuffers(MAX_PENDING, m_PixelBuffers);
+}
+
+void EntityPicker::request(int x, int y, GLenum id_attachment)
+{
+	// Full ring, the oldest pick is superseded by the new one
+	if (m_NumPending == MAX_PENDING)
+	{
+		GL_CHECK(glDeleteSync(m_Fences[m_Oldest]));
+		m_Fences[m_Oldest] = 0;
+		m_Oldest = (m_Oldest + 1) % MAX_PENDING;
+		m_NumPending--;
+	}
+
+	int slot = (m_Oldest + m_NumPending) % MAX_PENDING;
+	GL_CHECK(glReadBuffer(id_attachment));
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PixelBuffers[slot]));
+	GL_CHECK(glReadPixels(x, y, 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0));
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	m_Fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	m_NumPending++;
+}
+
+bool EntityPicker::poll(uint32_t& entity_id)
+{
+	if (m_NumPending == 0)
+		return false;
+
+	// Flushed so the fence signals even if nothing else is submitted
+	GLenum status = glClientWaitSync(m_Fences[m_Oldest], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+
+	GL_CHECK(glDeleteSync(m_Fences[m_Oldest]));
+	m_Fences[m_Oldest] = 0;
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, m_PixelBuffers[m_Oldest]));
+	GL_CHECK(glGetBufferSubData(GL_PIXEL_PACK_BUFFER, 0, sizeof(uint32_t), &entity_id));
+	GL_CHECK(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+	m_Oldest = (m_Oldest + 1) % MAX_PENDING;
+	m_NumPending--;
+	return true;
+}
@@ -0,0 +1,58 @@
+#include "renderproxy.h"
+
+void RenderProxies::clear()
+{
+	entities.clear();
+	transforms.clear();
+	models.clear();
+	bounds.clear();
+	occluders.clear();
+	has_material.clear();
+	materials.clear();
+	lightmap_textures.clear();
+	m_Index.clear();
+	m_MaterialComponents.clear();
+	m_LightmapComponents.clear();
+}
+
+void RenderProxies::copy_draw_data(const RenderProxies& source)
+{
+	entities.assign(source.entities.begin(), source.entities.end());
+	transforms.assign(source.transforms.begin(), source.transforms.end());
+	models.assign(source.models.begin(), source.models.end());
+	bounds.assign(source.bounds.begin(), source.bounds.end());
+	occluders.assign(source.occluders.begin(), source.occluders.end());
+	m_Index.clear();
+
+	has_material.resize(source.size());
+	materials.resize(source.size());
+	lightmap_textures.resize(source.size());
+	for (uint32_t i = 0; i < source.size(); i++)
+	{
+		const ExampleMaterial* material = source.m_MaterialComponents[i];
+		has_material[i] = material != nullptr;
+		materials[i] = material ? *material : ExampleMaterial();
+		const LightmapComponent* lightmap = source.m_LightmapComponents[i];
+		lightmap_textures[i] = lightmap ? lightmap->texture : 0;
+	}
+}
+
+void RenderProxies::set_transform(entt::entity entity, const glm::mat4& transform)
+{
+	auto it = m_Index.find(entity);
+	if (it != m_Index.end())
+		transforms[it->second] = transform;
+}
+
+void RenderProxies::add(entt::entity entity, const glm::mat4& transform, RawModel* model, const ExampleMaterial* material,
+	const LightmapComponent* lightmap, bool occluder)
+{
+	m_Index[entity] = (uint32_t)entities.size();
+	entities.push_back(entity);
+	transforms.push_back(transform);
+	models.push_back(model);
+	bounds.push_back(model->get_bvh().get_bounds());
+	occluders.push_back(occluder);
+	m_MaterialComponents.push_back(material);
+	m_LightmapComponents.push_back(lightmap);
+}
@@ -1,10 +1,14 @@
 #include "scene.h"
 
+#include <algorithm>
+#include <cstdio>
+#include <unordered_map>
+
+#include "clock.h"
 #include "renderer.h"
 
 Scene::Scene(const Window& window, const std::string& name) : 
     m_Name(name), 
-    grass_system(glm::ivec3(grass_per_dim.x, 1, grass_per_dim.y), glm::vec3(bbox_min.x, 0, bbox_min.z) / 32.0f, glm::vec3(bbox_max.x, 0, bbox_max.z) / 32.0f),
     m_ActiveEntity(Entity::Invalid())
 {
     FrameBufferCreateInfo fb_cinfo;
@@ -23,6 +27,9 @@ Scene::Scene(const Window& window, const std::string& name) :
     }
     // TODO: Fix memory leak when creating new framebuffers
     m_DefaultFrameBuffer = new FrameBuffer(fb_cinfo);
+    m_ParticleSplatTarget = new ParticleSplatTarget(fb_cinfo.width, fb_cinfo.height);
+    m_EntityPicker = new EntityPicker();
+    m_HiZPyramid = new HiZPyramid(fb_cinfo.width, fb_cinfo.height);
 
     FrameBufferCreateInfo shadow_cinfo;
     shadow_cinfo.width = shadow_cinfo.height = 4096;
@@ -40,10 +47,19 @@ Scene::Scene(const Window& window, const std::string& name) :
 
     m_GrassShader = AssetManager::GetShader("grass.glsl");
     m_SkyboxShader = AssetManager::GetShader("skybox.glsl");
-    m_ParticleShader = AssetManager::GetShader("particle.glsl");
-    m_ParticleCSShader = AssetManager::GetShader("particle_cs.glsl");
+    m_ParticleShader = AssetManager::GetShader("particle.glsl", get_particle_pack_shader_defines());
+    m_ParticlePoolShader = AssetManager::GetShader("particle_pool.glsl");
+    m_ParticlePoolCSShader = AssetManager::GetShader("particle_pool_cs.glsl");
+    m_ParticleSortCSShader = AssetManager::GetShader("particle_sort_cs.glsl");
+    m_ParticleSplatCSShader = AssetManager::GetShader("particle_splat_cs.glsl", get_splat_shader_defines());
+    m_ParticleSplatResolveShader = AssetManager::GetShader("particle_splat_resolve.glsl", get_splat_shader_defines());
     m_FramebufferShader = AssetManager::GetShader("framebuffer.glsl");
     m_VarianceShadowMapShader = AssetManager::GetShader("variance_shadow_map.glsl");
+    m_GrassDensityShader = AssetManager::GetShader("grass_density.glsl");
+    m_WindCSShader = AssetManager::GetShader("wind_cs.glsl");
+    m_GrassTrampleCSShader = AssetManager::GetShader("grass_trample_cs.glsl");
+    m_HiZDownsampleCSShader = AssetManager::GetShader("hiz_downsample_cs.glsl");
+    m_GrassTileCullCSShader = AssetManager::GetShader("grass_tile_cull_cs.glsl", get_hiz_shader_defines());
 
     m_Skyboxes[0] = new Skybox(AssetManager::GetTextureCubeMap(skyboxes_names[0], true));
     m_Skyboxes[1] = new Skybox(AssetManager::GetTextureCubeMap(skyboxes_names[1], true));
@@ -51,15 +67,157 @@ Scene::Scene(const Window& window, const std::string& name) :
     GL_CHECK(glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS));
 
     m_WindTexture = AssetManager::GetTexture2D("noisemarble1.png");
+    m_SnowflakeTexture = AssetManager::GetTexture2D("snowflake_non_commersial.png");
+
+    m_WindField = new WindField(1024, glm::vec3(bbox_min.x, 0, bbox_min.z), glm::vec3(bbox_max.x, 0, bbox_max.z));
+    // Near to far: fewer, larger particles further away from the camera
+    m_SnowLayers.push_back(new ParticleSystem(glm::ivec3(48, 48, 48), glm::vec3(-8.0f), glm::vec3(8.0f), 0.05f));
+    m_SnowLayers.push_back(new ParticleSystem(glm::ivec3(48, 32, 48), glm::vec3(-24.0f, -16.0f, -24.0f), glm::vec3(24.0f, 16.0f, 24.0f), 0.1f));
+    m_SnowLayers.push_back(new ParticleSystem(glm::ivec3(32, 16, 32), glm::vec3(-64.0f, -32.0f, -64.0f), glm::vec3(64.0f, 32.0f, 64.0f), 0.3f));
+
+    // Blades are generated from gl_InstanceID and gl_VertexID, the draw needs no vertex data
+    GL_CHECK(glGenVertexArrays(1, &m_GrassVAO));
+    m_GrassDensityMap = new GrassDensityMap(1024, glm::vec3(bbox_min.x, -0.1f, bbox_min.z), glm::vec3(bbox_max.x, 0, bbox_max.z));
+    m_GrassTrampleMap = new GrassTrampleMap(512, 64.0f);
+    m_GrassTileVisibility = new GrassTileVisibility(64, glm::vec3(bbox_min.x, 0, bbox_min.z), glm::vec3(bbox_max.x, 0, bbox_max.z));
+    m_OcclusionBuffer = new OcclusionBuffer(256, 144);
+    m_PrecipitationOcclusionMap = new PrecipitationOcclusionMap(1024, bbox_min, bbox_max);
+    m_ParticlePool = new ParticlePool(1 << 20, *m_ParticlePoolCSShader);
+    m_ParticleSorter = new ParticleSorter(m_ParticlePool->get_capacity());
+    // Low-lying static geometry only, snow above it is sheltered by the occlusion map anyway
+    m_SceneSDF = new SignedDistanceField(glm::ivec3(256, 32, 256), bbox_min, glm::vec3(bbox_max.x, bbox_min.y + 32.0f, bbox_max.z));
+
+    m_EntityRegistry.on_construct<QuadRendererComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_destroy<QuadRendererComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_construct<ModelRendererComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_destroy<ModelRendererComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_construct<MaterialComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_destroy<MaterialComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_construct<LightmapComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_destroy<LightmapComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_construct<OccluderComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+    m_EntityRegistry.on_destroy<OccluderComponent>().connect<&Scene::OnRenderComponentChanged>(*this);
+}
+
+void Scene::Update(float dt)
+{
+    m_TimeDelta = dt;
+    m_Time += dt;
+
+    UpdateTransforms();
+    UpdateRenderProxies();
+    UpdateSceneBVH();
 }
 
-void Scene::Update()
+void Scene::WriteSnapshot(FrameSnapshot& snapshot) const
 {
+    snapshot.time = m_Time;
+    snapshot.quads.copy_draw_data(m_QuadProxies);
+    snapshot.models.copy_draw_data(m_ModelProxies);
+    snapshot.footprints.clear();
+    m_EntityRegistry.view<const TransformComponent, const GrassTramplerComponent>().each([&](auto entity, const TransformComponent& tc, const GrassTramplerComponent& gtc) {
+        snapshot.footprints.push_back(glm::vec4(glm::vec3(tc.transform[3]), gtc.radius));
+    });
+    snapshot.emitters.clear();
+    m_EntityRegistry.view<const TransformComponent, const ParticleEmitterComponent>().each([&](auto entity, const TransformComponent& tc, const ParticleEmitterComponent& pec) {
+        EmitterSnapshot& snapshot_emitter = snapshot.emitters.emplace_back();
+        snapshot_emitter.entity = entity;
+        snapshot_emitter.rate = pec.rate;
+        ParticleEmitter& emitter = snapshot_emitter.emitter;
+        emitter.shape = pec.shape;
+        emitter.transform = tc.transform;
+        emitter.direction = pec.direction;
+        emitter.spread = pec.spread;
+        emitter.speed = pec.speed;
+        emitter.lifetime = pec.lifetime;
+        emitter.size = pec.size;
+        if (pec.shape == EmitterShape::MESH)
+        {
+            const ModelRendererComponent* mrc = m_EntityRegistry.try_get<ModelRendererComponent>(entity);
+            if (!mrc)
+            {
+                snapshot.emitters.pop_back();
+                return;
+            }
+            emitter.mesh = mrc->model;
+        }
+    });
 }
 
-void Scene::Draw(const Camera& camera, const Window& window)
+void Scene::Draw(const FrameSnapshot& snapshot, const Camera& camera, const Window& window, float dt)
 {
+    // GPU effects advance every frame, also while the same snapshot is drawn again
+    m_DrawTimeDelta = dt;
+    m_DrawTime += dt;
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        // Wait with re-baking until the gizmo is released
+        if (m_StaticGeometryDirty && !ImGuizmo::IsUsing())
+        {
+            BakeStaticGeometryMaps();
+            m_StaticGeometryDirty = false;
+        }
+
+        LoadLightmaps();
+    }
+    // The distance field bakes in the background, particles collide with the previous one until then
+    if (m_SceneSDF->finish_bake())
+        m_SceneSDF->upload();
+
+    /* WIND FIELD, shared by grass and snow */
+    m_WindField->update(m_DrawTime, *m_WindCSShader, m_WindTexture);
+
+    /* PICKING: a click is resolved once its readback completes, a frame or two later */
+    uint32_t picked_id;
+    bool clicked = !paint_grass_density && !ImGuizmo::IsOver() && !ImGuizmo::IsUsing() && !ImGui::IsAnyItemHovered() && Input::IsMouseClicked(Button::LEFT);
+    glm::mat4 camera_view_projection = camera.get_view_projection(true);
+    {
+        // The scene BVH is refit by the simulation, occluders are read from the registry
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_EntityPicker->poll(picked_id) && m_EntityRegistry.valid((entt::entity)picked_id))
+            m_ActiveEntity = Entity(picked_id, this);
+        if (clicked && cpu_picking)
+        {
+            Clock pick_clock;
+            RayHit hit;
+            if (Raycast(GetCursorRay(camera, window), hit))
+                m_ActiveEntity = Entity(hit.instance, this);
+            pick_time_us = pick_clock.since_start() * 1e6f;
+        }
+
+        /* SOFTWARE OCCLUSION, before anything is submitted for the camera */
+        if (occlusion_culling)
+            DrawOccluders(camera_view_projection);
+    }
+    bool pick_requested = clicked && !cpu_picking;
+
+    FrameVector<uint8_t> quad_visible;
+    FrameVector<uint8_t> model_visible;
+    occlusion_culled_entities = CullRenderProxies(snapshot.quads, camera_view_projection, quad_visible);
+    occlusion_culled_entities += CullRenderProxies(snapshot.models, camera_view_projection, model_visible);
+
+    /* RECORD OPAQUE PASS on the job system, while the shadow passes are submitted */
+    // Shaders come from the asset cache, only the GL thread looks them up
+    Shader* opaque_shader = ExampleMaterial::GetShader(pick_requested);
+    JobCounter opaque_recorded;
+    JobSystem::Run([&]() {
+        RecordOpaqueCommands(snapshot.quads, quad_visible, m_QuadCommands);
+        RecordOpaqueCommands(snapshot.models, model_visible, m_ModelCommands);
+    }, &opaque_recorded);
+
     /* DRAW SCENE TO SHADOW MAP */
+    RecordCommands(snapshot.quads.size(), m_ShadowQuadCommands, [&](CommandBuffer& buffer, uint32_t i) {
+        buffer.set_matrix4(RawModelFlatColorMaterial::MODEL_LOCATION, snapshot.quads.transforms[i]);
+        buffer.bind_model(snapshot.quads.models[i]);
+        buffer.draw();
+    });
+    RecordCommands(snapshot.models.size(), m_ShadowModelCommands, [&](CommandBuffer& buffer, uint32_t i) {
+        buffer.set_matrix4(RawModelFlatColorMaterial::MODEL_LOCATION, snapshot.models.transforms[i]);
+        buffer.bind_model(snapshot.models.models[i]);
+        buffer.draw();
+    });
+
     m_ShadowMapBuffer->bind();
     GL_CHECK(glClearColor(0.0, 0.0, 0.0, 1.0));
     GL_CHECK(glClear(GL_DEPTH_BUFFER_BIT));
@@ -72,23 +230,11 @@ void Scene::Draw(const Camera& camera, const Window& window)
 
         GL_CHECK(glDepthMask(depth_cull || quad_alpha >= 1.0f ? GL_TRUE : GL_FALSE));
         GL_CHECK(glDisable(GL_CULL_FACE));
-        auto& quad_view = m_EntityRegistry.view<TransformComponent, QuadRendererComponent>();
-        quad_view.each([&](auto entity, auto tc, auto qrc) {
-            shader->set_matrix4fv("u_Model", (float*)&tc.transform[0]);
-            qrc.model->bind();
-            qrc.model->draw();
-            qrc.model->unbind();
-        });
+        ReplayCommands(m_ShadowQuadCommands);
         GL_CHECK(glEnable(GL_CULL_FACE));
         GL_CHECK(glDepthMask(GL_TRUE));
 
-        auto& model_view = m_EntityRegistry.view<TransformComponent, ModelRendererComponent>();
-        model_view.each([&](auto entity, auto tc, auto mrc) {
-            shader->set_matrix4fv("u_Model", (float*)&tc.transform[0]);
-            mrc.model->bind();
-            mrc.model->draw();
-            mrc.model->unbind();
-        });
+        ReplayCommands(m_ShadowModelCommands);
 
         shader->unbind();
     }
@@ -117,6 +263,8 @@ void Scene::Draw(const Camera& camera, const Window& window)
 
     /* DRAW SCENE TO BACKBUFFER */
     m_DefaultFrameBuffer->bind();
+    // The entity id attachment is only written by the opaque pass on frames with a pick
+    GL_CHECK(glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
     GL_CHECK(glClearColor(0.0, 0.0, 0.0, 1.0));
     GL_CHECK(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
     GL_CHECK(glEnable(GL_DEPTH_TEST));
@@ -134,59 +282,69 @@ void Scene::Draw(const Camera& camera, const Window& window)
     /** SKYBOX RENDERING END **/
 
     {
-        Shader* shader = ExampleMaterial::GetShader();
+        if (pick_requested)
+        {
+            GLuint invalid_id[4] = { EntityPicker::INVALID_ID, 0, 0, 0 };
+            GL_CHECK(glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
+            GL_CHECK(glClearBufferuiv(GL_COLOR, 1, invalid_id));
+        }
+
+        Shader* shader = opaque_shader;
         shader->bind();
 
         // Environment uniforms
-        shader->set_matrix4fv("u_ViewProjection", (float*)&camera.get_view_projection(true)[0]);
-        int sampler_index = 0;
-        shader->set_int("u_ShadowMap", sampler_index++);
-        GL_CHECK(glActiveTexture(GL_TEXTURE0));
+        shader->set_matrix4fv("u_ViewProjection", (float*)&camera_view_projection[0]);
+        shader->set_int("u_ShadowMap", ExampleMaterial::SHADOW_MAP_SLOT);
+        GL_CHECK(glActiveTexture(GL_TEXTURE0 + ExampleMaterial::SHADOW_MAP_SLOT));
         GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_VarianceMapBuffer->get_color_attachment(0)));
 
         shader->set_float3("u_DirectionalLight", directional_light.x, directional_light.y, directional_light.z);
         shader->set_matrix4fv("u_LightViewProjection", &light_view_projection[0][0]);
         shader->set_float("u_MinVariance", 0.00001f);
 
+        // One texture fetch per fragment replaces the constant ambient term
+        shader->set_int("u_Lightmap", ExampleMaterial::LIGHTMAP_SLOT);
+
+        JobSystem::Wait(opaque_recorded);
         GL_CHECK(glDepthMask(depth_cull || quad_alpha >= 1.0f ? GL_TRUE : GL_FALSE));
         GL_CHECK(glDisable(GL_CULL_FACE));
-        auto& quad_view = m_EntityRegistry.view<TransformComponent, QuadRendererComponent, MaterialComponent>();
-        quad_view.each([&](auto entity, TransformComponent& tc, QuadRendererComponent& qrc, MaterialComponent& matc) {
-            shader->set_uint("u_EntityID", (uint32_t)entity);
-            shader->set_matrix4fv("u_Model", (float*)&tc.transform[0]);
-            matc.material.Bind(sampler_index);
-            qrc.model->bind();
-            qrc.model->draw();
-            qrc.model->unbind();
-        });
+        ReplayCommands(m_QuadCommands);
         GL_CHECK(glEnable(GL_CULL_FACE));
         GL_CHECK(glDepthMask(GL_TRUE));
 
-        auto& model_view = m_EntityRegistry.view<TransformComponent, ModelRendererComponent, MaterialComponent>();
-        model_view.each([&](auto entity, TransformComponent& tc, ModelRendererComponent& mrc, MaterialComponent& matc) {
-            shader->set_uint("u_EntityID", (uint32_t)entity);
-            shader->set_matrix4fv("u_Model", (float*)&tc.transform[0]);
-            matc.material.Bind(sampler_index);
-            mrc.model->bind();
-            mrc.model->draw();
-            mrc.model->unbind();
-        });
+        ReplayCommands(m_ModelCommands);
         shader->unbind();
-    }
 
-    if (!ImGuizmo::IsOver() && !ImGuizmo::IsUsing() && !ImGui::IsAnyItemHovered() && Input::IsMouseClicked(Button::LEFT))
-    {
-        glm::dvec2 mouse_pos;
-        Input::GetCursor(mouse_pos);
-        glReadBuffer(GL_COLOR_ATTACHMENT1);
-        uint32_t entity_id;
-        glReadPixels((int)mouse_pos.x, (int)(window.get_height() - mouse_pos.y), 1, 1, GL_RED_INTEGER, GL_UNSIGNED_INT, &entity_id);
-        if (m_EntityRegistry.valid((entt::entity)entity_id))
-            m_ActiveEntity = Entity(entity_id, this);
+        if (pick_requested)
+        {
+            glm::dvec2 mouse_pos;
+            Input::GetCursor(mouse_pos);
+            m_EntityPicker->request((int)mouse_pos.x, (int)(window.get_height() - mouse_pos.y), GL_COLOR_ATTACHMENT1);
+            GL_CHECK(glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE));
+        }
     }
 
+    /* HI-Z PYRAMID of the opaque pass, for the culling of everything drawn after it */
+    if (hiz_culling)
+        m_HiZPyramid->build(m_DefaultFrameBuffer->get_depth_attachment(), *m_HiZDownsampleCSShader);
+
     if (g_DrawGrass) {
-        static float time = 0.0f;
+        // The camera acts as the player's feet
+        FrameVector<glm::vec4> footprints;
+        glm::vec3 camera_position = camera.get_position();
+        if (camera_tramples_grass)
+            footprints.push_back(glm::vec4(camera_position.x, m_GrassTrampleMap->ground_height, camera_position.z, camera_trample_radius));
+        footprints.insert(footprints.end(), snapshot.footprints.begin(), snapshot.footprints.end());
+        m_GrassTrampleMap->update(m_DrawTimeDelta, camera_position, footprints.data(), (uint32_t)footprints.size(), *m_GrassTrampleCSShader);
+
+        // Tiles behind the opaque pass, on top of the software occluders
+        if (hiz_culling)
+        {
+            if (!occlusion_culling)
+                m_GrassTileVisibility->clear();
+            m_GrassTileVisibility->cull(*m_HiZPyramid, camera_view_projection, *m_GrassTileCullCSShader);
+        }
+
         m_GrassShader->bind();
         // Grass VS Uniforms
         m_GrassShader->set_matrix4fv("u_ViewMatrix", &camera.get_view_matrix(true)[0][0]);
@@ -196,13 +354,20 @@ void Scene::Draw(const Camera& camera, const Window& window)
         m_GrassShader->set_float3("u_SystemBoundsMin", bbox_min.x, 0, bbox_min.z);
         m_GrassShader->set_float3("u_SystemBoundsMax", bbox_max.x, 0, bbox_max.z);
         m_GrassShader->set_int3("u_ParticlesPerDim", grass_per_dim.x, 1, grass_per_dim.y);
-        m_GrassShader->set_float("u_Time", time);
-        m_GrassShader->set_float("u_WindAmp", u_WindAmp);
-        m_GrassShader->set_float("u_WindFactor", u_WindFactor);
-        m_GrassShader->set_float2("u_WindDirection", u_WindDirection.x, u_WindDirection.y);
-        m_GrassShader->set_int("u_WindTexture", 0);
+        m_GrassShader->set_float("u_WindAmp", m_WindField->amplitude);
+        m_GrassShader->set_int("u_WindField", 0);
         m_GrassShader->set_int("u_VerticesPerBlade", vertices_per_blade);
-        m_WindTexture->bind(0);
+        m_WindField->bind(0);
+        m_GrassShader->set_int("u_GrassDensityMap", 3);
+        m_GrassDensityMap->bind(3);
+        glm::vec2 trample_origin = m_GrassTrampleMap->get_origin();
+        m_GrassShader->set_float2("u_TrampleOrigin", trample_origin.x, trample_origin.y);
+        m_GrassShader->set_float("u_TrampleSize", m_GrassTrampleMap->get_world_size());
+        m_GrassShader->set_int("u_TrampleMap", 4);
+        m_GrassTrampleMap->bind(4);
+        m_GrassShader->set_int("u_TileCulling", (int)(occlusion_culling || hiz_culling));
+        m_GrassShader->set_int("u_GrassTileVisibility", 5);
+        m_GrassTileVisibility->bind(5);
 
         // Grass FS Uniforms
         m_GrassShader->set_float3("u_LightDirection", directional_light.x, directional_light.y, directional_light.z);
@@ -211,12 +376,90 @@ void Scene::Draw(const Camera& camera, const Window& window)
         GL_CHECK(glActiveTexture(GL_TEXTURE2));
         GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_ShadowMapBuffer->get_depth_attachment()));
 
-        grass_system.draw_instanced(vertices_per_blade);
+        GL_CHECK(glBindVertexArray(m_GrassVAO));
+        GL_CHECK(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, vertices_per_blade, grass_per_dim.x * grass_per_dim.y));
+        GL_CHECK(glBindVertexArray(0));
         m_GrassShader->unbind();
     }
 
+    if (g_DrawSnow) {
+        if (camera_relative_snow)
+        {
+            // Layers are ordered near to far, every layer skips the volume covered by the previous one
+            AABB inner_volume = { glm::vec3(1.0f), glm::vec3(0.0f) };
+            for (ParticleSystem* layer : m_SnowLayers)
+            {
+                layer->set_volume_center(camera.get_position(), bbox_min.y);
+                DrawParticleSystem(*layer, camera, inner_volume);
+                inner_volume = { layer->get_bbox_min(), layer->get_bbox_max() };
+            }
+        }
+        else
+        {
+            if (!m_SnowSystem)
+                m_SnowSystem = new ParticleSystem(particles_per_dim, bbox_min, bbox_max);
+            DrawParticleSystem(*m_SnowSystem, camera, { glm::vec3(1.0f), glm::vec3(0.0f) });
+        }
+
+        // Coverage of all layers is blended at once, over the quads
+        if (splat_small_particles)
+            m_ParticleSplatTarget->resolve(*m_ParticleSplatResolveShader);
+    }
+
+    if (g_DrawEmitters) {
+        // Emitters come from the snapshot, only the spawn accumulators and the bursts requested by
+        // the inspector live in the registry
+        FrameVector<uint32_t> emit_counts(snapshot.emitters.size(), 0);
+        {
+            std::lock_guard<std::mutex> lock(m_Mutex);
+            for (size_t i = 0; i < snapshot.emitters.size(); i++)
+            {
+                const EmitterSnapshot& snapshot_emitter = snapshot.emitters[i];
+                ParticleEmitterComponent* pec = m_EntityRegistry.valid(snapshot_emitter.entity) ?
+                    m_EntityRegistry.try_get<ParticleEmitterComponent>(snapshot_emitter.entity) : nullptr;
+                if (!pec)
+                    continue;
+                pec->accumulator += snapshot_emitter.rate * m_DrawTimeDelta;
+                emit_counts[i] = (uint32_t)pec->accumulator + pec->pending;
+                pec->accumulator -= (uint32_t)pec->accumulator;
+                pec->pending = 0;
+            }
+        }
+        for (size_t i = 0; i < snapshot.emitters.size(); i++)
+            m_ParticlePool->emit(snapshot.emitters[i].emitter, emit_counts[i], *m_ParticlePoolCSShader);
+        m_ParticlePool->update(m_DrawTimeDelta, *m_ParticlePoolCSShader, *m_WindField);
+
+        glm::mat4 view = camera.get_view_matrix(true);
+        glm::mat4 projection = camera.get_projection_matrix();
+        if (sort_emitter_particles)
+            m_ParticleSorter->sort(*m_ParticlePool, view, projection, *m_ParticleSortCSShader);
+
+        m_ParticlePoolShader->bind();
+        m_ParticlePoolShader->set_matrix4fv("u_ViewMatrix", &view[0][0]);
+        m_ParticlePoolShader->set_matrix4fv("u_ProjectionMatrix", &projection[0][0]);
+        m_ParticlePoolShader->set_int("u_Sorted", sort_emitter_particles);
+        m_ParticlePoolShader->set_int("u_particle_tex", 1);
+        m_SnowflakeTexture->bind(1);
+        if (sort_emitter_particles)
+        {
+            /* TRANSPARENT PASS: depth tested against the scene, but not written */
+            GL_CHECK(glEnable(GL_BLEND));
+            GL_CHECK(glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA));
+            GL_CHECK(glDepthMask(GL_FALSE));
+            m_ParticleSorter->draw(*m_ParticlePool);
+            GL_CHECK(glDepthMask(GL_TRUE));
+            GL_CHECK(glDisable(GL_BLEND));
+        }
+        else
+        {
+            m_ParticlePool->draw();
+        }
+        m_ParticlePoolShader->unbind();
+    }
+
     /* RENDER TO DEFAULT FRAMEBUFFER + PRESENT */
     {
+        GL_CHECK(glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE));
         m_DefaultFrameBuffer->unbind();
         GLuint rendered_texture = m_DefaultFrameBuffer->get_color_attachment(0);
         if (draw_shadow_map)
@@ -245,6 +488,7 @@ void Scene::Draw(const Camera& camera, const Window& window)
 
 void Scene::DrawGUI(const Camera& camera)
 {
+    std::lock_guard<std::mutex> lock(m_Mutex);
     ImGuiIO& io = ImGui::GetIO();
     float* view_matrix = (float*)&camera.get_view_matrix(true)[0];
     float* proj_matrix = (float*)&camera.get_projection_matrix()[0];
@@ -286,7 +530,17 @@ void Scene::DrawGUI(const Camera& camera)
         {
             ImGui::Text("Selected model id: %d", m_ActiveEntity.GetID());
             TransformComponent& tc = m_ActiveEntity.GetComponent<TransformComponent>();
-            ImGuizmo::Manipulate(view_matrix, proj_matrix, s_ImGuizmoOperation, ImGuizmo::WORLD, (float*)&tc.transform[0], NULL, NULL, NULL, NULL);
+            // The gizmo moves the world matrix, the change is written back relative to the parent
+            glm::mat4 world = tc.transform;
+            ImGuizmo::Manipulate(view_matrix, proj_matrix, s_ImGuizmoOperation, ImGuizmo::WORLD, (float*)&world[0], NULL, NULL, NULL, NULL);
+            if (world != tc.transform)
+            {
+                entt::entity parent = m_ActiveEntity.GetComponent<HierarchyComponent>().parent;
+                tc.set_local(parent != entt::null ? glm::inverse(m_EntityRegistry.get<TransformComponent>(parent).transform) * world : world);
+                tc.transform = world;
+            }
+            if (ImGuizmo::IsUsing())
+                m_StaticGeometryDirty = true;
         }
         else
         {
@@ -295,14 +549,76 @@ void Scene::DrawGUI(const Camera& camera)
         ImGuizmo::Enable(object_selected);
     }
 
+    // Paint grass density where the cursor hits the ground
+    if (paint_grass_density && Input::IsMousePressed(Button::LEFT) && !io.WantCaptureMouse)
+    {
+        glm::dvec2 mouse_pos;
+        Input::GetCursor(mouse_pos);
+        glm::vec2 ndc(2.0f * mouse_pos.x / io.DisplaySize.x - 1.0f, 1.0f - 2.0f * mouse_pos.y / io.DisplaySize.y);
+        glm::mat4 inv_view_projection = glm::inverse(camera.get_view_projection(true));
+        glm::vec4 near_point = inv_view_projection * glm::vec4(ndc, -1.0f, 1.0f);
+        glm::vec4 far_point = inv_view_projection * glm::vec4(ndc, 1.0f, 1.0f);
+        glm::vec3 ray_origin = glm::vec3(near_point) / near_point.w;
+        glm::vec3 ray_direction = glm::vec3(far_point) / far_point.w - ray_origin;
+        if (ray_direction.y < 0.0f)
+        {
+            glm::vec3 hit = ray_origin - ray_direction * (ray_origin.y / ray_direction.y);
+            m_GrassDensityMap->paint(glm::vec2(hit.x, hit.z), grass_brush_radius, grass_brush_density);
+        }
+    }
+
     ImGui::Dummy(ImVec2(0.0, 5.0));
     if (ImGui::CollapsingHeader("Simulation"))
     {
-        ImGui::Text("Num particles: %d, (%d x %d x %d)",
-            particles_per_dim.x * particles_per_dim.y * particles_per_dim.z,
-            particles_per_dim.x, particles_per_dim.y, particles_per_dim.z);
+        ImGui::Checkbox("Camera-relative snow", &camera_relative_snow);
+        if (camera_relative_snow)
+        {
+            int num_particles = 0;
+            for (ParticleSystem* layer : m_SnowLayers)
+                num_particles += layer->get_num_particles();
+            ImGui::Text("Num particles: %d, (%d layers)", num_particles, (int)m_SnowLayers.size());
+            // Read back every frame, the counts follow the clusters as the snow drifts
+            for (size_t i = 0; i < m_SnowLayers.size(); i++)
+                ImGui::Text("Layer %d culled clusters: %d / %d", (int)i, m_SnowLayers[i]->get_num_culled_clusters(), m_SnowLayers[i]->get_num_clusters());
+        }
+        else
+        {
+            ImGui::Text("Num particles: %d, (%d x %d x %d)",
+                particles_per_dim.x * particles_per_dim.y * particles_per_dim.z,
+                particles_per_dim.x, particles_per_dim.y, particles_per_dim.z);
+            if (m_SnowSystem)
+                ImGui::Text("Culled clusters: %d / %d", m_SnowSystem->get_num_culled_clusters(), m_SnowSystem->get_num_clusters());
+        }
         ImGui::Dummy(ImVec2(0.0, 5.0));
+        ImGui::Checkbox("Draw snow", &g_DrawSnow);
+        if (m_SceneSDF->is_baking())
+            ImGui::Text("Baking collision distance field...");
+        ImGui::Checkbox("Splat small particles", &splat_small_particles);
+        if (splat_small_particles)
+            ImGui::SliderFloat("Splat max size (px)", &splat_max_size, 0.5f, 4.0f);
+        ImGui::Checkbox("Draw emitters", &g_DrawEmitters);
+        ImGui::Checkbox("Sort emitter particles", &sort_emitter_particles);
+        if (sort_emitter_particles && ImGui::Button("Validate sort against CPU reference"))
+            m_ParticleSorter->validate();
+        ImGui::Text("Emitter pool capacity: %u", m_ParticlePool->get_capacity());
+        ImGui::SliderFloat("Emitter gravity", &m_ParticlePool->gravity, 0.0f, 10.0f);
+        ImGui::SliderFloat("Emitter drag", &m_ParticlePool->drag, 0.0f, 5.0f);
         ImGui::Checkbox("Colored particles", &colored_particles);
+
+        ImGui::Dummy(ImVec2(0.0, 5.0));
+        ImGui::SliderInt("Validation steps", &particle_validation_steps, 1, 3600);
+        ImGui::InputFloat("Validation tolerance", &particle_validation_tolerance, 0.001f, 0.01f, "%.4f");
+        ImGui::Checkbox("Validate wrapping volume", &particle_validation_wrap);
+        if (ImGui::Button("Validate against CPU reference"))
+            ValidateParticleSimulation();
+        if (particle_validation_done)
+        {
+            ImGui::Text("Mismatches: %u / %u", particle_validation.num_mismatches, particle_validation.num_compared);
+            ImGui::Text("Max error: position %.5f, velocity %.5f", particle_validation.max_position_error, particle_validation.max_velocity_error);
+            ImGui::Text("CPU reference: %.1f M particle updates/s", particle_reference_rate / 1e6);
+            ImGui::Text("Outside cluster bounds: %u, clusters across a seam: %u", particle_bounds_validation.num_outside, particle_bounds_validation.num_overhanging);
+            ImGui::Text("Max cluster extent: %.3f of the volume", particle_bounds_validation.max_extent);
+        }
     }
 
     ImGui::Dummy(ImVec2(0.0, 5.0));
@@ -314,6 +630,17 @@ void Scene::DrawGUI(const Camera& camera)
         if (draw_quads)
             ImGui::SliderFloat("Quad alpha", &quad_alpha, 0.0, 1.0);
         ImGui::Checkbox("Draw colliders", &draw_colliders);
+        ImGui::Checkbox("CPU picking", &cpu_picking);
+        if (cpu_picking)
+            ImGui::Text("Last pick: %.1f us", pick_time_us);
+        ImGui::Checkbox("Occlusion culling", &occlusion_culling);
+        if (occlusion_culling)
+        {
+            ImGui::Text("Occluders: %.1f us", occlusion_time_us);
+            ImGui::Text("Culled entities: %u", occlusion_culled_entities);
+            ImGui::Text("Visible grass tiles (CPU): %u / %u", m_GrassTileVisibility->get_num_visible(), m_GrassTileVisibility->get_num_tiles());
+        }
+        ImGui::Checkbox("Hi-Z culling", &hiz_culling);
     }
 
     ImGui::Dummy(ImVec2(0.0, 5.0));
@@ -321,14 +648,34 @@ void Scene::DrawGUI(const Camera& camera)
     {
         ImGui::Checkbox("Enable", &g_DrawGrass);
 
-        ImGui::Dummy(ImVec2(0.0, 5.0));
-        ImGui::SliderFloat2("Wind direction", (float*)&u_WindDirection, -1.0, 1.0);
-        ImGui::SliderFloat("WindAmp", &u_WindAmp, 0.0, 1.0);
-        ImGui::SliderFloat("WindFactor", &u_WindFactor, 0.0, 40.0);
-
         ImGui::Dummy(ImVec2(0.0, 5.0));
         ImGui::SliderInt("Vertices Per Blade", &vertices_per_blade, 4.0, 16.0);
         vertices_per_blade = (vertices_per_blade / 2) * 2;
+
+        ImGui::Dummy(ImVec2(0.0, 5.0));
+        if (ImGui::SliderFloat("Exclusion height", &grass_exclusion_height, 0.1, 50.0))
+            m_StaticGeometryDirty = true;
+        ImGui::Checkbox("Paint density", &paint_grass_density);
+        if (paint_grass_density)
+        {
+            ImGui::SliderFloat("Brush radius", &grass_brush_radius, 0.1, 20.0);
+            ImGui::SliderFloat("Brush density", &grass_brush_density, 0.0, 1.0);
+            if (ImGui::Button("Clear painted density"))
+                m_GrassDensityMap->clear_paint();
+        }
+
+        ImGui::Dummy(ImVec2(0.0, 5.0));
+        ImGui::Checkbox("Camera tramples grass", &camera_tramples_grass);
+        ImGui::SliderFloat("Camera trample radius", &camera_trample_radius, 0.1, 5.0);
+        ImGui::SliderFloat("Trample recovery rate", &m_GrassTrampleMap->recovery_rate, 0.0, 5.0);
+    }
+
+    ImGui::Dummy(ImVec2(0.0, 5.0));
+    if (ImGui::CollapsingHeader("Wind"))
+    {
+        ImGui::SliderFloat2("Wind direction", (float*)&m_WindField->direction, -1.0, 1.0);
+        ImGui::SliderFloat("WindAmp", &m_WindField->amplitude, 0.0, 1.0);
+        ImGui::SliderFloat("WindFactor", &m_WindField->factor, 0.0, 40.0);
     }
 
     ImGui::Dummy(ImVec2(0.0, 5.0));
@@ -342,6 +689,14 @@ void Scene::DrawGUI(const Camera& camera)
         ImGui::Checkbox("Draw shadow map", &draw_shadow_map);
         glm::mat4 light_view = glm::lookAt(directional_light * ortho_size, glm::vec3(0.0, 0.0, 0.0), glm::vec3(0.0, 1.0, 0.0));
         light_view_projection = glm::ortho<float>(-ortho_size, ortho_size, -ortho_size, ortho_size, 0.1, ortho_far) * light_view;
+
+        ImGui::Dummy(ImVec2(0.0, 5.0));
+        ImGui::SliderInt("Lightmap rays", (int*)&lightmap_settings.num_rays, 1, 256);
+        ImGui::SliderFloat("AO radius", &lightmap_settings.ao_radius, 0.1, 10.0);
+        if (ImGui::Button("Bake lightmaps"))
+            BakeLightmaps();
+        if (lightmap_bake_time > 0.0f)
+            ImGui::Text("Last bake: %.2f s", lightmap_bake_time);
     }
 
     ImGui::Dummy(ImVec2(0.0, 5.0));
@@ -367,15 +722,11 @@ void Scene::DrawGUI(const Camera& camera)
     ImGui::End(); // Settings panel
 
     ImGui::Begin("Hierarchy");
-    m_EntityRegistry.view<NameComponent>().each(
-        [&](auto entity, auto namecomp) {
-            ImGui::PushItemWidth(-1.0f);
-            std::string name_id = namecomp.name + std::string("##") + std::to_string((uint32_t)entity);
-            if (ImGui::Button(name_id.c_str(), ImVec2(ImGui::GetWindowSize().x, 0.0f)))
-                m_ActiveEntity = Entity(entity, this);
-            ImGui::PopItemWidth();
-        }
-    );
+    for (const TransformNode& node : m_TransformOrder)
+    {
+        if (node.parent < 0)
+            DrawHierarchyNode(node.entity);
+    }
     ImGui::End(); // Hierarchy
 
     ImGui::Begin("Inspector");
@@ -384,9 +735,14 @@ void Scene::DrawGUI(const Camera& camera)
         ImGui::Text("Id: %d", m_ActiveEntity.GetID());
         DrawComponentUIIfExists<NameComponent>(m_ActiveEntity);
         DrawComponentUIIfExists<TransformComponent>(m_ActiveEntity);
+        DrawComponentUIIfExists<HierarchyComponent>(m_ActiveEntity);
         DrawComponentUIIfExists<ModelRendererComponent>(m_ActiveEntity);
         DrawComponentUIIfExists<QuadRendererComponent>(m_ActiveEntity);
         DrawComponentUIIfExists<MaterialComponent>(m_ActiveEntity);
+        DrawComponentUIIfExists<LightmapComponent>(m_ActiveEntity);
+        DrawComponentUIIfExists<GrassTramplerComponent>(m_ActiveEntity);
+        DrawComponentUIIfExists<OccluderComponent>(m_ActiveEntity);
+        DrawComponentUIIfExists<ParticleEmitterComponent>(m_ActiveEntity);
     }
     ImGui::End(); // Inspector
 
@@ -398,6 +754,27 @@ void Scene::DrawGUI(const Camera& camera)
 #endif
 }
 
+void Scene::DrawHierarchyNode(entt::entity entity)
+{
+    const NameComponent& namecomp = m_EntityRegistry.get<NameComponent>(entity);
+    ImGui::PushItemWidth(-1.0f);
+    char id[16];
+    snprintf(id, sizeof(id), "##%u", (uint32_t)entity);
+    FrameString name_id(namecomp.name.c_str());
+    name_id += id;
+    if (ImGui::Button(name_id.c_str(), ImVec2(ImGui::GetContentRegionAvail().x, 0.0f)))
+        m_ActiveEntity = Entity(entity, this);
+    ImGui::PopItemWidth();
+
+    const HierarchyComponent& hc = m_EntityRegistry.get<HierarchyComponent>(entity);
+    if (hc.children.empty())
+        return;
+    ImGui::Indent();
+    for (entt::entity child : hc.children)
+        DrawHierarchyNode(child);
+    ImGui::Unindent();
+}
+
 template <typename Component>
 void Scene::DrawComponentUIIfExists(Entity entity)
 {
@@ -412,12 +789,494 @@ Entity Scene::CreateEntity(const std::string& name)
 	Entity entity(m_EntityRegistry.create(), this);
 	m_EntityRegistry.emplace<NameComponent>(entity, name);
 	m_EntityRegistry.emplace<TransformComponent>(entity);
+	m_EntityRegistry.emplace<HierarchyComponent>(entity);
+	m_HierarchyDirty = true;
+	m_StaticGeometryDirty = true;
 	return entity;
 }
 
 void Scene::DestroyEntity(Entity entity)
 {
-	m_EntityRegistry.destroy((entt::entity) entity.GetID());
+	entt::entity handle = (entt::entity)entity.GetID();
+	SetParent(entity, Entity::Invalid());
+
+	// Children first, they detach themselves from this entity
+	std::vector<entt::entity> children = m_EntityRegistry.get<HierarchyComponent>(handle).children;
+	for (entt::entity child : children)
+		DestroyEntity(Entity(child, this));
+
+	if (m_ActiveEntity.GetID() == entity.GetID())
+		m_ActiveEntity = Entity::Invalid();
+	m_EntityRegistry.destroy(handle);
+	m_HierarchyDirty = true;
+	m_StaticGeometryDirty = true;
+}
+
+void Scene::SetParent(Entity child, Entity parent)
+{
+	entt::entity child_handle = (entt::entity)child.GetID();
+	entt::entity parent_handle = parent.GetID() == Entity::Invalid().GetID() ? entt::null : (entt::entity)parent.GetID();
+	HierarchyComponent& hc = m_EntityRegistry.get<HierarchyComponent>(child_handle);
+	if (hc.parent == parent_handle)
+		return;
+
+	// Attaching to a descendant would create a cycle
+	for (entt::entity ancestor = parent_handle; ancestor != entt::null; ancestor = m_EntityRegistry.get<HierarchyComponent>(ancestor).parent)
+	{
+		if (ancestor == child_handle)
+		{
+			std::cout << "Error: Cannot parent entity " << child.GetID() << " to its own descendant " << parent.GetID() << std::endl;
+			return;
+		}
+	}
+
+	if (hc.parent != entt::null)
+	{
+		std::vector<entt::entity>& siblings = m_EntityRegistry.get<HierarchyComponent>(hc.parent).children;
+		siblings.erase(std::remove(siblings.begin(), siblings.end(), child_handle), siblings.end());
+	}
+	if (parent_handle != entt::null)
+		m_EntityRegistry.get<HierarchyComponent>(parent_handle).children.push_back(child_handle);
+
+	hc.parent = parent_handle;
+	m_EntityRegistry.get<TransformComponent>(child_handle).dirty = true;
+	m_HierarchyDirty = true;
+}
+
+void Scene::RebuildTransformOrder()
+{
+	m_TransformOrder.clear();
+	m_EntityRegistry.view<HierarchyComponent>().each([&](auto entity, HierarchyComponent& hc) {
+		if (hc.parent == entt::null)
+			m_TransformOrder.push_back({ entity, -1 });
+	});
+
+	// Breadth-first, every level is appended after the previous one is complete
+	m_TransformLevels.clear();
+	uint32_t level_begin = 0;
+	while (level_begin < m_TransformOrder.size())
+	{
+		uint32_t level_end = (uint32_t)m_TransformOrder.size();
+		for (uint32_t i = level_begin; i < level_end; i++)
+		{
+			for (entt::entity child : m_EntityRegistry.get<HierarchyComponent>(m_TransformOrder[i].entity).children)
+				m_TransformOrder.push_back({ child, (int32_t)i });
+		}
+		m_TransformLevels.push_back(level_end);
+		level_begin = level_end;
+	}
+
+	// Lay out the transforms in the same order, so the update walks their storage front to back
+	std::unordered_map<entt::entity, uint32_t> order_index;
+	for (uint32_t i = 0; i < m_TransformOrder.size(); i++)
+		order_index[m_TransformOrder[i].entity] = i;
+	m_EntityRegistry.sort<TransformComponent>([&](const entt::entity lhs, const entt::entity rhs) {
+		return order_index[lhs] < order_index[rhs];
+	});
+}
+
+void Scene::UpdateTransforms()
+{
+	if (m_HierarchyDirty)
+	{
+		RebuildTransformOrder();
+		m_HierarchyDirty = false;
+	}
+
+	// A node is recomputed if it was edited or its parent's world matrix changed, unchanged subtrees are skipped
+	m_TransformChanged.assign(m_TransformOrder.size(), 0);
+	std::atomic<bool> static_changed = false;
+	auto update_node = [&](uint32_t i) {
+		const TransformNode& node = m_TransformOrder[i];
+		TransformComponent& tc = m_EntityRegistry.get<TransformComponent>(node.entity);
+		const TransformComponent* parent = node.parent >= 0 ? &m_EntityRegistry.get<TransformComponent>(m_TransformOrder[node.parent].entity) : nullptr;
+
+		bool parent_changed = parent && m_TransformChanged[node.parent];
+		if (!tc.dirty && !parent_changed)
+			return;
+
+		tc.transform = parent ? parent->transform * tc.get_local() : tc.get_local();
+		m_QuadProxies.set_transform(node.entity, tc.transform);
+		m_ModelProxies.set_transform(node.entity, tc.transform);
+		m_TransformChanged[i] = 1;
+		tc.dirty = false;
+		if (tc.is_static)
+			static_changed = true;
+	};
+
+	// Nodes of one level only read the previous level, so each level is split over the job system
+	uint32_t level_begin = 0;
+	for (uint32_t level_end : m_TransformLevels)
+	{
+		JobSystem::ParallelFor(level_end - level_begin, TRANSFORM_GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+			for (uint32_t i = begin; i < end; i++)
+				update_node(level_begin + i);
+		});
+		level_begin = level_end;
+	}
+	if (static_changed)
+		m_StaticGeometryDirty = true;
+}
+
+bool Scene::Raycast(const Ray& ray, RayHit& hit) const
+{
+    return m_SceneBVH.intersect(ray, hit);
+}
+
+void Scene::UpdateRenderProxies()
+{
+    if (!m_RenderProxiesDirty)
+        return;
+    m_QuadProxies.rebuild<QuadRendererComponent>(m_EntityRegistry);
+    m_ModelProxies.rebuild<ModelRendererComponent>(m_EntityRegistry);
+    m_RenderProxiesDirty = false;
+}
+
+void Scene::OnRenderComponentChanged(entt::registry& registry, entt::entity entity)
+{
+    m_RenderProxiesDirty = true;
+}
+
+void Scene::UpdateSceneBVH()
+{
+    FrameVector<BVHInstance> instances;
+    instances.reserve(m_ModelProxies.size() + m_QuadProxies.size());
+    for (const RenderProxies* proxies : { &m_ModelProxies, &m_QuadProxies })
+    {
+        for (uint32_t i = 0; i < proxies->size(); i++)
+            instances.push_back({ &proxies->models[i]->get_bvh(), proxies->transforms[i], (uint32_t)proxies->entities[i] });
+    }
+
+    // Proxy order is stable until entities or components are added or removed
+    bool rebuild = instances.size() != m_SceneBVH.get_num_instances();
+    for (uint32_t i = 0; !rebuild && i < instances.size(); i++)
+        rebuild = instances[i].id != m_SceneBVH.get_instance(i).id || instances[i].mesh != m_SceneBVH.get_instance(i).mesh;
+    if (rebuild)
+    {
+        m_SceneBVH.build(std::vector<BVHInstance>(instances.begin(), instances.end()));
+        return;
+    }
+
+    for (uint32_t i = 0; i < instances.size(); i++)
+        if (instances[i].transform != m_SceneBVH.get_instance(i).transform)
+            m_SceneBVH.set_transform(i, instances[i].transform);
+    m_SceneBVH.refit();
+}
+
+Ray Scene::GetCursorRay(const Camera& camera, const Window& window) const
+{
+    glm::dvec2 mouse_pos;
+    Input::GetCursor(mouse_pos);
+    glm::vec2 ndc(2.0 * mouse_pos.x / window.get_width() - 1.0, 1.0 - 2.0 * mouse_pos.y / window.get_height());
+
+    glm::mat4 inverse_view_projection = glm::inverse(camera.get_view_projection(true));
+    glm::vec4 near_point = inverse_view_projection * glm::vec4(ndc, -1.0f, 1.0f);
+    glm::vec4 far_point = inverse_view_projection * glm::vec4(ndc, 1.0f, 1.0f);
+
+    Ray ray;
+    ray.origin = glm::vec3(near_point) / near_point.w;
+    ray.direction = glm::vec3(far_point) / far_point.w - ray.origin;
+    return ray;
+}
+
+// Model of the entity's model or quad renderer
+static RawModel* get_entity_model(entt::registry& registry, entt::entity entity)
+{
+    ModelRendererComponent* mrc = registry.try_get<ModelRendererComponent>(entity);
+    QuadRendererComponent* qrc = registry.try_get<QuadRendererComponent>(entity);
+    return mrc ? mrc->model : (qrc ? qrc->model : nullptr);
+}
+
+void Scene::DrawOccluders(const glm::mat4& view_projection)
+{
+    Clock occlusion_clock;
+    m_OcclusionBuffer->clear();
+    m_EntityRegistry.view<TransformComponent, OccluderComponent>().each([&](auto entity, TransformComponent& tc, OccluderComponent& oc) {
+        glm::mat4 model_view_projection = view_projection * tc.transform;
+        if (oc.mesh)
+        {
+            m_OcclusionBuffer->draw_occluder(oc.mesh->get_model_data(), model_view_projection);
+            return;
+        }
+
+        // Box of the rendered model, shrunk so the occluder does not cover more than the model
+        RawModel* model = get_entity_model(m_EntityRegistry, entity);
+        if (!model)
+            return;
+        BVHBounds bounds = model->get_bvh().get_bounds();
+        glm::vec3 center = 0.5f * (bounds.min + bounds.max);
+        glm::vec3 half_extent = 0.5f * (bounds.max - bounds.min) * oc.box_scale;
+        m_OcclusionBuffer->draw_box(center - half_extent, center + half_extent, model_view_projection);
+    });
+    m_OcclusionBuffer->finish();
+
+    m_GrassTileVisibility->update(*m_OcclusionBuffer, view_projection);
+    occlusion_time_us = occlusion_clock.since_start() * 1e6f;
+}
+
+bool Scene::IsOccluded(const RenderProxies& proxies, uint32_t index, const glm::mat4& view_projection) const
+{
+    // Occluders would only test against themselves
+    if (proxies.occluders[index])
+        return false;
+
+    const BVHBounds& bounds = proxies.bounds[index];
+    return m_OcclusionBuffer->is_occluded(bounds.min, bounds.max, view_projection * proxies.transforms[index]);
+}
+
+uint32_t Scene::CullRenderProxies(const RenderProxies& proxies, const glm::mat4& view_projection, FrameVector<uint8_t>& visible)
+{
+    visible.assign(proxies.size(), 1);
+    if (!occlusion_culling)
+        return 0;
+
+    // The occlusion buffer is only read, proxies are tested in parallel
+    JobSystem::ParallelFor(proxies.size(), 64, [&](uint32_t begin, uint32_t end) {
+        for (uint32_t i = begin; i < end; i++)
+            visible[i] = !IsOccluded(proxies, i, view_projection);
+    });
+    return (uint32_t)std::count(visible.begin(), visible.end(), 0);
+}
+
+void Scene::RecordCommands(uint32_t count, std::vector<CommandBuffer>& buffers, const std::function<void(CommandBuffer&, uint32_t)>& record)
+{
+    uint32_t num_buffers = (count + RECORD_GRAIN_SIZE - 1) / RECORD_GRAIN_SIZE;
+    if (buffers.size() < num_buffers)
+        buffers.resize(num_buffers);
+    for (CommandBuffer& buffer : buffers)
+        buffer.clear();
+
+    // Ranges start at multiples of the grain size, every job owns the buffer of its range
+    JobSystem::ParallelFor(count, RECORD_GRAIN_SIZE, [&](uint32_t begin, uint32_t end) {
+        CommandBuffer& buffer = buffers[begin / RECORD_GRAIN_SIZE];
+        for (uint32_t i = begin; i < end; i++)
+            record(buffer, i);
+    });
+}
+
+void Scene::ReplayCommands(const std::vector<CommandBuffer>& buffers)
+{
+    for (const CommandBuffer& buffer : buffers)
+    {
+        if (!buffer.is_empty())
+            buffer.replay();
+    }
+}
+
+void Scene::RecordOpaqueCommands(const RenderProxies& proxies, const FrameVector<uint8_t>& visible, std::vector<CommandBuffer>& buffers)
+{
+    FrameVector<uint32_t> draws;
+    draws.reserve(proxies.size());
+    for (uint32_t i = 0; i < proxies.size(); i++)
+    {
+        if (proxies.has_material[i] && visible[i])
+            draws.push_back(i);
+    }
+    // Consecutive draws of a model share its bind
+    std::sort(draws.begin(), draws.end(), [&](uint32_t a, uint32_t b) {
+        if (proxies.models[a] != proxies.models[b])
+            return std::less<RawModel*>()(proxies.models[a], proxies.models[b]);
+        return proxies.materials[a]._Albedo < proxies.materials[b]._Albedo;
+    });
+
+    RecordCommands((uint32_t)draws.size(), buffers, [&](CommandBuffer& buffer, uint32_t draw) {
+        uint32_t i = draws[draw];
+        buffer.set_uint(ExampleMaterial::ENTITY_ID_LOCATION, (uint32_t)proxies.entities[i]);
+        buffer.set_matrix4(ExampleMaterial::MODEL_LOCATION, proxies.transforms[i]);
+        proxies.materials[i].Record(buffer);
+        GLuint lightmap_texture = proxies.lightmap_textures[i];
+        buffer.set_int(ExampleMaterial::HAS_LIGHTMAP_LOCATION, lightmap_texture != 0);
+        if (lightmap_texture)
+            buffer.bind_texture(ExampleMaterial::LIGHTMAP_SLOT, lightmap_texture);
+        buffer.bind_model(proxies.models[i]);
+        buffer.draw();
+    });
+}
+
+void Scene::DrawParticleSystem(ParticleSystem& system, const Camera& camera, const AABB& inner_volume)
+{
+    glm::vec3 system_min = system.get_bbox_min();
+    glm::vec3 system_max = system.get_bbox_max();
+
+    // Simulate and cull clusters in compute, the draw only touches visible clusters
+    ParticleCullInfo cull_info;
+    cull_info.view = camera.get_view_matrix(true);
+    cull_info.projection = camera.get_projection_matrix();
+    cull_info.inner_volume = inner_volume;
+    cull_info.hiz = hiz_culling ? m_HiZPyramid : nullptr;
+    system.update(m_DrawTimeDelta, *m_WindField, *m_PrecipitationOcclusionMap, *m_SceneSDF, cull_info);
+
+    m_ParticleShader->bind();
+    // Particle VS Uniforms
+    m_ParticleShader->set_matrix4fv("u_ViewMatrix", &cull_info.view[0][0]);
+    m_ParticleShader->set_matrix4fv("u_ProjectionMatrix", &cull_info.projection[0][0]);
+    m_ParticleShader->set_float3("u_SystemBoundsMin", system_min.x, system_min.y, system_min.z);
+    m_ParticleShader->set_float3("u_SystemBoundsMax", system_max.x, system_max.y, system_max.z);
+    m_ParticleShader->set_int("u_ColoredParticles", colored_particles);
+    // Particles of partially covered clusters are culled one by one
+    m_ParticleShader->set_float3("u_InnerVolume.min", inner_volume.min.x, inner_volume.min.y, inner_volume.min.z);
+    m_ParticleShader->set_float3("u_InnerVolume.max", inner_volume.max.x, inner_volume.max.y, inner_volume.max.z);
+    float splat_size = splat_small_particles ? splat_max_size : 0.0f;
+    m_ParticleShader->set_float("u_SplatMaxSize", splat_size);
+    m_ParticleShader->set_float("u_PixelScale", m_ParticleSplatTarget->get_pixel_scale(cull_info.projection));
+
+    // Particle FS Uniforms
+    m_ParticleShader->set_int("u_particle_tex", 1);
+    m_SnowflakeTexture->bind(1);
+
+    system.draw();
+    m_ParticleShader->unbind();
+
+    // Sub-pixel flakes skipped by the quads, resolved once all layers are splatted
+    if (splat_small_particles)
+    {
+        m_ParticleSplatTarget->splat(system, cull_info.view, cull_info.projection, inner_volume,
+            m_DefaultFrameBuffer->get_depth_attachment(), splat_max_size, *m_ParticleSplatCSShader);
+    }
+}
+
+void Scene::ValidateParticleSimulation()
+{
+    // Fixed system and step, scene interaction has no CPU counterpart and is disabled
+    const glm::ivec3 validation_per_dim(64, 32, 64);
+    const glm::vec3 validation_min(-8.0f, 0.0f, -8.0f);
+    const glm::vec3 validation_max(8.0f, 8.0f, 8.0f);
+    const float dt = 1.0f / 60.0f;
+
+    // Snow layers wrap in a volume that follows the camera, the wrapped volume drifts like one
+    const glm::vec3 validation_center = (validation_min + validation_max) / 2.0f;
+    const glm::vec3 validation_drift(1.0f, 0.0f, 0.5f);
+
+    ParticleSystem gpu_system(validation_per_dim, validation_min, validation_max);
+    gpu_system.scene_interaction = false;
+    // Slots of particles with equal keys would not match the reference
+    gpu_system.recluster_particles = false;
+    ParticleCullInfo cull_info;
+    cull_info.view = glm::mat4(1.0f);
+    cull_info.projection = glm::mat4(1.0f);
+    for (int i = 0; i < particle_validation_steps; i++)
+    {
+        if (particle_validation_wrap)
+            gpu_system.set_volume_center(validation_center + (i * dt) * validation_drift, validation_min.y);
+        gpu_system.update(dt, *m_WindField, *m_PrecipitationOcclusionMap, *m_SceneSDF, cull_info);
+    }
+    std::vector<Particle> gpu_particles;
+    gpu_system.read_particles(gpu_particles);
+    // Bounds of the last step, the drifted volume has carried clusters over its seams by now
+    std::vector<glm::vec4> gpu_cluster_bounds;
+    gpu_system.read_cluster_bounds(gpu_cluster_bounds);
+    particle_bounds_validation = check_cluster_bounds(gpu_particles, gpu_cluster_bounds, gpu_system.get_bbox_min(), gpu_system.get_bbox_max());
+
+    ParticleReferenceSimulation cpu_system(validation_per_dim, validation_min, validation_max);
+    Clock clock;
+    for (int i = 0; i < particle_validation_steps; i++)
+    {
+        if (particle_validation_wrap)
+            cpu_system.set_volume_center(validation_center + (i * dt) * validation_drift, validation_min.y);
+        cpu_system.step(dt);
+    }
+    double seconds = clock.since_start();
+    particle_reference_rate = seconds > 0.0 ? (double)cpu_system.get_num_particles() * particle_validation_steps / seconds : 0.0;
+
+    particle_validation = compare_particles(gpu_particles, cpu_system.get_particles(), cpu_system.get_bbox_min(), cpu_system.get_bbox_max(), particle_validation_tolerance);
+    particle_validation_done = true;
+    std::cout << "Particle validation: " << particle_validation.num_mismatches << " of " << particle_validation.num_compared
+        << " particles above tolerance " << particle_validation_tolerance << " after " << particle_validation_steps << " steps (max position error "
+        << particle_validation.max_position_error << ", max velocity error " << particle_validation.max_velocity_error << ")" << std::endl;
+    std::cout << "Cluster bounds: " << particle_bounds_validation.num_outside << " particles outside their cluster, "
+        << particle_bounds_validation.num_overhanging << " clusters across a seam, max extent " << particle_bounds_validation.max_extent << " of the volume" << std::endl;
+}
+
+// RG8, ambient occlusion and sky visibility. A re-bake keeps the texture name, snapshots still drawn may refer to it.
+static void upload_lightmap(const Lightmap& lightmap, GLuint& texture)
+{
+    if (texture == 0)
+        GL_CHECK(glGenTextures(1, &texture));
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, texture));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+    GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+    GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 1));
+    GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, lightmap.width, lightmap.height, 0, GL_RG, GL_UNSIGNED_BYTE, lightmap.texels.data()));
+    GL_CHECK(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+    GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+// Entities are created in the same order on every run, so name and id identify them across runs
+static std::filesystem::path get_lightmap_path(const std::string& name, entt::entity entity)
+{
+    return AssetManager::GetCachePath().append("lightmaps").append(name + "_" + std::to_string((uint32_t)entity) + ".lightmap");
+}
+
+void Scene::BakeLightmaps()
+{
+    Clock bake_clock;
+    // Transforms as of the last update
+    m_EntityRegistry.view<NameComponent, TransformComponent, LightmapComponent>().each([&](auto entity, NameComponent& nc, TransformComponent& tc, LightmapComponent& lmc) {
+        RawModel* model = get_entity_model(m_EntityRegistry, entity);
+        if (!model)
+            return;
+        model->ensure_lightmap_uvs();
+
+        Lightmap lightmap;
+        lightmap.bake(model->get_model_data(), tc.transform, m_SceneBVH, (uint32_t)lmc.resolution, lightmap_settings);
+        lightmap.save(get_lightmap_path(nc.name, entity));
+        upload_lightmap(lightmap, lmc.texture);
+        lmc.load_attempted = true;
+    });
+    lightmap_bake_time = bake_clock.since_start();
+}
+
+void Scene::LoadLightmaps()
+{
+    m_EntityRegistry.view<NameComponent, TransformComponent, LightmapComponent>().each([&](auto entity, NameComponent& nc, TransformComponent& tc, LightmapComponent& lmc) {
+        // The cache is checked against the world matrix, wait for the first transform update
+        if (lmc.load_attempted || tc.dirty)
+            return;
+        lmc.load_attempted = true;
+        RawModel* model = get_entity_model(m_EntityRegistry, entity);
+        if (!model)
+            return;
+        model->ensure_lightmap_uvs();
+
+        Lightmap lightmap;
+        if (lightmap.load(get_lightmap_path(nc.name, entity), get_lightmap_hash(model->get_model_data(), tc.transform, (uint32_t)lmc.resolution)))
+            upload_lightmap(lightmap, lmc.texture);
+    });
+}
+
+void Scene::BakeStaticGeometryMaps()
+{
+    // All maps render the static scene from above, only the target and projection differ
+    auto draw_static_geometry = [&](const glm::mat4& top_down_projection) {
+        m_GrassDensityShader->bind();
+        m_GrassDensityShader->set_matrix4fv("u_ViewProjection", &top_down_projection[0][0]);
+        auto model_view = m_EntityRegistry.view<TransformComponent, ModelRendererComponent>();
+        model_view.each([&](auto entity, TransformComponent& tc, ModelRendererComponent& mrc) {
+            m_GrassDensityShader->set_matrix4fv("u_Model", (float*)&tc.transform[0]);
+            mrc.model->bind();
+            mrc.model->draw();
+            mrc.model->unbind();
+        });
+        m_GrassDensityShader->unbind();
+    };
+
+    /* GRASS DENSITY: static footprint seen from above removes grass */
+    draw_static_geometry(m_GrassDensityMap->begin_bake(grass_exclusion_height));
+    m_GrassDensityMap->end_bake();
+
+    /* PRECIPITATION OCCLUSION: highest static surface shelters snow, depth only */
+    draw_static_geometry(m_PrecipitationOcclusionMap->begin_bake());
+    m_PrecipitationOcclusionMap->end_bake();
+
+    /* SCENE SDF: particle collisions, baked on the CPU in the background */
+    std::vector<SDFMeshInstance> sdf_meshes;
+    auto sdf_view = m_EntityRegistry.view<TransformComponent, ModelRendererComponent>();
+    sdf_view.each([&](auto entity, TransformComponent& tc, ModelRendererComponent& mrc) {
+        sdf_meshes.push_back({ &mrc.model->get_model_data(), tc.transform });
+    });
+    m_SceneSDF->bake_async(sdf_meshes, sdf_band_width);
 }
 
 
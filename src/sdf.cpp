@@ -0,0 +1,221 @@
+#include "sdf.h"
+
+#include <algorithm>
+
+#include "gl_helpers.h"
+#include "jobs.h"
+
+/**
+* Closest point to p on triangle abc, from Real-Time Collision Detection (Ericson, 5.1.5)
+*/
+static glm::vec3 closest_point_on_triangle(glm::vec3 p, glm::vec3 a, glm::vec3 b, glm::vec3 c)
+{
+	glm::vec3 ab = b - a;
+	glm::vec3 ac = c - a;
+	glm::vec3 ap = p - a;
+	float d1 = glm::dot(ab, ap);
+	float d2 = glm::dot(ac, ap);
+	if (d1 <= 0.0f && d2 <= 0.0f)
+		return a;
+
+	glm::vec3 bp = p - b;
+	float d3 = glm::dot(ab, bp);
+	float d4 = glm::dot(ac, bp);
+	if (d3 >= 0.0f && d4 <= d3)
+		return b;
+
+	float vc = d1 * d4 - d3 * d2;
+	if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f)
+		return a + ab * (d1 / (d1 - d3));
+
+	glm::vec3 cp = p - c;
+	float d5 = glm::dot(ab, cp);
+	float d6 = glm::dot(ac, cp);
+	if (d6 >= 0.0f && d5 <= d6)
+		return c;
+
+	float vb = d5 * d2 - d1 * d6;
+	if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f)
+		return a + ac * (d2 / (d2 - d6));
+
+	float va = d3 * d6 - d5 * d4;
+	if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f)
+		return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+	float denom = 1.0f / (va + vb + vc);
+	return a + ab * (vb * denom) + ac * (vc * denom);
+}
+
+SignedDistanceField::SignedDistanceField(glm::ivec3 resolution, glm::vec3 bounds_min, glm::vec3 bounds_max)
+	: m_Resolution(resolution), m_BoundsMin(bounds_min), m_BoundsMax(bounds_max)
+{
+}
+
+SignedDistanceField::~SignedDistanceField()
+{
+	JobSystem::Wait(m_BakeCounter);
+	if (m_Handle != 0)
+		glDeleteTextures(1, &m_Handle);
+}
+
+glm::vec3 SignedDistanceField::get_voxel_center(glm::ivec3 voxel) const
+{
+	glm::vec3 voxel_size = (m_BoundsMax - m_BoundsMin) / glm::vec3(m_Resolution);
+	return m_BoundsMin + (glm::vec3(voxel) + 0.5f) * voxel_size;
+}
+
+float SignedDistanceField::get_distance(glm::vec3 position) const
+{
+	glm::vec3 voxel_size = (m_BoundsMax - m_BoundsMin) / glm::vec3(m_Resolution);
+	glm::ivec3 voxel = glm::ivec3(glm::floor((position - m_BoundsMin) / voxel_size));
+	if (m_Voxels.empty() || glm::any(glm::lessThan(voxel, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(voxel, m_Resolution)))
+		return m_BandWidth;
+	return m_Voxels[m_Resolution.x * (voxel.z * m_Resolution.y + voxel.y) + voxel.x].w;
+}
+
+std::vector<SignedDistanceField::Triangle> SignedDistanceField::get_triangles(const std::vector<SDFMeshInstance>& meshes, float band_width)
+{
+	std::vector<Triangle> triangles;
+	for (const SDFMeshInstance& mesh : meshes)
+	{
+		const std::vector<Vertex>& vertices = mesh.data->vertices;
+		const std::vector<uint32_t>& indices = mesh.data->indices;
+		for (size_t i = 0; i + 2 < indices.size(); i += 3)
+		{
+			Triangle triangle;
+			triangle.a = glm::vec3(mesh.transform * glm::vec4(vertices[indices[i + 0]].position, 1.0f));
+			triangle.b = glm::vec3(mesh.transform * glm::vec4(vertices[indices[i + 1]].position, 1.0f));
+			triangle.c = glm::vec3(mesh.transform * glm::vec4(vertices[indices[i + 2]].position, 1.0f));
+
+			// Slivers with a height below 1e-4 of their longest edge have no reliable normal, e.g. at
+			// the collapsed pole of a UV sphere. Their neighbours cover the same surface.
+			glm::vec3 normal = glm::cross(triangle.b - triangle.a, triangle.c - triangle.a);
+			float longest_edge_squared = glm::max(glm::dot(triangle.b - triangle.a, triangle.b - triangle.a),
+				glm::max(glm::dot(triangle.c - triangle.b, triangle.c - triangle.b), glm::dot(triangle.a - triangle.c, triangle.a - triangle.c)));
+			if (glm::dot(normal, normal) <= 1e-8f * longest_edge_squared * longest_edge_squared)
+				continue;
+			triangle.normal = glm::normalize(normal);
+			triangle.bounds_min = glm::min(triangle.a, glm::min(triangle.b, triangle.c)) - band_width;
+			triangle.bounds_max = glm::max(triangle.a, glm::max(triangle.b, triangle.c)) + band_width;
+			triangles.push_back(triangle);
+		}
+	}
+	return triangles;
+}
+
+void SignedDistanceField::bake_slices(const std::vector<Triangle>& triangles, float band_width,
+	glm::vec4* voxels, float* alignment, int z_begin, int z_end) const
+{
+	size_t slice_size = (size_t)m_Resolution.x * m_Resolution.y;
+	std::fill(voxels + z_begin * slice_size, voxels + z_end * slice_size, glm::vec4(0.0f, 0.0f, 0.0f, band_width));
+	std::fill(alignment + z_begin * slice_size, alignment + z_end * slice_size, 0.0f);
+
+	glm::vec3 voxel_size = (m_BoundsMax - m_BoundsMin) / glm::vec3(m_Resolution);
+	for (const Triangle& triangle : triangles)
+	{
+		glm::ivec3 lo = glm::ivec3(glm::ceil((triangle.bounds_min - m_BoundsMin) / voxel_size - 0.5f));
+		glm::ivec3 hi = glm::ivec3(glm::floor((triangle.bounds_max - m_BoundsMin) / voxel_size - 0.5f));
+		lo = glm::max(lo, glm::ivec3(0, 0, z_begin));
+		hi = glm::min(hi, glm::ivec3(m_Resolution.x - 1, m_Resolution.y - 1, z_end - 1));
+
+		for (int z = lo.z; z <= hi.z; z++)
+		for (int y = lo.y; y <= hi.y; y++)
+		for (int x = lo.x; x <= hi.x; x++)
+		{
+			glm::vec3 p = get_voxel_center(glm::ivec3(x, y, z));
+			glm::vec3 direction = p - closest_point_on_triangle(p, triangle.a, triangle.b, triangle.c);
+			float distance = glm::length(direction);
+			if (distance > band_width)
+				continue;
+
+			direction = distance > 1e-6f ? direction / distance : triangle.normal;
+			float triangle_alignment = glm::abs(glm::dot(direction, triangle.normal));
+
+			size_t i = (size_t)m_Resolution.x * (z * m_Resolution.y + y) + x;
+			float best = glm::abs(voxels[i].w);
+			if (distance < best - 1e-5f || (distance <= best + 1e-5f && triangle_alignment > alignment[i]))
+			{
+				float sign = glm::dot(direction, triangle.normal) >= 0.0f ? 1.0f : -1.0f;
+				// Gradient of the signed distance, points out of the surface on both sides
+				voxels[i] = glm::vec4(sign * direction, sign * distance);
+				alignment[i] = triangle_alignment;
+			}
+		}
+	}
+}
+
+void SignedDistanceField::bake(const std::vector<SDFMeshInstance>& meshes, float band_width)
+{
+	m_BandWidth = band_width;
+	std::vector<Triangle> triangles = get_triangles(meshes, band_width);
+	size_t num_voxels = (size_t)m_Resolution.x * m_Resolution.y * m_Resolution.z;
+	m_Voxels.resize(num_voxels);
+	std::vector<float> alignment(num_voxels);
+
+	// Jobs own disjoint z slices, so no voxel is written by more than one thread.
+	// Single slices keep the pool busy where geometry is concentrated in a few of them.
+	JobSystem::ParallelFor(m_Resolution.z, 1, [&](uint32_t z_begin, uint32_t z_end) {
+		bake_slices(triangles, band_width, m_Voxels.data(), alignment.data(), (int)z_begin, (int)z_end);
+	});
+}
+
+void SignedDistanceField::bake_async(const std::vector<SDFMeshInstance>& meshes, float band_width)
+{
+	m_PendingTriangles = get_triangles(meshes, band_width);
+	m_PendingBandWidth = band_width;
+	m_BakePending = true;
+	if (!m_BakeRunning)
+		start_bake();
+}
+
+void SignedDistanceField::start_bake()
+{
+	m_BakeTriangles = std::move(m_PendingTriangles);
+	m_PendingTriangles.clear();
+	m_BakeBandWidth = m_PendingBandWidth;
+	m_BakePending = false;
+	m_BakeRunning = true;
+	size_t num_voxels = (size_t)m_Resolution.x * m_Resolution.y * m_Resolution.z;
+	m_BakeVoxels.resize(num_voxels);
+	m_BakeAlignment.resize(num_voxels);
+
+	// One job per slice, a thread that runs queued jobs while it waits for its own never picks up more than a slice
+	for (int z = 0; z < m_Resolution.z; z++)
+	{
+		JobSystem::Run([this, z]() {
+			bake_slices(m_BakeTriangles, m_BakeBandWidth, m_BakeVoxels.data(), m_BakeAlignment.data(), z, z + 1);
+		}, &m_BakeCounter);
+	}
+}
+
+bool SignedDistanceField::finish_bake()
+{
+	if (!m_BakeRunning || !m_BakeCounter.is_done())
+		return false;
+
+	m_BakeRunning = false;
+	m_Voxels.swap(m_BakeVoxels);
+	m_BandWidth = m_BakeBandWidth;
+	if (m_BakePending)
+		start_bake();
+	return true;
+}
+
+void SignedDistanceField::upload()
+{
+	if (m_Handle == 0)
+	{
+		GL_CHECK(glGenTextures(1, &m_Handle));
+		GL_CHECK(glBindTexture(GL_TEXTURE_3D, m_Handle));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+		GL_CHECK(glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_CHECK(glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, m_Resolution.x, m_Resolution.y, m_Resolution.z));
+	}
+
+	GL_CHECK(glBindTexture(GL_TEXTURE_3D, m_Handle));
+	GL_CHECK(glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, m_Resolution.x, m_Resolution.y, m_Resolution.z, GL_RGBA, GL_FLOAT, m_Voxels.data()));
+	GL_CHECK(glBindTexture(GL_TEXTURE_3D, 0));
+}
@@ -0,0 +1,76 @@
+#include "simulation.h"
+
+#include <chrono>
+#include <mutex>
+
+#include "framearena.h"
+
+SimulationLoop::SimulationLoop(Scene& scene, float tick_rate)
+	: m_Scene(scene), m_TickRate(tick_rate), m_Input(InputSnapshot()), m_Snapshots(FrameSnapshot())
+{
+}
+
+SimulationLoop::~SimulationLoop()
+{
+	stop();
+}
+
+void SimulationLoop::start()
+{
+	if (m_Running)
+		return;
+	tick(0.0f);
+	m_Running = true;
+	m_Thread = std::thread(&SimulationLoop::run, this);
+}
+
+void SimulationLoop::stop()
+{
+	m_Running = false;
+	if (m_Thread.joinable())
+		m_Thread.join();
+}
+
+void SimulationLoop::tick(float dt)
+{
+	using clock = std::chrono::steady_clock;
+	clock::time_point tick_start = clock::now();
+
+	m_Input.acquire();
+	const InputSnapshot& input = m_Input.get_read_buffer();
+	if (input.paused)
+		dt = 0.0f;
+
+	FrameSnapshot& snapshot = m_Snapshots.get_write_buffer();
+	{
+		std::lock_guard<std::mutex> lock(m_Scene.GetMutex());
+		m_Scene.Update(dt);
+		m_Scene.WriteSnapshot(snapshot);
+	}
+	snapshot.tick = m_Tick++;
+	m_Snapshots.publish();
+
+	// Transient allocations of the tick
+	FrameArena::Get().reset();
+
+	m_TickTime.store(std::chrono::duration<float>(clock::now() - tick_start).count(), std::memory_order_relaxed);
+}
+
+void SimulationLoop::run()
+{
+	using clock = std::chrono::steady_clock;
+	float dt = 1.0f / m_TickRate;
+	clock::duration tick_duration = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(dt));
+
+	clock::time_point next_tick = clock::now() + tick_duration;
+	while (m_Running)
+	{
+		std::this_thread::sleep_until(next_tick);
+		tick(dt);
+
+		// Behind by more than a tick, e.g. after a bake held the scene mutex: drop the missed ticks instead of running them in a burst
+		next_tick += tick_duration;
+		if (clock::now() > next_tick + tick_duration)
+			next_tick = clock::now();
+	}
+}
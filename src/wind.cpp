@@ -0,0 +1,39 @@
+#include "wind.h"
+
+#include "gl_helpers.h"
+
+WindField::WindField(uint32_t resolution, glm::vec3 bounds_min, glm::vec3 bounds_max)
+	: m_Resolution(resolution), m_BoundsMin(bounds_min), m_BoundsMax(bounds_max)
+{
+	GL_CHECK(glGenTextures(1, &m_Handle));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, m_Handle));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+	GL_CHECK(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+	GL_CHECK(glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, resolution, resolution));
+	GL_CHECK(glBindTexture(GL_TEXTURE_2D, 0));
+}
+
+WindField::~WindField()
+{
+	glDeleteTextures(1, &m_Handle);
+}
+
+void WindField::update(float time, Shader& wind_cs, Texture2D* noise_texture)
+{
+	wind_cs.bind();
+	wind_cs.set_float("u_Time", time);
+	wind_cs.set_float("u_WindFactor", factor);
+	wind_cs.set_float2("u_WindDirection", direction.x, direction.y);
+	wind_cs.set_int("u_WindTexture", 0);
+	noise_texture->bind(0);
+
+	GL_CHECK(glBindImageTexture(0, m_Handle, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F));
+	GL_CHECK(glDispatchCompute((m_Resolution + 16 - 1) / 16, (m_Resolution + 16 - 1) / 16, 1));
+	GL_CHECK(glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT));
+	GL_CHECK(glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F));
+
+	noise_texture->unbind();
+	wind_cs.unbind();
+}
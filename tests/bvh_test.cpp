@@ -0,0 +1,319 @@
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bvh.h"
+#include "model.h"
+#include "test.h"
+
+static float random_float(float min, float max)
+{
+	return min + (max - min) * (float)std::rand() / (float)RAND_MAX;
+}
+
+static glm::vec3 random_vec3(glm::vec3 min, glm::vec3 max)
+{
+	return glm::vec3(random_float(min.x, max.x), random_float(min.y, max.y), random_float(min.z, max.z));
+}
+
+// Small triangles scattered over the box, vertices are not shared
+static ModelData make_triangle_soup(uint32_t num_triangles, glm::vec3 min, glm::vec3 max, float size)
+{
+	ModelData soup;
+	for (uint32_t t = 0; t < num_triangles; t++)
+	{
+		glm::vec3 center = random_vec3(min, max);
+		for (int v = 0; v < 3; v++)
+		{
+			soup.indices.push_back((uint32_t)soup.vertices.size());
+			soup.vertices.push_back({ center + random_vec3(glm::vec3(-size), glm::vec3(size)), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f) });
+		}
+	}
+	return soup;
+}
+
+// Grid of quads in the plane y = 0, every quad split into two triangles with a shared diagonal
+static ModelData make_plane(int quads_per_side, float extent)
+{
+	ModelData plane;
+	float step = 2.0f * extent / quads_per_side;
+	for (int z = 0; z <= quads_per_side; z++)
+		for (int x = 0; x <= quads_per_side; x++)
+			plane.vertices.push_back({ glm::vec3(-extent + x * step, 0.0f, -extent + z * step), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f) });
+	for (int z = 0; z < quads_per_side; z++)
+	{
+		for (int x = 0; x < quads_per_side; x++)
+		{
+			uint32_t i = z * (quads_per_side + 1) + x;
+			uint32_t row = quads_per_side + 1;
+			for (uint32_t index : { i, i + row + 1, i + 1, i, i + row, i + row + 1 })
+				plane.indices.push_back(index);
+		}
+	}
+	return plane;
+}
+
+// Same Moller-Trumbore test as MeshBVH, against every triangle
+static RayHit brute_force_intersect(const ModelData& mesh, const Ray& ray)
+{
+	RayHit hit;
+	for (uint32_t t = 0; t < mesh.indices.size() / 3; t++)
+	{
+		glm::vec3 v0 = mesh.vertices[mesh.indices[3 * t + 0]].position;
+		glm::vec3 e1 = mesh.vertices[mesh.indices[3 * t + 1]].position - v0;
+		glm::vec3 e2 = mesh.vertices[mesh.indices[3 * t + 2]].position - v0;
+		glm::vec3 p = glm::cross(ray.direction, e2);
+		float det = glm::dot(e1, p);
+		if (std::abs(det) < 1e-12f)
+			continue;
+		float inv_det = 1.0f / det;
+		glm::vec3 s = ray.origin - v0;
+		float u = glm::dot(s, p) * inv_det;
+		if (u < 0.0f || u > 1.0f)
+			continue;
+		glm::vec3 q = glm::cross(s, e1);
+		float v = glm::dot(ray.direction, q) * inv_det;
+		if (v < 0.0f || u + v > 1.0f)
+			continue;
+		float distance = glm::dot(e2, q) * inv_det;
+		if (distance >= 0.0f && distance < ray.t_max && distance < hit.t)
+		{
+			hit.t = distance;
+			hit.triangle = t;
+			hit.barycentrics = glm::vec2(u, v);
+		}
+	}
+	return hit;
+}
+
+// Distance of ray to triangle t, or -1 on a miss, to accept either triangle of a tie on a shared edge
+static float brute_force_distance(const ModelData& mesh, const Ray& ray, uint32_t t)
+{
+	ModelData triangle;
+	for (int v = 0; v < 3; v++)
+	{
+		triangle.vertices.push_back(mesh.vertices[mesh.indices[3 * t + v]]);
+		triangle.indices.push_back(v);
+	}
+	RayHit hit = brute_force_intersect(triangle, ray);
+	return hit.is_valid() ? hit.t : -1.0f;
+}
+
+static uint32_t check_mesh_rays(const ModelData& mesh, const MeshBVH& bvh, const std::vector<Ray>& rays)
+{
+	uint32_t num_hits = 0;
+	for (const Ray& ray : rays)
+	{
+		RayHit expected = brute_force_intersect(mesh, ray);
+		RayHit hit;
+		bool found = bvh.intersect(ray, hit);
+		CHECK(found == expected.is_valid());
+		CHECK(bvh.occluded(ray) == expected.is_valid());
+		if (!found || !expected.is_valid())
+			continue;
+		num_hits++;
+		CHECK(hit.t == expected.t);
+		if (hit.triangle != expected.triangle)
+			CHECK(brute_force_distance(mesh, ray, hit.triangle) == expected.t);
+	}
+	return num_hits;
+}
+
+static std::vector<Ray> make_rays(const ModelData& mesh, glm::vec3 min, glm::vec3 max, uint32_t count)
+{
+	std::vector<Ray> rays;
+	glm::vec3 center = 0.5f * (min + max);
+	glm::vec3 extent = max - min;
+	for (uint32_t i = 0; i < count; i++)
+	{
+		Ray ray;
+		ray.origin = random_vec3(center - extent, center + extent);
+		switch (i % 5)
+		{
+		// Towards a random point of the bounds
+		case 0:
+			ray.direction = random_vec3(min, max) - ray.origin;
+			break;
+		// Any direction, not normalized
+		case 1:
+			ray.direction = random_vec3(glm::vec3(-3.0f), glm::vec3(3.0f));
+			break;
+		// Axis-parallel, both signs
+		case 2:
+			ray.direction = glm::vec3(0.0f);
+			ray.direction[(i / 5) % 3] = (i / 15) % 2 ? 1.0f : -1.0f;
+			ray.origin[(i / 5) % 3] = (i / 15) % 2 ? center[(i / 5) % 3] - extent[(i / 5) % 3] : center[(i / 5) % 3] + extent[(i / 5) % 3];
+			break;
+		// Through a vertex or an edge midpoint of a triangle, where neighbouring triangles tie
+		case 3:
+		{
+			uint32_t t = (uint32_t)std::rand() % (uint32_t)(mesh.indices.size() / 3);
+			glm::vec3 a = mesh.vertices[mesh.indices[3 * t + (i / 5) % 3]].position;
+			glm::vec3 b = mesh.vertices[mesh.indices[3 * t + (i / 5 + 1) % 3]].position;
+			ray.direction = ((i / 5) % 2 ? a : 0.5f * (a + b)) - ray.origin;
+			break;
+		}
+		// Grazing: almost parallel to the y = center plane
+		case 4:
+			ray.origin.y = center.y + random_float(-0.01f, 0.01f) * extent.y;
+			ray.direction = random_vec3(center - extent, center + extent) - ray.origin;
+			ray.direction.y = random_float(-1e-3f, 1e-3f) * glm::length(ray.direction);
+			break;
+		}
+		// A few rays end before reaching anything
+		if (i % 7 == 0)
+			ray.t_max = random_float(0.0f, 1.0f);
+		rays.push_back(ray);
+	}
+	return rays;
+}
+
+static void test_triangle_soup()
+{
+	std::srand(1);
+	const uint32_t counts[] = { 1, 3, 17, 100, 2000 };
+	for (uint32_t count : counts)
+	{
+		glm::vec3 min(-10.0f, -2.0f, -6.0f), max(10.0f, 4.0f, 6.0f);
+		ModelData soup = make_triangle_soup(count, min, max, 1.0f);
+		MeshBVH bvh(soup);
+		uint32_t num_hits = check_mesh_rays(soup, bvh, make_rays(soup, min, max, 2000));
+		CHECK(num_hits > 0);
+	}
+}
+
+static void test_coplanar()
+{
+	std::srand(2);
+	// Flat bounds on y for every node, and shared edges between neighbouring triangles
+	ModelData plane = make_plane(32, 8.0f);
+	MeshBVH bvh(plane);
+	glm::vec3 min(-8.0f, 0.0f, -8.0f), max(8.0f, 0.0f, 8.0f);
+	std::vector<Ray> rays = make_rays(plane, min, max, 2000);
+	uint32_t num_hits = check_mesh_rays(plane, bvh, rays);
+	CHECK(num_hits > 100);
+
+	// Straight down onto a shared vertex and along a diagonal
+	Ray down;
+	down.origin = glm::vec3(0.0f, 5.0f, 0.0f);
+	down.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+	RayHit hit;
+	CHECK(bvh.intersect(down, hit));
+	CHECK(hit.t == 5.0f);
+	// In the plane, parallel to every triangle
+	Ray in_plane;
+	in_plane.origin = glm::vec3(-9.0f, 0.0f, 0.1f);
+	in_plane.direction = glm::vec3(1.0f, 0.0f, 0.0f);
+	RayHit no_hit;
+	CHECK(!bvh.intersect(in_plane, no_hit));
+	CHECK(!bvh.occluded(in_plane));
+
+	// All triangles on top of each other
+	ModelData stacked;
+	for (int i = 0; i < 64; i++)
+	{
+		for (int v = 0; v < 3; v++)
+			stacked.indices.push_back((uint32_t)stacked.vertices.size() + v);
+		stacked.vertices.push_back({ glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f) });
+		stacked.vertices.push_back({ glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f) });
+		stacked.vertices.push_back({ glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f) });
+	}
+	MeshBVH stacked_bvh(stacked);
+	check_mesh_rays(stacked, stacked_bvh, make_rays(stacked, glm::vec3(0.0f), glm::vec3(1.0f, 0.0f, 1.0f), 500));
+}
+
+static void test_instances()
+{
+	std::srand(3);
+	glm::vec3 min(-2.0f), max(2.0f);
+	std::vector<ModelData> meshes = { make_triangle_soup(300, min, max, 0.5f), make_plane(8, 2.0f) };
+	std::vector<MeshBVH> mesh_bvhs = { MeshBVH(meshes[0]), MeshBVH(meshes[1]) };
+
+	std::vector<BVHInstance> instances;
+	for (uint32_t i = 0; i < 40; i++)
+	{
+		glm::mat4 transform = glm::translate(glm::mat4(1.0f), random_vec3(glm::vec3(-20.0f, -5.0f, -20.0f), glm::vec3(20.0f, 5.0f, 20.0f)));
+		transform = glm::rotate(transform, random_float(0.0f, 6.28f), glm::normalize(random_vec3(glm::vec3(-1.0f), glm::vec3(1.0f))));
+		transform = glm::scale(transform, random_vec3(glm::vec3(0.5f), glm::vec3(2.0f)));
+		instances.push_back({ &mesh_bvhs[i % 2], transform, 100 + i });
+	}
+	SceneBVH scene;
+	scene.build(instances);
+
+	auto brute_force = [&](const Ray& ray) {
+		RayHit best;
+		for (const BVHInstance& instance : instances)
+		{
+			const ModelData& mesh = meshes[instance.mesh == &mesh_bvhs[0] ? 0 : 1];
+			glm::mat4 inverse = glm::inverse(instance.transform);
+			Ray object_ray;
+			object_ray.origin = glm::vec3(inverse * glm::vec4(ray.origin, 1.0f));
+			object_ray.direction = glm::vec3(inverse * glm::vec4(ray.direction, 0.0f));
+			object_ray.t_max = ray.t_max;
+			RayHit hit = brute_force_intersect(mesh, object_ray);
+			if (hit.is_valid() && hit.t < best.t)
+			{
+				best = hit;
+				best.instance = instance.id;
+			}
+		}
+		return best;
+	};
+
+	uint32_t num_hits = 0;
+	for (int i = 0; i < 3000; i++)
+	{
+		Ray ray;
+		ray.origin = random_vec3(glm::vec3(-30.0f), glm::vec3(30.0f));
+		ray.direction = i % 3 == 0 ? glm::vec3(0.0f, 0.0f, ray.origin.z > 0.0f ? -1.0f : 1.0f) :
+			random_vec3(glm::vec3(-20.0f, -5.0f, -20.0f), glm::vec3(20.0f, 5.0f, 20.0f)) - ray.origin;
+		RayHit expected = brute_force(ray);
+		RayHit hit;
+		bool found = scene.intersect(ray, hit);
+		CHECK(found == expected.is_valid());
+		CHECK(scene.occluded(ray) == expected.is_valid());
+		if (!found || !expected.is_valid())
+			continue;
+		num_hits++;
+		CHECK_NEAR(hit.t, expected.t, 1e-5 * expected.t);
+		// Ties only happen within a plane instance, where either triangle of a shared edge is fine
+		if (hit.instance == expected.instance && hit.triangle != expected.triangle)
+			CHECK(expected.instance % 2 == 1);
+	}
+	CHECK(num_hits > 300);
+
+	// Moving every instance only refits, queries must match a fresh build
+	for (uint32_t i = 0; i < instances.size(); i++)
+	{
+		instances[i].transform = glm::translate(instances[i].transform, glm::vec3(1.0f, -0.5f, 0.25f));
+		scene.set_transform(i, instances[i].transform);
+	}
+	scene.refit();
+	SceneBVH rebuilt;
+	rebuilt.build(instances);
+	for (int i = 0; i < 1000; i++)
+	{
+		Ray ray;
+		ray.origin = random_vec3(glm::vec3(-30.0f), glm::vec3(30.0f));
+		ray.direction = random_vec3(glm::vec3(-20.0f, -5.0f, -20.0f), glm::vec3(20.0f, 5.0f, 20.0f)) - ray.origin;
+		RayHit refit_hit, rebuilt_hit;
+		CHECK(scene.intersect(ray, refit_hit) == rebuilt.intersect(ray, rebuilt_hit));
+		CHECK(refit_hit.t == rebuilt_hit.t);
+		CHECK(refit_hit.t == brute_force(ray).t);
+	}
+}
+
+int main()
+{
+	test_triangle_soup();
+	test_coplanar();
+	test_instances();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "BVH: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
@@ -0,0 +1,202 @@
+#include <cmath>
+#include <filesystem>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "bvh.h"
+#include "jobs.h"
+#include "lightmap.h"
+#include "model.h"
+#include "test.h"
+
+// Ground quad of 20 x 20 meters at y = 0 with unique uvs
+static ModelData make_ground()
+{
+	ModelData ground;
+	ground.vertices = {
+		{ glm::vec3(-10.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f, 0.0f) },
+		{ glm::vec3(10.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(1.0f, 0.0f) },
+		{ glm::vec3(10.0f, 0.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(1.0f, 1.0f) },
+		{ glm::vec3(-10.0f, 0.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2(0.0f, 1.0f) },
+	};
+	ground.indices = { 0, 2, 1, 0, 3, 2 };
+	return ground;
+}
+
+// Cube of 2 meters on the ground at the origin, every face uses the whole uv square so they overlap
+static ModelData make_cube()
+{
+	ModelData cube;
+	const glm::vec3 normals[6] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	const glm::vec2 uvs[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+	for (const glm::vec3& normal : normals)
+	{
+		glm::vec3 tangent = std::abs(normal.y) > 0.5f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+		glm::vec3 bitangent = glm::cross(normal, tangent);
+		uint32_t base = (uint32_t)cube.vertices.size();
+		for (int i = 0; i < 4; i++)
+		{
+			glm::vec2 s = 2.0f * uvs[i] - 1.0f;
+			cube.vertices.push_back({ glm::vec3(0.0f, 1.0f, 0.0f) + normal + tangent * s.x + bitangent * s.y, normal, uvs[i] });
+		}
+		for (uint32_t i : { 0u, 1u, 2u, 0u, 2u, 3u })
+			cube.indices.push_back(base + i);
+	}
+	return cube;
+}
+
+static float get_uv_area(const ModelData& data, size_t t)
+{
+	glm::vec2 a = data.vertices[data.indices[3 * t]].lightmap_uv;
+	glm::vec2 b = data.vertices[data.indices[3 * t + 1]].lightmap_uv;
+	glm::vec2 c = data.vertices[data.indices[3 * t + 2]].lightmap_uv;
+	return 0.5f * std::abs((b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x));
+}
+
+static float get_area(const ModelData& data, size_t t)
+{
+	glm::vec3 a = data.vertices[data.indices[3 * t]].position;
+	glm::vec3 b = data.vertices[data.indices[3 * t + 1]].position;
+	glm::vec3 c = data.vertices[data.indices[3 * t + 2]].position;
+	return 0.5f * glm::length(glm::cross(b - a, c - a));
+}
+
+static void test_unique_uvs_are_kept()
+{
+	ModelData ground = make_ground();
+	generate_lightmap_uvs(ground);
+	CHECK(ground.vertices.size() == 4);
+	for (const Vertex& vertex : ground.vertices)
+		CHECK(vertex.lightmap_uv == vertex.uv);
+}
+
+// Charts are disjoint, inside the atlas and share one texel density
+static void test_generated_uvs()
+{
+	// A large face next to many small ones, all sharing uvs
+	ModelData mesh = make_cube();
+	for (int i = 0; i < 64; i++)
+	{
+		uint32_t base = (uint32_t)mesh.vertices.size();
+		glm::vec3 offset(3.0f + 0.2f * (i % 8), 0.0f, 0.2f * (i / 8));
+		mesh.vertices.push_back({ offset, glm::vec3(0, 1, 0), glm::vec2(0.0f) });
+		mesh.vertices.push_back({ offset + glm::vec3(0.1f, 0.0f, 0.0f), glm::vec3(0, 1, 0), glm::vec2(0.0f) });
+		mesh.vertices.push_back({ offset + glm::vec3(0.0f, 0.0f, 0.05f), glm::vec3(0, 1, 0), glm::vec2(0.0f) });
+		mesh.indices.insert(mesh.indices.end(), { base, base + 2, base + 1 });
+	}
+	size_t num_triangles = mesh.indices.size() / 3;
+	generate_lightmap_uvs(mesh);
+	CHECK(mesh.indices.size() / 3 == num_triangles);
+
+	float min_density = std::numeric_limits<float>::max();
+	float max_density = 0.0f;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		for (int i = 0; i < 3; i++)
+		{
+			glm::vec2 uv = mesh.vertices[mesh.indices[3 * t + i]].lightmap_uv;
+			CHECK(uv.x >= 0.0f && uv.y >= 0.0f && uv.x <= 1.0f && uv.y <= 1.0f);
+		}
+		float density = get_uv_area(mesh, t) / get_area(mesh, t);
+		min_density = std::min(min_density, density);
+		max_density = std::max(max_density, density);
+	}
+	CHECK(max_density <= 1.001f * min_density);
+
+	// No texel centre of a 512 atlas is inside two triangles
+	const int resolution = 512;
+	std::vector<uint8_t> coverage(resolution * resolution, 0);
+	uint32_t overlaps = 0;
+	for (size_t t = 0; t < num_triangles; t++)
+	{
+		glm::vec2 uv[3];
+		for (int i = 0; i < 3; i++)
+			uv[i] = mesh.vertices[mesh.indices[3 * t + i]].lightmap_uv * (float)resolution;
+		for (int y = 0; y < resolution; y++)
+		for (int x = 0; x < resolution; x++)
+		{
+			glm::vec2 p(x + 0.5f, y + 0.5f);
+			float e[3];
+			for (int i = 0; i < 3; i++)
+			{
+				glm::vec2 a = uv[i], b = uv[(i + 1) % 3];
+				e[i] = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+			}
+			bool inside = (e[0] >= 0.0f && e[1] >= 0.0f && e[2] >= 0.0f) || (e[0] <= 0.0f && e[1] <= 0.0f && e[2] <= 0.0f);
+			if (!inside)
+				continue;
+			overlaps += coverage[y * resolution + x];
+			coverage[y * resolution + x] = 1;
+		}
+	}
+	CHECK(overlaps == 0);
+}
+
+// The cube darkens the ground next to it, open ground sees the whole sky
+static void test_bake()
+{
+	ModelData ground = make_ground();
+	ModelData cube = make_cube();
+	generate_lightmap_uvs(ground);
+	generate_lightmap_uvs(cube);
+	MeshBVH ground_bvh(ground), cube_bvh(cube);
+	SceneBVH scene;
+	scene.build({ { &ground_bvh, glm::mat4(1.0f), 0 }, { &cube_bvh, glm::mat4(1.0f), 1 } });
+
+	const uint32_t resolution = 64;
+	Lightmap lightmap;
+	lightmap.bake(ground, glm::mat4(1.0f), scene, resolution, LightmapBakeSettings());
+	CHECK(lightmap.width == resolution && lightmap.height == resolution);
+	auto texel = [&](float x, float z, int channel) {
+		glm::ivec2 t((x + 10.0f) / 20.0f * resolution, (z + 10.0f) / 20.0f * resolution);
+		return (int)lightmap.texels[2 * (t.y * resolution + t.x) + channel];
+	};
+	CHECK(texel(9.0f, 9.0f, 0) == 255 && texel(9.0f, 9.0f, 1) == 255);
+	CHECK(texel(1.2f, 0.0f, 0) < 200);
+	CHECK(texel(1.2f, 0.0f, 1) < texel(4.0f, 0.0f, 1));
+}
+
+// A cached lightmap only loads for the mesh, transform and resolution it was baked for
+static void test_cache_validation()
+{
+	ModelData ground = make_ground();
+	glm::mat4 transform(1.0f);
+	transform[3] = glm::vec4(1.0f, 2.0f, 3.0f, 1.0f);
+
+	Lightmap lightmap;
+	lightmap.width = lightmap.height = 4;
+	lightmap.texels.assign(4 * 4 * 2, 17);
+	lightmap.source_hash = get_lightmap_hash(ground, transform, 4);
+	std::filesystem::path path = std::filesystem::temp_directory_path().append("lightmap_test.lightmap");
+	CHECK(lightmap.save(path));
+
+	Lightmap loaded;
+	CHECK(loaded.load(path, get_lightmap_hash(ground, transform, 4)));
+	CHECK(loaded.texels == lightmap.texels);
+
+	glm::mat4 moved = transform;
+	moved[3].x += 0.5f;
+	CHECK(!Lightmap().load(path, get_lightmap_hash(ground, moved, 4)));
+	CHECK(!Lightmap().load(path, get_lightmap_hash(ground, transform, 8)));
+	ModelData edited = ground;
+	edited.vertices[0].position.y += 0.1f;
+	CHECK(!Lightmap().load(path, get_lightmap_hash(edited, transform, 4)));
+
+	std::error_code error;
+	std::filesystem::remove(path, error);
+}
+
+int main()
+{
+	JobSystem::Init(3);
+	test_unique_uvs_are_kept();
+	test_generated_uvs();
+	test_bake();
+	test_cache_validation();
+	JobSystem::Destroy();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "Lightmap: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
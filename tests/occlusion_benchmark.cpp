@@ -0,0 +1,74 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "occlusion.h"
+
+/**
+* Times rasterizing a few hundred box occluders and testing bounds against them, with the
+* scalar and the AVX2 path. Not run by CTest, numbers are only meaningful in release builds.
+*/
+static void run(bool use_avx2)
+{
+	const int ITERATIONS = 100;
+	const int OCCLUDERS = 256;
+	const int TESTS = 4096;
+
+	glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+	OcclusionBuffer buffer(256, 144);
+	buffer.use_avx2 = use_avx2;
+
+	std::srand(1);
+	auto random = [](float min, float max) { return min + (max - min) * (float)std::rand() / (float)RAND_MAX; };
+	std::vector<glm::vec3> occluders;
+	for (int i = 0; i < OCCLUDERS; i++)
+	{
+		glm::vec3 center(random(-20.0f, 20.0f), random(-12.0f, 12.0f), random(-60.0f, -5.0f));
+		glm::vec3 extent(random(0.5f, 4.0f), random(0.5f, 4.0f), random(0.5f, 4.0f));
+		occluders.push_back(center - extent);
+		occluders.push_back(center + extent);
+	}
+	std::vector<glm::vec3> bounds;
+	for (int i = 0; i < TESTS; i++)
+	{
+		glm::vec3 center(random(-20.0f, 20.0f), random(-12.0f, 12.0f), random(-80.0f, -5.0f));
+		glm::vec3 extent(random(0.1f, 2.0f), random(0.1f, 2.0f), random(0.1f, 2.0f));
+		bounds.push_back(center - extent);
+		bounds.push_back(center + extent);
+	}
+
+	using clock = std::chrono::high_resolution_clock;
+	double raster_time = 0.0;
+	double test_time = 0.0;
+	size_t occluded = 0;
+	for (int iteration = 0; iteration < ITERATIONS; iteration++)
+	{
+		auto start = clock::now();
+		buffer.clear();
+		for (size_t i = 0; i < occluders.size(); i += 2)
+			buffer.draw_box(occluders[i], occluders[i + 1], projection);
+		buffer.finish();
+		auto rasterized = clock::now();
+		for (size_t i = 0; i < bounds.size(); i += 2)
+			occluded += buffer.is_occluded(bounds[i], bounds[i + 1], projection);
+		auto tested = clock::now();
+		raster_time += std::chrono::duration<double, std::micro>(rasterized - start).count();
+		test_time += std::chrono::duration<double, std::micro>(tested - rasterized).count();
+	}
+
+	std::cout << (use_avx2 ? "AVX2  " : "Scalar") << ": " << OCCLUDERS << " occluders " << raster_time / ITERATIONS << " us, "
+		<< TESTS << " tests " << test_time / ITERATIONS << " us, " << occluded / ITERATIONS << " occluded" << std::endl;
+}
+
+int main()
+{
+	run(false);
+	if (cpu_supports_avx2())
+		run(true);
+	else
+		std::cout << "AVX2 not supported" << std::endl;
+	return 0;
+}
@@ -0,0 +1,133 @@
+#include <cstdlib>
+#include <iostream>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "model.h"
+#include "occlusion.h"
+#include "test.h"
+
+// Camera at the origin looking down -z
+static glm::mat4 get_projection()
+{
+	return glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+}
+
+static void test_box_occluder(bool use_avx2)
+{
+	glm::mat4 projection = get_projection();
+	OcclusionBuffer buffer(256, 144);
+	buffer.use_avx2 = use_avx2;
+	buffer.clear();
+	buffer.draw_box(glm::vec3(-5.0f, -5.0f, -11.0f), glm::vec3(5.0f, 5.0f, -10.0f), projection);
+	buffer.finish();
+
+	CHECK(buffer.is_occluded(glm::vec3(-1.0f, -1.0f, -30.0f), glm::vec3(1.0f, 1.0f, -29.0f), projection));
+	// In front of the occluder
+	CHECK(!buffer.is_occluded(glm::vec3(-1.0f, -1.0f, -6.0f), glm::vec3(1.0f, 1.0f, -5.0f), projection));
+	// Behind, but partly outside the occluder
+	CHECK(!buffer.is_occluded(glm::vec3(-20.0f, -1.0f, -30.0f), glm::vec3(-1.0f, 1.0f, -29.0f), projection));
+	// Crossing the near plane
+	CHECK(!buffer.is_occluded(glm::vec3(-1.0f, -1.0f, -30.0f), glm::vec3(1.0f, 1.0f, 1.0f), projection));
+	// Outside the screen
+	CHECK(!buffer.is_occluded(glm::vec3(-1.0f, 200.0f, -30.0f), glm::vec3(1.0f, 201.0f, -29.0f), projection));
+}
+
+static void test_near_clipping(bool use_avx2)
+{
+	glm::mat4 projection = get_projection();
+	OcclusionBuffer buffer(256, 144);
+	buffer.use_avx2 = use_avx2;
+	// A wall reaching behind the camera is clipped, not dropped
+	buffer.draw_box(glm::vec3(-50.0f, -50.0f, -12.0f), glm::vec3(50.0f, 50.0f, 5.0f), projection);
+	buffer.finish();
+	CHECK(buffer.is_occluded(glm::vec3(-1.0f, -1.0f, -30.0f), glm::vec3(1.0f, 1.0f, -29.0f), projection));
+}
+
+static void test_model_occluder(bool use_avx2)
+{
+	glm::mat4 projection = get_projection();
+	OcclusionBuffer buffer(256, 144);
+	buffer.use_avx2 = use_avx2;
+
+	// Quad at z = -10, one of the triangles wound clockwise, both faces are drawn
+	ModelData quad;
+	for (glm::vec2 corner : { glm::vec2(-8.0f, -8.0f), glm::vec2(8.0f, -8.0f), glm::vec2(8.0f, 8.0f), glm::vec2(-8.0f, 8.0f) })
+		quad.vertices.push_back({ glm::vec3(corner, -10.0f), glm::vec3(0.0f, 0.0f, 1.0f), glm::vec2(0.0f) });
+	quad.indices = { 0, 1, 2, 0, 3, 2 };
+	buffer.draw_occluder(quad, projection);
+	buffer.finish();
+
+	CHECK(buffer.is_occluded(glm::vec3(-2.0f, -2.0f, -20.0f), glm::vec3(2.0f, 2.0f, -15.0f), projection));
+	CHECK(!buffer.is_occluded(glm::vec3(-2.0f, -2.0f, -9.0f), glm::vec3(2.0f, 2.0f, -8.0f), projection));
+
+	// The center pixel holds the depth of the quad
+	float depth = buffer.get_depth()[(buffer.get_height() / 2) * buffer.get_width() + buffer.get_width() / 2];
+	glm::vec4 clip = projection * glm::vec4(0.0f, 0.0f, -10.0f, 1.0f);
+	CHECK_NEAR(depth, clip.z / clip.w * 0.5f + 0.5f, 1e-5);
+}
+
+// Both paths rasterize the same random triangles to the same depths
+static void test_avx2_matches_scalar()
+{
+	if (!cpu_supports_avx2())
+	{
+		std::cout << "AVX2 not supported, skipping the comparison" << std::endl;
+		return;
+	}
+
+	glm::mat4 projection = get_projection();
+	OcclusionBuffer scalar(320, 180);
+	OcclusionBuffer avx2(320, 180);
+	scalar.use_avx2 = false;
+	avx2.use_avx2 = true;
+
+	std::srand(1);
+	auto random = [](float min, float max) { return min + (max - min) * (float)std::rand() / (float)RAND_MAX; };
+	for (int i = 0; i < 200; i++)
+	{
+		glm::vec3 center(random(-20.0f, 20.0f), random(-12.0f, 12.0f), random(-60.0f, -5.0f));
+		glm::vec3 extent(random(0.1f, 4.0f), random(0.1f, 4.0f), random(0.1f, 4.0f));
+		scalar.draw_box(center - extent, center + extent, projection);
+		avx2.draw_box(center - extent, center + extent, projection);
+	}
+	scalar.finish();
+	avx2.finish();
+
+	// FMA rounds differently, pixels centred exactly on an edge may go either way
+	const std::vector<float>& a = scalar.get_depth();
+	const std::vector<float>& b = avx2.get_depth();
+	size_t mismatches = 0;
+	for (size_t i = 0; i < a.size(); i++)
+		if (std::abs(a[i] - b[i]) > 1e-5f)
+			mismatches++;
+	CHECK(mismatches * 1000 < a.size());
+
+	size_t disagreements = 0;
+	for (int i = 0; i < 1000; i++)
+	{
+		glm::vec3 center(random(-20.0f, 20.0f), random(-12.0f, 12.0f), random(-80.0f, -5.0f));
+		glm::vec3 extent(random(0.1f, 2.0f), random(0.1f, 2.0f), random(0.1f, 2.0f));
+		if (scalar.is_occluded(center - extent, center + extent, projection) != avx2.is_occluded(center - extent, center + extent, projection))
+			disagreements++;
+	}
+	CHECK(disagreements <= 5);
+}
+
+int main()
+{
+	for (bool use_avx2 : { false, true })
+	{
+		if (use_avx2 && !cpu_supports_avx2())
+			continue;
+		test_box_occluder(use_avx2);
+		test_near_clipping(use_avx2);
+		test_model_occluder(use_avx2);
+	}
+	test_avx2_matches_scalar();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "OcclusionBuffer: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
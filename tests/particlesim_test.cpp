@@ -0,0 +1,252 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "jobs.h"
+#include "particlesim.h"
+#include "test.h"
+
+static const glm::ivec3 PER_DIM(23, 11, 17);
+static const glm::vec3 BBOX_MIN(-8.0f, 0.0f, -6.0f);
+static const glm::vec3 BBOX_MAX(8.0f, 2.0f, 6.0f);
+static const float DT = 1.0f / 60.0f;
+
+static void test_pack_round_trip()
+{
+	glm::vec3 extent = BBOX_MAX - BBOX_MIN;
+	std::srand(1);
+	auto random = []() { return (float)std::rand() / (float)RAND_MAX; };
+	for (int i = 0; i < 1000; i++)
+	{
+		UnpackedParticle particle;
+		particle.position = BBOX_MIN + glm::vec3(random(), random(), random()) * extent * 0.999f;
+		particle.velocity = glm::vec3(random() - 0.5f, -2.5f * random(), random() - 0.5f);
+		particle.size = random();
+		particle.flags = 0;
+		UnpackedParticle unpacked = unpack_particle(pack_particle(particle, BBOX_MIN, BBOX_MAX), BBOX_MIN, BBOX_MAX);
+		CHECK(glm::all(glm::lessThanEqual(glm::abs(unpacked.position - particle.position), extent / PARTICLE_POSITION_SCALE * 2.0f)));
+		// Half floats keep 11 significant bits
+		CHECK(glm::all(glm::lessThanEqual(glm::abs(unpacked.velocity - particle.velocity), glm::vec3(2e-3f))));
+		CHECK_NEAR(unpacked.size, particle.size, 0.5f / 255.0f + 1e-6f);
+		CHECK(unpacked.flags == 0);
+	}
+}
+
+// State of every step: used particles inside the volume with clamped velocities, unused slots untouched
+static void check_invariants(const ParticleReferenceSimulation& simulation, const std::vector<Particle>& initial, float particle_size)
+{
+	glm::vec3 bbox_min = simulation.get_bbox_min();
+	glm::vec3 bbox_max = simulation.get_bbox_max();
+	const float epsilon = 1e-4f;
+	const std::vector<Particle>& particles = simulation.get_particles();
+	int num_used = 0;
+	for (size_t slot = 0; slot < particles.size(); slot++)
+	{
+		UnpackedParticle particle = unpack_particle(particles[slot], bbox_min, bbox_max);
+		if (particle.flags & PARTICLE_FLAG_UNUSED)
+		{
+			CHECK(std::memcmp(&particles[slot], &initial[slot], sizeof(Particle)) == 0);
+			continue;
+		}
+		num_used++;
+		CHECK(glm::all(glm::greaterThanEqual(particle.position, bbox_min - epsilon)));
+		CHECK(glm::all(glm::lessThanEqual(particle.position, bbox_max + epsilon)));
+		CHECK(glm::all(glm::lessThanEqual(glm::abs(glm::vec3(particle.velocity.x, 0.0f, particle.velocity.z)), glm::vec3(PARTICLE_MAX_SPEED))));
+		CHECK(particle.velocity.y <= 0.0f && particle.velocity.y >= -5.0f * PARTICLE_MAX_SPEED);
+		CHECK_NEAR(particle.size, particle_size, 0.5f / 255.0f + 1e-6f);
+	}
+	CHECK(num_used == simulation.get_num_particles());
+}
+
+static uint32_t count_respawned(const ParticleReferenceSimulation& simulation)
+{
+	uint32_t respawned = 0;
+	for (const Particle& packed : simulation.get_particles())
+	{
+		UnpackedParticle particle = unpack_particle(packed, simulation.get_bbox_min(), simulation.get_bbox_max());
+		if (!(particle.flags & PARTICLE_FLAG_UNUSED) && particle.velocity == glm::vec3(0.0f, -PARTICLE_SPAWN_SPEED, 0.0f))
+			respawned++;
+	}
+	return respawned;
+}
+
+// Particles fall through the floor of the 2 m volume within a few seconds
+static void test_respawn()
+{
+	const float particle_size = 0.05f;
+	ParticleReferenceSimulation simulation(PER_DIM, BBOX_MIN, BBOX_MAX, particle_size);
+	std::vector<Particle> initial = simulation.get_particles();
+	uint32_t respawned = 0;
+	uint32_t jumps = 0;
+	for (int i = 0; i < 300; i++)
+	{
+		std::vector<Particle> previous = simulation.get_particles();
+		simulation.step(DT);
+		check_invariants(simulation, initial, particle_size);
+		respawned += count_respawned(simulation);
+		jumps += compare_particles(previous, simulation.get_particles(), BBOX_MIN, BBOX_MAX, 0.05f).num_mismatches;
+	}
+	CHECK(respawned > 0);
+	CHECK(jumps > 0);
+}
+
+// Like a snow layer following the camera: nothing respawns, particles only ever move by dt * velocity
+static void test_wrap()
+{
+	const float particle_size = 0.05f;
+	const glm::vec3 center = (BBOX_MIN + BBOX_MAX) / 2.0f;
+	ParticleReferenceSimulation simulation(PER_DIM, BBOX_MIN, BBOX_MAX, particle_size);
+	std::vector<Particle> initial = simulation.get_particles();
+	uint32_t respawned = 0;
+	for (int i = 0; i < 300; i++)
+	{
+		std::vector<Particle> previous = simulation.get_particles();
+		simulation.set_volume_center(center + (i * DT) * glm::vec3(3.0f, 0.0f, -2.0f), BBOX_MIN.y);
+		simulation.step(DT);
+		check_invariants(simulation, initial, particle_size);
+		respawned += count_respawned(simulation);
+		// Positions are compared modulo the volume
+		ParticleComparison comparison = compare_particles(previous, simulation.get_particles(), simulation.get_bbox_min(), simulation.get_bbox_max(), 0.05f);
+		CHECK(comparison.num_mismatches == 0);
+	}
+	CHECK(respawned == 0);
+	CHECK(simulation.get_bbox_min().y == BBOX_MIN.y);
+}
+
+// Jobs own disjoint slots and the random numbers depend only on slot and step
+static void test_thread_count_independence()
+{
+	ParticleReferenceSimulation single(PER_DIM, BBOX_MIN, BBOX_MAX);
+	ParticleReferenceSimulation multi(PER_DIM, BBOX_MIN, BBOX_MAX);
+	single.num_threads = 1;
+	multi.num_threads = 7;
+	single.run(120, DT);
+	multi.run(120, DT);
+	CHECK(single.get_particles().size() == multi.get_particles().size());
+	CHECK(std::memcmp(single.get_particles().data(), multi.get_particles().data(), single.get_particles().size() * sizeof(Particle)) == 0);
+}
+
+// One cluster drifted over the x seam: half its particles sit at the min face, half at the max face
+static void test_cluster_bounds_across_seam()
+{
+	std::vector<Particle> particles(PARTICLES_PER_CLUSTER);
+	for (int i = 0; i < PARTICLES_PER_CLUSTER; i++)
+	{
+		UnpackedParticle particle;
+		particle.position = glm::vec3(i % 2 ? BBOX_MAX.x - 0.1f : BBOX_MIN.x + 0.1f, 1.0f, 0.01f * i);
+		particle.velocity = glm::vec3(0.0f);
+		particle.size = 0.05f;
+		particle.flags = 0;
+		particles[i] = pack_particle(particle, BBOX_MIN, BBOX_MAX);
+	}
+
+	// Relative to the first particle the cluster overhangs the max face, as particle_cs.glsl reduces it
+	std::vector<glm::vec4> bounds = { glm::vec4(BBOX_MAX.x - 0.1f, 1.0f, 0.0f, 0.0f), glm::vec4(BBOX_MAX.x + 0.1f, 1.0f, 1.24f, 0.0f) };
+	ClusterBoundsCheck check = check_cluster_bounds(particles, bounds, BBOX_MIN, BBOX_MAX);
+	CHECK(check.num_outside == 0);
+	CHECK(check.num_overhanging == 1);
+	CHECK_NEAR(check.max_extent, 1.24f / (BBOX_MAX.z - BBOX_MIN.z), 1e-3f);
+
+	// Over the wrapped positions the bounds span the whole volume and are never culled
+	bounds = { glm::vec4(BBOX_MIN.x + 0.1f, 1.0f, 0.0f, 0.0f), glm::vec4(BBOX_MAX.x - 0.1f, 1.0f, 1.24f, 0.0f) };
+	check = check_cluster_bounds(particles, bounds, BBOX_MIN, BBOX_MAX);
+	CHECK(check.num_outside == 0);
+	CHECK(check.max_extent > 0.95f);
+
+	// Bounds cut at the seam lose the particles on the other side, the even ones
+	bounds = { glm::vec4(BBOX_MAX.x - 0.1f, 1.0f, 0.0f, 0.0f), glm::vec4(BBOX_MAX.x, 1.0f, 1.24f, 0.0f) };
+	check = check_cluster_bounds(particles, bounds, BBOX_MIN, BBOX_MAX);
+	CHECK(check.num_outside == (PARTICLES_PER_CLUSTER + 1) / 2);
+}
+
+// Bounds as particle_cs.glsl reduces them in a wrapping volume, relative to the first used particle of each cluster
+static std::vector<glm::vec4> get_cluster_bounds(const ParticleReferenceSimulation& simulation)
+{
+	const std::vector<Particle>& particles = simulation.get_particles();
+	glm::vec3 bbox_min = simulation.get_bbox_min();
+	glm::vec3 bbox_max = simulation.get_bbox_max();
+	glm::vec3 volume_size = bbox_max - bbox_min;
+	std::vector<glm::vec4> bounds;
+	for (size_t cluster = 0; cluster < particles.size() / PARTICLES_PER_CLUSTER; cluster++)
+	{
+		bool empty = true;
+		glm::vec3 reference, bounds_min, bounds_max;
+		for (size_t slot = cluster * PARTICLES_PER_CLUSTER; slot < (cluster + 1) * PARTICLES_PER_CLUSTER; slot++)
+		{
+			UnpackedParticle particle = unpack_particle(particles[slot], bbox_min, bbox_max);
+			if (particle.flags & PARTICLE_FLAG_UNUSED)
+				continue;
+			if (empty)
+				reference = bounds_min = bounds_max = particle.position;
+			empty = false;
+			glm::vec3 offset = particle.position - reference;
+			for (int axis = 0; axis < 3; axis++)
+				offset[axis] -= volume_size[axis] * std::round(offset[axis] / volume_size[axis]);
+			bounds_min = glm::min(bounds_min, reference + offset);
+			bounds_max = glm::max(bounds_max, reference + offset);
+		}
+		bounds.push_back(empty ? glm::vec4(1.0f) : glm::vec4(bounds_min, 0.0f));
+		bounds.push_back(empty ? glm::vec4(0.0f) : glm::vec4(bounds_max, 0.0f));
+	}
+	return bounds;
+}
+
+// Random kicks spread the clusters over the whole volume, regrouping by key keeps them local
+static void test_recluster()
+{
+	const glm::ivec3 per_dim(28, 13, 28);
+	const glm::vec3 bbox_min(-8.0f, 0.0f, -8.0f);
+	const glm::vec3 bbox_max(8.0f, 8.0f, 8.0f);
+	const glm::vec3 center = (bbox_min + bbox_max) / 2.0f;
+	ParticleReferenceSimulation drifting(per_dim, bbox_min, bbox_max);
+	ParticleReferenceSimulation reclustered(per_dim, bbox_min, bbox_max);
+	for (int i = 0; i < 1800; i++)
+	{
+		for (ParticleReferenceSimulation* simulation : { &drifting, &reclustered })
+		{
+			simulation->set_volume_center(center + (i * DT) * glm::vec3(1.0f, 0.0f, 0.5f), bbox_min.y);
+			simulation->step(DT);
+		}
+		if (i % 64 == 63)
+		{
+			std::vector<Particle> before = reclustered.get_particles();
+			reclustered.recluster();
+			// A permutation of the slots, unused ones last
+			auto less = [](const Particle& a, const Particle& b) { return std::memcmp(&a, &b, sizeof(Particle)) < 0; };
+			std::vector<Particle> after = reclustered.get_particles();
+			std::sort(before.begin(), before.end(), less);
+			std::sort(after.begin(), after.end(), less);
+			CHECK(std::memcmp(before.data(), after.data(), sizeof(Particle) * before.size()) == 0);
+			CHECK(get_particle_cluster_key(reclustered.get_particles().back()) == 1);
+		}
+	}
+
+	ClusterBoundsCheck drifting_check = check_cluster_bounds(drifting.get_particles(), get_cluster_bounds(drifting), drifting.get_bbox_min(), drifting.get_bbox_max());
+	ClusterBoundsCheck reclustered_check = check_cluster_bounds(reclustered.get_particles(), get_cluster_bounds(reclustered), reclustered.get_bbox_min(), reclustered.get_bbox_max());
+	CHECK(drifting_check.num_outside == 0);
+	CHECK(reclustered_check.num_outside == 0);
+	CHECK(drifting_check.max_extent > 0.9f);
+	CHECK(reclustered_check.max_extent < 0.6f);
+	std::cout << "Max cluster extent after 1800 steps: " << drifting_check.max_extent << " drifting, "
+		<< reclustered_check.max_extent << " reclustered" << std::endl;
+}
+
+int main()
+{
+	JobSystem::Init(3);
+	test_pack_round_trip();
+	test_respawn();
+	test_wrap();
+	test_thread_count_independence();
+	test_cluster_bounds_across_seam();
+	test_recluster();
+	JobSystem::Destroy();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "ParticleReferenceSimulation: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
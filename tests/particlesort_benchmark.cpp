@@ -0,0 +1,65 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "particlesort.h"
+
+/**
+* Times the CPU reference of the particle sort, key generation and radix sort, against std::sort
+* for a few particle counts up to the pool capacity. Not run by CTest, numbers are only
+* meaningful in release builds.
+*/
+static void run(uint32_t count)
+{
+	const int ITERATIONS = 10;
+
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	std::srand(1);
+	auto random = [](float min, float max) { return min + (max - min) * (float)std::rand() / (float)RAND_MAX; };
+	std::vector<glm::vec3> positions(count);
+	for (glm::vec3& position : positions)
+		position = glm::vec3(random(-50.0f, 50.0f), random(0.0f, 20.0f), random(-100.0f, 10.0f));
+
+	using clock = std::chrono::high_resolution_clock;
+	double key_time = 0.0;
+	double radix_time = 0.0;
+	double std_sort_time = 0.0;
+	std::vector<glm::uvec2> keys(count);
+	bool sorted = true;
+	for (int iteration = 0; iteration < ITERATIONS; iteration++)
+	{
+		auto start = clock::now();
+		for (uint32_t i = 0; i < count; i++)
+			keys[i] = glm::uvec2(get_particle_sort_key(positions[i], view), i);
+		auto keyed = clock::now();
+		std::vector<glm::uvec2> std_keys = keys;
+		radix_sort_particles(keys);
+		auto radix_sorted = clock::now();
+		std::sort(std_keys.begin(), std_keys.end(), [](glm::uvec2 a, glm::uvec2 b) { return a.x > b.x; });
+		auto std_sorted = clock::now();
+		sorted = sorted && is_sorted_back_to_front(keys);
+
+		key_time += std::chrono::duration<double, std::micro>(keyed - start).count();
+		radix_time += std::chrono::duration<double, std::micro>(radix_sorted - keyed).count();
+		std_sort_time += std::chrono::duration<double, std::micro>(std_sorted - radix_sorted).count();
+	}
+
+	double radix_us = radix_time / ITERATIONS;
+	std::cout << count << " particles: keys " << key_time / ITERATIONS << " us, radix sort " << radix_us << " us ("
+		<< (radix_us > 0.0 ? count / radix_us : 0.0) << " M keys/s), std::sort " << std_sort_time / ITERATIONS << " us"
+		<< (sorted ? "" : ", NOT SORTED") << std::endl;
+}
+
+int main()
+{
+	run(1 << 10);
+	run(1 << 14);
+	run(1 << 17);
+	run(1 << 20);
+	return 0;
+}
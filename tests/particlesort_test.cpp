@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "particlesort.h"
+#include "test.h"
+
+static float random_float(float min, float max)
+{
+	return min + (max - min) * (float)std::rand() / (float)RAND_MAX;
+}
+
+// (key, index) pairs of particles scattered in front of and behind the camera, with repeated positions
+static std::vector<glm::uvec2> make_keys(uint32_t count, const glm::mat4& view)
+{
+	std::vector<glm::uvec2> keys(count);
+	glm::vec3 position(0.0f);
+	for (uint32_t i = 0; i < count; i++)
+	{
+		// Every fourth particle shares the depth of the one before it
+		if (i % 4 != 3)
+			position = glm::vec3(random_float(-20.0f, 20.0f), random_float(-5.0f, 5.0f), random_float(-60.0f, 10.0f));
+		keys[i] = glm::uvec2(get_particle_sort_key(position, view), i);
+	}
+	return keys;
+}
+
+// Stable descending order by key, which is what the radix sort produces including ties
+static std::vector<glm::uvec2> reference_sort(std::vector<glm::uvec2> keys)
+{
+	std::stable_sort(keys.begin(), keys.end(), [](glm::uvec2 a, glm::uvec2 b) { return a.x > b.x; });
+	return keys;
+}
+
+static void test_sort_key()
+{
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 5.0f), glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	// Depth along the view direction, further is larger, behind the camera clamps to 0
+	CHECK(get_particle_sort_key(glm::vec3(0.0f, 2.0f, -10.0f), view) > get_particle_sort_key(glm::vec3(0.0f, 2.0f, 0.0f), view));
+	CHECK(get_particle_sort_key(glm::vec3(0.0f, 2.0f, 0.0f), view) > get_particle_sort_key(glm::vec3(0.0f, 2.0f, 4.0f), view));
+	CHECK(get_particle_sort_key(glm::vec3(0.0f, 2.0f, 8.0f), view) == 0);
+	CHECK(get_particle_sort_key(glm::vec3(0.0f, 2.0f, 5.0f), view) == 0);
+	// Lateral offsets do not change the depth
+	CHECK(get_particle_sort_key(glm::vec3(3.0f, -1.0f, -10.0f), view) == get_particle_sort_key(glm::vec3(0.0f, 2.0f, -10.0f), view));
+}
+
+static void test_radix_sort()
+{
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	std::srand(1);
+	const uint32_t counts[] = { 0, 1, 2, 3, 127, 1000, 1024, 1025, 4097, 100000 };
+	for (uint32_t count : counts)
+	{
+		std::vector<glm::uvec2> keys = make_keys(count, view);
+		std::vector<glm::uvec2> reference = reference_sort(keys);
+		radix_sort_particles(keys);
+		CHECK(keys.size() == count);
+		CHECK(is_sorted_back_to_front(keys));
+		CHECK(std::equal(keys.begin(), keys.end(), reference.begin(), reference.end()));
+
+		// Ties may be in any order on the GPU, std::sort agrees on the key sequence
+		std::vector<glm::uvec2> unstable = make_keys(count, view);
+		std::vector<glm::uvec2> sorted = unstable;
+		std::sort(sorted.begin(), sorted.end(), [](glm::uvec2 a, glm::uvec2 b) { return a.x > b.x; });
+		radix_sort_particles(unstable);
+		CHECK(std::equal(unstable.begin(), unstable.end(), sorted.begin(), sorted.end(), [](glm::uvec2 a, glm::uvec2 b) { return a.x == b.x; }));
+	}
+
+	// Keys that differ in a single digit, and the extremes
+	std::vector<glm::uvec2> keys = {
+		{ 0u, 0 }, { 0xFFFFFFFFu, 1 }, { 0x00000100u, 2 }, { 0x00010000u, 3 }, { 0x01000000u, 4 },
+		{ 0x000000FFu, 5 }, { 0u, 6 }, { 0x01000000u, 7 }, { 1u, 8 },
+	};
+	std::vector<glm::uvec2> reference = reference_sort(keys);
+	radix_sort_particles(keys);
+	CHECK(std::equal(keys.begin(), keys.end(), reference.begin(), reference.end()));
+	CHECK(keys.front() == glm::uvec2(0xFFFFFFFFu, 1));
+	CHECK(keys[keys.size() - 2] == glm::uvec2(0u, 0));
+	CHECK(keys.back() == glm::uvec2(0u, 6));
+
+	// All keys equal keeps the input order
+	std::vector<glm::uvec2> equal(333);
+	for (uint32_t i = 0; i < equal.size(); i++)
+		equal[i] = glm::uvec2(42u, i);
+	std::vector<glm::uvec2> equal_sorted = equal;
+	radix_sort_particles(equal_sorted);
+	CHECK(equal_sorted == equal);
+}
+
+static void test_is_sorted_back_to_front()
+{
+	std::vector<glm::uvec2> empty;
+	std::vector<glm::uvec2> single = { { 7u, 0 } };
+	std::vector<glm::uvec2> all_equal = { { 5u, 0 }, { 5u, 1 }, { 5u, 2 } };
+	std::vector<glm::uvec2> descending = { { 9u, 2 }, { 5u, 0 }, { 5u, 1 }, { 0u, 3 } };
+	// Indices of ties do not matter
+	std::vector<glm::uvec2> swapped_ties = { { 9u, 0 }, { 5u, 3 }, { 5u, 1 }, { 0u, 2 } };
+	CHECK(is_sorted_back_to_front(empty));
+	CHECK(is_sorted_back_to_front(single));
+	CHECK(is_sorted_back_to_front(all_equal));
+	CHECK(is_sorted_back_to_front(descending));
+	CHECK(is_sorted_back_to_front(swapped_ties));
+
+	std::vector<glm::uvec2> ascending = { { 1u, 0 }, { 2u, 1 } };
+	std::vector<glm::uvec2> last_out_of_order = { { 9u, 0 }, { 5u, 1 }, { 0u, 2 }, { 1u, 3 } };
+	std::vector<glm::uvec2> first_out_of_order = { { 0u, 0 }, { 9u, 1 }, { 5u, 2 } };
+	// Equal keys followed by a larger one
+	std::vector<glm::uvec2> rising_after_tie = { { 3u, 0 }, { 3u, 1 }, { 4u, 2 } };
+	CHECK(!is_sorted_back_to_front(ascending));
+	CHECK(!is_sorted_back_to_front(last_out_of_order));
+	CHECK(!is_sorted_back_to_front(first_out_of_order));
+	CHECK(!is_sorted_back_to_front(rising_after_tie));
+}
+
+int main()
+{
+	test_sort_key();
+	test_radix_sort();
+	test_is_sorted_back_to_front();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "Particle sort reference: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
@@ -0,0 +1,199 @@
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+#include <glm/glm.hpp>
+
+#include "jobs.h"
+#include "model.h"
+#include "sdf.h"
+#include "test.h"
+
+static const float PI = 3.14159265f;
+static const float BAND_WIDTH = 1.0f;
+
+// UV sphere, outward winding
+static ModelData make_sphere(float radius, int segments, int rings)
+{
+	ModelData data;
+	for (int ring = 0; ring <= rings; ring++)
+	{
+		float theta = PI * ring / rings;
+		for (int segment = 0; segment <= segments; segment++)
+		{
+			float phi = 2.0f * PI * segment / segments;
+			glm::vec3 normal(std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi));
+			data.vertices.push_back({ radius * normal, normal, glm::vec2(0.0f) });
+		}
+	}
+	for (int ring = 0; ring < rings; ring++)
+	{
+		for (int segment = 0; segment < segments; segment++)
+		{
+			uint32_t a = ring * (segments + 1) + segment;
+			uint32_t b = a + segments + 1;
+			data.indices.insert(data.indices.end(), { a, a + 1, b, a + 1, b + 1, b });
+		}
+	}
+	return data;
+}
+
+// Unit cube in [-0.5, 0.5], outward winding
+static ModelData make_cube()
+{
+	ModelData data;
+	for (int c = 0; c < 8; c++)
+		data.vertices.push_back({ glm::vec3((c & 1) ? 0.5f : -0.5f, (c & 2) ? 0.5f : -0.5f, (c & 4) ? 0.5f : -0.5f), glm::vec3(0.0f), glm::vec2(0.0f) });
+	data.indices = {
+		0, 4, 6, 0, 6, 2, // -x
+		1, 3, 7, 1, 7, 5, // +x
+		0, 1, 5, 0, 5, 4, // -y
+		2, 6, 7, 2, 7, 3, // +y
+		0, 2, 3, 0, 3, 1, // -z
+		4, 5, 7, 4, 7, 6, // +z
+	};
+	return data;
+}
+
+static glm::mat4 translate_scale(glm::vec3 translation, glm::vec3 scale)
+{
+	glm::mat4 transform(1.0f);
+	transform[0][0] = scale.x;
+	transform[1][1] = scale.y;
+	transform[2][2] = scale.z;
+	transform[3] = glm::vec4(translation, 1.0f);
+	return transform;
+}
+
+static float sphere_distance(glm::vec3 p, glm::vec3 center, float radius)
+{
+	return glm::length(p - center) - radius;
+}
+
+// Exact box distance, "Distance functions" (Quilez)
+static float box_distance(glm::vec3 p, glm::vec3 center, glm::vec3 half_extent)
+{
+	glm::vec3 q = glm::abs(p - center) - half_extent;
+	return glm::length(glm::max(q, glm::vec3(0.0f))) + glm::min(glm::max(q.x, glm::max(q.y, q.z)), 0.0f);
+}
+
+/**
+* Compare every voxel against the closed form distance. Within the band the baked distance
+* matches up to tolerance and its direction follows the gradient, outside it is the band width.
+*/
+template<typename Distance>
+static void check_against(const SignedDistanceField& sdf, Distance distance, float tolerance, float min_direction_alignment)
+{
+	glm::ivec3 resolution = sdf.get_resolution();
+	const std::vector<glm::vec4>& voxels = sdf.get_voxels();
+	CHECK(voxels.size() == (size_t)resolution.x * resolution.y * resolution.z);
+	if (voxels.size() != (size_t)resolution.x * resolution.y * resolution.z)
+		return;
+
+	uint32_t errors = 0;
+	uint32_t in_band = 0;
+	float max_error = 0.0f;
+	for (int z = 0; z < resolution.z; z++)
+	for (int y = 0; y < resolution.y; y++)
+	for (int x = 0; x < resolution.x; x++)
+	{
+		glm::vec3 p = sdf.get_voxel_center(glm::ivec3(x, y, z));
+		float expected = distance(p);
+		const glm::vec4& voxel = voxels[(size_t)resolution.x * (z * resolution.y + y) + x];
+		if (std::abs(expected) > BAND_WIDTH + tolerance)
+		{
+			errors += voxel.w != BAND_WIDTH;
+			continue;
+		}
+		if (std::abs(expected) > BAND_WIDTH - tolerance)
+			continue;
+
+		in_band++;
+		max_error = std::max(max_error, std::abs(voxel.w - expected));
+		errors += std::abs(voxel.w - expected) > tolerance;
+
+		// Central differences, skipped on the medial axis where the gradient is undefined
+		const float h = 1e-3f;
+		glm::vec3 gradient(distance(p + glm::vec3(h, 0.0f, 0.0f)) - distance(p - glm::vec3(h, 0.0f, 0.0f)),
+			distance(p + glm::vec3(0.0f, h, 0.0f)) - distance(p - glm::vec3(0.0f, h, 0.0f)),
+			distance(p + glm::vec3(0.0f, 0.0f, h)) - distance(p - glm::vec3(0.0f, 0.0f, h)));
+		if (std::abs(glm::length(gradient) / (2.0f * h) - 1.0f) > 1e-2f || std::abs(expected) < 0.05f)
+			continue;
+		errors += glm::dot(glm::vec3(voxel), glm::normalize(gradient)) < min_direction_alignment;
+	}
+	CHECK(in_band > 0);
+	CHECK(errors == 0);
+	if (errors > 0)
+		std::cout << errors << " voxels off, max distance error in the band " << max_error << std::endl;
+}
+
+static void test_sphere()
+{
+	const glm::vec3 center(0.3f, -0.2f, 0.1f);
+	const float radius = 2.0f;
+	// Edges sag below the sphere by radius * (1 - cos(pi / segments)), face centres by about twice that
+	const int segments = 96;
+	const float tessellation_error = 2.0f * radius * (1.0f - std::cos(PI / segments));
+
+	ModelData sphere = make_sphere(radius, segments, segments / 2);
+	SignedDistanceField sdf(glm::ivec3(32), glm::vec3(-4.0f), glm::vec3(4.0f));
+	sdf.bake({ { &sphere, translate_scale(center, glm::vec3(1.0f)) } }, BAND_WIDTH);
+	check_against(sdf, [&](glm::vec3 p) { return sphere_distance(p, center, radius); }, tessellation_error + 1e-3f, 0.99f);
+
+	CHECK(sdf.get_distance(center) == BAND_WIDTH); // Deep inside counts as outside the band
+	CHECK(sdf.get_distance(glm::vec3(100.0f)) == BAND_WIDTH);
+}
+
+static void test_box()
+{
+	const glm::vec3 center(-0.6f, 0.25f, 0.4f);
+	const glm::vec3 half_extent(1.5f, 0.75f, 1.0f);
+
+	ModelData cube = make_cube();
+	SignedDistanceField sdf(glm::ivec3(40, 24, 32), glm::vec3(-4.0f, -2.5f, -3.0f), glm::vec3(4.0f, 2.5f, 3.0f));
+	sdf.bake({ { &cube, translate_scale(center, 2.0f * half_extent) } }, BAND_WIDTH);
+	check_against(sdf, [&](glm::vec3 p) { return box_distance(p, center, half_extent); }, 1e-4f, 0.999f);
+}
+
+// The background bake runs the same slices as the synchronous one
+static void test_async_matches_sync()
+{
+	ModelData sphere = make_sphere(1.5f, 32, 16);
+	ModelData cube = make_cube();
+	std::vector<SDFMeshInstance> meshes = {
+		{ &sphere, translate_scale(glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(1.0f)) },
+		{ &cube, translate_scale(glm::vec3(-1.5f, 0.5f, 0.0f), glm::vec3(2.0f, 1.0f, 3.0f)) },
+	};
+
+	SignedDistanceField sync(glm::ivec3(32, 16, 24), glm::vec3(-4.0f, -2.0f, -3.0f), glm::vec3(4.0f, 2.0f, 3.0f));
+	sync.bake(meshes, BAND_WIDTH);
+
+	SignedDistanceField async(glm::ivec3(32, 16, 24), glm::vec3(-4.0f, -2.0f, -3.0f), glm::vec3(4.0f, 2.0f, 3.0f));
+	// The second request replaces nothing yet, it runs after the first is taken over
+	async.bake_async({ meshes[0] }, BAND_WIDTH);
+	async.bake_async(meshes, BAND_WIDTH);
+	while (!async.finish_bake())
+		std::this_thread::yield();
+	CHECK(async.is_baking());
+	while (!async.finish_bake())
+		std::this_thread::yield();
+	CHECK(!async.is_baking());
+	CHECK(!async.finish_bake());
+
+	CHECK(sync.get_voxels().size() == async.get_voxels().size());
+	CHECK(std::memcmp(sync.get_voxels().data(), async.get_voxels().data(), sync.get_voxels().size() * sizeof(glm::vec4)) == 0);
+}
+
+int main()
+{
+	JobSystem::Init(3);
+	test_sphere();
+	test_box();
+	test_async_matches_sync();
+	JobSystem::Destroy();
+
+	if (TEST_RESULT() == 0)
+		std::cout << "SignedDistanceField: all checks passed" << std::endl;
+	return TEST_RESULT();
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cmath>
+#include <iostream>
+
+/**
+* Minimal checks for the headless tests: a failed CHECK prints the expression and marks the
+* test as failed, main returns TEST_RESULT() so CTest sees the failure.
+*/
+inline int& test_failures()
+{
+	static int failures = 0;
+	return failures;
+}
+
+#define CHECK(expression) \
+	do { \
+		if (!(expression)) \
+		{ \
+			std::cout << "Error: " << __FILE__ << ":" << __LINE__ << ": CHECK(" #expression ") failed" << std::endl; \
+			test_failures()++; \
+		} \
+	} while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+	do { \
+		double check_a = (a), check_b = (b); \
+		if (!(std::abs(check_a - check_b) <= (tolerance))) \
+		{ \
+			std::cout << "Error: " << __FILE__ << ":" << __LINE__ << ": CHECK_NEAR(" #a ", " #b ") failed, " << check_a << " vs " << check_b << std::endl; \
+			test_failures()++; \
+		} \
+	} while (0)
+
+#define TEST_RESULT() (test_failures() == 0 ? 0 : 1)